@@ -1,26 +1,12 @@
 #include "Actor.h"
-#include "components/componentmanager.h"
 
 Actor::Actor()
+	: m_id(INVALID_ACTOR_ID)
+	, m_componentManger(nullptr)
+	, m_pArchetype(nullptr)
+	, m_timeAlive(0)
+	, m_lifespan(0)
+	, m_nextFree(0)
 {
 
 }
-
-Actor::~Actor()
-{
-
-}
-
-void Actor::init(LuaPlus::LuaObject)
-{
-
-}
-
-void Actor::update(float dt)
-{
-	if (m_componentManger)
-	{
-		m_componentManger->update(dt);
-	}
-}
-
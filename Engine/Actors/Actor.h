@@ -1,23 +1,40 @@
 #pragma once
 
+#include <cstdint>
 #include "interfaces.h"
-#include "3rdParty/LuaPlus/LuaPlus.h"
+#include "components/componentmanager.h"
 
-class ComponentManager;
+struct ActorArchetype;
 
 class Actor
 {
-	friend class ActorFactory;
+	friend class ActorManager;
 public:
 	Actor();
 
-	~Actor();
+	ActorId GetId() const { return m_id; }
 
-	void init(LuaPlus::LuaObject);
+	const ActorArchetype* GetArchetype() const { return m_pArchetype; }
 
-	void update(float dt);
+	// Milliseconds since the actor was created, advanced by ActorManager::update.
+	float GetTimeAlive() const { return m_timeAlive; }
+
+	// Milliseconds after creation at which the ActorManager destroys the actor, 0 to live until destroyed.
+	float GetLifespan() const { return m_lifespan; }
+	void SetLifespan(float lifespan) { m_lifespan = lifespan; }
+
+	// Compatibility accessor, see ComponentManager::GetComponent.
+	template <class ComponentType>
+	ComponentType* GetComponent()
+	{
+		return m_componentManger ? m_componentManger->GetComponent<ComponentType>(m_id) : nullptr;
+	}
 
 private:
-	ActorId m_id;					// unique id for the actor
-	std::shared_ptr<ComponentManager> m_componentManger;
+	ActorId m_id;					// generational handle of the actor, see ActorIndex
+	ComponentManager* m_componentManger;	// shared storage of all actors' components, not owned
+	const ActorArchetype* m_pArchetype;	// owned by the ActorManager, may be null
+	float m_timeAlive;
+	float m_lifespan;
+	uint32_t m_nextFree;			// ActorManager free list link, kSlotInUse while the actor is alive
 };
\ No newline at end of file
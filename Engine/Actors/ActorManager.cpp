@@ -0,0 +1,296 @@
+#include "ActorManager.h"
+#include "components/transformcomponent.h"
+#include "components/steeringcomponent.h"
+#include "log.h"
+
+#include <cstring>
+
+static bool ParseTransformComponent(const LuaPlus::LuaObject& data, TransformComponent& transform)
+{
+	if (!data.IsTable())
+		return true;
+
+	LuaPlus::LuaObject x = data.GetByName("x");
+	LuaPlus::LuaObject y = data.GetByName("y");
+	LuaPlus::LuaObject yaw = data.GetByName("yaw");
+	if (x.IsNumber())
+		transform.position.x = x.GetNumber();
+	if (y.IsNumber())
+		transform.position.y = y.GetNumber();
+	if (yaw.IsNumber())
+		transform.yaw = yaw.GetNumber();
+	return true;
+}
+
+// Steering = { behaviors = { "wander", "separation" }, maxSpeed = 50, maxForce = 100, mass = 1 }
+static bool ParseSteeringComponent(const LuaPlus::LuaObject& data, SteeringComponent& steering)
+{
+	if (!data.IsTable())
+		return true;
+
+	LuaPlus::LuaObject behaviors = data.GetByName("behaviors");
+	if (behaviors.IsTable())
+	{
+		for (LuaPlus::LuaTableIterator it(behaviors); it.IsValid(); it.Next())
+		{
+			uint32_t behavior = it.GetValue().IsString() ? SteeringComponent::GetBehaviorFromName(it.GetValue().GetString()) : 0;
+			if (!behavior)
+				return false;
+			steering.behaviors |= behavior;
+		}
+	}
+
+	LuaPlus::LuaObject maxSpeed = data.GetByName("maxSpeed");
+	LuaPlus::LuaObject maxForce = data.GetByName("maxForce");
+	LuaPlus::LuaObject mass = data.GetByName("mass");
+	if (maxSpeed.IsNumber())
+		steering.maxSpeed = (float)maxSpeed.GetNumber();
+	if (maxForce.IsNumber())
+		steering.maxForce = (float)maxForce.GetNumber();
+	if (mass.IsNumber())
+	{
+		if (mass.GetNumber() <= 0)
+			return false;
+		steering.mass = (float)mass.GetNumber();
+	}
+	return true;
+}
+
+
+ActorManager::ActorManager(ComponentManager* pComponents, LuaPlus::LuaState* pLuaState)
+	: m_pComponents(pComponents)
+	, m_pLuaState(pLuaState)
+	, m_freeHead(kNoSlot)
+	, m_freeTail(kNoSlot)
+	, m_numActors(0)
+	, m_updating(false)
+{
+	RegisterComponentType<TransformComponent>("Transform", &ParseTransformComponent);
+	RegisterComponentType<SteeringComponent>("Steering", &ParseSteeringComponent);
+}
+
+ActorManager::~ActorManager(void)
+{
+	Clear();
+}
+
+ActorArchetype* ActorManager::ParseArchetype(const std::string& name, const LuaPlus::LuaObject& table)
+{
+	if (!table.IsTable())
+	{
+		errorstream << "Actor archetype " << name << " is not a table" << std::endl;
+		return nullptr;
+	}
+
+	std::unique_ptr<ActorArchetype> pArchetype(new ActorArchetype);
+	pArchetype->name = name;
+
+	for (LuaPlus::LuaTableIterator it(table); it.IsValid(); it.Next())
+	{
+		if (!it.GetKey().IsString())
+			continue;
+
+		const char* key = it.GetKey().GetString();
+		if (strcmp(key, "lifespan") == 0)
+		{
+			pArchetype->lifespan = it.GetValue().IsNumber() ? (float)it.GetValue().GetNumber() : 0;
+			continue;
+		}
+
+		ComponentParserMap::iterator parser = m_componentParsers.find(key);
+		if (parser == m_componentParsers.end())
+		{
+			warningstream << "Actor archetype " << name << ": unknown component " << key << std::endl;
+			continue;
+		}
+
+		IActorComponentPrototype* pPrototype = parser->second(it.GetValue());
+		if (!pPrototype)
+		{
+			errorstream << "Actor archetype " << name << ": invalid data for component " << key << std::endl;
+			return nullptr;
+		}
+		pArchetype->components.push_back(std::unique_ptr<IActorComponentPrototype>(pPrototype));
+	}
+
+	return pArchetype.release();
+}
+
+bool ActorManager::RegisterArchetype(const std::string& name, const LuaPlus::LuaObject& table)
+{
+	std::unique_ptr<ActorArchetype> pParsed(ParseArchetype(name, table));
+	if (!pParsed)
+		return false;
+
+	// live actors point at the archetype, so a redefinition is moved into the existing one
+	std::unique_ptr<ActorArchetype>& pArchetype = m_archetypes[name];
+	if (pArchetype)
+		*pArchetype = std::move(*pParsed);
+	else
+		pArchetype = std::move(pParsed);
+	return true;
+}
+
+const ActorArchetype* ActorManager::FindArchetype(const std::string& name)
+{
+	ArchetypeMap::iterator findIt = m_archetypes.find(name);
+	if (findIt != m_archetypes.end())
+		return findIt->second.get();
+
+	if (!m_pLuaState)
+		return nullptr;
+
+	// parsed on first use, the table is not read again
+	LuaPlus::LuaObject archetypes = m_pLuaState->GetGlobal("ActorArchetypes");
+	if (!archetypes.IsTable())
+		return nullptr;
+
+	LuaPlus::LuaObject table = archetypes.GetByName(name.c_str());
+	if (table.IsNil() || !RegisterArchetype(name, table))
+		return nullptr;
+	return m_archetypes[name].get();
+}
+
+ActorId ActorManager::CreateActor(const std::string& archetype)
+{
+	const ActorArchetype* pArchetype = FindArchetype(archetype);
+	if (!pArchetype)
+	{
+		errorstream << "CreateActor: unknown archetype " << archetype << std::endl;
+		return INVALID_ACTOR_ID;
+	}
+	return CreateActor(pArchetype);
+}
+
+ActorId ActorManager::CreateActor(const ActorArchetype* pArchetype)
+{
+	uint32_t index = AllocateSlot();
+	if (index == kNoSlot)
+	{
+		errorstream << "CreateActor: all " << (ACTOR_INDEX_MASK + 1) << " actor slots are in use" << std::endl;
+		return INVALID_ACTOR_ID;
+	}
+
+	Actor& actor = m_actors[index];
+	actor.m_componentManger = m_pComponents;
+	actor.m_pArchetype = pArchetype;
+	actor.m_timeAlive = 0;
+	actor.m_lifespan = pArchetype ? pArchetype->lifespan : 0;
+
+	if (pArchetype)
+	{
+		for (auto it = pArchetype->components.begin(); it != pArchetype->components.end(); ++it)
+			(*it)->VAddTo(*m_pComponents, actor.m_id);
+	}
+	return actor.m_id;
+}
+
+bool ActorManager::DestroyActor(ActorId id)
+{
+	Actor* pActor = GetActor(id);
+	if (!pActor)
+		return false;
+
+	// component systems may be walking the pools, the actor goes once they are done
+	if (m_updating)
+	{
+		std::lock_guard<std::mutex> lock(m_pendingMutex);
+		m_pendingDestroy.push_back(id);
+	}
+	else
+		DestroyNow(*pActor);
+	return true;
+}
+
+void ActorManager::DestroyNow(Actor& actor)
+{
+	m_pComponents->RemoveActor(actor.m_id);
+	ReleaseSlot(ActorIndex(actor.m_id));
+}
+
+void ActorManager::Clear(void)
+{
+	for (auto iter = m_actors.begin(); iter != m_actors.end(); ++iter)
+	{
+		if (iter->m_nextFree == kSlotInUse)
+			m_pComponents->RemoveActor(iter->m_id);
+	}
+	m_actors.clear();
+	m_pendingDestroy.clear();
+	m_freeHead = m_freeTail = kNoSlot;
+	m_numActors = 0;
+}
+
+void ActorManager::update(float deltaMs)
+{
+	m_updating = true;
+
+	for (Actor* pActor = m_actors.data(), *pEnd = pActor + m_actors.size(); pActor != pEnd; ++pActor)
+	{
+		if (pActor->m_nextFree != kSlotInUse)
+			continue;
+
+		pActor->m_timeAlive += deltaMs;
+		if (pActor->m_lifespan > 0 && pActor->m_timeAlive >= pActor->m_lifespan)
+			m_pendingDestroy.push_back(pActor->m_id);
+	}
+
+	m_pComponents->update(deltaMs);
+
+	m_updating = false;
+
+	// the same actor may have been destroyed more than once
+	for (auto it = m_pendingDestroy.begin(); it != m_pendingDestroy.end(); ++it)
+	{
+		Actor* pActor = GetActor(*it);
+		if (pActor)
+			DestroyNow(*pActor);
+	}
+	m_pendingDestroy.clear();
+}
+
+uint32_t ActorManager::AllocateSlot(void)
+{
+	uint32_t index;
+	unsigned int generation;
+
+	if (m_freeHead != kNoSlot)
+	{
+		index = m_freeHead;
+		m_freeHead = m_actors[index].m_nextFree;
+		if (m_freeHead == kNoSlot)
+			m_freeTail = kNoSlot;
+
+		generation = (ActorGeneration(m_actors[index].m_id) + 1) & ACTOR_GENERATION_MASK;
+		if (generation == 0)
+			generation = 1;
+	}
+	else
+	{
+		if (m_actors.size() > ACTOR_INDEX_MASK)
+			return kNoSlot;
+		index = (uint32_t)m_actors.size();
+		m_actors.push_back(Actor());
+		generation = 1;
+	}
+
+	m_actors[index].m_id = MakeActorId(index, generation);
+	m_actors[index].m_nextFree = kSlotInUse;
+	m_numActors++;
+	return index;
+}
+
+void ActorManager::ReleaseSlot(uint32_t index)
+{
+	Actor& actor = m_actors[index];
+	actor.m_pArchetype = nullptr;
+	actor.m_nextFree = kNoSlot;
+
+	// append to the free list, the slot is reused after all slots freed before it
+	if (m_freeTail != kNoSlot)
+		m_actors[m_freeTail].m_nextFree = index;
+	else
+		m_freeHead = index;
+	m_freeTail = index;
+	m_numActors--;
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include "Actor.h"
+#include "3rdParty/LuaPlus/LuaPlus.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+// Component of an archetype, parsed from the archetype's Lua table once and copied into every actor created from it.
+//---------------------------------------------------------------------------------------------------------------------
+class IActorComponentPrototype
+{
+public:
+	virtual ~IActorComponentPrototype(void) { }
+	virtual void VAddTo(ComponentManager& components, ActorId id) const = 0;
+};
+
+template <class ComponentType>
+class ActorComponentPrototype : public IActorComponentPrototype
+{
+public:
+	ComponentType m_component;
+
+	virtual void VAddTo(ComponentManager& components, ActorId id) const
+	{
+		components.AddComponent<ComponentType>(id, m_component);
+	}
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+// Actor template built from a Lua table such as
+//
+//     ActorArchetypes.Soldier = { lifespan = 0, Transform = { x = 0, y = 0 }, Health = { hp = 100 } }
+//
+// Every key but "lifespan" names a component type registered with ActorManager::RegisterComponentType.
+//---------------------------------------------------------------------------------------------------------------------
+struct ActorArchetype
+{
+	std::string name;
+	float lifespan;			// milliseconds, 0 to live until destroyed
+	std::vector<std::unique_ptr<IActorComponentPrototype> > components;
+
+	ActorArchetype(void) : lifespan(0) { }
+};
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Creates, owns and updates all actors.
+//
+// Actors live in one contiguous slot array and are referred to by generational ActorId handles: looking up or
+// destroying an actor is an index into the array plus a generation check, and a stale handle simply resolves to
+// nothing.  Freed slots are reused in FIFO order so a slot's generation advances as slowly as possible.  update()
+// walks the slot array in a single loop and then runs the component systems.
+//---------------------------------------------------------------------------------------------------------------------
+class ActorManager
+{
+	enum eConstants
+	{
+		kNoSlot = 0xffffffff,
+		kSlotInUse = 0xfffffffe,
+	};
+
+	typedef std::function<IActorComponentPrototype* (const LuaPlus::LuaObject& data)> ComponentParser;
+	typedef std::unordered_map<std::string, ComponentParser> ComponentParserMap;
+	typedef std::unordered_map<std::string, std::unique_ptr<ActorArchetype> > ArchetypeMap;
+
+	ComponentManager* m_pComponents;
+	LuaPlus::LuaState* m_pLuaState;
+	ComponentParserMap m_componentParsers;
+	ArchetypeMap m_archetypes;
+
+	std::vector<Actor> m_actors;
+	uint32_t m_freeHead;		// oldest free slot
+	uint32_t m_freeTail;		// newest free slot
+	size_t m_numActors;
+
+	bool m_updating;
+	std::mutex m_pendingMutex;	// component systems may destroy actors from several threads
+	std::vector<ActorId> m_pendingDestroy;
+
+public:
+	// Archetypes not registered explicitly are looked up in the ActorArchetypes global of pLuaState, if given.
+	explicit ActorManager(ComponentManager* pComponents, LuaPlus::LuaState* pLuaState = nullptr);
+	~ActorManager(void);
+
+	// Makes a component type available to archetypes under the given name.  parse fills the component from the
+	// archetype's table for it and returns false if the data is invalid.
+	template <class ComponentType>
+	void RegisterComponentType(const std::string& name, bool (*parse)(const LuaPlus::LuaObject& data, ComponentType& component))
+	{
+		m_componentParsers[name] = [parse](const LuaPlus::LuaObject& data) -> IActorComponentPrototype* {
+			std::unique_ptr<ActorComponentPrototype<ComponentType> > pPrototype(new ActorComponentPrototype<ComponentType>);
+			if (!parse(data, pPrototype->m_component))
+				return nullptr;
+			return pPrototype.release();
+		};
+	}
+
+	// Parses an archetype table.  Registering a name again replaces its definition; existing actors keep the components
+	// they were created with.
+	bool RegisterArchetype(const std::string& name, const LuaPlus::LuaObject& table);
+	const ActorArchetype* FindArchetype(const std::string& name);
+
+	// Returns INVALID_ACTOR_ID if the archetype is unknown or all slots are taken.
+	ActorId CreateActor(const std::string& archetype);
+	ActorId CreateActor(const ActorArchetype* pArchetype = nullptr);
+
+	// Removes the actor and its components.  During update() the actor stays valid until the update is finished.
+	bool DestroyActor(ActorId id);
+
+	// Null for stale handles.  The pointer is only valid until the next CreateActor; keep the ActorId across frames.
+	Actor* GetActor(ActorId id)
+	{
+		uint32_t index = ActorIndex(id);
+		if (index >= m_actors.size() || m_actors[index].m_id != id || m_actors[index].m_nextFree != kSlotInUse)
+			return nullptr;
+		return &m_actors[index];
+	}
+
+	bool IsAlive(ActorId id) { return GetActor(id) != nullptr; }
+	size_t GetNumActors(void) const { return m_numActors; }
+	void Reserve(size_t count) { m_actors.reserve(count); }
+	void Clear(void);
+
+	ComponentManager& GetComponents(void) { return *m_pComponents; }
+
+	// Advances every actor and runs the component systems.
+	void update(float deltaMs);
+
+	// Calls function(Actor&) for every live actor.
+	template <class Function>
+	void ForEach(Function function)
+	{
+		for (auto iter = m_actors.begin(); iter != m_actors.end(); ++iter)
+		{
+			if (iter->m_nextFree == kSlotInUse)
+				function(*iter);
+		}
+	}
+
+private:
+	ActorArchetype* ParseArchetype(const std::string& name, const LuaPlus::LuaObject& table);
+	uint32_t AllocateSlot(void);
+	void ReleaseSlot(uint32_t index);
+	void DestroyNow(Actor& actor);
+};
@@ -1,18 +1,38 @@
 #include "BaseApp.h"
+#include "binary_log.h"
 #include "debug.h"
 #include "log.h"
 #include "settings.h"
+#include "settings_reload.h"
 #include "utils/macros.h"
+#include "utils/random_utils.h"
+#include "utils/string_utils.h"
 #include "unittest/test.h"
+#include "LUAScripting/LuaMemory.h"
 #include "LUAScripting/LuaStateManager.h"
+#include "LUAScripting/ScriptEventBatch.h"
 #include "LUAScripting/ScriptExports.h"
+#include "LUAScripting/ScriptProfiler.h"
 #include "eventmanager/EventManagerImpl.h"
 #include "eventmanager/Events.h"
+#include "eventmanager/EventRecorder.h"
+#include "components/componentmanager.h"
+#include "Actors/ActorManager.h"
+#include "threading/job_system.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
 
 std::shared_ptr<BaseApp> g_pApp = nullptr;
 FileLogOutput file_log_output;
 
 BaseApp::BaseApp()
+	: m_eventBudgetUs(20000),
+	m_binaryLogFlushMs(0.0f),
+	m_luaProfilerSetting(false),
+	m_luaMemoryLogMs(0.0f),
+	m_luaMemoryLogIntervalMs(0.0f)
 {
 
 }
@@ -20,7 +40,8 @@ BaseApp::BaseApp()
 
 BaseApp::~BaseApp()
 {
-
+	if (m_pEventManger)
+		m_pEventManger->SetRecorder(nullptr);
 }
 
 bool BaseApp::init()
@@ -30,13 +51,56 @@ bool BaseApp::init()
 
 	init_log_streams();
 
+	// the same numbers from random_int() and co on every run, for replays
+	if (g_settings->exists("random_seed"))
+		set_random_seed(read_seed(g_settings->get("random_seed").c_str()));
+
+	// pick up edits of setting.txt without a restart
+	if (g_settings->getFlag("settings_reload"))
+	{
+		uint32_t pollMs = 500;
+		if (g_settings->exists("settings_reload_interval_ms"))
+			pollMs = g_settings->getU32("settings_reload_interval_ms");
+		m_pSettingsReloader = std::make_shared<SettingsReloader>(g_settings, getResPath() + "setting.txt");
+		m_pSettingsReloader->start(pollMs);
+	}
+
 	if (!init_lua_manager())
 		return false;
 
+	// step the Lua collector in a time budget per frame instead of in the allocations
+	if (g_settings->exists("lua_gc_budget_us"))
+	{
+		LuaGarbageCollector* pCollector = LuaStateManager::Get()->GetGarbageCollector();
+		uint32_t loadingBudgetUs = g_settings->getU32("lua_gc_budget_us") * 8;
+		if (g_settings->exists("lua_gc_loading_budget_us"))
+			loadingBudgetUs = g_settings->getU32("lua_gc_loading_budget_us");
+		pCollector->SetBudget(g_settings->getU32("lua_gc_budget_us"), loadingBudgetUs);
+		if (g_settings->exists("lua_gc_pause"))
+			pCollector->SetPause(g_settings->getU32("lua_gc_pause"));
+		if (g_settings->exists("lua_gc_limit_mb"))
+			pCollector->SetLimit((size_t)g_settings->getU32("lua_gc_limit_mb") * 1024 * 1024);
+		pCollector->Start();
+	}
+	if (g_settings->exists("lua_memory_log_s"))
+		m_luaMemoryLogIntervalMs = g_settings->getFloat("lua_memory_log_s") * 1000.0f;
+
 	registerLuaFunc();
 
 	RegisterScriptEvents();
 
+	// sample the scripts while lua_profiler is set, also when it is switched in a reloaded setting.txt
+	m_pLuaProfilerSetting = std::make_shared<SettingHandle<bool> >(g_settings, "lua_profiler", false);
+	m_pLuaProfilerIntervalSetting = std::make_shared<SettingHandle<uint32_t> >(g_settings, "lua_profiler_interval",
+		ScriptProfiler::kDefaultInterval);
+	updateLuaProfiler();
+
+	if (g_settings->exists("event_pool"))
+		EventMemoryPool::SetEnabled(g_settings->getBool("event_pool"));
+
+	if (g_settings->exists("event_budget_us"))
+		m_eventBudgetUs = g_settings->getU32("event_budget_us");
+
 	m_pEventManger = std::make_shared<EventManager>("GameCodeApp Event Mgr", true);
 	if (!m_pEventManger)
 	{
@@ -44,6 +108,38 @@ bool BaseApp::init()
 		return false;
 	}
 
+	// parallel-safe listeners and the job workers share the spare cores unless configured
+	unsigned int spareCores = (std::max)(std::thread::hardware_concurrency(), 1u) - 1;
+	unsigned int dispatchThreads = (spareCores + 1) / 2;
+	if (g_settings->exists("event_dispatch_threads"))
+		dispatchThreads = g_settings->getU16("event_dispatch_threads");
+	m_pEventManger->SetDispatchThreads(dispatchThreads);
+
+	// capture the session to an event log, or feed one back instead of waiting for input
+	std::string eventLog;
+	if (g_settings->getNoEx("event_record", eventLog) && !eventLog.empty())
+	{
+		m_pEventRecorder = std::make_shared<EventRecorder>();
+		if (m_pEventRecorder->Open(eventLog))
+			m_pEventManger->SetRecorder(m_pEventRecorder.get());
+	}
+	if (g_settings->getNoEx("event_replay", eventLog) && !eventLog.empty())
+	{
+		m_pEventReplayer = std::make_shared<EventReplayer>();
+		if (!m_pEventReplayer->Open(eventLog))
+			m_pEventReplayer.reset();
+	}
+
+	// component systems without conflicting accesses update on the job workers
+	unsigned int jobThreads = spareCores - (std::min)(dispatchThreads, spareCores);
+	if (g_settings->exists("job_threads"))
+		jobThreads = g_settings->getU16("job_threads");
+	m_pJobSystem = std::make_shared<JobSystem>(jobThreads);
+
+	m_pComponentManager = std::make_shared<ComponentManager>();
+	m_pComponentManager->SetJobSystem(m_pJobSystem.get());
+	m_pActorManager = std::make_shared<ActorManager>(m_pComponentManager.get(), LuaStateManager::Get()->GetLuaState());
+
 	if (g_settings->getBool("unittest"))
 	{
 		run_tests();
@@ -54,7 +150,74 @@ bool BaseApp::init()
 
 void BaseApp::update(float dt)
 {
-	IEventManager::Get()->VUpdate(20);
+	if (m_pSettingsReloader)
+		m_pSettingsReloader->update();
+
+	if (m_pEventReplayer && !m_pEventReplayer->ReplayFrame(*IEventManager::Get()))
+	{
+		infostream << "Event replay finished: " << m_pEventReplayer->GetNumEvents() << " events, "
+			<< m_pEventReplayer->GetNumSkipped() << " skipped" << std::endl;
+		m_pEventReplayer.reset();
+	}
+
+	if (!m_pEventReplayer)
+		IEventManager::Get()->VUpdateMicros(m_eventBudgetUs);
+
+	// the events the scripts fired with FireEvent(), one call per listener and type
+	ScriptEventBatcher::Get()->Flush();
+
+	m_pActorManager->update(dt * 1000.0f);
+
+	updateLuaProfiler();
+
+	LuaStateManager::Get()->GetGarbageCollector()->Update();
+	if (m_luaMemoryLogIntervalMs > 0.0f)
+	{
+		m_luaMemoryLogMs += dt * 1000.0f;
+		if (m_luaMemoryLogMs >= m_luaMemoryLogIntervalMs)
+		{
+			LuaStateManager::Get()->LogMemoryStats();
+			m_luaMemoryLogMs = 0.0f;
+		}
+	}
+
+	// records stay in the buffers of their threads until written out
+	if (g_binary_log.isOpen())
+	{
+		m_binaryLogFlushMs += dt * 1000.0f;
+		if (m_binaryLogFlushMs >= 1000.0f)
+		{
+			g_binary_log.flush();
+			m_binaryLogFlushMs = 0.0f;
+		}
+	}
+}
+
+void BaseApp::updateLuaProfiler()
+{
+	bool enabled = m_pLuaProfilerSetting->get();
+	if (enabled == m_luaProfilerSetting)
+		return;
+	m_luaProfilerSetting = enabled;
+
+	ScriptProfiler* pProfiler = ScriptProfiler::Get();
+	if (enabled)
+	{
+		uint32_t interval = m_pLuaProfilerIntervalSetting->get();
+		pProfiler->Stop();
+		pProfiler->Reset();
+		if (pProfiler->Start(interval))
+			infostream << "Lua profiler started, a sample every " << interval << " instructions" << std::endl;
+		return;
+	}
+
+	// the Lua code may have stopped it already
+	pProfiler->Stop();
+	std::string output = "lua_profile.folded";
+	g_settings->getNoEx("lua_profiler_output", output);
+	pProfiler->LogReport();
+	if (!output.empty() && pProfiler->WriteFoldedStacks(output))
+		infostream << "Lua profile written to " << output << std::endl;
 }
 
 bool BaseApp::init_setting()
@@ -77,6 +240,33 @@ void BaseApp::init_log_streams()
 	g_logger.registerThread("Main");
 	g_logger.addOutputMaxLevel(&stderr_output, LL_ACTION);
 
+	// format on the logging thread, write the outputs from a background thread
+	if (g_settings->getFlag("log_async") && !g_logger.isAsync())
+	{
+		size_t bufferSize = 256 * 1024;
+		if (g_settings->exists("log_async_buffer"))
+			bufferSize = g_settings->getU32("log_async_buffer");
+		LogAsyncPolicy policy = LOG_ASYNC_BLOCK;
+		if (g_settings->exists("log_async_policy") && g_settings->get("log_async_policy") == "drop")
+			policy = LOG_ASYNC_DROP;
+		g_logger.startAsync(bufferSize, policy);
+		// the writer must be gone before the static outputs are destroyed
+		std::atexit([]() { g_logger.stopAsync(); });
+	}
+
+	// compact records of the BLOG() call sites, read with tools/binary_log_decode
+	std::string binaryLog;
+	if (g_settings->getNoEx("binary_log", binaryLog) && !binaryLog.empty() && !g_binary_log.isOpen())
+	{
+		if (g_settings->exists("binary_log_level"))
+		{
+			LogLevel binaryLevel = Logger::stringToLevel(g_settings->get("binary_log_level"));
+			if (binaryLevel != LL_MAX)
+				g_binary_log.setMaxLevel(binaryLevel);
+		}
+		g_binary_log.open(binaryLog);
+	}
+
 	std::string log_filename = g_settings->get("logfile");
 
 	g_logger.removeOutput(&file_log_output);
@@ -114,7 +304,9 @@ void BaseApp::init_log_streams()
 bool BaseApp::init_lua_manager()
 {
 	// Rez up the Lua State manager now, and run the initial script - discussed in Chapter 5, page 144.
-	if (!LuaStateManager::Create())
+	// lua_allocator = false keeps the allocator of luaL_newstate()
+	bool pooledAllocator = !g_settings->exists("lua_allocator") || g_settings->getBool("lua_allocator");
+	if (!LuaStateManager::Create(nullptr, pooledAllocator))
 	{
 		errorstream << ("Failed to initialize Lua");
 		return false;
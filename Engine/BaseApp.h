@@ -4,6 +4,13 @@
 #include <memory>
 
 class EventManager;
+class ComponentManager;
+class ActorManager;
+class JobSystem;
+class EventRecorder;
+class EventReplayer;
+class SettingsReloader;
+template <class T> class SettingHandle;
 
 class BaseApp
 {
@@ -18,6 +25,12 @@ public:
 
 	void update(float dt);
 
+	ComponentManager* GetComponentManager() { return m_pComponentManager.get(); }
+
+	ActorManager* GetActorManager() { return m_pActorManager.get(); }
+
+	JobSystem* GetJobSystem() { return m_pJobSystem.get(); }
+
 private:
 	bool init_setting();
 
@@ -26,8 +39,23 @@ private:
 	virtual bool init_lua_manager();
 
 	void registerLuaFunc();
+
+	void updateLuaProfiler();
 private:
 	std::shared_ptr<EventManager> m_pEventManger;
+	std::shared_ptr<JobSystem> m_pJobSystem;
+	std::shared_ptr<ComponentManager> m_pComponentManager;
+	std::shared_ptr<ActorManager> m_pActorManager;
+	unsigned long m_eventBudgetUs;	// time per frame for queued events, setting event_budget_us
+	std::shared_ptr<EventRecorder> m_pEventRecorder;
+	std::shared_ptr<EventReplayer> m_pEventReplayer;
+	std::shared_ptr<SettingsReloader> m_pSettingsReloader;
+	float m_binaryLogFlushMs;	// since the binary log buffers were last written out
+	std::shared_ptr<SettingHandle<bool> > m_pLuaProfilerSetting;
+	std::shared_ptr<SettingHandle<uint32_t> > m_pLuaProfilerIntervalSetting;
+	bool m_luaProfilerSetting;	// last seen value, the profiler follows changes only
+	float m_luaMemoryLogMs;	// since the Lua memory statistics were last logged
+	float m_luaMemoryLogIntervalMs;	// setting lua_memory_log_s, 0 for never
 };
 
 extern std::shared_ptr<BaseApp> g_pApp;
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "3rdParty/LuaPlus/LuaPlus.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+// The cocos runtime links LuaJIT, whose lua.h is the one of Lua 5.1.  Its luaconf.h defines LUA_LJDIR; luajit.h is
+// included then, so LUAJIT_VERSION tells the code that depends on the VM (allocator, hooks) which one it is built for.
+//---------------------------------------------------------------------------------------------------------------------
+#if defined(LUA_LJDIR) && !defined(LUAJIT_VERSION)
+extern "C" {
+#include "luajit.h"
+}
+#endif
@@ -0,0 +1,427 @@
+#include "LuaMemory.h"
+#include "log.h"
+#include "utils/time_utils.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace
+{
+	std::mutex s_subsystemMutex;
+
+	// Never destroyed, like the scopes' static ids
+	std::vector<const char*>& GetSubsystemNames(void)
+	{
+		static std::vector<const char*>* s_pNames = new std::vector<const char*>(1, "script");
+		return *s_pNames;
+	}
+
+	void* AllocateChunk(void)
+	{
+#ifdef _WIN32
+		return _aligned_malloc(LuaAllocator::kChunkSize, LuaAllocator::kChunkSize);
+#else
+		void* p = NULL;
+		return posix_memalign(&p, LuaAllocator::kChunkSize, LuaAllocator::kChunkSize) == 0 ? p : NULL;
+#endif
+	}
+
+	void FreeChunk(void* p)
+	{
+#ifdef _WIN32
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+
+	inline unsigned int SizeClass(size_t size)
+	{
+		return (unsigned int)((size + LuaAllocator::kGranularity - 1) / LuaAllocator::kGranularity) - 1;
+	}
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Scope
+//---------------------------------------------------------------------------------------------------------------------
+LuaAllocator::Scope::Scope(lua_State* L, unsigned int subsystem)
+:   m_pAllocator(LuaAllocator::Get(L))
+{
+	if (!m_pAllocator)
+		return;
+
+	if (m_pAllocator->m_subsystems.size() <= subsystem)
+	{
+		SubsystemCounters counters = { 0, 0, 0 };
+		m_pAllocator->m_subsystems.resize(subsystem + 1, counters);
+	}
+	m_previous = m_pAllocator->m_subsystem;
+	m_pAllocator->m_subsystem = subsystem;
+}
+
+LuaAllocator::Scope::~Scope(void)
+{
+	if (m_pAllocator)
+		m_pAllocator->m_subsystem = m_previous;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// LuaAllocator
+//---------------------------------------------------------------------------------------------------------------------
+LuaAllocator::LuaAllocator(void)
+:   m_heapAlloc(&LuaAllocator::HeapAlloc),
+	m_pHeapUserdata(NULL),
+	m_adopted(false)
+{
+	std::fill(m_freeLists, m_freeLists + kNumClasses, (FreeBlock*)NULL);
+
+	SubsystemCounters counters = { 0, 0, 0 };
+	m_subsystem = kScriptSubsystem;
+	m_subsystems.resize(1, counters);
+
+	m_liveBytes = 0;
+	m_peakBytes = 0;
+	m_poolAllocs = 0;
+	m_heapAllocs = 0;
+}
+
+LuaAllocator::~LuaAllocator(void)
+{
+	for (auto it = m_chunks.begin(); it != m_chunks.end(); ++it)
+		FreeChunk(*it);
+}
+
+void LuaAllocator::Adopt(lua_State* L)
+{
+	void* pUserdata = NULL;
+	lua_Alloc alloc = lua_getallocf(L, &pUserdata);
+	if (alloc == &LuaAllocator::Alloc)
+		return;
+
+	// the state's blocks go back to the allocator that made them
+	m_heapAlloc = alloc;
+	m_pHeapUserdata = pUserdata;
+	m_adopted = true;
+
+	m_liveBytes = (uint64_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+	m_peakBytes = m_liveBytes;
+	lua_setallocf(L, &LuaAllocator::Alloc, this);
+}
+
+void* LuaAllocator::Alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	return static_cast<LuaAllocator*>(ud)->Reallocate(ptr, osize, nsize);
+}
+
+LuaAllocator* LuaAllocator::Get(lua_State* L)
+{
+	void* pUserdata = NULL;
+	if (lua_getallocf(L, &pUserdata) != &LuaAllocator::Alloc)
+		return NULL;
+	return static_cast<LuaAllocator*>(pUserdata);
+}
+
+// the allocator of luaL_newstate()
+void* LuaAllocator::HeapAlloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	if (nsize == 0)
+	{
+		free(ptr);
+		return NULL;
+	}
+	return realloc(ptr, nsize);
+}
+
+
+void* LuaAllocator::Reallocate(void* p, size_t oldSize, size_t newSize)
+{
+	if (!p)
+		return newSize ? AllocateBlock(newSize) : NULL;
+
+	if (newSize == 0)
+	{
+		ReleaseBlock(p, oldSize);
+		return NULL;
+	}
+
+	bool pooled = IsPooled(p, oldSize);
+	if (pooled && newSize <= kMaxBlockSize && SizeClass(newSize) == SizeClass(oldSize))
+	{
+		if (newSize > oldSize)
+			CountAlloc(newSize - oldSize);
+		else
+			CountFree(oldSize - newSize);
+		return p;
+	}
+
+	if (!pooled && newSize > kMaxBlockSize)
+	{
+		void* q = m_heapAlloc(m_pHeapUserdata, p, oldSize, newSize);
+		if (!q)
+			return NULL;
+		m_heapAllocs++;
+		CountFree(oldSize);
+		CountAlloc(newSize);
+		return q;
+	}
+
+	// between the pools and the heap, or between size classes
+	void* q = AllocateBlock(newSize);
+	if (!q)
+		return NULL;
+	memcpy(q, p, (std::min)(oldSize, newSize));
+	ReleaseBlock(p, oldSize);
+	return q;
+}
+
+void* LuaAllocator::AllocateBlock(size_t size)
+{
+	if (size > kMaxBlockSize)
+	{
+		void* p = m_heapAlloc(m_pHeapUserdata, NULL, 0, size);
+		if (!p)
+			return NULL;
+		m_heapAllocs++;
+		CountAlloc(size);
+		return p;
+	}
+
+	unsigned int sizeClass = SizeClass(size);
+	if (!m_freeLists[sizeClass] && !Refill(sizeClass))
+		return NULL;
+
+	FreeBlock* block = m_freeLists[sizeClass];
+	m_freeLists[sizeClass] = block->next;
+	m_poolAllocs++;
+	CountAlloc(size);
+	return block;
+}
+
+void LuaAllocator::ReleaseBlock(void* p, size_t size)
+{
+	CountFree(size);
+	if (!IsPooled(p, size))
+	{
+		m_heapAlloc(m_pHeapUserdata, p, size, 0);
+		return;
+	}
+
+	FreeBlock* block = static_cast<FreeBlock*>(p);
+	unsigned int sizeClass = SizeClass(size);
+	block->next = m_freeLists[sizeClass];
+	m_freeLists[sizeClass] = block;
+}
+
+bool LuaAllocator::IsPooled(void* p, size_t size) const
+{
+	if (size > kMaxBlockSize)
+		return false;
+	// only the blocks of an adopted state can be small and not ours
+	return !m_adopted || m_chunkIndices.count((uintptr_t)p / kChunkSize) != 0;
+}
+
+bool LuaAllocator::Refill(unsigned int sizeClass)
+{
+	char* chunk = static_cast<char*>(AllocateChunk());
+	if (!chunk)
+		return false;
+	m_heapAllocs++;
+	m_chunks.push_back(chunk);
+	m_chunkIndices.insert((uintptr_t)chunk / kChunkSize);
+
+	size_t blockSize = (sizeClass + 1) * kGranularity;
+	for (size_t i = kChunkSize / blockSize; i-- > 0; )
+	{
+		FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + i * blockSize);
+		block->next = m_freeLists[sizeClass];
+		m_freeLists[sizeClass] = block;
+	}
+	return true;
+}
+
+void LuaAllocator::CountAlloc(size_t bytes)
+{
+	m_liveBytes += bytes;
+	m_peakBytes = (std::max)(m_peakBytes, m_liveBytes);
+
+	SubsystemCounters& counters = m_subsystems[m_subsystem];
+	counters.allocs++;
+	counters.allocBytes += bytes;
+}
+
+void LuaAllocator::CountFree(size_t bytes)
+{
+	m_liveBytes -= std::min<uint64_t>(bytes, m_liveBytes);
+	m_subsystems[m_subsystem].freedBytes += bytes;
+}
+
+
+LuaMemoryStats LuaAllocator::GetStats(void) const
+{
+	LuaMemoryStats stats;
+	stats.liveBytes = m_liveBytes;
+	stats.peakBytes = m_peakBytes;
+	stats.poolBytes = (uint64_t)m_chunks.size() * kChunkSize;
+	stats.poolAllocs = m_poolAllocs;
+	stats.heapAllocs = m_heapAllocs;
+	return stats;
+}
+
+std::vector<LuaSubsystemMemoryStats> LuaAllocator::GetSubsystemStats(void) const
+{
+	std::lock_guard<std::mutex> lock(s_subsystemMutex);
+	const std::vector<const char*>& names = GetSubsystemNames();
+
+	std::vector<LuaSubsystemMemoryStats> stats(names.size());
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		stats[i].name = names[i];
+		stats[i].allocs = i < m_subsystems.size() ? m_subsystems[i].allocs : 0;
+		stats[i].allocBytes = i < m_subsystems.size() ? m_subsystems[i].allocBytes : 0;
+		stats[i].freedBytes = i < m_subsystems.size() ? m_subsystems[i].freedBytes : 0;
+	}
+	return stats;
+}
+
+unsigned int LuaAllocator::RegisterSubsystem(const char* name)
+{
+	std::lock_guard<std::mutex> lock(s_subsystemMutex);
+	std::vector<const char*>& names = GetSubsystemNames();
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		if (strcmp(names[i], name) == 0)
+			return (unsigned int)i;
+	}
+	names.push_back(name);
+	return (unsigned int)names.size() - 1;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// LuaGarbageCollector
+//---------------------------------------------------------------------------------------------------------------------
+LuaGarbageCollector::LuaGarbageCollector(lua_State* L)
+:   m_pLuaState(L)
+{
+	m_running = false;
+	m_loading = false;
+	m_inCycle = false;
+	m_frameBudgetUs = 1000;
+	m_loadingBudgetUs = 8000;
+	m_pause = 200;
+	m_limitBytes = 0;
+	m_lastCycleBytes = GetBytes();
+	m_thresholdBytes = m_lastCycleBytes / 100 * m_pause;
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+LuaGarbageCollector::~LuaGarbageCollector(void)
+{
+	Stop();
+}
+
+void LuaGarbageCollector::Start(void)
+{
+	if (m_running)
+		return;
+
+	lua_gc(m_pLuaState, LUA_GCSTOP, 0);
+	m_running = true;
+	m_inCycle = false;
+	m_lastCycleBytes = GetBytes();
+	m_thresholdBytes = m_lastCycleBytes / 100 * m_pause;
+}
+
+void LuaGarbageCollector::Stop(void)
+{
+	if (!m_running)
+		return;
+
+	lua_gc(m_pLuaState, LUA_GCRESTART, 0);
+	m_running = false;
+}
+
+void LuaGarbageCollector::SetBudget(unsigned int frameUs, unsigned int loadingUs)
+{
+	m_frameBudgetUs = frameUs;
+	m_loadingBudgetUs = loadingUs;
+}
+
+void LuaGarbageCollector::SetPause(unsigned int percent)
+{
+	m_pause = (std::max)(percent, 100u);
+	m_thresholdBytes = m_lastCycleBytes / 100 * m_pause;
+}
+
+size_t LuaGarbageCollector::GetBytes(void) const
+{
+	return (size_t)lua_gc(m_pLuaState, LUA_GCCOUNT, 0) * 1024 + lua_gc(m_pLuaState, LUA_GCCOUNTB, 0);
+}
+
+void LuaGarbageCollector::Update(void)
+{
+	if (!m_running)
+		return;
+
+	LUA_MEMORY_SCOPE(m_pLuaState, "gc");
+	uint64_t start = getTimeNs();
+	size_t bytes = GetBytes();
+
+	if (m_limitBytes && bytes >= m_limitBytes)
+	{
+		lua_gc(m_pLuaState, LUA_GCCOLLECT, 0);
+		m_stats.fullCollects++;
+		EndCycle();
+	}
+	else
+	{
+		// loading screens collect what they can
+		if (!m_inCycle && (m_loading ? bytes > m_lastCycleBytes : bytes >= m_thresholdBytes))
+			m_inCycle = true;
+
+		if (m_inCycle)
+		{
+			uint64_t budgetNs = GetBudgetUs() * 1000ull;
+			if (bytes >= m_thresholdBytes * 2)
+			{
+				budgetNs *= 4;
+				m_stats.catchUps++;
+			}
+
+			do
+			{
+				m_stats.steps++;
+				if (lua_gc(m_pLuaState, LUA_GCSTEP, 0))
+				{
+					EndCycle();
+					break;
+				}
+			}
+			while (getTimeNs() - start < budgetNs);
+		}
+	}
+
+	// stepping set the threshold of the automatic collector again
+	lua_gc(m_pLuaState, LUA_GCSTOP, 0);
+
+	uint64_t elapsed = getTimeNs() - start;
+	m_stats.frames++;
+	m_stats.lastFrameNs = elapsed;
+	m_stats.maxFrameNs = (std::max)(m_stats.maxFrameNs, elapsed);
+	m_stats.totalNs += elapsed;
+}
+
+void LuaGarbageCollector::EndCycle(void)
+{
+	m_inCycle = false;
+	m_stats.cycles++;
+	m_lastCycleBytes = GetBytes();
+	m_thresholdBytes = m_lastCycleBytes / 100 * m_pause;
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+#include "3rdParty/LuaPlus/LuaPlus.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+// Memory of the Lua state.  liveBytes counts the blocks Lua holds, poolBytes the chunks carved into size classes
+// (used or free), heapAllocs the calls that reached the underlying allocator.
+//---------------------------------------------------------------------------------------------------------------------
+struct LuaMemoryStats
+{
+	uint64_t liveBytes;
+	uint64_t peakBytes;
+	uint64_t poolBytes;
+	uint64_t poolAllocs;
+	uint64_t heapAllocs;
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+// Allocations made while a subsystem had the Lua state: what its scripts cost the collector.  Blocks are not tagged,
+// so freedBytes is what was freed during the subsystem's scope, not what it allocated.
+//---------------------------------------------------------------------------------------------------------------------
+struct LuaSubsystemMemoryStats
+{
+	const char* name;
+	uint64_t allocs;
+	uint64_t allocBytes;
+	uint64_t freedBytes;
+};
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// lua_Alloc serving the small blocks Lua allocates most (strings, tables, closures, upvalues) from size-class pools,
+// the larger ones from the allocator the state had.  Pools grow in aligned chunks and are only handed back when the
+// allocator is destroyed, after lua_close().
+//
+// A state created elsewhere (cocos) is adopted with lua_setallocf(): its existing blocks are not in any chunk and are
+// freed with the allocator that made them.
+//---------------------------------------------------------------------------------------------------------------------
+class LuaAllocator
+{
+public:
+	// Charges the allocations of the scope to a subsystem, see LUA_MEMORY_SCOPE()
+	class Scope
+	{
+		LuaAllocator* m_pAllocator;
+		unsigned int m_previous;
+
+	public:
+		Scope(lua_State* L, unsigned int subsystem);
+		~Scope(void);
+	};
+
+	enum eConstants
+	{
+		kGranularity = 16,
+		kMaxBlockSize = 256,  // larger blocks go to the underlying allocator
+		kNumClasses = kMaxBlockSize / kGranularity,
+		kChunkSize = 64 * 1024,  // aligned, so a block finds its chunk
+		kScriptSubsystem = 0,  // outside any scope
+	};
+
+	LuaAllocator(void);
+	~LuaAllocator(void);
+
+	// Installs the allocator in a state made with another one.  Creating the state with lua_newstate(Alloc, this) is
+	// the better choice where possible.
+	void Adopt(lua_State* L);
+
+	static void* Alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+	// The allocator of the state, NULL if it has another one
+	static LuaAllocator* Get(lua_State* L);
+
+	LuaMemoryStats GetStats(void) const;
+	std::vector<LuaSubsystemMemoryStats> GetSubsystemStats(void) const;
+
+	// Called once per subsystem by LUA_MEMORY_SCOPE(); the same name gives the same subsystem
+	static unsigned int RegisterSubsystem(const char* name);
+
+private:
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	struct SubsystemCounters
+	{
+		uint64_t allocs;
+		uint64_t allocBytes;
+		uint64_t freedBytes;
+	};
+
+	lua_Alloc m_heapAlloc;
+	void* m_pHeapUserdata;
+	bool m_adopted;  // some small blocks are not ours
+
+	FreeBlock* m_freeLists[kNumClasses];
+	std::vector<void*> m_chunks;
+	std::unordered_set<uintptr_t> m_chunkIndices;  // address / kChunkSize of each chunk
+
+	unsigned int m_subsystem;
+	std::vector<SubsystemCounters> m_subsystems;
+
+	uint64_t m_liveBytes;
+	uint64_t m_peakBytes;
+	uint64_t m_poolAllocs;
+	uint64_t m_heapAllocs;
+
+	void* Reallocate(void* p, size_t oldSize, size_t newSize);
+	void* AllocateBlock(size_t size);
+	void ReleaseBlock(void* p, size_t size);
+	bool IsPooled(void* p, size_t size) const;
+	bool Refill(unsigned int sizeClass);
+	void CountAlloc(size_t bytes);
+	void CountFree(size_t bytes);
+
+	static void* HeapAlloc(void* ud, void* ptr, size_t osize, size_t nsize);
+};
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Statistics of the garbage collector driven by LuaGarbageCollector.
+//---------------------------------------------------------------------------------------------------------------------
+struct LuaGCStats
+{
+	uint64_t frames;
+	uint64_t steps;
+	uint64_t cycles;  // completed
+	uint64_t catchUps;  // frames with more than the budget, the garbage grew faster than it was collected
+	uint64_t fullCollects;  // at the memory limit
+	uint64_t lastFrameNs;
+	uint64_t maxFrameNs;
+	uint64_t totalNs;
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+// Runs the incremental collector of a Lua state in a time budget per frame instead of in the allocations.
+//
+// Lua's own collector is stopped and Update() steps it until the budget of the frame is spent.  A cycle starts when
+// the memory reaches pause percent of what the last cycle left (as Lua's setpause), at once on loading screens, which
+// also have a larger budget.  When the memory grows to twice that threshold the budget is not enough: the frame gets
+// four times the budget.  At the limit, if one is set, the collection is finished at once.
+//---------------------------------------------------------------------------------------------------------------------
+class LuaGarbageCollector
+{
+public:
+	explicit LuaGarbageCollector(lua_State* L);
+	~LuaGarbageCollector(void);
+
+	// Takes over from the automatic collector and gives it back
+	void Start(void);
+	void Stop(void);
+	bool IsRunning(void) const { return m_running; }
+
+	void SetBudget(unsigned int frameUs, unsigned int loadingUs);
+	void SetPause(unsigned int percent);
+	// 0 for no limit
+	void SetLimit(size_t bytes) { m_limitBytes = bytes; }
+
+	void SetLoading(bool loading) { m_loading = loading; }
+	bool IsLoading(void) const { return m_loading; }
+
+	// Once per frame
+	void Update(void);
+
+	const LuaGCStats& GetStats(void) const { return m_stats; }
+	unsigned int GetBudgetUs(void) const { return m_loading ? m_loadingBudgetUs : m_frameBudgetUs; }
+	size_t GetThreshold(void) const { return m_thresholdBytes; }
+	size_t GetBytes(void) const;
+
+private:
+	lua_State* m_pLuaState;
+	bool m_running;
+	bool m_loading;
+	bool m_inCycle;
+	unsigned int m_frameBudgetUs;
+	unsigned int m_loadingBudgetUs;
+	unsigned int m_pause;
+	size_t m_limitBytes;
+	size_t m_lastCycleBytes;  // what the last cycle left
+	size_t m_thresholdBytes;
+	LuaGCStats m_stats;
+
+	void EndCycle(void);
+};
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Put at the start of code running scripts for a subsystem to have their allocations charged to it.
+//---------------------------------------------------------------------------------------------------------------------
+#define LUA_MEMORY_SCOPE(L, name) \
+	static const unsigned int s_luaMemorySubsystem = LuaAllocator::RegisterSubsystem(name); \
+	LuaAllocator::Scope luaMemoryScope(L, s_luaMemorySubsystem)
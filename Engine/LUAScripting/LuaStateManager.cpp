@@ -1,10 +1,12 @@
 #include "LuaStateManager.h"
+#include "LuaJit.h"
+#include "LuaMemory.h"
 #include "utils/macros.h"
 #include "log.h"
 
 LuaStateManager* LuaStateManager::s_pSingleton = NULL;
 
-bool LuaStateManager::Create(lua_State* L)
+bool LuaStateManager::Create(lua_State* L, bool pooledAllocator)
 {
     if (s_pSingleton)
     {
@@ -14,7 +16,7 @@ bool LuaStateManager::Create(lua_State* L)
 
     s_pSingleton = new LuaStateManager;
     if (s_pSingleton)
-        return s_pSingleton->Init(L);
+        return s_pSingleton->Init(L, pooledAllocator);
 
     return false;
 }
@@ -28,23 +30,42 @@ void LuaStateManager::Destroy(void)
 LuaStateManager::LuaStateManager(void)
 {
     m_pLuaState = NULL;
+    m_pAllocator = NULL;
+    m_pGarbageCollector = NULL;
 }
 
 LuaStateManager::~LuaStateManager(void)
 {
+    SAFE_DELETE(m_pGarbageCollector);
     if (m_pLuaState)
     {
         LuaPlus::LuaState::Destroy(m_pLuaState);
         m_pLuaState = NULL;
     }
+
+    // after lua_close(), which frees the blocks
+    SAFE_DELETE(m_pAllocator);
 }
 
-bool LuaStateManager::Init(lua_State* L)
+bool LuaStateManager::Init(lua_State* L, bool pooledAllocator)
 {
+#ifdef LUAJIT_VERSION
+	// 64-bit LuaJIT needs the memory of its own allocator; the pools' chunks can be anywhere
+	pooledAllocator = false;
+#endif
+	if (pooledAllocator)
+		m_pAllocator = new LuaAllocator;
+
 	if (L)
 	{
+		if (m_pAllocator)
+			m_pAllocator->Adopt(L);
 		m_pLuaState = LuaPlus::LuaState::Create(L);
 	}
+	else if (m_pAllocator)
+	{
+		m_pLuaState = LuaPlus::LuaState::Create(&LuaAllocator::Alloc, m_pAllocator);
+	}
 	else
 	{
 		m_pLuaState = LuaPlus::LuaState::Create();
@@ -53,7 +74,8 @@ bool LuaStateManager::Init(lua_State* L)
     if (m_pLuaState == nullptr)
         return false;
 
- 
+    // Lua's own collector runs until the GC driver is started
+    m_pGarbageCollector = new LuaGarbageCollector(m_pLuaState->GetCState());
     return true;
 }
 
@@ -90,4 +112,31 @@ LuaPlus::LuaObject LuaStateManager::GetGlobalVars(void)
 LuaPlus::LuaState* LuaStateManager::GetLuaState(void) const
 {
     return m_pLuaState;
+}
+
+void LuaStateManager::LogMemoryStats(void) const
+{
+	const LuaGCStats& gcStats = m_pGarbageCollector->GetStats();
+	infostream << "Lua memory: " << m_pGarbageCollector->GetBytes() / 1024 << " KB, collection at "
+		<< m_pGarbageCollector->GetThreshold() / 1024 << " KB; GC " << gcStats.cycles << " cycles, "
+		<< gcStats.steps << " steps, " << gcStats.totalNs / 1000000 << " ms, at most "
+		<< gcStats.maxFrameNs / 1000 << " us per frame, " << gcStats.catchUps << " catch-ups, "
+		<< gcStats.fullCollects << " full collections" << std::endl;
+
+	if (!m_pAllocator)
+		return;
+
+	LuaMemoryStats stats = m_pAllocator->GetStats();
+	infostream << "Lua allocator: peak " << stats.peakBytes / 1024 << " KB, pools " << stats.poolBytes / 1024
+		<< " KB, " << stats.poolAllocs << " pool and " << stats.heapAllocs << " heap allocations" << std::endl;
+
+	std::vector<LuaSubsystemMemoryStats> subsystems = m_pAllocator->GetSubsystemStats();
+	for (auto it = subsystems.begin(); it != subsystems.end(); ++it)
+	{
+		if (it->allocs)
+		{
+			infostream << "  " << it->name << ": " << it->allocs << " allocations, " << it->allocBytes / 1024
+				<< " KB allocated, " << it->freedBytes / 1024 << " KB freed" << std::endl;
+		}
+	}
 }
\ No newline at end of file
@@ -5,27 +5,39 @@
 #include "math2d/vector2d.h"
 #include "3rdParty/LuaPlus/LuaPlus.h"
 
+class LuaAllocator;
+class LuaGarbageCollector;
+
 class LuaStateManager
 {
     static LuaStateManager* s_pSingleton;
     LuaPlus::LuaState* m_pLuaState;
+    LuaAllocator* m_pAllocator;  // NULL with the allocator the state came with
+    LuaGarbageCollector* m_pGarbageCollector;
     std::string m_lastError;
 
 public:
-    // Singleton functions
-    static bool Create(lua_State* L = nullptr);
+    // Singleton functions; pooledAllocator installs a LuaAllocator, also in a state L made elsewhere.  It is ignored
+    // when built against LuaJIT.
+    static bool Create(lua_State* L = nullptr, bool pooledAllocator = true);
 
     static void Destroy(void);
     
 	static LuaStateManager* Get(void) { assert(s_pSingleton); return s_pSingleton; }
 
     // IScriptManager interface
-	bool Init(lua_State* L = nullptr);
+	bool Init(lua_State* L = nullptr, bool pooledAllocator = true);
 
     LuaPlus::LuaObject GetGlobalVars(void);
     
 	LuaPlus::LuaState* GetLuaState(void) const;
 
+	LuaAllocator* GetAllocator(void) const { return m_pAllocator; }
+	LuaGarbageCollector* GetGarbageCollector(void) const { return m_pGarbageCollector; }
+
+	// Writes the memory and collector statistics to the info log
+	void LogMemoryStats(void) const;
+
 private:
     void SetError(int errorNum);
     void ClearStack(void);
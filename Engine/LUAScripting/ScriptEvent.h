@@ -1,18 +1,23 @@
 #pragma once
 
-#include "EventManager/EventManager.h"
+#include <map>
+#include "eventmanager/EventManager.h"
 #include "3rdParty/LuaPlus/LuaPlus.h"
+#include "ScriptEventBatch.h"
 
 class ScriptEvent;
 typedef ScriptEvent* (*CreateEventForScriptFunctionType)(void);  // function ptr typedef to create a script event
 
 
 //---------------------------------------------------------------------------------------------------------------------
-// These macros implement exporting events to script.
+// These macros implement exporting events to script.  The fields after the event type are the schema of the event
+// when the script fires it with FireEvent(), e.g. { "actorId", SCRIPT_FIELD_INTEGER }, { "damage", SCRIPT_FIELD_NUMBER }
+// (see ScriptEventBatch.h).
 //---------------------------------------------------------------------------------------------------------------------
-#define REGISTER_SCRIPT_EVENT(eventClass, eventType) \
+#define REGISTER_SCRIPT_EVENT(eventClass, eventType, ...) \
 	ScriptEvent::RegisterEventTypeWithScript(#eventClass, eventType); \
-	ScriptEvent::AddCreationFunction(eventType, &eventClass::CreateEventForScript)
+	ScriptEvent::AddCreationFunction(eventType, &eventClass::CreateEventForScript); \
+	ScriptEventBatcher::Get()->RegisterEventType(eventType, #eventClass, { __VA_ARGS__ })
 	
 #define EXPORT_FOR_SCRIPT_EVENT(eventClass) \
 	public: \
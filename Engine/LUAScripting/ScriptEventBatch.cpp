@@ -0,0 +1,548 @@
+#include "ScriptEventBatch.h"
+#include "LuaMemory.h"
+#include "ScriptProfiler.h"
+#include "log.h"
+#include "utils/macros.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+ScriptEventBatcher* ScriptEventBatcher::s_pSingleton = NULL;
+
+//---------------------------------------------------------------------------------------------------------------------
+// ScriptEventBatch
+//---------------------------------------------------------------------------------------------------------------------
+int ScriptEventBatch::FindField(const char* name) const
+{
+	for (size_t i = 0; i < m_pFields->size(); ++i)
+	{
+		if (strcmp((*m_pFields)[i].name, name) == 0)
+			return (int)i;
+	}
+	return -1;
+}
+
+long long ScriptEventBatch::GetInteger(unsigned int event, unsigned int field) const
+{
+	const ScriptEventValue& value = GetValue(event, field);
+	return GetField(field).type == SCRIPT_FIELD_NUMBER ? (long long)value.number : value.integer;
+}
+
+double ScriptEventBatch::GetNumber(unsigned int event, unsigned int field) const
+{
+	const ScriptEventValue& value = GetValue(event, field);
+	return GetField(field).type == SCRIPT_FIELD_NUMBER ? value.number : (double)value.integer;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Singleton functions
+//---------------------------------------------------------------------------------------------------------------------
+bool ScriptEventBatcher::Create(LuaPlus::LuaState* pLuaState)
+{
+	if (s_pSingleton)
+	{
+		errorstream << "Overwriting ScriptEventBatcher singleton" << std::endl;
+		SAFE_DELETE(s_pSingleton);
+	}
+
+	s_pSingleton = new ScriptEventBatcher(pLuaState);
+	return s_pSingleton != NULL;
+}
+
+void ScriptEventBatcher::Destroy(void)
+{
+	SAFE_DELETE(s_pSingleton);
+}
+
+
+ScriptEventBatcher::ScriptEventBatcher(LuaPlus::LuaState* pLuaState, size_t ringSize)
+:   m_pLuaState(pLuaState)
+{
+	size_t size = 16;
+	while (size < ringSize)
+		size *= 2;
+	m_ring.resize(size);
+	m_ringHead = 0;
+	m_ringTail = 0;
+	m_numPending = 0;
+	m_flushing = false;
+	m_listenersRemoved = false;
+}
+
+ScriptEventBatcher::~ScriptEventBatcher(void)
+{
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Declares the schema of an event type.  Returns false if the type already has one.
+//---------------------------------------------------------------------------------------------------------------------
+bool ScriptEventBatcher::RegisterEventType(EventType eventType, const char* name, std::initializer_list<ScriptEventField> fields)
+{
+	if (IsEventTypeRegistered(eventType))
+	{
+		errorstream << "ScriptEventBatcher: event type " << name << " registered twice" << std::endl;
+		return false;
+	}
+
+	m_typeIndices[eventType] = (unsigned int)m_types.size();
+	m_types.push_back(EventTypeBatch());
+	EventTypeBatch& batch = m_types.back();
+	batch.eventType = eventType;
+	batch.name = name;
+	batch.fields.assign(fields.begin(), fields.end());
+	batch.numEvents = 0;
+	batch.numStaleScriptListeners = 0;
+	batch.scriptBatchSize = 0;
+	return true;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Registers the script side.  The functions find the batcher in their upvalue, so a test can run its own batcher on
+// its own Lua state.
+//---------------------------------------------------------------------------------------------------------------------
+void ScriptEventBatcher::RegisterScriptFunctions(LuaPlus::LuaObject table)
+{
+	lua_State* L = m_pLuaState->GetCState();
+	table.Push(L);
+
+	lua_pushlightuserdata(L, this);
+	lua_pushcclosure(L, &ScriptEventBatcher::LuaFireEvent, 1);
+	lua_setfield(L, -2, "FireEvent");
+
+	lua_pushlightuserdata(L, this);
+	lua_pushcclosure(L, &ScriptEventBatcher::LuaRegisterBatchListener, 1);
+	lua_setfield(L, -2, "RegisterBatchListener");
+
+	lua_pushlightuserdata(L, this);
+	lua_pushcclosure(L, &ScriptEventBatcher::LuaRemoveBatchListener, 1);
+	lua_setfield(L, -2, "RemoveBatchListener");
+
+	lua_pop(L, 1);
+}
+
+
+bool ScriptEventBatcher::AddListener(const ScriptEventBatchDelegate& eventDelegate, EventType eventType)
+{
+	auto findIt = m_typeIndices.find(eventType);
+	if (findIt == m_typeIndices.end())
+	{
+		errorstream << "ScriptEventBatcher: no schema for event type " << eventType << std::endl;
+		return false;
+	}
+
+	std::vector<ScriptEventBatchDelegate>& delegates = m_types[findIt->second].delegates;
+	if (std::find(delegates.begin(), delegates.end(), eventDelegate) != delegates.end())
+	{
+		warningstream << "ScriptEventBatcher: attempting to double-register a delegate" << std::endl;
+		return false;
+	}
+
+	delegates.push_back(eventDelegate);
+	return true;
+}
+
+bool ScriptEventBatcher::RemoveListener(const ScriptEventBatchDelegate& eventDelegate, EventType eventType)
+{
+	auto findIt = m_typeIndices.find(eventType);
+	if (findIt == m_typeIndices.end())
+		return false;
+
+	std::vector<ScriptEventBatchDelegate>& delegates = m_types[findIt->second].delegates;
+	auto delegateIt = std::find(delegates.begin(), delegates.end(), eventDelegate);
+	if (delegateIt == delegates.end())
+		return false;
+
+	// a flush in progress walks the list by index
+	if (m_flushing)
+	{
+		delegateIt->clear();
+		m_listenersRemoved = true;
+	}
+	else
+	{
+		delegates.erase(delegateIt);
+	}
+	return true;
+}
+
+
+ScriptEventBatcher::ScriptListenerHandle ScriptEventBatcher::AddScriptListener(EventType eventType, const LuaPlus::LuaObject& callbackFunction)
+{
+	auto findIt = m_typeIndices.find(eventType);
+	if (findIt == m_typeIndices.end())
+	{
+		errorstream << "ScriptEventBatcher: no schema for event type " << eventType << std::endl;
+		return 0;
+	}
+	if (!callbackFunction.IsFunction())
+	{
+		errorstream << "Attempting to register script batch listener with invalid callback function" << std::endl;
+		return 0;
+	}
+
+	ScriptListener listener;
+	listener.typeIndex = findIt->second;
+	listener.function = callbackFunction;
+	listener.module = ScriptModule::GetFunctionModule(callbackFunction);
+	std::string module = listener.module;
+
+	ScriptListenerHandle listenerId = m_scriptListeners.Insert(std::move(listener));
+	if (!listenerId)
+	{
+		errorstream << "ScriptEventBatcher: too many script listeners" << std::endl;
+		return 0;
+	}
+	m_types[findIt->second].scriptListeners.push_back(listenerId);
+	m_moduleListeners.Add(module, listenerId);
+	return listenerId;
+}
+
+bool ScriptEventBatcher::RemoveScriptListener(ScriptListenerHandle listenerId)
+{
+	const ScriptListener* pListener = m_scriptListeners.Get(listenerId);
+	if (!pListener)
+		return false;
+
+	m_moduleListeners.Remove(pListener->module, listenerId);
+	DestroyScriptListener(listenerId);
+	return true;
+}
+
+unsigned int ScriptEventBatcher::RemoveModuleListeners(const std::string& moduleName)
+{
+	std::vector<uint32_t> handles = m_moduleListeners.TakeModule(moduleName);
+	for (auto it = handles.begin(); it != handles.end(); ++it)
+		DestroyScriptListener(*it);
+	return (unsigned int)handles.size();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// The handle stays in the list of its type until stale handles are the majority, so removing costs no search and the
+// listeners keep their order.
+//---------------------------------------------------------------------------------------------------------------------
+void ScriptEventBatcher::DestroyScriptListener(ScriptListenerHandle listenerId)
+{
+	EventTypeBatch& batch = m_types[m_scriptListeners.Get(listenerId)->typeIndex];
+	m_scriptListeners.Remove(listenerId);
+
+	batch.numStaleScriptListeners++;
+	if (batch.numStaleScriptListeners * 2 < batch.scriptListeners.size())
+		return;
+
+	// a flush in progress walks the list by index
+	if (m_flushing)
+		m_listenersRemoved = true;
+	else
+		CompactScriptListeners(batch);
+}
+
+void ScriptEventBatcher::CompactScriptListeners(EventTypeBatch& batch)
+{
+	batch.scriptListeners.erase(std::remove_if(batch.scriptListeners.begin(), batch.scriptListeners.end(),
+		[this](ScriptListenerHandle listenerId) { return !m_scriptListeners.Contains(listenerId); }),
+		batch.scriptListeners.end());
+	batch.numStaleScriptListeners = 0;
+}
+
+
+bool ScriptEventBatcher::Fire(EventType eventType, const ScriptEventValue* values, unsigned int numValues)
+{
+	auto findIt = m_typeIndices.find(eventType);
+	if (findIt == m_typeIndices.end())
+	{
+		errorstream << "ScriptEventBatcher: no schema for event type " << eventType << std::endl;
+		return false;
+	}
+
+	const EventTypeBatch& batch = m_types[findIt->second];
+	if (numValues != batch.fields.size())
+	{
+		errorstream << "ScriptEventBatcher: " << batch.name << " takes " << batch.fields.size()
+			<< " values, got " << numValues << std::endl;
+		return false;
+	}
+
+	BeginEvent(findIt->second, numValues);
+	for (unsigned int i = 0; i < numValues; ++i)
+		WriteValue(values[i]);
+	return true;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Gathers the events in the ring by type, then calls the listeners of each type once.
+//---------------------------------------------------------------------------------------------------------------------
+unsigned int ScriptEventBatcher::Flush(void)
+{
+	// a listener flushing would hand out the batch it is called with again
+	if (m_flushing)
+		return 0;
+	m_flushing = true;
+	LUA_MEMORY_SCOPE(m_pLuaState->GetCState(), "events");
+
+	const size_t mask = m_ring.size() - 1;
+	unsigned int numFlushed = 0;
+	while (m_ringHead != m_ringTail)
+	{
+		EventTypeBatch& batch = m_types[(size_t)m_ring[m_ringHead++ & mask].integer];
+		for (size_t i = 0; i < batch.fields.size(); ++i)
+			batch.values.push_back(m_ring[m_ringHead++ & mask]);
+		batch.numEvents++;
+		numFlushed++;
+	}
+	m_numPending = 0;
+
+	// events the listeners fire go to the ring, which is empty now, and wait for the next flush
+	for (size_t typeIndex = 0; typeIndex < m_types.size(); ++typeIndex)
+	{
+		if (!m_types[typeIndex].numEvents)
+			continue;
+
+		ScriptEventBatch events;
+		events.m_eventType = m_types[typeIndex].eventType;
+		events.m_pFields = &m_types[typeIndex].fields;
+		events.m_pValues = m_types[typeIndex].values.data();
+		events.m_numEvents = m_types[typeIndex].numEvents;
+
+		// by index, and the type looked up again: listeners may add listeners
+		size_t numDelegates = m_types[typeIndex].delegates.size();
+		for (size_t i = 0; i < numDelegates; ++i)
+		{
+			ScriptEventBatchDelegate eventDelegate = m_types[typeIndex].delegates[i];
+			if (eventDelegate)
+				eventDelegate(events);
+		}
+
+		size_t numScriptListeners = m_types[typeIndex].scriptListeners.size();
+		if (numScriptListeners > m_types[typeIndex].numStaleScriptListeners)
+		{
+			FillScriptBatch(m_types[typeIndex]);
+
+			lua_State* L = m_pLuaState->GetCState();
+			for (size_t i = 0; i < numScriptListeners; ++i)
+			{
+				EventTypeBatch& batch = m_types[typeIndex];
+				const ScriptListener* pListener = m_scriptListeners.Get(batch.scriptListeners[i]);
+				if (!pListener)
+					continue;
+
+				pListener->function.Push(L);
+				batch.scriptBatch.Push(L);
+				if (lua_pcall(L, 1, 0, 0) != 0)
+				{
+					const char* error = lua_tostring(L, -1);
+					errorstream << "Batch listener of " << batch.name << " failed: " << (error ? error : "?") << std::endl;
+					lua_pop(L, 1);
+				}
+			}
+		}
+
+		m_types[typeIndex].values.clear();
+		m_types[typeIndex].numEvents = 0;
+	}
+
+	if (m_listenersRemoved)
+		CompactListeners();
+	m_flushing = false;
+	return numFlushed;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Writes the events into the batch table of the type: batch.count and one array per field.  Entries left from a
+// larger batch are cleared so that the arrays have the right length.
+//---------------------------------------------------------------------------------------------------------------------
+void ScriptEventBatcher::FillScriptBatch(EventTypeBatch& batch)
+{
+	lua_State* L = m_pLuaState->GetCState();
+	const unsigned int numFields = (unsigned int)batch.fields.size();
+
+	if (batch.scriptBatch.IsNil())
+	{
+		batch.scriptBatch.AssignNewTable(m_pLuaState, 0, numFields + 1);
+		for (unsigned int field = 0; field < numFields; ++field)
+			batch.scriptColumns.push_back(batch.scriptBatch.CreateTable(batch.fields[field].name, batch.numEvents));
+	}
+
+	for (unsigned int field = 0; field < numFields; ++field)
+	{
+		batch.scriptColumns[field].Push(L);
+		const ScriptEventValue* pValue = batch.values.data() + field;
+		switch (batch.fields[field].type)
+		{
+		case SCRIPT_FIELD_INTEGER:
+			for (unsigned int i = 0; i < batch.numEvents; ++i, pValue += numFields)
+			{
+				lua_pushnumber(L, (lua_Number)pValue->integer);
+				lua_rawseti(L, -2, i + 1);
+			}
+			break;
+		case SCRIPT_FIELD_NUMBER:
+			for (unsigned int i = 0; i < batch.numEvents; ++i, pValue += numFields)
+			{
+				lua_pushnumber(L, pValue->number);
+				lua_rawseti(L, -2, i + 1);
+			}
+			break;
+		case SCRIPT_FIELD_BOOL:
+			for (unsigned int i = 0; i < batch.numEvents; ++i, pValue += numFields)
+			{
+				lua_pushboolean(L, pValue->integer != 0);
+				lua_rawseti(L, -2, i + 1);
+			}
+			break;
+		}
+
+		for (unsigned int i = batch.numEvents; i < batch.scriptBatchSize; ++i)
+		{
+			lua_pushnil(L);
+			lua_rawseti(L, -2, i + 1);
+		}
+		lua_pop(L, 1);
+	}
+
+	batch.scriptBatch.SetInteger("count", batch.numEvents);
+	batch.scriptBatchSize = batch.numEvents;
+}
+
+
+void ScriptEventBatcher::CompactListeners(void)
+{
+	for (auto typeIt = m_types.begin(); typeIt != m_types.end(); ++typeIt)
+	{
+		std::vector<ScriptEventBatchDelegate>& delegates = typeIt->delegates;
+		delegates.erase(std::remove_if(delegates.begin(), delegates.end(),
+			[](const ScriptEventBatchDelegate& eventDelegate) { return eventDelegate.empty(); }), delegates.end());
+
+		if (typeIt->numStaleScriptListeners * 2 >= typeIt->scriptListeners.size())
+			CompactScriptListeners(*typeIt);
+	}
+	m_listenersRemoved = false;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Makes room for an event of numValues values and writes its type.  The ring grows instead of dropping events; it
+// only grows for frames that fire more than it ever held.
+//---------------------------------------------------------------------------------------------------------------------
+void ScriptEventBatcher::BeginEvent(unsigned int typeIndex, size_t numValues)
+{
+	if (m_ringTail - m_ringHead + 1 + numValues > m_ring.size())
+		GrowRing(m_ringTail - m_ringHead + 1 + numValues);
+
+	ScriptEventValue header;
+	header.integer = typeIndex;
+	WriteValue(header);
+	m_numPending++;
+}
+
+void ScriptEventBatcher::GrowRing(size_t minSize)
+{
+	size_t size = m_ring.size();
+	while (size < minSize)
+		size *= 2;
+
+	std::vector<ScriptEventValue> ring(size);
+	const size_t mask = m_ring.size() - 1;
+	size_t count = m_ringTail - m_ringHead;
+	for (size_t i = 0; i < count; ++i)
+		ring[i] = m_ring[(m_ringHead + i) & mask];
+
+	m_ring.swap(ring);
+	m_ringHead = 0;
+	m_ringTail = count;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// FireEvent(eventType, value1, value2, ...) with one value per field of the schema.  Returns true if the event was
+// stored.
+//---------------------------------------------------------------------------------------------------------------------
+int ScriptEventBatcher::LuaFireEvent(lua_State* L)
+{
+	SCRIPT_PROFILE_EXPORT("FireEvent");
+	ScriptEventBatcher* pBatcher = static_cast<ScriptEventBatcher*>(lua_touserdata(L, lua_upvalueindex(1)));
+
+	auto findIt = pBatcher->m_typeIndices.end();
+	if (lua_isnumber(L, 1))
+		findIt = pBatcher->m_typeIndices.find((EventType)lua_tonumber(L, 1));
+	if (findIt == pBatcher->m_typeIndices.end())
+	{
+		errorstream << "FireEvent: no schema for event type " << (lua_tostring(L, 1) ? lua_tostring(L, 1) : "<nil>") << std::endl;
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+
+	// checked before anything is written, so a bad event leaves nothing behind
+	const EventTypeBatch& batch = pBatcher->m_types[findIt->second];
+	const int numFields = (int)batch.fields.size();
+	bool valid = lua_gettop(L) == numFields + 1;
+	for (int field = 0; valid && field < numFields; ++field)
+	{
+		if (batch.fields[field].type == SCRIPT_FIELD_BOOL)
+			valid = lua_isboolean(L, field + 2) != 0;
+		else
+			valid = lua_type(L, field + 2) == LUA_TNUMBER;
+	}
+	if (!valid)
+	{
+		errorstream << "FireEvent: " << batch.name << " takes";
+		for (int field = 0; field < numFields; ++field)
+		{
+			errorstream << " " << batch.fields[field].name << ":"
+				<< (batch.fields[field].type == SCRIPT_FIELD_BOOL ? "boolean" : "number");
+		}
+		errorstream << std::endl;
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+
+	pBatcher->BeginEvent(findIt->second, numFields);
+	for (int field = 0; field < numFields; ++field)
+	{
+		ScriptEventValue value = { 0 };
+		switch (batch.fields[field].type)
+		{
+		case SCRIPT_FIELD_INTEGER:
+			value.integer = (long long)lua_tonumber(L, field + 2);
+			break;
+		case SCRIPT_FIELD_NUMBER:
+			value.number = lua_tonumber(L, field + 2);
+			break;
+		case SCRIPT_FIELD_BOOL:
+			value.integer = lua_toboolean(L, field + 2);
+			break;
+		}
+		pBatcher->WriteValue(value);
+	}
+
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// RegisterBatchListener(eventType, function(batch) ... end) returns the handle to remove the listener with.
+//---------------------------------------------------------------------------------------------------------------------
+int ScriptEventBatcher::LuaRegisterBatchListener(lua_State* L)
+{
+	ScriptEventBatcher* pBatcher = static_cast<ScriptEventBatcher*>(lua_touserdata(L, lua_upvalueindex(1)));
+
+	ScriptListenerHandle listenerId = 0;
+	if (lua_isnumber(L, 1))
+		listenerId = pBatcher->AddScriptListener((EventType)lua_tonumber(L, 1), LuaPlus::LuaObject(L, 2));
+	else
+		errorstream << "RegisterBatchListener: invalid event type" << std::endl;
+
+	lua_pushnumber(L, (lua_Number)listenerId);
+	return 1;
+}
+
+int ScriptEventBatcher::LuaRemoveBatchListener(lua_State* L)
+{
+	ScriptEventBatcher* pBatcher = static_cast<ScriptEventBatcher*>(lua_touserdata(L, lua_upvalueindex(1)));
+	lua_pushboolean(L, lua_isnumber(L, 1) && pBatcher->RemoveScriptListener((ScriptListenerHandle)lua_tonumber(L, 1)));
+	return 1;
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "eventmanager/EventManager.h"
+#include "ScriptModule.h"
+#include "utils/slot_map.h"
+#include "3rdParty/LuaPlus/LuaPlus.h"
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Batched script events.
+//
+// Events fired from the script with FireEvent(eventType, field1, field2, ...) don't become ScriptEvent objects.  The
+// field values are written as raw numbers into a ring buffer, following the schema declared with
+// REGISTER_SCRIPT_EVENT(eventClass, eventType, { "name", SCRIPT_FIELD_INTEGER }, ...).  Once per frame Flush() hands
+// each listener every event of its type fired since the last flush in a single call: C++ listeners get a
+// ScriptEventBatch, script listeners registered with RegisterBatchListener(eventType, function(batch) ... end) get a
+// table with one array per field, indexed 1..batch.count.
+//
+// Batched events only reach batch listeners; QueueEvent() and TriggerEvent() still go through the event manager.
+// The order of the events is kept within a type, not across types.
+//---------------------------------------------------------------------------------------------------------------------
+enum ScriptEventFieldType
+{
+	SCRIPT_FIELD_INTEGER,
+	SCRIPT_FIELD_NUMBER,
+	SCRIPT_FIELD_BOOL,
+};
+
+struct ScriptEventField
+{
+	const char* name;  // must outlive the batcher, normally a string literal
+	ScriptEventFieldType type;
+};
+
+union ScriptEventValue
+{
+	long long integer;  // SCRIPT_FIELD_INTEGER, and SCRIPT_FIELD_BOOL as 0 or 1
+	double number;  // SCRIPT_FIELD_NUMBER
+};
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// The events of one type fired during a frame, as handed to C++ listeners.  It is only valid during the call.
+//---------------------------------------------------------------------------------------------------------------------
+class ScriptEventBatch
+{
+	friend class ScriptEventBatcher;
+
+	EventType m_eventType;
+	const std::vector<ScriptEventField>* m_pFields;
+	const ScriptEventValue* m_pValues;  // one row of GetNumFields() values per event
+	unsigned int m_numEvents;
+
+public:
+	EventType GetEventType(void) const { return m_eventType; }
+	unsigned int GetNumEvents(void) const { return m_numEvents; }
+	unsigned int GetNumFields(void) const { return (unsigned int)m_pFields->size(); }
+	const ScriptEventField& GetField(unsigned int field) const { return (*m_pFields)[field]; }
+
+	// Returns the index of the field, or -1 if the schema has none of that name
+	int FindField(const char* name) const;
+
+	const ScriptEventValue& GetValue(unsigned int event, unsigned int field) const { return m_pValues[event * GetNumFields() + field]; }
+	long long GetInteger(unsigned int event, unsigned int field) const;
+	double GetNumber(unsigned int event, unsigned int field) const;
+	bool GetBool(unsigned int event, unsigned int field) const { return GetValue(event, field).integer != 0; }
+};
+
+typedef fastdelegate::FastDelegate1<const ScriptEventBatch&> ScriptEventBatchDelegate;
+
+
+class ScriptEventBatcher
+{
+public:
+	typedef uint32_t ScriptListenerHandle;
+
+private:
+	struct ScriptListener
+	{
+		unsigned int typeIndex;
+		LuaPlus::LuaObject function;
+		std::string module;  // see ScriptModule
+	};
+	typedef SlotMap<ScriptListener> ScriptListenerMap;
+
+	struct EventTypeBatch
+	{
+		EventType eventType;
+		const char* name;
+		std::vector<ScriptEventField> fields;
+
+		// the events of the flush in progress
+		std::vector<ScriptEventValue> values;
+		unsigned int numEvents;
+
+		std::vector<ScriptEventBatchDelegate> delegates;  // emptied once removed during a flush
+		std::vector<ScriptListenerHandle> scriptListeners;  // in the order they were added, stale handles included
+		unsigned int numStaleScriptListeners;
+
+		// the table handed to script listeners, kept from frame to frame so flushing allocates nothing
+		LuaPlus::LuaObject scriptBatch;
+		std::vector<LuaPlus::LuaObject> scriptColumns;
+		unsigned int scriptBatchSize;
+	};
+
+	static ScriptEventBatcher* s_pSingleton;
+
+	LuaPlus::LuaState* m_pLuaState;
+	std::vector<EventTypeBatch> m_types;
+	std::unordered_map<EventType, unsigned int> m_typeIndices;
+
+	// each event is a slot with its index in m_types followed by one slot per field; head and tail only grow and are
+	// masked into the buffer, whose size is a power of two
+	std::vector<ScriptEventValue> m_ring;
+	size_t m_ringHead;
+	size_t m_ringTail;
+	size_t m_numPending;
+
+	ScriptListenerMap m_scriptListeners;
+	ScriptModuleListeners m_moduleListeners;
+
+	bool m_flushing;
+	bool m_listenersRemoved;
+
+public:
+	// The batcher of the game, created by ScriptExports::Register()
+	static bool Create(LuaPlus::LuaState* pLuaState);
+	static void Destroy(void);
+	static ScriptEventBatcher* Get(void) { assert(s_pSingleton); return s_pSingleton; }
+
+	explicit ScriptEventBatcher(LuaPlus::LuaState* pLuaState, size_t ringSize = 4096);
+	~ScriptEventBatcher(void);
+
+	// Declares the fields of an event type, in the order FireEvent() takes them.  Call REGISTER_SCRIPT_EVENT() instead.
+	bool RegisterEventType(EventType eventType, const char* name, std::initializer_list<ScriptEventField> fields);
+	bool IsEventTypeRegistered(EventType eventType) const { return m_typeIndices.find(eventType) != m_typeIndices.end(); }
+
+	// Adds FireEvent, RegisterBatchListener and RemoveBatchListener to the table, bound to this batcher
+	void RegisterScriptFunctions(LuaPlus::LuaObject table);
+
+	bool AddListener(const ScriptEventBatchDelegate& eventDelegate, EventType eventType);
+	bool RemoveListener(const ScriptEventBatchDelegate& eventDelegate, EventType eventType);
+
+	// Returns the handle to remove the listener with, 0 on failure.  A stale handle removes nothing.
+	ScriptListenerHandle AddScriptListener(EventType eventType, const LuaPlus::LuaObject& callbackFunction);
+	bool RemoveScriptListener(ScriptListenerHandle listenerId);
+	// Removes the script listeners defined in the module, returns how many
+	unsigned int RemoveModuleListeners(const std::string& moduleName);
+	size_t GetNumScriptListeners(void) const { return m_scriptListeners.Size(); }
+
+	// Fires an event from C++: one value per field of the schema
+	bool Fire(EventType eventType, const ScriptEventValue* values, unsigned int numValues);
+
+	// Hands the events fired since the last flush to the listeners of their type.  Events fired by the listeners are
+	// kept for the next flush.  Returns the number of events flushed.
+	unsigned int Flush(void);
+
+	// Events fired and not flushed yet
+	size_t GetNumPendingEvents(void) const { return m_numPending; }
+
+private:
+	// starts an event in the ring, the values follow with WriteValue()
+	void BeginEvent(unsigned int typeIndex, size_t numValues);
+	void WriteValue(const ScriptEventValue& value) { m_ring[m_ringTail++ & (m_ring.size() - 1)] = value; }
+	void GrowRing(size_t minSize);
+	void FillScriptBatch(EventTypeBatch& batch);
+	void CompactListeners(void);
+	void CompactScriptListeners(EventTypeBatch& batch);
+	void DestroyScriptListener(ScriptListenerHandle listenerId);
+
+	static int LuaFireEvent(lua_State* L);
+	static int LuaRegisterBatchListener(lua_State* L);
+	static int LuaRemoveBatchListener(lua_State* L);
+};
@@ -1,32 +1,55 @@
 #include "ScriptExports.h"
 #include "ScriptEvent.h"
+#include "ScriptEventBatch.h"
+#include "ScriptModule.h"
+#include "ScriptProfiler.h"
 #include "LuaStateManager.h"
+#include "LuaMemory.h"
+#include "BaseApp.h"
+#include "Actors/ActorManager.h"
+#include "components/transformcomponent.h"
+#include "threading/job_system.h"
 #include "log.h"
 #include "utils/macros.h"
+#include "utils/slot_map.h"
 #include "utils/time_utils.h"
-#include <set>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
 
 class ScriptEventListener
 {
     EventType m_eventType;
 	LuaPlus::LuaObject m_scriptCallbackFunction;
+	std::string m_module;  // see ScriptModule
 
 public:
 	explicit ScriptEventListener(const EventType& eventType, const LuaPlus::LuaObject& scriptCallbackFunction);
     ~ScriptEventListener(void);
+	const std::string& GetModule(void) const { return m_module; }
     EventListenerDelegate GetDelegate(void) { return fastdelegate::MakeDelegate(this, &ScriptEventListener::ScriptEventDelegate); }
 	void ScriptEventDelegate(IEventDataPtr pEventPtr);
 };
 
+//---------------------------------------------------------------------------------------------------------------------
+// Owns the script listeners.  The handle given to the script is a generational slot map handle, so adding and
+// removing a listener costs no allocation beyond the listener and a stale handle removes nothing.
+//---------------------------------------------------------------------------------------------------------------------
 class ScriptEventListenerMgr
 {
-	typedef std::set<ScriptEventListener*> ScriptEventListenerSet;
-	ScriptEventListenerSet m_listeners;
+	typedef SlotMap<std::unique_ptr<ScriptEventListener> > ScriptEventListenerMap;
+	ScriptEventListenerMap m_listeners;
+	ScriptModuleListeners m_moduleListeners;
 
 public:
+	typedef ScriptEventListenerMap::Handle Handle;
+
 	~ScriptEventListenerMgr(void);
-	void AddListener(ScriptEventListener* pListener);
-	void DestroyListener(ScriptEventListener* pListener);
+	Handle AddListener(ScriptEventListener* pListener);
+	bool DestroyListener(Handle listenerId);
+	unsigned int DestroyModuleListeners(const std::string& moduleName);
+	size_t GetNumListeners(void) const { return m_listeners.Size(); }
 };
 
 class InternalScriptExports
@@ -39,13 +62,28 @@ public:
 	static void Destroy(void);
 	
 	// actors
-	static int CreateActor(const char* actorArchetype, LuaPlus::LuaObject luaPosition, LuaPlus::LuaObject luaYawPitchRoll);
+	static ActorId CreateActor(const char* actorArchetype, LuaPlus::LuaObject luaPosition, LuaPlus::LuaObject luaYawPitchRoll);
+	static bool DestroyActor(ActorId actorId);
+	static bool IsActorAlive(ActorId actorId);
 
 	// event system
 	static unsigned long RegisterEventListener(EventType eventType, LuaPlus::LuaObject callbackFunction);
-	static void RemoveEventListener(unsigned long listenerId);
+	static bool RemoveEventListener(unsigned long listenerId);
 	static bool QueueEvent(EventType eventType, LuaPlus::LuaObject eventData);
 	static bool TriggerEvent(EventType eventType, LuaPlus::LuaObject eventData);
+	static void SetEventPriority(EventType eventType, int priority);
+	static LuaPlus::LuaObject GetEventStats(void);
+
+	// jobs
+	static bool RunParallel(const char* kernelName, unsigned int count, unsigned int grain);
+	static LuaPlus::LuaObject GetJobStats(void);
+
+	// modules
+	static int UnloadModule(const char* moduleName);
+
+	// memory
+	static LuaPlus::LuaObject GetLuaMemoryStats(void);
+	static void SetLoadingScreen(bool loading);
 
     // misc
     static void LuaLog(LuaPlus::LuaObject text);
@@ -58,6 +96,8 @@ private:
 
 ScriptEventListenerMgr* InternalScriptExports::s_pScriptEventListenerMgr = NULL;
 
+static std::map<std::string, ScriptExports::ParallelKernel> s_parallelKernels;
+
 
 
 
@@ -66,37 +106,45 @@ ScriptEventListenerMgr* InternalScriptExports::s_pScriptEventListenerMgr = NULL;
 //---------------------------------------------------------------------------------------------------------------------
 ScriptEventListenerMgr::~ScriptEventListenerMgr(void)
 {
-	for (auto it = m_listeners.begin(); it != m_listeners.end(); ++it)
-	{
-		ScriptEventListener* pListener = (*it);
-		delete pListener;
-	}
-	m_listeners.clear();
+	m_listeners.Clear();
+	m_moduleListeners.Clear();
 }
 
 //---------------------------------------------------------------------------------------------------------------------
-// Adds a new listener
+// Takes ownership of a new listener and returns its handle, 0 if there are too many listeners
 //---------------------------------------------------------------------------------------------------------------------
-void ScriptEventListenerMgr::AddListener(ScriptEventListener* pListener)
+ScriptEventListenerMgr::Handle ScriptEventListenerMgr::AddListener(ScriptEventListener* pListener)
 {
-	m_listeners.insert(pListener);
+	std::unique_ptr<ScriptEventListener> listener(pListener);
+	Handle listenerId = m_listeners.Insert(std::move(listener));
+	if (listenerId)
+		m_moduleListeners.Add(pListener->GetModule(), listenerId);
+	return listenerId;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
-// Destroys a listener
+// Destroys a listener, returns false for a handle that was removed already
 //---------------------------------------------------------------------------------------------------------------------
-void ScriptEventListenerMgr::DestroyListener(ScriptEventListener* pListener)
+bool ScriptEventListenerMgr::DestroyListener(Handle listenerId)
 {
-	ScriptEventListenerSet::iterator findIt = m_listeners.find(pListener);
-	if (findIt != m_listeners.end())
-	{
-		m_listeners.erase(findIt);
-		delete pListener;
-	}
-	else
-	{
-		errorstream<<("Couldn't find script listener in set; this will probably cause a memory leak");
-	}
+	std::unique_ptr<ScriptEventListener>* pListener = m_listeners.Get(listenerId);
+	if (!pListener)
+		return false;
+
+	m_moduleListeners.Remove((*pListener)->GetModule(), listenerId);
+	m_listeners.Remove(listenerId);  // the destructor will remove the listener from the event manager
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// Destroys the listeners whose callback was defined in the module, returns how many
+//---------------------------------------------------------------------------------------------------------------------
+unsigned int ScriptEventListenerMgr::DestroyModuleListeners(const std::string& moduleName)
+{
+	std::vector<uint32_t> handles = m_moduleListeners.TakeModule(moduleName);
+	for (auto it = handles.begin(); it != handles.end(); ++it)
+		m_listeners.Remove(*it);
+	return (unsigned int)handles.size();
 }
 
 
@@ -107,6 +155,7 @@ ScriptEventListener::ScriptEventListener(const EventType& eventType, const LuaPl
 :   m_scriptCallbackFunction(scriptCallbackFunction)
 {
     m_eventType = eventType;
+	m_module = ScriptModule::GetFunctionModule(scriptCallbackFunction);
 }
 
 ScriptEventListener::~ScriptEventListener(void)
@@ -135,7 +184,8 @@ bool InternalScriptExports::Init(void)
 	assert(s_pScriptEventListenerMgr == NULL);
 	s_pScriptEventListenerMgr = new ScriptEventListenerMgr;
 	
-	return true;
+	return ScriptEventBatcher::Create(LuaStateManager::Get()->GetLuaState()) &&
+		ScriptProfiler::Create(LuaStateManager::Get()->GetLuaState());
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -145,26 +195,31 @@ void InternalScriptExports::Destroy(void)
 {
 	assert(s_pScriptEventListenerMgr != NULL);
 	SAFE_DELETE(s_pScriptEventListenerMgr);
+	ScriptEventBatcher::Destroy();
+	ScriptProfiler::Destroy();
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 // Instantiates a C++ ScriptListener object, inserts it into the manager, and returns a handle to it.  The script 
 // should maintain the handle if it needs to remove the listener at some point.  Otherwise, the listener will be 
-// destroyed when the program exits.
+// destroyed when its module is unloaded or the program exits.
 //---------------------------------------------------------------------------------------------------------------------
 unsigned long InternalScriptExports::RegisterEventListener(EventType eventType, LuaPlus::LuaObject callbackFunction)
 {
+	SCRIPT_PROFILE_EXPORT("RegisterEventListener");
 	assert(s_pScriptEventListenerMgr);
 
 	if (callbackFunction.IsFunction())
 	{
 		// create the C++ listener proxy and set it to listen for the event
 		ScriptEventListener* pListener = new ScriptEventListener(eventType, callbackFunction);
-		s_pScriptEventListenerMgr->AddListener(pListener);
+		unsigned long handle = s_pScriptEventListenerMgr->AddListener(pListener);
+		if (!handle)
+		{
+			errorstream << "Too many script event listeners" << std::endl;
+			return 0;
+		}
 		IEventManager::Get()->VAddListener(pListener->GetDelegate(), eventType);
-		
-		// convert the pointer to an unsigned long to use as the handle
-		unsigned long handle = reinterpret_cast<unsigned long>(pListener);
 		return handle;
 	}
 
@@ -173,16 +228,13 @@ unsigned long InternalScriptExports::RegisterEventListener(EventType eventType,
 }
 
 //---------------------------------------------------------------------------------------------------------------------
-// Removes a script listener.
+// Removes a script listener.  Returns false if the handle is stale, e.g. removed twice.
 //---------------------------------------------------------------------------------------------------------------------
-void InternalScriptExports::RemoveEventListener(unsigned long listenerId)
+bool InternalScriptExports::RemoveEventListener(unsigned long listenerId)
 {
+	SCRIPT_PROFILE_EXPORT("RemoveEventListener");
 	assert(s_pScriptEventListenerMgr);
-	assert(listenerId != 0);
-	
-	// convert the listenerId back into a pointer
-	ScriptEventListener* pListener = reinterpret_cast<ScriptEventListener*>(listenerId);
-	s_pScriptEventListenerMgr->DestroyListener(pListener);  // the destructor will remove the listener
+	return s_pScriptEventListenerMgr->DestroyListener((ScriptEventListenerMgr::Handle)listenerId);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -190,6 +242,7 @@ void InternalScriptExports::RemoveEventListener(unsigned long listenerId)
 //---------------------------------------------------------------------------------------------------------------------
 bool InternalScriptExports::QueueEvent(EventType eventType, LuaPlus::LuaObject eventData)
 {
+	SCRIPT_PROFILE_EXPORT("QueueEvent");
 	std::shared_ptr<ScriptEvent> pEvent(BuildEvent(eventType, eventData));
     if (pEvent)
     {
@@ -204,6 +257,7 @@ bool InternalScriptExports::QueueEvent(EventType eventType, LuaPlus::LuaObject e
 //---------------------------------------------------------------------------------------------------------------------
 bool InternalScriptExports::TriggerEvent(EventType eventType, LuaPlus::LuaObject eventData)
 {
+	SCRIPT_PROFILE_EXPORT("TriggerEvent");
 	std::shared_ptr<ScriptEvent> pEvent(BuildEvent(eventType, eventData));
     if (pEvent)
 	    return IEventManager::Get()->VTriggerEvent(pEvent);
@@ -227,14 +281,255 @@ std::shared_ptr<ScriptEvent> InternalScriptExports::BuildEvent(EventType eventTy
 }
 
 
-int InternalScriptExports::CreateActor(const char* actorArchetype, LuaPlus::LuaObject luaPosition, LuaPlus::LuaObject luaYawPitchRoll)
+void InternalScriptExports::SetEventPriority(EventType eventType, int priority)
+{
+	if (priority < 0 || priority >= EVENTPRIORITY_COUNT)
+	{
+		errorstream << "SetEventPriority: invalid priority " << priority << std::endl;
+		return;
+	}
+
+	IEventManager::Get()->VSetEventPriority(eventType, (EventPriority)priority);
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Returns the statistics of the last event update as
+//   { timeUs = n, processed = { [EventPriority.X] = n, ... }, deferred = { ... },
+//     types = { [eventType] = { processed = n, deferred = n, timeUs = n }, ... } }
+//---------------------------------------------------------------------------------------------------------------------
+LuaPlus::LuaObject InternalScriptExports::GetEventStats(void)
+{
+	LuaPlus::LuaState* pState = LuaStateManager::Get()->GetLuaState();
+	const EventFrameStats& stats = IEventManager::Get()->VGetFrameStats();
+
+	LuaPlus::LuaObject result;
+	result.AssignNewTable(pState);
+	result.SetNumber("timeUs", stats.timeNs / 1000.0);
+
+	LuaPlus::LuaObject processed = result.CreateTable("processed", EVENTPRIORITY_COUNT);
+	LuaPlus::LuaObject deferred = result.CreateTable("deferred", EVENTPRIORITY_COUNT);
+	for (int priority = 0; priority < EVENTPRIORITY_COUNT; ++priority)
+	{
+		processed.SetInteger(priority, stats.processed[priority]);
+		deferred.SetInteger(priority, stats.deferred[priority]);
+	}
+
+	LuaPlus::LuaObject types = result.CreateTable("types");
+	for (auto it = stats.types.begin(); it != stats.types.end(); ++it)
+	{
+		if (!it->second.processed && !it->second.deferred)
+			continue;
+
+		LuaPlus::LuaObject key;
+		key.Assign(pState, (lua_Number)it->first);
+		LuaPlus::LuaObject typeStats = types.CreateTable(key);
+		typeStats.SetInteger("processed", it->second.processed);
+		typeStats.SetInteger("deferred", it->second.deferred);
+		typeStats.SetNumber("timeUs", it->second.timeNs / 1000.0);
+	}
+
+	return result;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Creates an actor from ActorArchetypes[actorArchetype] and returns its handle, 0 on failure.  luaPosition is a
+// table {x, y} (or {x = , y = }) and luaYawPitchRoll a number or a table whose first entry is the yaw; either may be
+// nil to keep the archetype's transform.
+//---------------------------------------------------------------------------------------------------------------------
+ActorId InternalScriptExports::CreateActor(const char* actorArchetype, LuaPlus::LuaObject luaPosition, LuaPlus::LuaObject luaYawPitchRoll)
+{
+	SCRIPT_PROFILE_EXPORT("CreateActor");
+	ActorManager* pActorManager = g_pApp->GetActorManager();
+	ActorId actorId = pActorManager->CreateActor(actorArchetype ? actorArchetype : "");
+	if (actorId == INVALID_ACTOR_ID)
+		return INVALID_ACTOR_ID;
+
+	if (!luaPosition.IsTable() && !luaYawPitchRoll.IsNumber() && !luaYawPitchRoll.IsTable())
+		return actorId;
+
+	ComponentManager& components = pActorManager->GetComponents();
+	TransformComponent* pTransform = components.GetComponent<TransformComponent>(actorId);
+	if (!pTransform)
+		pTransform = &components.AddComponent<TransformComponent>(actorId);
+
+	if (luaPosition.IsTable())
+	{
+		LuaPlus::LuaObject x = luaPosition.GetByName("x");
+		LuaPlus::LuaObject y = luaPosition.GetByName("y");
+		if (!x.IsNumber())
+			x = luaPosition.GetByIndex(1);
+		if (!y.IsNumber())
+			y = luaPosition.GetByIndex(2);
+		if (x.IsNumber() && y.IsNumber())
+			pTransform->position.Set(x.GetNumber(), y.GetNumber());
+	}
+
+	if (luaYawPitchRoll.IsNumber())
+		pTransform->yaw = luaYawPitchRoll.GetNumber();
+	else if (luaYawPitchRoll.IsTable() && luaYawPitchRoll.GetByIndex(1).IsNumber())
+		pTransform->yaw = luaYawPitchRoll.GetByIndex(1).GetNumber();
+
+	return actorId;
+}
+
+bool InternalScriptExports::DestroyActor(ActorId actorId)
+{
+	SCRIPT_PROFILE_EXPORT("DestroyActor");
+	return g_pApp->GetActorManager()->DestroyActor(actorId);
+}
+
+bool InternalScriptExports::IsActorAlive(ActorId actorId)
+{
+	SCRIPT_PROFILE_EXPORT("IsActorAlive");
+	return g_pApp->GetActorManager()->IsAlive(actorId);
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Runs a kernel registered with ScriptExports::RegisterParallelKernel over [0, count) on the job system and returns
+// once every subrange is done.  grain 0 splits the range into a few pieces per thread.
+//---------------------------------------------------------------------------------------------------------------------
+bool InternalScriptExports::RunParallel(const char* kernelName, unsigned int count, unsigned int grain)
+{
+	SCRIPT_PROFILE_EXPORT("RunParallel");
+	auto findIt = s_parallelKernels.find(kernelName ? kernelName : "");
+	if (findIt == s_parallelKernels.end())
+	{
+		errorstream << "RunParallel: unknown kernel " << (kernelName ? kernelName : "<nil>") << std::endl;
+		return false;
+	}
+
+	ScriptExports::ParallelKernel kernel = findIt->second;
+	JobSystem* pJobSystem = g_pApp->GetJobSystem();
+	if (!pJobSystem)
+	{
+		kernel(0, count);
+		return true;
+	}
+
+	if (grain == 0)
+		grain = (std::max)(count / ((pJobSystem->getNumWorkers() + 1) * 4), 1u);
+	pJobSystem->parallelFor(0, count, grain, [kernel](size_t begin, size_t end) { kernel(begin, end); });
+	return true;
+}
+
+LuaPlus::LuaObject InternalScriptExports::GetJobStats(void)
+{
+	LuaPlus::LuaObject result;
+	result.AssignNewTable(LuaStateManager::Get()->GetLuaState());
+
+	JobSystem* pJobSystem = g_pApp->GetJobSystem();
+	if (pJobSystem)
+	{
+		JobSystem::Stats stats = pJobSystem->getStats();
+		result.SetInteger("workers", pJobSystem->getNumWorkers());
+		result.SetNumber("executed", (lua_Number)stats.executed);
+		result.SetNumber("stolen", (lua_Number)stats.stolen);
+	}
+	return result;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Removes the event and batch listeners whose callbacks were defined in the module and forgets the module, so that
+// the next require() loads it again.  Returns the number of listeners removed.
+//---------------------------------------------------------------------------------------------------------------------
+int InternalScriptExports::UnloadModule(const char* moduleName)
+{
+	SCRIPT_PROFILE_EXPORT("UnloadModule");
+	if (!moduleName || !*moduleName)
+		return 0;
+
+	unsigned int removed = s_pScriptEventListenerMgr->DestroyModuleListeners(moduleName);
+	removed += ScriptEventBatcher::Get()->RemoveModuleListeners(moduleName);
+
+	LuaPlus::LuaObject loaded = LuaStateManager::Get()->GetGlobalVars().GetByName("package").GetByName("loaded");
+	if (loaded.IsTable())
+		loaded.SetNil(moduleName);
+
+	infostream << "Unloaded script module " << moduleName << ", " << removed << " listeners removed" << std::endl;
+	return (int)removed;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Returns the memory of the Lua state as
+//   { liveKB = n, peakKB = n, poolKB = n, poolAllocs = n, heapAllocs = n,
+//     subsystems = { [name] = { allocs = n, allocKB = n, freedKB = n }, ... },
+//     gc = { KB = n, thresholdKB = n, budgetUs = n, lastFrameUs = n, maxFrameUs = n, cycles = n, steps = n,
+//            catchUps = n, fullCollects = n, loading = b } }
+// The allocator entries are missing if the state kept its own allocator.
+//---------------------------------------------------------------------------------------------------------------------
+LuaPlus::LuaObject InternalScriptExports::GetLuaMemoryStats(void)
+{
+	LuaStateManager* pManager = LuaStateManager::Get();
+	LuaPlus::LuaObject result;
+	result.AssignNewTable(pManager->GetLuaState());
+
+	// read before the tables below are allocated
+	LuaAllocator* pAllocator = pManager->GetAllocator();
+	LuaMemoryStats stats = {};
+	std::vector<LuaSubsystemMemoryStats> subsystems;
+	if (pAllocator)
+	{
+		stats = pAllocator->GetStats();
+		subsystems = pAllocator->GetSubsystemStats();
+	}
+	LuaGarbageCollector* pCollector = pManager->GetGarbageCollector();
+	const LuaGCStats gcStats = pCollector->GetStats();
+	size_t bytes = pCollector->GetBytes();
+
+	if (pAllocator)
+	{
+		result.SetNumber("liveKB", stats.liveBytes / 1024.0);
+		result.SetNumber("peakKB", stats.peakBytes / 1024.0);
+		result.SetNumber("poolKB", stats.poolBytes / 1024.0);
+		result.SetNumber("poolAllocs", (lua_Number)stats.poolAllocs);
+		result.SetNumber("heapAllocs", (lua_Number)stats.heapAllocs);
+
+		LuaPlus::LuaObject subsystemTable = result.CreateTable("subsystems");
+		for (auto it = subsystems.begin(); it != subsystems.end(); ++it)
+		{
+			LuaPlus::LuaObject entry = subsystemTable.CreateTable(it->name);
+			entry.SetNumber("allocs", (lua_Number)it->allocs);
+			entry.SetNumber("allocKB", it->allocBytes / 1024.0);
+			entry.SetNumber("freedKB", it->freedBytes / 1024.0);
+		}
+	}
+
+	LuaPlus::LuaObject gc = result.CreateTable("gc");
+	gc.SetNumber("KB", bytes / 1024.0);
+	gc.SetNumber("thresholdKB", pCollector->GetThreshold() / 1024.0);
+	gc.SetInteger("budgetUs", pCollector->GetBudgetUs());
+	gc.SetNumber("lastFrameUs", gcStats.lastFrameNs / 1000.0);
+	gc.SetNumber("maxFrameUs", gcStats.maxFrameNs / 1000.0);
+	gc.SetNumber("cycles", (lua_Number)gcStats.cycles);
+	gc.SetNumber("steps", (lua_Number)gcStats.steps);
+	gc.SetNumber("catchUps", (lua_Number)gcStats.catchUps);
+	gc.SetNumber("fullCollects", (lua_Number)gcStats.fullCollects);
+	gc.SetBoolean("loading", pCollector->IsLoading());
+	return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// Gives the collector the loading budget while a loading screen is up.  The memory statistics are logged when it
+// goes down.
+//---------------------------------------------------------------------------------------------------------------------
+void InternalScriptExports::SetLoadingScreen(bool loading)
 {
-	return -1;
+	LuaGarbageCollector* pCollector = LuaStateManager::Get()->GetGarbageCollector();
+	bool wasLoading = pCollector->IsLoading();
+	pCollector->SetLoading(loading);
+	if (wasLoading && !loading)
+		LuaStateManager::Get()->LogMemoryStats();
 }
 
 
 void InternalScriptExports::LuaLog(LuaPlus::LuaObject text)
 {
+	SCRIPT_PROFILE_EXPORT("LuaLog");
     if (text.IsConvertibleToString())
     {
 		actionstream << "Lua:" << text.ToString();
@@ -263,12 +558,33 @@ void ScriptExports::Register(void)
 
 	// actors
 	globals.RegisterDirect("CreateActor", &InternalScriptExports::CreateActor);
+	globals.RegisterDirect("DestroyActor", &InternalScriptExports::DestroyActor);
+	globals.RegisterDirect("IsActorAlive", &InternalScriptExports::IsActorAlive);
 
 	// event system
 	globals.RegisterDirect("RegisterEventListener", &InternalScriptExports::RegisterEventListener);
 	globals.RegisterDirect("RemoveEventListener", &InternalScriptExports::RemoveEventListener);
 	globals.RegisterDirect("QueueEvent", &InternalScriptExports::QueueEvent);
 	globals.RegisterDirect("TriggerEvent", &InternalScriptExports::TriggerEvent);
+	globals.RegisterDirect("SetEventPriority", &InternalScriptExports::SetEventPriority);
+	globals.RegisterDirect("GetEventStats", &InternalScriptExports::GetEventStats);
+
+	// batched events: FireEvent, RegisterBatchListener, RemoveBatchListener
+	ScriptEventBatcher::Get()->RegisterScriptFunctions(globals);
+
+	// profiler: StartProfiler, StopProfiler, GetProfilerStats
+	ScriptProfiler::Get()->RegisterScriptFunctions(globals);
+
+	// modules
+	globals.RegisterDirect("UnloadModule", &InternalScriptExports::UnloadModule);
+
+	// memory
+	globals.RegisterDirect("GetLuaMemoryStats", &InternalScriptExports::GetLuaMemoryStats);
+	globals.RegisterDirect("SetLoadingScreen", &InternalScriptExports::SetLoadingScreen);
+
+	// jobs
+	globals.RegisterDirect("RunParallel", &InternalScriptExports::RunParallel);
+	globals.RegisterDirect("GetJobStats", &InternalScriptExports::GetJobStats);
 	
 	// misc
 	globals.RegisterDirect("Log", &InternalScriptExports::LuaLog);
@@ -276,6 +592,11 @@ void ScriptExports::Register(void)
 
 	globals.CreateTable("Event");
 	globals.CreateTable("EventType");
+
+	LuaPlus::LuaObject eventPriority = globals.CreateTable("EventPriority");
+	eventPriority.SetInteger("Critical", EVENTPRIORITY_CRITICAL);
+	eventPriority.SetInteger("Normal", EVENTPRIORITY_NORMAL);
+	eventPriority.SetInteger("Deferrable", EVENTPRIORITY_DEFERRABLE);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -286,3 +607,8 @@ void ScriptExports::Unregister(void)
 {
 	InternalScriptExports::Destroy();
 }
+
+void ScriptExports::RegisterParallelKernel(const char* name, ParallelKernel kernel)
+{
+	s_parallelKernels[name] = kernel;
+}
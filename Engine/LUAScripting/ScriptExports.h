@@ -1,8 +1,15 @@
 #pragma once
 
+#include <cstddef>
+
 namespace ScriptExports
 {
 	void Register(void);
 	void Unregister(void);
+
+	// Native loop body that scripts run across the job workers with RunParallel(name, count [, grain]).  It is called
+	// with subranges [begin, end) of [0, count) on any thread, so it must not touch the Lua state.
+	typedef void (*ParallelKernel)(size_t begin, size_t end);
+	void RegisterParallelKernel(const char* name, ParallelKernel kernel);
 }
 
@@ -0,0 +1,91 @@
+#include "ScriptModule.h"
+#include <algorithm>
+#include <cstring>
+
+//---------------------------------------------------------------------------------------------------------------------
+// The source of a function is "@path" for luaL_loadfile, the chunk name a loader such as the cocos one gave
+// luaL_loadbuffer (the path of the file), or the code itself for loadstring.
+//---------------------------------------------------------------------------------------------------------------------
+std::string ScriptModule::GetFunctionModule(const LuaPlus::LuaObject& function)
+{
+	if (!function.IsFunction())
+		return "";
+
+	lua_State* L = function.GetCState();
+	lua_Debug ar;
+	function.Push(L);
+	if (!lua_getinfo(L, ">S", &ar) || !ar.source || strcmp(ar.what, "C") == 0)
+		return "";
+
+	std::string path = ar.source[0] == '@' ? ar.source + 1 : ar.source;
+	size_t extension = path.rfind('.');
+	if (path.find('\n') != std::string::npos || extension == std::string::npos)
+		return "";
+	std::string suffix = path.substr(extension);
+	if (suffix != ".lua" && suffix != ".luac")
+		return "";
+	path.erase(extension);
+
+	std::replace(path.begin(), path.end(), '\\', '/');
+	while (path.compare(0, 2, "./") == 0)
+		path.erase(0, 2);
+	std::replace(path.begin(), path.end(), '/', '.');
+	return path;
+}
+
+static bool EndsWithModule(const std::string& name, const std::string& moduleName)
+{
+	if (name.size() < moduleName.size() || name.compare(name.size() - moduleName.size(), moduleName.size(), moduleName) != 0)
+		return false;
+	return name.size() == moduleName.size() || name[name.size() - moduleName.size() - 1] == '.';
+}
+
+bool ScriptModule::IsModule(const std::string& functionModule, const std::string& moduleName)
+{
+	if (moduleName.empty() || functionModule.empty())
+		return false;
+	if (EndsWithModule(functionModule, moduleName))
+		return true;
+
+	// require("a.b") also finds a/b/init.lua
+	const size_t initSize = 5;
+	return functionModule.size() > initSize &&
+		functionModule.compare(functionModule.size() - initSize, initSize, ".init") == 0 &&
+		EndsWithModule(functionModule.substr(0, functionModule.size() - initSize), moduleName);
+}
+
+
+void ScriptModuleListeners::Add(const std::string& functionModule, uint32_t handle)
+{
+	if (!functionModule.empty())
+		m_modules[functionModule].insert(handle);
+}
+
+void ScriptModuleListeners::Remove(const std::string& functionModule, uint32_t handle)
+{
+	auto findIt = m_modules.find(functionModule);
+	if (findIt == m_modules.end())
+		return;
+
+	findIt->second.erase(handle);
+	if (findIt->second.empty())
+		m_modules.erase(findIt);
+}
+
+std::vector<uint32_t> ScriptModuleListeners::TakeModule(const std::string& moduleName)
+{
+	std::vector<uint32_t> handles;
+	for (auto it = m_modules.begin(); it != m_modules.end();)
+	{
+		if (ScriptModule::IsModule(it->first, moduleName))
+		{
+			handles.insert(handles.end(), it->second.begin(), it->second.end());
+			it = m_modules.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	return handles;
+}
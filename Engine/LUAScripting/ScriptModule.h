@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "3rdParty/LuaPlus/LuaPlus.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+// Lua modules own the listeners whose callback function was defined in their file, so that UnloadModule() can remove
+// them all.  A module is named by the dotted path of its file without the extension: a function of
+// src/app/views/Unit.lua belongs to "src.app.views.Unit", which require("app.views.Unit") loaded.
+//---------------------------------------------------------------------------------------------------------------------
+namespace ScriptModule
+{
+	// Returns the module the function was defined in, "" for C functions and code not loaded from a file
+	std::string GetFunctionModule(const LuaPlus::LuaObject& function);
+
+	// True if functionModule is the module that require(moduleName) loads
+	bool IsModule(const std::string& functionModule, const std::string& moduleName);
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// The listener handles of each module.
+//---------------------------------------------------------------------------------------------------------------------
+class ScriptModuleListeners
+{
+	typedef std::unordered_map<std::string, std::unordered_set<uint32_t> > ModuleListenerMap;
+	ModuleListenerMap m_modules;
+
+public:
+	void Add(const std::string& functionModule, uint32_t handle);
+	void Remove(const std::string& functionModule, uint32_t handle);
+
+	// Forgets and returns the handles of the listeners of require(moduleName)
+	std::vector<uint32_t> TakeModule(const std::string& moduleName);
+
+	void Clear(void) { m_modules.clear(); }
+};
@@ -0,0 +1,495 @@
+#include "ScriptProfiler.h"
+#include "LuaJit.h"
+#include "log.h"
+#include "utils/macros.h"
+#include "utils/time_utils.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+
+ScriptProfiler* ScriptProfiler::s_pSingleton = NULL;
+ScriptProfiler* ScriptProfiler::s_pActive = NULL;
+std::vector<const char*> ScriptProfiler::s_exportNames;
+
+static std::mutex s_exportNamesMutex;
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// ExportScope
+//---------------------------------------------------------------------------------------------------------------------
+ScriptProfiler::ExportScope::ExportScope(unsigned int exportId)
+:   m_pProfiler(s_pActive)
+{
+	if (!m_pProfiler)
+		return;
+
+	// the Lua code before the export goes to the next sample, the export to no sample
+	m_exportId = exportId;
+	m_startNs = getTimeNs();
+	m_pProfiler->m_pendingLuaNs += m_startNs - m_pProfiler->m_lastSampleNs;
+	m_pProfiler->m_lastSampleNs = m_startNs;
+	m_luaNsAtStart = m_pProfiler->m_luaNs + m_pProfiler->m_pendingLuaNs;
+	m_exportNsAtStart = m_pProfiler->m_exportNs;
+}
+
+ScriptProfiler::ExportScope::~ExportScope(void)
+{
+	// stopped or restarted inside the export: nothing to compare with
+	if (!m_pProfiler || m_pProfiler != s_pActive)
+		return;
+
+	uint64_t now = getTimeNs();
+	m_pProfiler->EndExport(m_exportId, now - m_startNs,
+		m_pProfiler->m_luaNs + m_pProfiler->m_pendingLuaNs - m_luaNsAtStart,
+		m_pProfiler->m_exportNs - m_exportNsAtStart);
+	m_pProfiler->m_lastSampleNs = now;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Singleton functions
+//---------------------------------------------------------------------------------------------------------------------
+bool ScriptProfiler::Create(LuaPlus::LuaState* pLuaState)
+{
+	if (s_pSingleton)
+	{
+		errorstream << "Overwriting ScriptProfiler singleton" << std::endl;
+		SAFE_DELETE(s_pSingleton);
+	}
+
+	s_pSingleton = new ScriptProfiler(pLuaState);
+	return s_pSingleton != NULL;
+}
+
+void ScriptProfiler::Destroy(void)
+{
+	SAFE_DELETE(s_pSingleton);
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// ScriptProfiler
+//---------------------------------------------------------------------------------------------------------------------
+ScriptProfiler::ScriptProfiler(LuaPlus::LuaState* pLuaState)
+:   m_pLuaState(pLuaState)
+{
+	m_interval = kDefaultInterval;
+	Reset();
+}
+
+ScriptProfiler::~ScriptProfiler(void)
+{
+	Stop();
+}
+
+bool ScriptProfiler::Start(unsigned int instructionInterval)
+{
+	if (s_pActive && s_pActive != this)
+	{
+		errorstream << "ScriptProfiler: another profiler is running" << std::endl;
+		return false;
+	}
+
+	m_interval = (std::max)(instructionInterval, 1u);
+	m_lastSampleNs = getTimeNs();
+	m_pendingLuaNs = 0;
+	s_pActive = this;
+	lua_State* L = m_pLuaState->GetCState();
+#ifdef LUAJIT_VERSION
+	// count hooks do not fire inside compiled traces: sample the interpreter only
+	luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_FLUSH);
+	luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF);
+#endif
+	lua_sethook(L, &ScriptProfiler::Hook, LUA_MASKCOUNT, (int)m_interval);
+	return true;
+}
+
+void ScriptProfiler::Stop(void)
+{
+	if (!IsRunning())
+		return;
+
+	lua_State* L = m_pLuaState->GetCState();
+	lua_sethook(L, NULL, 0, 0);
+#ifdef LUAJIT_VERSION
+	luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_ON);
+#endif
+	s_pActive = NULL;
+}
+
+void ScriptProfiler::Reset(void)
+{
+	m_functions.clear();
+	m_functionIndices.clear();
+	m_children.clear();
+	m_lineNs.clear();
+	m_exports.clear();
+
+	m_nodes.clear();
+	StackNode root;
+	root.function = 0;
+	root.parent = 0;
+	root.selfNs = 0;
+	m_nodes.push_back(root);
+
+	m_lastSampleNs = getTimeNs();
+	m_numSamples = 0;
+	m_luaNs = 0;
+	m_exportNs = 0;
+	m_pendingLuaNs = 0;
+}
+
+
+unsigned int ScriptProfiler::RegisterExport(const char* name)
+{
+	std::lock_guard<std::mutex> lock(s_exportNamesMutex);
+	s_exportNames.push_back(name);
+	return (unsigned int)s_exportNames.size() - 1;
+}
+
+void ScriptProfiler::EndExport(unsigned int exportId, uint64_t elapsedNs, uint64_t luaNsInside, uint64_t exportNsInside)
+{
+	// the Lua code the export called back and the exports that code called are not the export's own time
+	uint64_t inside = luaNsInside + exportNsInside;
+	uint64_t selfNs = elapsedNs > inside ? elapsedNs - inside : 0;
+
+	if (m_exports.size() <= exportId)
+	{
+		std::lock_guard<std::mutex> lock(s_exportNamesMutex);
+		size_t first = m_exports.size();
+		m_exports.resize(s_exportNames.size());
+		for (size_t i = first; i < m_exports.size(); ++i)
+		{
+			m_exports[i].name = s_exportNames[i];
+			m_exports[i].calls = 0;
+			m_exports[i].selfNs = 0;
+		}
+	}
+
+	m_exports[exportId].calls++;
+	m_exports[exportId].selfNs += selfNs;
+	m_exportNs += selfNs;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// The count hook.  Lua calls it with the interrupted function innermost on the stack.
+//---------------------------------------------------------------------------------------------------------------------
+void ScriptProfiler::Hook(lua_State* L, lua_Debug* ar)
+{
+	if (s_pActive && ar->event == LUA_HOOKCOUNT)
+		s_pActive->Sample(L);
+}
+
+void ScriptProfiler::Sample(lua_State* L)
+{
+	// the exports since the last sample are not in the interval, see ExportScope
+	uint64_t now = getTimeNs();
+	uint64_t elapsed = m_pendingLuaNs + now - m_lastSampleNs;
+	m_lastSampleNs = now;
+	m_pendingLuaNs = 0;
+
+	unsigned int stack[kMaxDepth];
+	int depth = 0;
+	int line = -1;
+	lua_Debug frame;
+	while (depth < kMaxDepth && lua_getstack(L, depth, &frame))
+	{
+		// the current line only of the innermost frame
+		lua_getinfo(L, depth == 0 ? "Sl" : "S", &frame);
+		if (depth == 0)
+			line = frame.currentline;
+		stack[depth++] = GetFunction(L, frame);
+	}
+	if (!depth)
+		return;
+
+	m_numSamples++;
+	m_luaNs += elapsed;
+
+	// stack[0] is the innermost frame, the tree goes from the outermost
+	unsigned int node = 0;
+	for (int i = depth - 1; i >= 0; --i)
+	{
+		node = GetChild(node, stack[i]);
+
+		Function& function = m_functions[stack[i]];
+		if (function.lastSample != m_numSamples)
+		{
+			function.lastSample = m_numSamples;
+			function.totalNs += elapsed;
+		}
+	}
+	m_nodes[node].selfNs += elapsed;
+
+	Function& innermost = m_functions[stack[0]];
+	innermost.selfNs += elapsed;
+	innermost.samples++;
+	if (line >= 0)
+		m_lineNs[((uint64_t)stack[0] << 32) | (uint32_t)line] += elapsed;
+}
+
+unsigned int ScriptProfiler::GetFunction(lua_State* L, lua_Debug& frame)
+{
+	FunctionKey key;
+	key.source = frame.source;
+	key.lineDefined = frame.linedefined;
+	auto findIt = m_functionIndices.find(key);
+	if (findIt != m_functionIndices.end())
+		return findIt->second;
+
+	// named once, by the first call seen
+	lua_getinfo(L, "n", &frame);
+	Function function;
+	if (strcmp(frame.what, "C") == 0)
+		function.name = "[C]";
+	else if (strcmp(frame.what, "tail") == 0)
+		function.name = "[tail]";  // the callers a tail call replaced
+	else if (strcmp(frame.what, "main") == 0)
+		function.name = std::string("main@") + frame.short_src;
+	else
+		function.name = std::string(frame.name ? frame.name : "?") + "@" + frame.short_src + ":" + std::to_string(frame.linedefined);
+
+	// ';' separates the frames of a folded stack
+	std::replace(function.name.begin(), function.name.end(), ';', ':');
+	std::replace(function.name.begin(), function.name.end(), ' ', '_');
+	function.selfNs = 0;
+	function.totalNs = 0;
+	function.samples = 0;
+	function.lastSample = 0;
+
+	unsigned int index = (unsigned int)m_functions.size();
+	m_functions.push_back(function);
+	m_functionIndices[key] = index;
+	return index;
+}
+
+unsigned int ScriptProfiler::GetChild(unsigned int parent, unsigned int function)
+{
+	uint64_t key = ((uint64_t)parent << 32) | function;
+	auto findIt = m_children.find(key);
+	if (findIt != m_children.end())
+		return findIt->second;
+
+	StackNode node;
+	node.function = function;
+	node.parent = parent;
+	node.selfNs = 0;
+	unsigned int index = (unsigned int)m_nodes.size();
+	m_nodes.push_back(node);
+	m_children[key] = index;
+	return index;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Results
+//---------------------------------------------------------------------------------------------------------------------
+std::vector<ScriptProfiler::FunctionStats> ScriptProfiler::GetFunctionStats(void) const
+{
+	std::vector<FunctionStats> stats;
+	for (auto it = m_functions.begin(); it != m_functions.end(); ++it)
+	{
+		FunctionStats function;
+		function.name = it->name;
+		function.selfNs = it->selfNs;
+		function.totalNs = it->totalNs;
+		function.samples = it->samples;
+		stats.push_back(function);
+	}
+	std::stable_sort(stats.begin(), stats.end(),
+		[](const FunctionStats& left, const FunctionStats& right) { return left.selfNs > right.selfNs; });
+	return stats;
+}
+
+std::vector<ScriptProfiler::LineStats> ScriptProfiler::GetLineStats(void) const
+{
+	std::vector<LineStats> stats;
+	for (auto it = m_lineNs.begin(); it != m_lineNs.end(); ++it)
+	{
+		LineStats line;
+		line.function = (unsigned int)(it->first >> 32);
+		line.line = (int)(uint32_t)it->first;
+		line.selfNs = it->second;
+		stats.push_back(line);
+	}
+	std::sort(stats.begin(), stats.end(), [](const LineStats& left, const LineStats& right) {
+		if (left.selfNs != right.selfNs)
+			return left.selfNs > right.selfNs;
+		return left.function != right.function ? left.function < right.function : left.line < right.line;
+	});
+	return stats;
+}
+
+std::vector<ScriptProfiler::ExportStats> ScriptProfiler::GetExportStats(void) const
+{
+	std::vector<ExportStats> stats;
+	for (auto it = m_exports.begin(); it != m_exports.end(); ++it)
+	{
+		if (it->calls)
+			stats.push_back(*it);
+	}
+	std::sort(stats.begin(), stats.end(),
+		[](const ExportStats& left, const ExportStats& right) { return left.selfNs > right.selfNs; });
+	return stats;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// One line per stack with self time, in microseconds.  The exports are stacks of their own under "[C++]", since the
+// Lua stack they were called from is not sampled.
+//---------------------------------------------------------------------------------------------------------------------
+bool ScriptProfiler::WriteFoldedStacks(const std::string& path) const
+{
+	std::ofstream os(path.c_str(), std::ios::binary);
+	if (!os.good())
+	{
+		errorstream << "ScriptProfiler: cannot write " << path << std::endl;
+		return false;
+	}
+
+	std::vector<unsigned int> frames;
+	for (size_t node = 1; node < m_nodes.size(); ++node)
+	{
+		uint64_t us = m_nodes[node].selfNs / 1000;
+		if (!us)
+			continue;
+
+		frames.clear();
+		for (unsigned int index = (unsigned int)node; index != 0; index = m_nodes[index].parent)
+			frames.push_back(m_nodes[index].function);
+
+		for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+			os << (it == frames.rbegin() ? "" : ";") << m_functions[*it].name;
+		os << ' ' << us << '\n';
+	}
+
+	for (auto it = m_exports.begin(); it != m_exports.end(); ++it)
+	{
+		if (it->selfNs / 1000)
+			os << "[C++];" << it->name << ' ' << it->selfNs / 1000 << '\n';
+	}
+
+	return os.good();
+}
+
+void ScriptProfiler::LogReport(size_t maxEntries) const
+{
+	infostream << "ScriptProfiler: " << m_numSamples << " samples, Lua " << m_luaNs / 1000 << " us, exports "
+		<< m_exportNs / 1000 << " us" << std::endl;
+
+	std::vector<FunctionStats> functions = GetFunctionStats();
+	for (size_t i = 0; i < functions.size() && i < maxEntries; ++i)
+	{
+		infostream << "  self " << functions[i].selfNs / 1000 << " us, total " << functions[i].totalNs / 1000
+			<< " us: " << functions[i].name << std::endl;
+	}
+
+	std::vector<LineStats> lines = GetLineStats();
+	for (size_t i = 0; i < lines.size() && i < maxEntries; ++i)
+	{
+		infostream << "  line " << lines[i].line << " " << lines[i].selfNs / 1000 << " us: "
+			<< GetFunctionName(lines[i].function) << std::endl;
+	}
+
+	std::vector<ExportStats> exports = GetExportStats();
+	for (size_t i = 0; i < exports.size() && i < maxEntries; ++i)
+	{
+		infostream << "  export " << exports[i].name << " " << exports[i].selfNs / 1000 << " us, "
+			<< exports[i].calls << " calls" << std::endl;
+	}
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Script functions, bound to the profiler through their upvalue
+//---------------------------------------------------------------------------------------------------------------------
+void ScriptProfiler::RegisterScriptFunctions(LuaPlus::LuaObject table)
+{
+	lua_State* L = m_pLuaState->GetCState();
+	table.Push(L);
+
+	lua_pushlightuserdata(L, this);
+	lua_pushcclosure(L, &ScriptProfiler::LuaStartProfiler, 1);
+	lua_setfield(L, -2, "StartProfiler");
+
+	lua_pushlightuserdata(L, this);
+	lua_pushcclosure(L, &ScriptProfiler::LuaStopProfiler, 1);
+	lua_setfield(L, -2, "StopProfiler");
+
+	lua_pushlightuserdata(L, this);
+	lua_pushcclosure(L, &ScriptProfiler::LuaGetProfilerStats, 1);
+	lua_setfield(L, -2, "GetProfilerStats");
+
+	lua_pop(L, 1);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// StartProfiler([instructionInterval]) clears the last results and starts sampling
+//---------------------------------------------------------------------------------------------------------------------
+int ScriptProfiler::LuaStartProfiler(lua_State* L)
+{
+	ScriptProfiler* pProfiler = static_cast<ScriptProfiler*>(lua_touserdata(L, lua_upvalueindex(1)));
+	unsigned int interval = lua_isnumber(L, 1) ? (unsigned int)lua_tonumber(L, 1) : (unsigned int)kDefaultInterval;
+
+	pProfiler->Stop();
+	pProfiler->Reset();
+	lua_pushboolean(L, pProfiler->Start(interval));
+	return 1;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// StopProfiler([path]) stops sampling, logs the report and writes the folded stacks to path if given
+//---------------------------------------------------------------------------------------------------------------------
+int ScriptProfiler::LuaStopProfiler(lua_State* L)
+{
+	ScriptProfiler* pProfiler = static_cast<ScriptProfiler*>(lua_touserdata(L, lua_upvalueindex(1)));
+	pProfiler->Stop();
+	pProfiler->LogReport();
+
+	bool written = true;
+	if (lua_isstring(L, 1))
+		written = pProfiler->WriteFoldedStacks(lua_tostring(L, 1));
+	lua_pushboolean(L, written);
+	return 1;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// GetProfilerStats() returns { samples = n, luaUs = n, exportUs = n,
+//   functions = { { name = , selfUs = , totalUs = }, ... }, exports = { { name = , selfUs = , calls = }, ... } }
+// with the most expensive entries first
+//---------------------------------------------------------------------------------------------------------------------
+int ScriptProfiler::LuaGetProfilerStats(lua_State* L)
+{
+	ScriptProfiler* pProfiler = static_cast<ScriptProfiler*>(lua_touserdata(L, lua_upvalueindex(1)));
+
+	LuaPlus::LuaObject result;
+	result.AssignNewTable(L);
+	result.SetNumber("samples", (lua_Number)pProfiler->m_numSamples);
+	result.SetNumber("luaUs", pProfiler->m_luaNs / 1000.0);
+	result.SetNumber("exportUs", pProfiler->m_exportNs / 1000.0);
+
+	std::vector<FunctionStats> functions = pProfiler->GetFunctionStats();
+	LuaPlus::LuaObject functionTable = result.CreateTable("functions", (int)functions.size());
+	for (size_t i = 0; i < functions.size(); ++i)
+	{
+		LuaPlus::LuaObject entry = functionTable.CreateTable((int)i + 1);
+		entry.SetString("name", functions[i].name.c_str());
+		entry.SetNumber("selfUs", functions[i].selfNs / 1000.0);
+		entry.SetNumber("totalUs", functions[i].totalNs / 1000.0);
+	}
+
+	std::vector<ExportStats> exports = pProfiler->GetExportStats();
+	LuaPlus::LuaObject exportTable = result.CreateTable("exports", (int)exports.size());
+	for (size_t i = 0; i < exports.size(); ++i)
+	{
+		LuaPlus::LuaObject entry = exportTable.CreateTable((int)i + 1);
+		entry.SetString("name", exports[i].name);
+		entry.SetNumber("selfUs", exports[i].selfNs / 1000.0);
+		entry.SetNumber("calls", (lua_Number)exports[i].calls);
+	}
+
+	result.Push(L);
+	return 1;
+}
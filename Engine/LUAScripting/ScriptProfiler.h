@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "3rdParty/LuaPlus/LuaPlus.h"
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Sampling profiler of the Lua code.
+//
+// A count hook (lua_sethook with LUA_MASKCOUNT) takes a sample every few thousand VM instructions: the time since the
+// previous sample is charged to the Lua stack at that moment.  Samples are aggregated per call stack, per function
+// (self and total time) and per line of the innermost function.  Time spent inside C++ exports is measured by the
+// SCRIPT_PROFILE_EXPORT() scope at the start of the export and kept apart from the Lua time.
+//
+// On LuaJIT the count hook does not fire inside compiled traces, so the JIT is flushed and turned off while the
+// profiler runs and turned back on by Stop().  The times are those of the interpreter: hot loops weigh more than in a
+// JIT-compiled run, but they show up.
+//
+// WriteFoldedStacks() writes one "outer;...;inner microseconds" line per stack, the input of flamegraph.pl and
+// speedscope.  Started and stopped from Lua with StartProfiler([interval]) and StopProfiler([path]), or with the
+// lua_profiler setting.
+//---------------------------------------------------------------------------------------------------------------------
+class ScriptProfiler
+{
+public:
+	struct FunctionStats
+	{
+		std::string name;  // "function@file:line"
+		uint64_t selfNs;  // with the function innermost on the stack
+		uint64_t totalNs;  // with the function anywhere on the stack
+		uint64_t samples;
+	};
+
+	struct LineStats
+	{
+		unsigned int function;  // index into GetFunctionStats() before sorting, see GetFunctionName()
+		int line;
+		uint64_t selfNs;
+	};
+
+	struct ExportStats
+	{
+		const char* name;
+		uint64_t calls;
+		uint64_t selfNs;  // without the Lua code the export called back
+	};
+
+	// Measures the export while the active profiler runs; a branch otherwise
+	class ExportScope
+	{
+		ScriptProfiler* m_pProfiler;
+		unsigned int m_exportId;
+		uint64_t m_startNs;
+		uint64_t m_luaNsAtStart;
+		uint64_t m_exportNsAtStart;
+
+	public:
+		explicit ExportScope(unsigned int exportId);
+		~ExportScope(void);
+	};
+
+	enum eConstants
+	{
+		kDefaultInterval = 10000,  // VM instructions between samples
+		kMaxDepth = 64,  // frames walked per sample, outer frames are cut
+	};
+
+	// The profiler of the scripts, created with the script exports
+	static bool Create(LuaPlus::LuaState* pLuaState);
+	static void Destroy(void);
+	static ScriptProfiler* Get(void) { return s_pSingleton; }
+
+	explicit ScriptProfiler(LuaPlus::LuaState* pLuaState);
+	~ScriptProfiler(void);
+
+	// Only one profiler runs at a time.  Samples are added to those of earlier runs until Reset().
+	bool Start(unsigned int instructionInterval = kDefaultInterval);
+	void Stop(void);
+	bool IsRunning(void) const { return s_pActive == this; }
+	void Reset(void);
+
+	uint64_t GetNumSamples(void) const { return m_numSamples; }
+	uint64_t GetLuaNs(void) const { return m_luaNs; }
+	uint64_t GetExportNs(void) const { return m_exportNs; }
+
+	// Sorted by self time, the most expensive first
+	std::vector<FunctionStats> GetFunctionStats(void) const;
+	std::vector<LineStats> GetLineStats(void) const;
+	std::vector<ExportStats> GetExportStats(void) const;
+	const std::string& GetFunctionName(unsigned int function) const { return m_functions[function].name; }
+
+	bool WriteFoldedStacks(const std::string& path) const;
+	// Writes the most expensive functions, lines and exports to the info log
+	void LogReport(size_t maxEntries = 20) const;
+
+	// Adds StartProfiler, StopProfiler and GetProfilerStats to the table, bound to this profiler
+	void RegisterScriptFunctions(LuaPlus::LuaObject table);
+
+	// Called once per export by SCRIPT_PROFILE_EXPORT()
+	static unsigned int RegisterExport(const char* name);
+	static ScriptProfiler* GetActive(void) { return s_pActive; }
+
+private:
+	struct FunctionKey
+	{
+		const char* source;  // interned by Lua, the same pointer for all functions of a chunk
+		int lineDefined;
+
+		bool operator==(const FunctionKey& other) const { return source == other.source && lineDefined == other.lineDefined; }
+	};
+
+	struct FunctionKeyHash
+	{
+		size_t operator()(const FunctionKey& key) const { return std::hash<const void*>()(key.source) ^ ((size_t)key.lineDefined * 0x9e3779b9u); }
+	};
+
+	struct Function
+	{
+		std::string name;
+		uint64_t selfNs;
+		uint64_t totalNs;
+		uint64_t samples;
+		uint64_t lastSample;  // counts the function once per sample in recursion
+	};
+
+	// a call stack is a path from the root of the node tree
+	struct StackNode
+	{
+		unsigned int function;
+		unsigned int parent;
+		uint64_t selfNs;
+	};
+
+	static ScriptProfiler* s_pSingleton;
+	static ScriptProfiler* s_pActive;
+	static std::vector<const char*> s_exportNames;
+
+	LuaPlus::LuaState* m_pLuaState;
+	unsigned int m_interval;
+
+	std::vector<Function> m_functions;
+	std::unordered_map<FunctionKey, unsigned int, FunctionKeyHash> m_functionIndices;
+	std::vector<StackNode> m_nodes;  // m_nodes[0] is the root
+	std::unordered_map<uint64_t, unsigned int> m_children;  // parent << 32 | function -> node
+	std::unordered_map<uint64_t, uint64_t> m_lineNs;  // function << 32 | line -> self time
+	std::vector<ExportStats> m_exports;
+
+	uint64_t m_lastSampleNs;
+	uint64_t m_numSamples;
+	uint64_t m_luaNs;
+	uint64_t m_exportNs;
+	uint64_t m_pendingLuaNs;  // Lua time before the last export, for the next sample
+
+	static void Hook(lua_State* L, lua_Debug* ar);
+	void Sample(lua_State* L);
+	unsigned int GetFunction(lua_State* L, lua_Debug& frame);
+	unsigned int GetChild(unsigned int parent, unsigned int function);
+	void EndExport(unsigned int exportId, uint64_t elapsedNs, uint64_t luaNsInside, uint64_t exportNsInside);
+
+	static int LuaStartProfiler(lua_State* L);
+	static int LuaStopProfiler(lua_State* L);
+	static int LuaGetProfilerStats(lua_State* L);
+};
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Put at the start of a function exported to Lua to have its time reported apart from the Lua time.
+//---------------------------------------------------------------------------------------------------------------------
+#define SCRIPT_PROFILE_EXPORT(name) \
+	static const unsigned int s_scriptProfilerExportId = ScriptProfiler::RegisterExport(name); \
+	ScriptProfiler::ExportScope scriptProfilerExportScope(s_scriptProfilerExportId)
@@ -0,0 +1,589 @@
+#include "binary_log.h"
+#include "threading/mutex_auto_lock.h"
+#include "utils/time_utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+
+const char BinaryLog::MAGIC[8] = { 'T', 'W', 'B', 'L', 'O', 'G', '\0', '\0' };
+
+// initial file size and minimum growth step
+static const size_t BLOG_GROW_BYTES = 4 * 1024 * 1024;
+
+// record bytes a thread collects before they go to the file together
+static const size_t BLOG_BLOCK_SIZE = 64 * 1024;
+
+BinaryLog g_binary_log;
+
+struct BinaryLogThread {
+	std::mutex mutex;
+	uint32_t index;
+	uint64_t start_time;	// of the first record in data
+	uint64_t last_time;
+	size_t used;
+	uint64_t records;
+	char data[BLOG_BLOCK_SIZE];
+};
+
+// Buffer of the calling thread in the file of generation
+struct BinaryLogThreadRef {
+	uint32_t generation = 0;
+	std::shared_ptr<BinaryLogThread> thread;
+};
+
+static thread_local BinaryLogThreadRef t_blog_thread;
+
+// Serializes the fixed part of blocks
+class BlockWriter {
+public:
+	template <class T>
+	void put(const T &value)
+	{
+		const char *p = (const char *)&value;
+		m_data.insert(m_data.end(), p, p + sizeof(T));
+	}
+
+	void putString(const std::string &s)
+	{
+		char size[10];
+		char *end = size;
+		uint64_t value = s.size();
+		while (value >= 0x80) {
+			*end++ = (char)(value | 0x80);
+			value >>= 7;
+		}
+		*end++ = (char)value;
+		m_data.insert(m_data.end(), size, end);
+		m_data.insert(m_data.end(), s.begin(), s.end());
+	}
+
+	const char *data() const { return m_data.data(); }
+	size_t size() const { return m_data.size(); }
+
+private:
+	std::vector<char> m_data;
+};
+
+
+////
+//// BinaryLog
+////
+
+BinaryLog::BinaryLog() :
+	m_open(false),
+	m_max_level(LL_VERBOSE),
+	m_generation(0),
+	m_used(0),
+	m_next_site(1),
+	m_next_thread(0)
+{
+}
+
+BinaryLog::~BinaryLog()
+{
+	close();
+}
+
+bool BinaryLog::open(const std::string &path)
+{
+	close();
+
+	MutexAutoLock lock(m_file_mutex);
+	if (!m_file.openWrite(path, BLOG_GROW_BYTES)) {
+		errorstream << "BinaryLog: cannot create " << path << std::endl;
+		return false;
+	}
+
+	FileHeader header;
+	memcpy(header.magic, MAGIC, sizeof(header.magic));
+	header.version = VERSION;
+	header.reserved = 0;
+	header.data_size = 0;
+	header.start_time_ns = getTimeNs();
+	header.start_wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	memcpy(m_file.data(), &header, sizeof(header));
+
+	m_used = sizeof(header);
+	m_next_site = 1;
+	m_next_thread = 0;
+	m_generation++;
+	m_open.store(true);
+	return true;
+}
+
+void BinaryLog::close()
+{
+	if (!isOpen())
+		return;
+
+	m_open.store(false);
+	flush();
+
+	{
+		MutexAutoLock lock(m_threads_mutex);
+		m_threads.clear();
+	}
+
+	MutexAutoLock lock(m_file_mutex);
+	m_file.close(m_used);
+}
+
+void BinaryLog::flush()
+{
+	std::vector<std::shared_ptr<BinaryLogThread> > threads;
+	{
+		MutexAutoLock lock(m_threads_mutex);
+		threads = m_threads;
+	}
+
+	for (auto it = threads.begin(); it != threads.end(); ++it) {
+		MutexAutoLock lock((*it)->mutex);
+		flushThread(**it);
+	}
+
+	// forget the buffers of exited threads, they are empty now
+	MutexAutoLock lock(m_threads_mutex);
+	for (size_t i = 0; i < m_threads.size();) {
+		if (m_threads[i].use_count() == 1 && m_threads[i]->used == 0) {
+			m_threads[i] = m_threads.back();
+			m_threads.pop_back();
+		} else {
+			i++;
+		}
+	}
+}
+
+uint64_t BinaryLog::getRecordCount()
+{
+	MutexAutoLock lock(m_threads_mutex);
+	uint64_t records = 0;
+	for (auto it = m_threads.begin(); it != m_threads.end(); ++it) {
+		MutexAutoLock thread_lock((*it)->mutex);
+		records += (*it)->records;
+	}
+	return records;
+}
+
+uint64_t BinaryLog::getFileSize()
+{
+	MutexAutoLock lock(m_file_mutex);
+	return m_used;
+}
+
+uint32_t BinaryLog::registerSite(BinaryLogSite &site, const char *format,
+	const uint8_t *types, size_t argc)
+{
+	MutexAutoLock lock(m_file_mutex);
+	if (!isOpen())
+		return 0;
+
+	// another thread may have been first
+	uint32_t generation = m_generation.load(std::memory_order_relaxed);
+	if (site.generation.load(std::memory_order_relaxed) == generation)
+		return site.id.load(std::memory_order_relaxed);
+
+	uint32_t id = m_next_site++;
+	BlockWriter block;
+	block.put(id);
+	block.put((uint8_t)site.level);
+	block.put((uint8_t)argc);
+	for (size_t i = 0; i < argc; i++)
+		block.put(types[i]);
+	block.put((uint32_t)site.line);
+	block.putString(site.file);
+	block.putString(format);
+	if (!appendBlock(BLOCK_SITE, block.data(), block.size()))
+		return 0;
+
+	site.id.store(id, std::memory_order_relaxed);
+	site.generation.store(generation, std::memory_order_release);
+	return id;
+}
+
+BinaryLogThread *BinaryLog::getThread()
+{
+	BinaryLogThreadRef &ref = t_blog_thread;
+	uint32_t generation = m_generation.load(std::memory_order_relaxed);
+	if (ref.generation == generation && ref.thread)
+		return ref.thread.get();
+
+	std::shared_ptr<BinaryLogThread> thread = std::make_shared<BinaryLogThread>();
+	thread->used = 0;
+	thread->records = 0;
+	thread->start_time = 0;
+	thread->last_time = 0;
+
+	{
+		MutexAutoLock lock(m_file_mutex);
+		if (!isOpen())
+			return nullptr;
+		thread->index = m_next_thread++;
+
+		BlockWriter block;
+		block.put(thread->index);
+		block.putString(g_logger.getThreadName());
+		if (!appendBlock(BLOCK_THREAD, block.data(), block.size()))
+			return nullptr;
+	}
+
+	{
+		MutexAutoLock lock(m_threads_mutex);
+		m_threads.push_back(thread);
+	}
+	ref.generation = generation;
+	ref.thread = thread;
+	return thread.get();
+}
+
+char *BinaryLog::beginRecord(uint32_t id, size_t max_size)
+{
+	BinaryLogThread *thread = getThread();
+	if (!thread)
+		return nullptr;
+
+	// unlocked by endRecord
+	thread->mutex.lock();
+	if (thread->used + max_size > BLOG_BLOCK_SIZE)
+		flushThread(*thread);
+
+	uint64_t now = getTimeNs();
+	if (thread->used == 0) {
+		thread->start_time = now;
+		thread->last_time = now;
+	}
+	char *p = thread->data + thread->used;
+	p = writeVarint(p, id);
+	p = writeVarint(p, now - thread->last_time);
+	thread->last_time = now;
+	return p;
+}
+
+void BinaryLog::endRecord(char *end)
+{
+	BinaryLogThread *thread = t_blog_thread.thread.get();
+	thread->used = end - thread->data;
+	thread->records++;
+	thread->mutex.unlock();
+}
+
+// Called with the thread's mutex held
+void BinaryLog::flushThread(BinaryLogThread &thread)
+{
+	if (thread.used == 0)
+		return;
+
+	char prefix[sizeof(uint32_t) + sizeof(uint64_t)];
+	memcpy(prefix, &thread.index, sizeof(uint32_t));
+	memcpy(prefix + sizeof(uint32_t), &thread.start_time, sizeof(uint64_t));
+
+	MutexAutoLock lock(m_file_mutex);
+	appendBlock(BLOCK_RECORDS, prefix, sizeof(prefix), thread.data, thread.used);
+	thread.used = 0;
+}
+
+// Called with m_file_mutex held
+bool BinaryLog::appendBlock(BlockType type, const void *data1, size_t size1,
+	const void *data2, size_t size2)
+{
+	if (!m_file.isOpen())
+		return false;
+
+	size_t bytes = sizeof(BlockHeader) + size1 + size2;
+	if (m_used + bytes > m_file.size()) {
+		size_t new_size = (std::max)(m_file.size() * 2, m_used + bytes + BLOG_GROW_BYTES);
+		if (!m_file.resize(new_size)) {
+			m_open.store(false);
+			m_file.close(m_used);
+			errorstream << "BinaryLog: cannot grow the log file, logging stopped" << std::endl;
+			return false;
+		}
+	}
+
+	BlockHeader header;
+	header.type = type;
+	header.size = (uint32_t)(size1 + size2);
+
+	char *p = m_file.data() + m_used;
+	memcpy(p, &header, sizeof(header));
+	memcpy(p + sizeof(header), data1, size1);
+	if (size2)
+		memcpy(p + sizeof(header) + size1, data2, size2);
+	m_used += bytes;
+
+	// publish the block only once it is complete
+	FileHeader *file_header = reinterpret_cast<FileHeader *>(m_file.data());
+	file_header->data_size = m_used - sizeof(FileHeader);
+	return true;
+}
+
+
+////
+//// BinaryLogReader
+////
+
+// Bounds-checked reading from a block
+class BlockReader {
+public:
+	BlockReader(const char *data, size_t size) :
+		m_pos(data), m_end(data + size), m_ok(true)
+	{}
+
+	template <class T>
+	T get()
+	{
+		T value = T();
+		if (!take(sizeof(T)))
+			return value;
+		memcpy(&value, m_pos - sizeof(T), sizeof(T));
+		return value;
+	}
+
+	uint64_t getVarint()
+	{
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (!take(1))
+				return 0;
+			uint8_t byte = (uint8_t)m_pos[-1];
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return value;
+		}
+		m_ok = false;
+		return 0;
+	}
+
+	std::string getString()
+	{
+		size_t size = (size_t)getVarint();
+		if (!take(size))
+			return "";
+		return std::string(m_pos - size, size);
+	}
+
+	bool ok() const { return m_ok; }
+	bool atEnd() const { return m_pos >= m_end; }
+
+private:
+	bool take(size_t size)
+	{
+		if (!m_ok || (size_t)(m_end - m_pos) < size) {
+			m_ok = false;
+			return false;
+		}
+		m_pos += size;
+		return true;
+	}
+
+	const char *m_pos;
+	const char *m_end;
+	bool m_ok;
+};
+
+bool BinaryLogReader::fail(const std::string &error)
+{
+	m_error = error;
+	return false;
+}
+
+bool BinaryLogReader::load(const std::string &path)
+{
+	m_sites.clear();
+	m_threads.clear();
+	m_entries.clear();
+	m_error.clear();
+
+	MappedFile file;
+	if (!file.openRead(path))
+		return fail("cannot open " + path);
+
+	BinaryLog::FileHeader header;
+	if (file.size() < sizeof(header))
+		return fail(path + " is not a binary log");
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, BinaryLog::MAGIC, sizeof(header.magic)) != 0)
+		return fail(path + " is not a binary log");
+	if (header.version != BinaryLog::VERSION)
+		return fail(path + " has an unsupported version");
+
+	m_wall_offset_ns = header.start_wall_ns - (int64_t)header.start_time_ns;
+	size_t size = std::min<uint64_t>(header.data_size, file.size() - sizeof(header));
+	return readBlocks(file.data() + sizeof(header), size);
+}
+
+bool BinaryLogReader::readBlocks(const char *data, size_t size)
+{
+	size_t pos = 0;
+	while (size - pos >= sizeof(BinaryLog::BlockHeader)) {
+		BinaryLog::BlockHeader header;
+		memcpy(&header, data + pos, sizeof(header));
+		pos += sizeof(header);
+		if (header.size > size - pos)
+			return fail("block cut off");
+
+		const char *block = data + pos;
+		pos += header.size;
+
+		if (header.type == BinaryLog::BLOCK_SITE) {
+			BlockReader reader(block, header.size);
+			uint32_t id = reader.get<uint32_t>();
+			Site site;
+			site.known = true;
+			site.level = (LogLevel)std::min<uint8_t>(reader.get<uint8_t>(), LL_MAX - 1);
+			uint8_t argc = reader.get<uint8_t>();
+			for (uint8_t i = 0; i < argc; i++)
+				site.types.push_back(reader.get<uint8_t>());
+			site.line = (int)reader.get<uint32_t>();
+			site.file = reader.getString();
+			site.format = reader.getString();
+			if (!reader.ok())
+				return fail("bad site block");
+			if (id >= m_sites.size())
+				m_sites.resize(id + 1);
+			m_sites[id] = site;
+		} else if (header.type == BinaryLog::BLOCK_THREAD) {
+			BlockReader reader(block, header.size);
+			uint32_t index = reader.get<uint32_t>();
+			std::string name = reader.getString();
+			if (!reader.ok())
+				return fail("bad thread block");
+			if (index >= m_threads.size())
+				m_threads.resize(index + 1);
+			m_threads[index] = name;
+		} else if (header.type == BinaryLog::BLOCK_RECORDS) {
+			if (!readRecords(block, header.size))
+				return false;
+		}
+		// unknown blocks are skipped
+	}
+	return true;
+}
+
+// Replaces each {} in format by the next argument
+static void formatArgs(const std::string &format, const std::vector<std::string> &args,
+	std::string &text)
+{
+	text.clear();
+	size_t next = 0;
+	for (size_t i = 0; i < format.size(); i++) {
+		if (format[i] == '{' && i + 1 < format.size() && format[i + 1] == '}') {
+			text += next < args.size() ? args[next] : "{?}";
+			next++;
+			i++;
+		} else {
+			text += format[i];
+		}
+	}
+	// arguments without a {} are not lost
+	for (; next < args.size(); next++)
+		text += " " + args[next];
+}
+
+bool BinaryLogReader::readRecords(const char *data, size_t size)
+{
+	BlockReader reader(data, size);
+	uint32_t thread = reader.get<uint32_t>();
+	uint64_t time = reader.get<uint64_t>();
+	if (!reader.ok())
+		return fail("bad record block");
+
+	std::string thread_name;
+	if (thread < m_threads.size())
+		thread_name = m_threads[thread];
+	else
+		thread_name = "#" + std::to_string(thread);
+
+	std::vector<std::string> args;
+	while (!reader.atEnd()) {
+		uint64_t id = reader.getVarint();
+		time += reader.getVarint();
+		if (id >= m_sites.size() || !m_sites[id].known)
+			return fail("record of an unknown site");
+		const Site &site = m_sites[id];
+
+		args.clear();
+		for (size_t i = 0; i < site.types.size(); i++) {
+			std::ostringstream os;
+			switch (site.types[i]) {
+			case BLOG_ARG_BOOL:
+				os << (reader.get<uint8_t>() ? "true" : "false");
+				break;
+			case BLOG_ARG_CHAR:
+				os << reader.get<char>();
+				break;
+			case BLOG_ARG_INT: {
+				uint64_t v = reader.getVarint();
+				os << (int64_t)((v >> 1) ^ (~(v & 1) + 1));
+				break;
+			}
+			case BLOG_ARG_UINT:
+				os << reader.getVarint();
+				break;
+			case BLOG_ARG_FLOAT:
+				os << reader.get<float>();
+				break;
+			case BLOG_ARG_DOUBLE:
+				os << reader.get<double>();
+				break;
+			case BLOG_ARG_STRING:
+				os << reader.getString();
+				break;
+			default:
+				return fail("unknown argument type");
+			}
+			args.push_back(os.str());
+		}
+		if (!reader.ok())
+			return fail("record cut off");
+
+		Entry entry;
+		entry.time_ns = time;
+		entry.wall_ns = m_wall_offset_ns + (int64_t)time;
+		entry.level = site.level;
+		entry.thread_name = thread_name;
+		formatArgs(site.format, args, entry.text);
+		entry.file = site.file;
+		entry.line = site.line;
+		m_entries.push_back(entry);
+	}
+	return true;
+}
+
+void BinaryLogReader::sortByTime()
+{
+	// blocks of one thread are in order already
+	std::stable_sort(m_entries.begin(), m_entries.end(),
+		[](const Entry &a, const Entry &b) { return a.time_ns < b.time_ns; });
+}
+
+std::string BinaryLogReader::formatEntry(const Entry &entry)
+{
+	time_t seconds = (time_t)(entry.wall_ns / 1000000000);
+	int micros = (int)(entry.wall_ns % 1000000000 / 1000);
+	if (micros < 0) {
+		seconds--;
+		micros += 1000000;
+	}
+
+	struct tm tm;
+#ifdef _WIN32
+	localtime_s(&tm, &seconds);
+#else
+	localtime_r(&seconds, &tm);
+#endif
+	char timestamp[32];
+	size_t len = strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm);
+	snprintf(timestamp + len, sizeof(timestamp) - len, ".%06d", micros);
+
+	std::string line = timestamp;
+	line += ": ";
+	line += Logger::getLevelLabel(entry.level);
+	line += "[";
+	line += entry.thread_name;
+	line += "]: ";
+	line += entry.text;
+	return line;
+}
@@ -0,0 +1,314 @@
+#pragma once
+
+#include "log.h"
+#include "utils/mapped_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/*
+	Structured binary log.
+
+	BLOG(LL_INFO, "unit {} reached {},{}", id, x, y);
+
+	Every call site is registered once: its level, source location,
+	format and argument types go into the file the first time it is used.
+	After that a record is only the site id, the time since the previous
+	record of the thread and the raw argument values, appended to a buffer
+	of the calling thread. The text is put together by BinaryLogReader,
+	offline (see tools/binary_log_decode.cpp).
+
+	Arguments may be integers, bool, char, float, double, const char *
+	and std::string; each {} in the format is replaced by the next one.
+*/
+
+class BinaryLog;
+struct BinaryLogThread;
+
+enum BinaryLogArgType {
+	BLOG_ARG_BOOL,
+	BLOG_ARG_CHAR,
+	BLOG_ARG_INT,		// zigzag varint
+	BLOG_ARG_UINT,		// varint
+	BLOG_ARG_FLOAT,
+	BLOG_ARG_DOUBLE,
+	BLOG_ARG_STRING,	// varint length, bytes
+};
+
+// Strings longer than this are cut, so a record always fits a block
+const size_t BLOG_MAX_STRING = 1024;
+
+/*
+	A BLOG() call site. Constant-initialized, so the function-local statics
+	BLOG() declares cost nothing until they are first reached.
+*/
+class BinaryLogSite {
+public:
+	constexpr BinaryLogSite(LogLevel level, const char *file, int line) :
+		level(level), file(file), line(line), id(0), generation(0)
+	{}
+
+	const LogLevel level;
+	const char *const file;
+	const int line;
+
+private:
+	friend class BinaryLog;
+	std::atomic<uint32_t> id;			// in the file of generation
+	std::atomic<uint32_t> generation;
+};
+
+template <class T, class Enable = void>
+struct BinaryLogArg;
+
+template <> struct BinaryLogArg<bool> { enum { type = BLOG_ARG_BOOL }; };
+template <> struct BinaryLogArg<char> { enum { type = BLOG_ARG_CHAR }; };
+template <> struct BinaryLogArg<float> { enum { type = BLOG_ARG_FLOAT }; };
+template <> struct BinaryLogArg<double> { enum { type = BLOG_ARG_DOUBLE }; };
+template <> struct BinaryLogArg<const char *> { enum { type = BLOG_ARG_STRING }; };
+template <> struct BinaryLogArg<char *> { enum { type = BLOG_ARG_STRING }; };
+template <> struct BinaryLogArg<std::string> { enum { type = BLOG_ARG_STRING }; };
+
+template <class T>
+struct BinaryLogArg<T, typename std::enable_if<std::is_integral<T>::value &&
+		!std::is_same<T, bool>::value && !std::is_same<T, char>::value>::type>
+{
+	enum { type = std::is_signed<T>::value ? BLOG_ARG_INT : BLOG_ARG_UINT };
+};
+
+template <class T>
+struct BinaryLogArg<T, typename std::enable_if<std::is_enum<T>::value>::type>
+{
+	enum { type = BLOG_ARG_INT };
+};
+
+class BinaryLog {
+public:
+	BinaryLog();
+	~BinaryLog();
+
+	bool open(const std::string &path);
+	// Writes out the buffers of all threads and closes the file
+	void close();
+	bool isOpen() const { return m_open.load(std::memory_order_relaxed); }
+
+	// Records above this level are not written
+	void setMaxLevel(LogLevel lev) { m_max_level.store(lev, std::memory_order_relaxed); }
+	bool isEnabled(LogLevel lev) const
+	{
+		return isOpen() && lev <= m_max_level.load(std::memory_order_relaxed);
+	}
+
+	// Writes out the buffers of all threads
+	void flush();
+
+	// Use BLOG() rather than calling this directly
+	template <class... Args>
+	void log(BinaryLogSite &site, const char *format, const Args &... args)
+	{
+		uint32_t id;
+		if (site.generation.load(std::memory_order_acquire) == m_generation.load(std::memory_order_relaxed)) {
+			id = site.id.load(std::memory_order_relaxed);
+		} else {
+			// arrays decay, so string literals are strings
+			const uint8_t types[] = { (uint8_t)BinaryLogArg<typename std::decay<Args>::type>::type..., 0 };
+			id = registerSite(site, format, types, sizeof...(Args));
+			if (id == 0)
+				return;
+		}
+
+		size_t max_size = MAX_RECORD_HEADER + maxSize(args...);
+		char *p = beginRecord(id, max_size);
+		if (!p)
+			return;
+		p = writeArgs(p, args...);
+		endRecord(p);
+	}
+
+	// Records logged since open
+	uint64_t getRecordCount();
+	uint64_t getFileSize();
+
+	static const char MAGIC[8];
+	static const uint32_t VERSION = 1;
+
+	enum BlockType {
+		// strings are a varint length and the bytes
+		BLOCK_SITE = 1,		// u32 id, u8 level, u8 argc, argc types, u32 line, string file, string format
+		BLOCK_THREAD = 2,	// u32 index, string name
+		BLOCK_RECORDS = 3,	// u32 thread, u64 time of the first record, records
+	};
+
+	struct FileHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t reserved;
+		uint64_t data_size;		// bytes of complete blocks after the header
+		uint64_t start_time_ns;	// getTimeNs() at open
+		int64_t start_wall_ns;	// wall clock at open, ns since the Unix epoch
+	};
+
+	struct BlockHeader {
+		uint32_t type;
+		uint32_t size;			// bytes after this header
+	};
+
+	// site id and time delta, both varints
+	static const size_t MAX_RECORD_HEADER = 5 + 10;
+
+private:
+	uint32_t registerSite(BinaryLogSite &site, const char *format,
+		const uint8_t *types, size_t argc);
+	BinaryLogThread *getThread();
+	char *beginRecord(uint32_t id, size_t max_size);
+	void endRecord(char *end);
+	void flushThread(BinaryLogThread &thread);
+	bool appendBlock(BlockType type, const void *data1, size_t size1,
+		const void *data2 = nullptr, size_t size2 = 0);
+
+	// Argument encoding
+
+	static size_t maxSize() { return 0; }
+	template <class T, class... Rest>
+	static size_t maxSize(const T &value, const Rest &... rest)
+	{
+		return argMaxSize(value) + maxSize(rest...);
+	}
+
+	static size_t argMaxSize(bool) { return 1; }
+	static size_t argMaxSize(char) { return 1; }
+	static size_t argMaxSize(float) { return 4; }
+	static size_t argMaxSize(double) { return 8; }
+	static size_t argMaxSize(const char *s) { return 5 + (std::min)(strlen(s), BLOG_MAX_STRING); }
+	static size_t argMaxSize(const std::string &s) { return 5 + (std::min)(s.size(), BLOG_MAX_STRING); }
+	template <class T>
+	static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, size_t>::type
+	argMaxSize(const T &) { return 10; }
+
+	static char *writeArgs(char *p) { return p; }
+	template <class T, class... Rest>
+	static char *writeArgs(char *p, const T &value, const Rest &... rest)
+	{
+		return writeArgs(writeArg(p, value), rest...);
+	}
+
+	static char *writeVarint(char *p, uint64_t value)
+	{
+		while (value >= 0x80) {
+			*p++ = (char)(value | 0x80);
+			value >>= 7;
+		}
+		*p++ = (char)value;
+		return p;
+	}
+
+	static char *writeArg(char *p, bool value) { *p++ = value ? 1 : 0; return p; }
+	static char *writeArg(char *p, char value) { *p++ = value; return p; }
+	static char *writeArg(char *p, float value) { memcpy(p, &value, 4); return p + 4; }
+	static char *writeArg(char *p, double value) { memcpy(p, &value, 8); return p + 8; }
+	static char *writeArg(char *p, const char *s) { return writeString(p, s, strlen(s)); }
+	static char *writeArg(char *p, const std::string &s) { return writeString(p, s.data(), s.size()); }
+
+	template <class T>
+	static typename std::enable_if<std::is_signed<T>::value || std::is_enum<T>::value, char *>::type
+	writeArg(char *p, const T &value)
+	{
+		int64_t v = (int64_t)value;
+		return writeVarint(p, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+	}
+
+	template <class T>
+	static typename std::enable_if<std::is_unsigned<T>::value, char *>::type
+	writeArg(char *p, const T &value)
+	{
+		return writeVarint(p, (uint64_t)value);
+	}
+
+	static char *writeString(char *p, const char *s, size_t size)
+	{
+		size = (std::min)(size, BLOG_MAX_STRING);
+		p = writeVarint(p, size);
+		memcpy(p, s, size);
+		return p + size;
+	}
+
+	std::atomic<bool> m_open;
+	std::atomic<int> m_max_level;
+	// bumped by every open, sites and threads of older files register again
+	std::atomic<uint32_t> m_generation;
+
+	std::mutex m_file_mutex;
+	MappedFile m_file;
+	size_t m_used;
+	uint32_t m_next_site;
+	uint32_t m_next_thread;
+
+	std::mutex m_threads_mutex;
+	std::vector<std::shared_ptr<BinaryLogThread> > m_threads;
+};
+
+extern BinaryLog g_binary_log;
+
+#define BLOG(lev, ...) do {                                               \
+	static BinaryLogSite blog_site_(lev, __FILE__, __LINE__);             \
+	if (LOG_LEVEL_COMPILED(lev) && g_binary_log.isEnabled(lev))           \
+		g_binary_log.log(blog_site_, __VA_ARGS__);                        \
+} while (0)
+
+
+/*
+	Reads a binary log back. Records come in the order their thread
+	buffers were written; sortByTime() puts them in the order they were
+	logged.
+*/
+class BinaryLogReader {
+public:
+	struct Entry {
+		uint64_t time_ns;		// getTimeNs() of the writing process
+		int64_t wall_ns;		// wall clock, ns since the Unix epoch
+		LogLevel level;
+		std::string thread_name;
+		std::string text;
+		std::string file;
+		int line;
+	};
+
+	// Returns false if path is not a binary log; a log cut off in the
+	// middle of a block is read up to the last complete block.
+	bool load(const std::string &path);
+
+	const std::vector<Entry> &getEntries() const { return m_entries; }
+	const std::string &getError() const { return m_error; }
+
+	void sortByTime();
+
+	// "2024-01-02 03:04:05.678901: INFO[Main]: text", like the text log
+	static std::string formatEntry(const Entry &entry);
+
+private:
+	struct Site {
+		bool known = false;
+		LogLevel level;
+		std::vector<uint8_t> types;
+		int line;
+		std::string file;
+		std::string format;
+	};
+
+	bool fail(const std::string &error);
+	bool readBlocks(const char *data, size_t size);
+	bool readRecords(const char *data, size_t size);
+
+	int64_t m_wall_offset_ns;
+	std::vector<Site> m_sites;
+	std::vector<std::string> m_threads;
+	std::vector<Entry> m_entries;
+	std::string m_error;
+};
@@ -1,16 +1,89 @@
 #include "componentmanager.h"
-#include "debug.h"
+
+#include <algorithm>
+#include <atomic>
+
+uint32_t IComponentPool::NextTypeIndex(void)
+{
+	static std::atomic<uint32_t> s_nextIndex(0);
+	return s_nextIndex++;
+}
+
+bool ComponentAccess::Contains(const std::vector<uint32_t>& types, uint32_t type)
+{
+	return std::find(types.begin(), types.end(), type) != types.end();
+}
+
+bool ComponentAccess::Intersects(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+{
+	for (auto iter = a.begin(); iter != a.end(); iter++)
+	{
+		if (Contains(b, *iter))
+			return true;
+	}
+	return false;
+}
+
+bool ComponentAccess::ConflictsWith(const ComponentAccess& other) const
+{
+	return m_exclusive || other.m_exclusive
+		|| Intersects(m_writes, other.m_writes)
+		|| Intersects(m_writes, other.m_reads)
+		|| Intersects(m_reads, other.m_writes);
+}
 
 void ComponentManager::update(float dt)
 {
-	for (auto iter = m_components.begin();iter != m_components.end();iter++)
+	if (m_pJobSystem)
 	{
-		iter->second->VUpdate(dt);
+		if (m_graphDirty)
+			BuildGraph();
+
+		m_deltaMs = dt;
+		m_graph.run(m_pJobSystem);
+		return;
 	}
+
+	for (auto iter = m_systems.begin(); iter != m_systems.end(); iter++)
+	{
+		(*iter)->VUpdate(*this, dt);
+	}
+}
+
+bool ComponentManager::SystemsConflict(size_t before, size_t after)
+{
+	if (m_graphDirty)
+		BuildGraph();
+	return m_graph.hasDependency(before, after);
 }
 
-void ComponentManager::AddComponent(StrongActorComponentPtr pComponent)
+void ComponentManager::BuildGraph(void)
 {
-	std::pair<ActorComponents::iterator, bool> success = m_components.insert(std::make_pair(pComponent->VGetId(), pComponent));
-	SANITY_CHECK(success.second);
+	// collecting the accesses also creates every pool the systems use
+	std::vector<ComponentAccess> access(m_systems.size(), ComponentAccess(this));
+	for (size_t i = 0; i < m_systems.size(); i++)
+		m_systems[i]->VGetAccess(access[i]);
+
+	m_graph.clear();
+	for (size_t i = 0; i < m_systems.size(); i++)
+	{
+		ComponentSystem* pSystem = m_systems[i].get();
+		m_graph.addJob([this, pSystem]() { pSystem->VUpdate(*this, m_deltaMs); });
+
+		for (size_t before = 0; before < i; before++)
+		{
+			if (access[before].ConflictsWith(access[i]))
+				m_graph.addDependency(before, i);
+		}
+	}
+	m_graphDirty = false;
+}
+
+void ComponentManager::RemoveActor(ActorId id)
+{
+	for (auto iter = m_pools.begin(); iter != m_pools.end(); iter++)
+	{
+		if (*iter)
+			(*iter)->VRemove(id);
+	}
 }
@@ -1,56 +1,197 @@
 #pragma once
 
-#include <map>
+#include <vector>
 #include <memory>
-#include "component.h"
+#include "componentpool.h"
+#include "threading/job_graph.h"
 
+class ComponentManager;
+class JobSystem;
+
+//---------------------------------------------------------------------------------------------------------------------
+// Component types a system reads and writes.  Two systems conflict when one writes a type the other reads or writes;
+// conflicting systems run in the order they were added, all others may run at the same time on different threads.
+//---------------------------------------------------------------------------------------------------------------------
+class ComponentAccess
+{
+	ComponentManager* m_pComponents;
+	std::vector<uint32_t> m_reads;
+	std::vector<uint32_t> m_writes;
+	bool m_exclusive;
+
+public:
+	explicit ComponentAccess(ComponentManager* pComponents) : m_pComponents(pComponents), m_exclusive(false) { }
+
+	template <class ComponentType>
+	ComponentAccess& Read(void);
+
+	template <class ComponentType>
+	ComponentAccess& Write(void);
+
+	// The system uses state other than its declared components and is ordered against every other system.
+	ComponentAccess& Exclusive(void) { m_exclusive = true; return *this; }
+
+	bool ConflictsWith(const ComponentAccess& other) const;
+
+private:
+	static bool Contains(const std::vector<uint32_t>& types, uint32_t type);
+	static bool Intersects(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b);
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+// Batch update over the components of one or more types, run once per frame by ComponentManager::update.
+//---------------------------------------------------------------------------------------------------------------------
+class ComponentSystem
+{
+public:
+	virtual ~ComponentSystem(void) { }
+	virtual void VUpdate(ComponentManager& components, float deltaMs) = 0;
+
+	// Declares the components the system touches.  A system may only add or remove components of types it writes.
+	// The default runs the system alone.
+	virtual void VGetAccess(ComponentAccess& access) const { access.Exclusive(); }
+};
+
+// System calling a function with the whole pool of one component type.
+template <class ComponentType>
+class ComponentBatchSystem : public ComponentSystem
+{
+public:
+	typedef void (*BatchFunction)(ComponentPool<ComponentType>& pool, float deltaMs);
+
+	explicit ComponentBatchSystem(BatchFunction function) : m_function(function) { }
+
+	virtual void VUpdate(ComponentManager& components, float deltaMs);
+	virtual void VGetAccess(ComponentAccess& access) const { access.Write<ComponentType>(); }
+
+private:
+	BatchFunction m_function;
+};
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Component storage for all actors.
+//
+// Components are plain data: every type lives in its own ComponentPool (a sparse set indexed by ActorId) and is
+// processed by systems that walk the dense arrays, instead of a map of virtual components per actor.
+//
+// With a JobSystem, update() runs the systems as a job graph built from their declared ComponentAccess, so systems
+// working on different components update in parallel; without one they run on the calling thread in the order they
+// were added.
+//---------------------------------------------------------------------------------------------------------------------
 class ComponentManager
 {
-	typedef std::map<ComponentId, StrongActorComponentPtr> ActorComponents;
+	std::vector<std::unique_ptr<IComponentPool> > m_pools;  // indexed by IComponentPool::GetTypeIndex
+	std::vector<std::unique_ptr<ComponentSystem> > m_systems;
+
+	JobSystem* m_pJobSystem;
+	JobGraph m_graph;
+	bool m_graphDirty;
+	float m_deltaMs;	// of the update in progress, read by the graph's jobs
 
 public:
+	ComponentManager(void) : m_pJobSystem(nullptr), m_graphDirty(true), m_deltaMs(0) { }
 
 	void update(float dt);
 
+	// Not owned.  Null runs the systems serially.
+	void SetJobSystem(JobSystem* pJobSystem) { m_pJobSystem = pJobSystem; }
+	JobSystem* GetJobSystem(void) const { return m_pJobSystem; }
+
+	// Whether the system added as index after must wait for the one added as index before, see ComponentAccess.
+	bool SystemsConflict(size_t before, size_t after);
+
 	template <class ComponentType>
-	std::weak_ptr<ComponentType> GetComponent(ComponentId id)
-	{
-		ActorComponents::iterator findIt = m_components.find(id);
-		if (findIt != m_components.end())
-		{
-			StrongActorComponentPtr pBase(findIt->second);
-			shared_ptr<ComponentType> pSub(static_pointer_cast<ComponentType>(pBase));  // cast to subclass version of the pointer
-			weak_ptr<ComponentType> pWeakSub(pSub);  // convert strong pointer to weak pointer
-			return pWeakSub;  // return the weak pointer
-		}
-		else
-		{
-			return weak_ptr<ComponentType>();
-		}
+	ComponentPool<ComponentType>& GetPool(void)
+	{
+		uint32_t index = IComponentPool::GetTypeIndex<ComponentType>();
+		if (index >= m_pools.size())
+			m_pools.resize(index + 1);
+		if (!m_pools[index])
+			m_pools[index].reset(new ComponentPool<ComponentType>);
+		return static_cast<ComponentPool<ComponentType>&>(*m_pools[index]);
+	}
+
+	template <class ComponentType, class... Args>
+	ComponentType& AddComponent(ActorId id, Args&&... args)
+	{
+		return GetPool<ComponentType>().Add(id, std::forward<Args>(args)...);
+	}
+
+	template <class ComponentType>
+	bool RemoveComponent(ActorId id)
+	{
+		return GetPool<ComponentType>().VRemove(id);
 	}
 
+	// Compatibility accessor.  The pointer is only valid until a component of the same type is added or removed;
+	// keep the ActorId instead of the pointer across frames.
 	template <class ComponentType>
-	std::weak_ptr<ComponentType> GetComponent(const char *name)
+	ComponentType* GetComponent(ActorId id)
+	{
+		uint32_t index = IComponentPool::GetTypeIndex<ComponentType>();
+		if (index >= m_pools.size() || !m_pools[index])
+			return nullptr;
+		return static_cast<ComponentPool<ComponentType>&>(*m_pools[index]).Get(id);
+	}
+
+	template <class ComponentType>
+	bool HasComponent(ActorId id) const
+	{
+		uint32_t index = IComponentPool::GetTypeIndex<ComponentType>();
+		return index < m_pools.size() && m_pools[index] && m_pools[index]->VHas(id);
+	}
+
+	// Calls function(ActorId, ComponentType&) for every component of the type.
+	template <class ComponentType, class Function>
+	void ForEach(Function function)
 	{
-		ComponentId id = ActorComponent::GetIdFromName(name);
-		ActorComponents::iterator findIt = m_components.find(id);
-		if (findIt != m_components.end())
-		{
-			StrongActorComponentPtr pBase(findIt->second);
-			shared_ptr<ComponentType> pSub(static_pointer_cast<ComponentType>(pBase));  // cast to subclass version of the pointer
-			weak_ptr<ComponentType> pWeakSub(pSub);  // convert strong pointer to weak pointer
-			return pWeakSub;  // return the weak pointer
-		}
-		else
-		{
-			return weak_ptr<ComponentType>();
-		}
+		ComponentPool<ComponentType>& pool = GetPool<ComponentType>();
+		ComponentType* pComponents = pool.Data();
+		const ActorId* pActors = pool.Actors();
+		for (size_t i = 0, count = pool.Size(); i < count; ++i)
+			function(pActors[i], pComponents[i]);
 	}
 
-	const ActorComponents* GetComponents() { return &m_components; }
+	// Removes every component of the actor.
+	void RemoveActor(ActorId id);
+
+	void AddSystem(std::unique_ptr<ComponentSystem> pSystem)
+	{
+		m_systems.push_back(std::move(pSystem));
+		m_graphDirty = true;
+	}
 
-	void AddComponent(StrongActorComponentPtr pComponent);
+	template <class ComponentType>
+	void AddBatchUpdate(typename ComponentBatchSystem<ComponentType>::BatchFunction function)
+	{
+		AddSystem(std::unique_ptr<ComponentSystem>(new ComponentBatchSystem<ComponentType>(function)));
+	}
 
 private:
-	ActorComponents m_components;
-};
\ No newline at end of file
+	void BuildGraph(void);
+};
+
+
+template <class ComponentType>
+ComponentAccess& ComponentAccess::Read(void)
+{
+	// systems may run on other threads, so their pools have to exist before
+	m_pComponents->GetPool<ComponentType>();
+	m_reads.push_back(IComponentPool::GetTypeIndex<ComponentType>());
+	return *this;
+}
+
+template <class ComponentType>
+ComponentAccess& ComponentAccess::Write(void)
+{
+	m_pComponents->GetPool<ComponentType>();
+	m_writes.push_back(IComponentPool::GetTypeIndex<ComponentType>());
+	return *this;
+}
+
+template <class ComponentType>
+void ComponentBatchSystem<ComponentType>::VUpdate(ComponentManager& components, float deltaMs)
+{
+	m_function(components.GetPool<ComponentType>(), deltaMs);
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <utility>
+#include <cstdint>
+#include "interfaces.h"
+
+// Entries per page of the sparse actor index.  Pages are allocated on first use, so sparse or high actor indices
+// cost one page each instead of a table sized by the largest index.
+const uint32_t COMPONENTPOOL_PAGE_SIZE = 1024;
+
+//---------------------------------------------------------------------------------------------------------------------
+// Type-erased part of a component pool, used by ComponentManager for whole-actor operations.
+//---------------------------------------------------------------------------------------------------------------------
+class IComponentPool
+{
+public:
+	virtual ~IComponentPool(void) { }
+
+	virtual bool VHas(ActorId id) const = 0;
+	virtual bool VRemove(ActorId id) = 0;
+	virtual size_t VSize(void) const = 0;
+	virtual void VClear(void) = 0;
+
+	// Small consecutive index per component type, assigned on first use.
+	template <class ComponentType>
+	static uint32_t GetTypeIndex(void)
+	{
+		static const uint32_t s_index = NextTypeIndex();
+		return s_index;
+	}
+
+private:
+	static uint32_t NextTypeIndex(void);
+};
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Sparse set of components of one type.
+//
+// The components are kept packed in a dense array, in step with a dense array of their owners, and a paged sparse
+// array maps the slot index of an actor handle (see ActorIndex) to its dense slot.  Systems iterate the dense arrays
+// directly; lookups by actor are two array reads plus a check of the stored owner, so a handle of an earlier
+// generation of the same slot does not see the current owner's component.  Removal moves the last component into
+// the freed slot, so pointers and dense indices are only stable until the next add or remove on the same pool.
+//---------------------------------------------------------------------------------------------------------------------
+template <class ComponentType>
+class ComponentPool : public IComponentPool
+{
+	enum eConstants { kInvalidSlot = 0xffffffff };
+
+	std::vector<std::unique_ptr<uint32_t[]> > m_sparse;
+	std::vector<ActorId> m_actors;
+	std::vector<ComponentType> m_components;
+
+public:
+	template <class... Args>
+	ComponentType& Add(ActorId id, Args&&... args)
+	{
+		uint32_t& slot = SparseSlot(id);
+		if (slot != kInvalidSlot)
+		{
+			// replace the existing component, or the one left behind by an earlier generation of the slot
+			m_actors[slot] = id;
+			m_components[slot] = ComponentType(std::forward<Args>(args)...);
+			return m_components[slot];
+		}
+
+		slot = (uint32_t)m_components.size();
+		m_actors.push_back(id);
+		m_components.emplace_back(std::forward<Args>(args)...);
+		return m_components.back();
+	}
+
+	ComponentType* Get(ActorId id)
+	{
+		uint32_t slot = FindSlot(id);
+		return (slot != kInvalidSlot) ? &m_components[slot] : nullptr;
+	}
+
+	const ComponentType* Get(ActorId id) const
+	{
+		uint32_t slot = FindSlot(id);
+		return (slot != kInvalidSlot) ? &m_components[slot] : nullptr;
+	}
+
+	virtual bool VHas(ActorId id) const { return FindSlot(id) != kInvalidSlot; }
+
+	virtual bool VRemove(ActorId id)
+	{
+		uint32_t slot = FindSlot(id);
+		if (slot == kInvalidSlot)
+			return false;
+
+		// move the last component into the hole
+		uint32_t last = (uint32_t)m_components.size() - 1;
+		if (slot != last)
+		{
+			m_components[slot] = std::move(m_components[last]);
+			m_actors[slot] = m_actors[last];
+			SparseSlot(m_actors[slot]) = slot;
+		}
+		m_components.pop_back();
+		m_actors.pop_back();
+		SparseSlot(id) = kInvalidSlot;
+		return true;
+	}
+
+	virtual size_t VSize(void) const { return m_components.size(); }
+
+	virtual void VClear(void)
+	{
+		m_sparse.clear();
+		m_actors.clear();
+		m_components.clear();
+	}
+
+	void Reserve(size_t count)
+	{
+		m_actors.reserve(count);
+		m_components.reserve(count);
+	}
+
+	// Dense arrays, Size() entries each; entry i of Data() belongs to entry i of Actors().
+	ComponentType* Data(void) { return m_components.data(); }
+	const ComponentType* Data(void) const { return m_components.data(); }
+	const ActorId* Actors(void) const { return m_actors.data(); }
+	size_t Size(void) const { return m_components.size(); }
+
+	typename std::vector<ComponentType>::iterator begin(void) { return m_components.begin(); }
+	typename std::vector<ComponentType>::iterator end(void) { return m_components.end(); }
+	typename std::vector<ComponentType>::const_iterator begin(void) const { return m_components.begin(); }
+	typename std::vector<ComponentType>::const_iterator end(void) const { return m_components.end(); }
+
+private:
+	uint32_t FindSlot(ActorId id) const
+	{
+		uint32_t index = ActorIndex(id);
+		uint32_t page = index / COMPONENTPOOL_PAGE_SIZE;
+		if (page >= m_sparse.size() || !m_sparse[page])
+			return kInvalidSlot;
+		uint32_t slot = m_sparse[page][index % COMPONENTPOOL_PAGE_SIZE];
+		return (slot != kInvalidSlot && m_actors[slot] == id) ? slot : kInvalidSlot;
+	}
+
+	uint32_t& SparseSlot(ActorId id)
+	{
+		uint32_t index = ActorIndex(id);
+		uint32_t page = index / COMPONENTPOOL_PAGE_SIZE;
+		if (page >= m_sparse.size())
+			m_sparse.resize(page + 1);
+
+		if (!m_sparse[page])
+		{
+			m_sparse[page].reset(new uint32_t[COMPONENTPOOL_PAGE_SIZE]);
+			for (uint32_t i = 0; i < COMPONENTPOOL_PAGE_SIZE; ++i)
+				m_sparse[page][i] = kInvalidSlot;
+		}
+		return m_sparse[page][index % COMPONENTPOOL_PAGE_SIZE];
+	}
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include "interfaces.h"
+#include "math2d/vector2d.h"
+
+// Behaviours a SteeringComponent combines, see SteeringSystem.
+enum eSteeringBehavior
+{
+	STEER_SEEK = 1 << 0,
+	STEER_FLEE = 1 << 1,
+	STEER_ARRIVE = 1 << 2,
+	STEER_PURSUIT = 1 << 3,
+	STEER_WANDER = 1 << 4,
+	STEER_SEPARATION = 1 << 5,
+	STEER_ALIGNMENT = 1 << 6,
+	STEER_COHESION = 1 << 7,
+	STEER_WALL_AVOIDANCE = 1 << 8,
+
+	STEER_FLOCKING = STEER_SEPARATION | STEER_ALIGNMENT | STEER_COHESION,
+};
+
+// Motion of an actor moved by the SteeringSystem; the actor also needs a TransformComponent.
+struct SteeringComponent
+{
+	Vector2D velocity;
+	Vector2D heading;		// unit, turned along the velocity
+	Vector2D target;		// of seek, flee and arrive
+	Vector2D wanderTarget;	// on the wander circle, relative to it
+	ActorId evader;			// of pursuit
+	uint32_t behaviors;		// eSteeringBehavior flags
+	uint32_t wanderSeed;	// 0 to seed from the actor id
+	float mass;
+	float maxSpeed;			// units per second
+	float maxForce;
+
+	SteeringComponent(void)
+		: heading(1, 0), wanderTarget(1, 0), evader(INVALID_ACTOR_ID), behaviors(0), wanderSeed(0)
+		, mass(1), maxSpeed(100), maxForce(200) { }
+
+	// Parses "seek", "flee", "arrive", "pursuit", "wander", "separation", "alignment", "cohesion",
+	// "wall_avoidance" or "flocking"; returns 0 for other names.
+	static uint32_t GetBehaviorFromName(const char* name);
+};
@@ -0,0 +1,879 @@
+#include "steeringsystem.h"
+#include "math2d/batchtransform.h"
+#include "threading/job_system.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// SSE2 is part of x86-64, so it needs neither a check of the CPU nor functions compiled for it.  Unlike the
+// kernels of batchtransform.cpp, which are plain functions marked MATH2D_TARGET("avx") and picked at run time, the
+// steering kernel is a template over its lanes: an AVX version would need every function it instantiates compiled
+// for AVX, i.e. a translation unit of its own built with AVX enabled, and stays SSE2 until the build has one.
+#if defined(_M_X64) || defined(__x86_64__)
+#define STEERING_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	const float kEpsilon = std::numeric_limits<float>::epsilon();
+
+	// the side feelers of wall avoidance are half as long and turned by 45 degrees
+	const float kFeelerCos = 0.70710678f;
+
+	// cells of the neighbour grid at most
+	const double kMaxCells = 1 << 20;
+
+	struct SteeringNames
+	{
+		const char* name;
+		uint32_t behaviors;
+	};
+
+	const SteeringNames s_behaviorNames[] =
+	{
+		{ "seek", STEER_SEEK },
+		{ "flee", STEER_FLEE },
+		{ "arrive", STEER_ARRIVE },
+		{ "pursuit", STEER_PURSUIT },
+		{ "wander", STEER_WANDER },
+		{ "separation", STEER_SEPARATION },
+		{ "alignment", STEER_ALIGNMENT },
+		{ "cohesion", STEER_COHESION },
+		{ "wall_avoidance", STEER_WALL_AVOIDANCE },
+		{ "flocking", STEER_FLOCKING },
+	};
+
+	//-----------------------------------------------------------------------------------------------------------------
+	// Lanes of the steering kernel: one agent as plain floats, or four in SSE2 registers.  Both do the same IEEE
+	// operations in the same order (no fused multiply-adds, correctly rounded square roots and divisions), so they
+	// compute the same bits.
+	//-----------------------------------------------------------------------------------------------------------------
+	struct ScalarLanes
+	{
+		enum { kWidth = 1 };
+		typedef float Float;
+		typedef bool Mask;
+		typedef uint32_t Uint;
+
+		static Float Load(const float* p) { return *p; }
+		static Float LoadDoubles(const double* p) { return (float)*p; }
+		static Float Gather(const float* base, Uint index) { return base[index]; }
+		static void Store(float* p, Float v) { *p = v; }
+		static float Sum(Float v) { return v; }
+		static Uint LoadUint(const uint32_t* p) { return *p; }
+		static Uint SplatUint(uint32_t v) { return v; }
+		static void StoreUint(uint32_t* p, Uint v) { *p = v; }
+		static Float Splat(float v) { return v; }
+
+		static Float Sqrt(Float v) { return std::sqrt(v); }
+		static Float Min(Float a, Float b) { return a < b ? a : b; }
+		static Float Max(Float a, Float b) { return a > b ? a : b; }
+		static Float Abs(Float v) { return std::fabs(v); }
+		static Float Negate(Float v) { return -v; }
+		static Mask Less(Float a, Float b) { return a < b; }
+		static Mask Greater(Float a, Float b) { return a > b; }
+		static Mask And(Mask a, Mask b) { return a && b; }
+		static Mask HasFlag(Uint flags, uint32_t flag) { return (flags & flag) != 0; }
+		static Mask NotEqual(Uint a, uint32_t b) { return a != b; }
+		static Mask FirstLanes(size_t count) { return count != 0; }
+		static Float Select(Mask m, Float a, Float b) { return m ? a : b; }
+		static Uint SelectUint(Mask m, Uint a, Uint b) { return m ? a : b; }
+		static bool Any(Mask m) { return m; }
+
+		// xorshift32
+		static Uint NextRandom(Uint x)
+		{
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			return x;
+		}
+
+		// in [-1, 1)
+		static Float RandomClamped(Uint x) { return (float)(x >> 8) * (1.0f / 8388608.0f) - 1.0f; }
+	};
+
+#ifdef STEERING_SSE2
+	struct Float4
+	{
+		__m128 v;
+
+		Float4(void) { }
+		Float4(__m128 v_) : v(v_) { }
+	};
+
+	inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+	inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+	inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+	inline Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.v, b.v); }
+
+	struct SSE2Lanes
+	{
+		enum { kWidth = 4 };
+		typedef Float4 Float;
+		typedef __m128 Mask;
+		typedef __m128i Uint;
+
+		static Float Load(const float* p) { return _mm_loadu_ps(p); }
+		static Float LoadDoubles(const double* p)
+		{
+			return _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(p)), _mm_cvtpd_ps(_mm_loadu_pd(p + 2)));
+		}
+		static Float Gather(const float* base, Uint indices)
+		{
+			return _mm_setr_ps(base[(uint32_t)_mm_cvtsi128_si32(indices)],
+				base[(uint32_t)_mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 1))],
+				base[(uint32_t)_mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 2))],
+				base[(uint32_t)_mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 3))]);
+		}
+		static void Store(float* p, Float v) { _mm_storeu_ps(p, v.v); }
+		static float Sum(Float v)
+		{
+			__m128 pairs = _mm_add_ps(v.v, _mm_movehl_ps(v.v, v.v));
+			return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+		}
+		static Uint LoadUint(const uint32_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+		static Uint SplatUint(uint32_t v) { return _mm_set1_epi32((int)v); }
+		static void StoreUint(uint32_t* p, Uint v) { _mm_storeu_si128((__m128i*)p, v); }
+		static Float Splat(float v) { return _mm_set1_ps(v); }
+
+		static Float Sqrt(Float v) { return _mm_sqrt_ps(v.v); }
+		static Float Min(Float a, Float b) { return _mm_min_ps(a.v, b.v); }
+		static Float Max(Float a, Float b) { return _mm_max_ps(a.v, b.v); }
+		static Float Abs(Float v) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), v.v); }
+		static Float Negate(Float v) { return _mm_xor_ps(_mm_set1_ps(-0.0f), v.v); }
+		static Mask Less(Float a, Float b) { return _mm_cmplt_ps(a.v, b.v); }
+		static Mask Greater(Float a, Float b) { return _mm_cmpgt_ps(a.v, b.v); }
+		static Mask And(Mask a, Mask b) { return _mm_and_ps(a, b); }
+
+		static Mask HasFlag(Uint flags, uint32_t flag)
+		{
+			__m128i bit = _mm_set1_epi32((int)flag);
+			return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(flags, bit), bit));
+		}
+
+		static Mask NotEqual(Uint a, uint32_t b)
+		{
+			return _mm_castsi128_ps(_mm_xor_si128(_mm_cmpeq_epi32(a, _mm_set1_epi32((int)b)), _mm_set1_epi32(-1)));
+		}
+
+		// the lanes below count
+		static Mask FirstLanes(size_t count)
+		{
+			return _mm_castsi128_ps(_mm_cmplt_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32((int)(std::min)(count, (size_t)4))));
+		}
+
+		static Float Select(Mask m, Float a, Float b) { return _mm_or_ps(_mm_and_ps(m, a.v), _mm_andnot_ps(m, b.v)); }
+		static Uint SelectUint(Mask m, Uint a, Uint b)
+		{
+			__m128i mask = _mm_castps_si128(m);
+			return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+		}
+		static bool Any(Mask m) { return _mm_movemask_ps(m) != 0; }
+
+		static Uint NextRandom(Uint x)
+		{
+			x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+			x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+			x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+			return x;
+		}
+
+		static Float RandomClamped(Uint x)
+		{
+			__m128 r = _mm_cvtepi32_ps(_mm_srli_epi32(x, 8));
+			return _mm_sub_ps(_mm_mul_ps(r, _mm_set1_ps(1.0f / 8388608.0f)), _mm_set1_ps(1.0f));
+		}
+	};
+#endif
+
+	// Vector2D::Normalize(): vectors not longer than epsilon are left as they are
+	template <class L>
+	void Normalize(typename L::Float& x, typename L::Float& y)
+	{
+		typename L::Float length = L::Sqrt(x * x + y * y);
+		typename L::Mask longEnough = L::Greater(length, L::Splat(kEpsilon));
+		x = L::Select(longEnough, x / length, x);
+		y = L::Select(longEnough, y / length, y);
+	}
+
+	// Vector2D::Truncate()
+	template <class L>
+	void Truncate(typename L::Float& x, typename L::Float& y, typename L::Float max)
+	{
+		typename L::Float length = L::Sqrt(x * x + y * y);
+		typename L::Mask tooLong = L::Greater(length, max);
+		x = L::Select(tooLong, x / length * max, x);
+		y = L::Select(tooLong, y / length * max, y);
+	}
+
+	template <class L>
+	void Seek(typename L::Float targetX, typename L::Float targetY,
+		typename L::Float px, typename L::Float py, typename L::Float vx, typename L::Float vy,
+		typename L::Float maxSpeed, typename L::Float& forceX, typename L::Float& forceY)
+	{
+		typename L::Float desiredX = targetX - px;
+		typename L::Float desiredY = targetY - py;
+		Normalize<L>(desiredX, desiredY);
+		forceX = desiredX * maxSpeed - vx;
+		forceY = desiredY * maxSpeed - vy;
+	}
+
+	// adds force * weight to sum in the lanes of the mask; the other lanes may hold anything, NaNs included
+	template <class L>
+	void AddForce(typename L::Mask use, typename L::Float weight,
+		typename L::Float forceX, typename L::Float forceY, typename L::Float& sumX, typename L::Float& sumY)
+	{
+		typename L::Float zero = L::Splat(0.0f);
+		sumX = sumX + L::Select(use, forceX * weight, zero);
+		sumY = sumY + L::Select(use, forceY * weight, zero);
+	}
+
+	// atan2() within 1e-5 radians: a polynomial of atan over [0, 1] and the octant from the signs and the larger
+	// coordinate.  The yaw of a heading, which the library function would make the slowest part of the update.
+	template <class L>
+	typename L::Float Atan2(typename L::Float y, typename L::Float x)
+	{
+		typedef typename L::Float Float;
+
+		Float absX = L::Abs(x);
+		Float absY = L::Abs(y);
+		Float larger = L::Max(absX, absY);
+		Float z = L::Select(L::Greater(larger, L::Splat(0.0f)), L::Min(absX, absY) / larger, L::Splat(0.0f));
+		Float zz = z * z;
+
+		Float angle = L::Splat(-0.0117212f);
+		angle = angle * zz + L::Splat(0.05265332f);
+		angle = angle * zz + L::Splat(-0.11643287f);
+		angle = angle * zz + L::Splat(0.19354346f);
+		angle = angle * zz + L::Splat(-0.33262347f);
+		angle = angle * zz + L::Splat(0.99997726f);
+		angle = angle * z;
+
+		angle = L::Select(L::Greater(absY, absX), L::Splat(1.57079633f) - angle, angle);
+		angle = L::Select(L::Less(x, L::Splat(0.0f)), L::Splat(3.14159265f) - angle, angle);
+		return L::Select(L::Less(y, L::Splat(0.0f)), L::Negate(angle), angle);
+	}
+}
+
+namespace
+{
+	// of the neighbours of one agent: the separation forces, the headings and the positions, and how many
+	template <class L>
+	struct NeighborSums
+	{
+		typename L::Float separationX, separationY;
+		typename L::Float headingX, headingY;
+		typename L::Float centerX, centerY;
+		typename L::Float count;
+
+		NeighborSums(void)
+		{
+			separationX = separationY = headingX = headingY = centerX = centerY = count = L::Splat(0.0f);
+		}
+	};
+
+	//-----------------------------------------------------------------------------------------------------------------
+	// Adds the count candidates of a cell to the sums of agent self at (x, y).  Each counts with a weight of one if it
+	// is a neighbour and zero otherwise: branching on it would be mispredicted a lot.  The last lanes may read past
+	// count, see CellSpacePartition::ForEachCell(); they are moved onto the agent and weigh zero.
+	//-----------------------------------------------------------------------------------------------------------------
+	template <class L>
+	void SumCandidates(const ActorId* ids, const double* xs, const double* ys, size_t count,
+		uint32_t self, float x, float y, float radiusSq, const float* hx, const float* hy, NeighborSums<L>& sums)
+	{
+		typedef typename L::Float Float;
+		typedef typename L::Mask Mask;
+		typedef typename L::Uint Uint;
+
+		const Float one = L::Splat(1.0f);
+		const Float zero = L::Splat(0.0f);
+		const Float smallest = L::Splat((std::numeric_limits<float>::min)());
+
+		for (size_t k = 0; k < count; k += L::kWidth)
+		{
+			Mask valid = L::FirstLanes(count - k);
+			Uint candidates = L::SelectUint(valid, L::LoadUint(ids + k), L::SplatUint(self));
+			Float neighborX = L::Select(valid, L::LoadDoubles(xs + k), L::Splat(x));
+			Float neighborY = L::Select(valid, L::LoadDoubles(ys + k), L::Splat(y));
+			Float toAgentX = L::Splat(x) - neighborX;
+			Float toAgentY = L::Splat(y) - neighborY;
+			Float distanceSq = toAgentX * toAgentX + toAgentY * toAgentY;
+			Float weight = L::Select(L::And(L::Less(distanceSq, L::Splat(radiusSq)), L::NotEqual(candidates, self)),
+				one, zero);
+
+			// pushed away by each neighbour in inverse proportion to its distance
+			Float push = weight / L::Max(distanceSq, smallest);
+			sums.separationX = sums.separationX + toAgentX * push;
+			sums.separationY = sums.separationY + toAgentY * push;
+			sums.headingX = sums.headingX + L::Gather(hx, candidates) * weight;
+			sums.headingY = sums.headingY + L::Gather(hy, candidates) * weight;
+			sums.centerX = sums.centerX + neighborX * weight;
+			sums.centerY = sums.centerY + neighborY * weight;
+			sums.count = sums.count + weight;
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// One array per quantity, padded to a multiple of four agents.
+//---------------------------------------------------------------------------------------------------------------------
+struct SteeringSystem::Agents
+{
+	std::vector<SteeringComponent*> steering;
+	std::vector<TransformComponent*> transforms;
+	std::vector<ActorId> ids;
+
+	std::vector<float> px, py;
+	std::vector<float> vx, vy;
+	std::vector<float> hx, hy;
+	std::vector<float> targetX, targetY;
+	std::vector<float> evaderX, evaderY, evaderVx, evaderVy, evaderHx, evaderHy;
+	std::vector<float> wanderX, wanderY;
+	std::vector<float> maxSpeed, maxForce, invMass;
+	std::vector<uint32_t> behaviors;
+	std::vector<uint32_t> seeds;
+
+	// of the neighbours: sum of the separation forces, sum of the headings, sum of the positions and their number
+	std::vector<float> separationX, separationY;
+	std::vector<float> headingSumX, headingSumY;
+	std::vector<float> centerSumX, centerSumY;
+	std::vector<float> neighbors;
+
+	// the new velocities, headings and yaws; the inputs are read by the neighbours of other chunks
+	std::vector<float> newVx, newVy;
+	std::vector<float> newHx, newHy;
+	std::vector<float> newYaw;
+
+	void Resize(size_t count)
+	{
+		std::vector<float>* floats[] =
+		{
+			&px, &py, &vx, &vy, &hx, &hy, &targetX, &targetY,
+			&evaderX, &evaderY, &evaderVx, &evaderVy, &evaderHx, &evaderHy,
+			&wanderX, &wanderY, &maxSpeed, &maxForce, &invMass,
+			&separationX, &separationY, &headingSumX, &headingSumY, &centerSumX, &centerSumY, &neighbors,
+			&newVx, &newVy, &newHx, &newHy, &newYaw,
+		};
+		for (size_t i = 0; i < sizeof(floats) / sizeof(floats[0]); i++)
+			floats[i]->resize(count);
+		behaviors.resize(count);
+		seeds.resize(count);
+	}
+};
+
+namespace
+{
+	struct SteeringContext
+	{
+		const SteeringSettings* pSettings;
+		const SteeringWall* pWalls;
+		size_t numWalls;
+		float dt;
+	};
+
+	//-----------------------------------------------------------------------------------------------------------------
+	// Steers and moves the agents [begin, end), begin and end being multiples of the lane width.  Every behaviour is
+	// computed for every lane and added to the sum in the lanes of the agents using it.
+	//-----------------------------------------------------------------------------------------------------------------
+	template <class L>
+	void SteerAgents(SteeringSystem::Agents& a, const SteeringContext& context, size_t begin, size_t end)
+	{
+		typedef typename L::Float Float;
+		typedef typename L::Mask Mask;
+		typedef typename L::Uint Uint;
+
+		const SteeringSettings& settings = *context.pSettings;
+		const Float zero = L::Splat(0.0f);
+		const Float one = L::Splat(1.0f);
+		const Float dt = L::Splat(context.dt);
+
+		for (size_t i = begin; i < end; i += L::kWidth)
+		{
+			Float px = L::Load(&a.px[i]);
+			Float py = L::Load(&a.py[i]);
+			Float vx = L::Load(&a.vx[i]);
+			Float vy = L::Load(&a.vy[i]);
+			Float hx = L::Load(&a.hx[i]);
+			Float hy = L::Load(&a.hy[i]);
+			Float maxSpeed = L::Load(&a.maxSpeed[i]);
+			Uint behaviors = L::LoadUint(&a.behaviors[i]);
+
+			Float sumX = zero;
+			Float sumY = zero;
+			Float forceX, forceY;
+
+			// wall avoidance: of the feelers crossing a wall, the last one is pushed back by how far it reaches
+			// past the nearest wall it crosses
+			Mask avoidsWalls = L::HasFlag(behaviors, STEER_WALL_AVOIDANCE);
+			if (context.numWalls && L::Any(avoidsWalls))
+			{
+				Float wallX = zero;
+				Float wallY = zero;
+
+				for (int feeler = 0; feeler < 3; feeler++)
+				{
+					float length = (feeler == 0) ? settings.feelerLength : settings.feelerLength * 0.5f;
+					float turn = (feeler == 0) ? 0.0f : (feeler == 1) ? -kFeelerCos : kFeelerCos;
+					float cosine = (feeler == 0) ? 1.0f : kFeelerCos;
+
+					Float dirX = hx * L::Splat(cosine) - hy * L::Splat(turn);
+					Float dirY = hx * L::Splat(turn) + hy * L::Splat(cosine);
+					Float tipX = dirX * L::Splat(length);
+					Float tipY = dirY * L::Splat(length);
+
+					Float nearest = one;
+					Float normalX = zero;
+					Float normalY = zero;
+
+					for (size_t w = 0; w < context.numWalls; w++)
+					{
+						const SteeringWall& wall = context.pWalls[w];
+						Float toAgentX = px - L::Splat((float)wall.from.x);
+						Float toAgentY = py - L::Splat((float)wall.from.y);
+						Float wallDirX = L::Splat((float)(wall.to.x - wall.from.x));
+						Float wallDirY = L::Splat((float)(wall.to.y - wall.from.y));
+
+						// LineIntersection2D(): r along the feeler, s along the wall; parallel lines give no
+						// number or an infinite one, which fail the comparisons
+						Float rTop = toAgentY * wallDirX - toAgentX * wallDirY;
+						Float sTop = toAgentY * tipX - toAgentX * tipY;
+						Float bottom = tipX * wallDirY - tipY * wallDirX;
+						Float inverse = one / bottom;
+						Float r = rTop * inverse;
+						Float s = sTop * inverse;
+
+						Mask crosses = L::And(L::And(L::Greater(r, zero), L::Less(r, nearest)),
+							L::And(L::Greater(s, zero), L::Less(s, one)));
+						nearest = L::Select(crosses, r, nearest);
+						normalX = L::Select(crosses, L::Splat((float)wall.normal.x), normalX);
+						normalY = L::Select(crosses, L::Splat((float)wall.normal.y), normalY);
+					}
+
+					Mask hit = L::Less(nearest, one);
+					Float overshoot = (one - nearest) * L::Splat(length);
+					wallX = L::Select(hit, normalX * overshoot, wallX);
+					wallY = L::Select(hit, normalY * overshoot, wallY);
+				}
+
+				AddForce<L>(avoidsWalls, L::Splat(settings.wallAvoidanceWeight),
+					wallX, wallY, sumX, sumY);
+			}
+
+			// the flocking behaviours, from the sums over the neighbours
+			Float neighbors = L::Load(&a.neighbors[i]);
+			Mask anyNeighbor = L::Greater(neighbors, zero);
+
+			AddForce<L>(L::HasFlag(behaviors, STEER_SEPARATION), L::Splat(settings.separationWeight),
+				L::Load(&a.separationX[i]), L::Load(&a.separationY[i]), sumX, sumY);
+
+			forceX = L::Load(&a.headingSumX[i]) / neighbors - hx;
+			forceY = L::Load(&a.headingSumY[i]) / neighbors - hy;
+			AddForce<L>(L::And(L::HasFlag(behaviors, STEER_ALIGNMENT), anyNeighbor), L::Splat(settings.alignmentWeight),
+				forceX, forceY, sumX, sumY);
+
+			// cohesion is normalised, it would dwarf the other two
+			Seek<L>(L::Load(&a.centerSumX[i]) / neighbors, L::Load(&a.centerSumY[i]) / neighbors,
+				px, py, vx, vy, maxSpeed, forceX, forceY);
+			Normalize<L>(forceX, forceY);
+			AddForce<L>(L::And(L::HasFlag(behaviors, STEER_COHESION), anyNeighbor), L::Splat(settings.cohesionWeight),
+				forceX, forceY, sumX, sumY);
+
+			// wander: jitter the target on the circle ahead of the agent and seek it, in local space
+			{
+				Mask wanders = L::HasFlag(behaviors, STEER_WANDER);
+				Uint seed = L::LoadUint(&a.seeds[i]);
+				Uint seedX = L::NextRandom(seed);
+				Uint seedY = L::NextRandom(seedX);
+				L::StoreUint(&a.seeds[i], seedY);
+
+				Float jitter = L::Splat(settings.wanderJitter * context.dt);
+				Float wanderX = L::Load(&a.wanderX[i]) + L::RandomClamped(seedX) * jitter;
+				Float wanderY = L::Load(&a.wanderY[i]) + L::RandomClamped(seedY) * jitter;
+				Normalize<L>(wanderX, wanderY);
+				wanderX = wanderX * L::Splat(settings.wanderRadius);
+				wanderY = wanderY * L::Splat(settings.wanderRadius);
+
+				L::Store(&a.wanderX[i], L::Select(wanders, wanderX, L::Load(&a.wanderX[i])));
+				L::Store(&a.wanderY[i], L::Select(wanders, wanderY, L::Load(&a.wanderY[i])));
+
+				Float localX = wanderX + L::Splat(settings.wanderDistance);
+				forceX = hx * localX - hy * wanderY;
+				forceY = hy * localX + hx * wanderY;
+				AddForce<L>(wanders, L::Splat(settings.wanderWeight), forceX, forceY, sumX, sumY);
+			}
+
+			Float targetX = L::Load(&a.targetX[i]);
+			Float targetY = L::Load(&a.targetY[i]);
+
+			Seek<L>(targetX, targetY, px, py, vx, vy, maxSpeed, forceX, forceY);
+			AddForce<L>(L::HasFlag(behaviors, STEER_SEEK), L::Splat(settings.seekWeight), forceX, forceY, sumX, sumY);
+
+			// flee only from targets within the panic distance
+			{
+				Float awayX = px - targetX;
+				Float awayY = py - targetY;
+				Mask panic = L::Less(awayX * awayX + awayY * awayY,
+					L::Splat(settings.panicDistance * settings.panicDistance));
+				Normalize<L>(awayX, awayY);
+				forceX = awayX * maxSpeed - vx;
+				forceY = awayY * maxSpeed - vy;
+				AddForce<L>(L::And(L::HasFlag(behaviors, STEER_FLEE), panic), L::Splat(settings.fleeWeight),
+					forceX, forceY, sumX, sumY);
+			}
+
+			// arrive: the speed that reaches the target in arriveTime, at most maxSpeed
+			{
+				Float toTargetX = targetX - px;
+				Float toTargetY = targetY - py;
+				Float distance = L::Sqrt(toTargetX * toTargetX + toTargetY * toTargetY);
+				Float speed = L::Min(distance / L::Splat(settings.arriveTime), maxSpeed);
+				forceX = toTargetX * speed / distance - vx;
+				forceY = toTargetY * speed / distance - vy;
+				AddForce<L>(L::And(L::HasFlag(behaviors, STEER_ARRIVE), L::Greater(distance, zero)),
+					L::Splat(settings.arriveWeight), forceX, forceY, sumX, sumY);
+			}
+
+			// pursuit: seek where the evader will be, or where it is when it comes head on
+			{
+				Float evaderX = L::Load(&a.evaderX[i]);
+				Float evaderY = L::Load(&a.evaderY[i]);
+				Float evaderVx = L::Load(&a.evaderVx[i]);
+				Float evaderVy = L::Load(&a.evaderVy[i]);
+				Float toEvaderX = evaderX - px;
+				Float toEvaderY = evaderY - py;
+
+				Float relativeHeading = hx * L::Load(&a.evaderHx[i]) + hy * L::Load(&a.evaderHy[i]);
+				Mask headOn = L::And(L::Greater(toEvaderX * hx + toEvaderY * hy, zero),
+					L::Less(relativeHeading, L::Splat(-0.95f)));
+
+				Float closing = maxSpeed + L::Sqrt(evaderVx * evaderVx + evaderVy * evaderVy);
+				Float lookAhead = L::Select(L::Greater(closing, zero),
+					L::Sqrt(toEvaderX * toEvaderX + toEvaderY * toEvaderY) / closing, zero);
+				lookAhead = L::Select(headOn, zero, lookAhead);
+
+				Seek<L>(evaderX + evaderVx * lookAhead, evaderY + evaderVy * lookAhead,
+					px, py, vx, vy, maxSpeed, forceX, forceY);
+				AddForce<L>(L::HasFlag(behaviors, STEER_PURSUIT), L::Splat(settings.pursuitWeight),
+					forceX, forceY, sumX, sumY);
+			}
+
+			Truncate<L>(sumX, sumY, L::Load(&a.maxForce[i]));
+
+			// Vehicle::Update()
+			Float invMass = L::Load(&a.invMass[i]);
+			vx = vx + sumX * invMass * dt;
+			vy = vy + sumY * invMass * dt;
+			Truncate<L>(vx, vy, maxSpeed);
+
+			Float speed = L::Sqrt(vx * vx + vy * vy);
+			Mask moving = L::Greater(speed * speed, L::Splat(0.00000001f));
+			L::Store(&a.newVx[i], vx);
+			L::Store(&a.newVy[i], vy);
+			Float newHx = L::Select(moving, vx / speed, hx);
+			Float newHy = L::Select(moving, vy / speed, hy);
+			L::Store(&a.newHx[i], newHx);
+			L::Store(&a.newHy[i], newHy);
+			L::Store(&a.newYaw[i], Atan2<L>(newHy, newHx));
+		}
+	}
+}
+
+
+SteeringWall::SteeringWall(const Vector2D& from_, const Vector2D& to_)
+	: from(from_), to(to_)
+{
+	normal = Vec2DNormalize(to - from).Perp();
+}
+
+SteeringSettings::SteeringSettings(void)
+	: seekWeight(1), fleeWeight(1), arriveWeight(1), pursuitWeight(1), wanderWeight(1)
+	, separationWeight(1), alignmentWeight(1), cohesionWeight(2), wallAvoidanceWeight(10)
+	, viewDistance(50), panicDistance(100), arriveTime(0.6f)
+	, wanderRadius(1.2f), wanderDistance(2), wanderJitter(80), feelerLength(40)
+	, worldMin(0, 0), worldMax(1000, 1000)
+{
+}
+
+uint32_t SteeringComponent::GetBehaviorFromName(const char* name)
+{
+	for (size_t i = 0; i < sizeof(s_behaviorNames) / sizeof(s_behaviorNames[0]); i++)
+	{
+		if (strcmp(name, s_behaviorNames[i].name) == 0)
+			return s_behaviorNames[i].behaviors;
+	}
+	return 0;
+}
+
+
+SteeringSystem::SteeringSystem(const SteeringSettings& settings)
+	: m_pAgents(new Agents)
+	, m_numAgents(0)
+{
+	SetSettings(settings);
+}
+
+SteeringSystem::~SteeringSystem(void)
+{
+}
+
+void SteeringSystem::SetSettings(const SteeringSettings& settings)
+{
+	m_settings = settings;
+
+	// cells as large as the view distance, or larger to keep the grid within kMaxCells
+	Vector2D size = settings.worldMax - settings.worldMin;
+	double cellSize = (std::max)((double)settings.viewDistance, sqrt(size.x * size.y / kMaxCells));
+	m_pPartition.reset(new CellSpacePartition(settings.worldMin, settings.worldMax, cellSize));
+	m_cells.clear();
+}
+
+void SteeringSystem::VUpdate(ComponentManager& components, float deltaMs)
+{
+	bool flocking = false;
+	Gather(components, flocking);
+	if (!m_numAgents)
+		return;
+
+	JobSystem* pJobSystem = components.GetJobSystem();
+
+	if (flocking)
+	{
+		UpdatePartition();
+
+		// cell ranges of about kChunkSize agents
+		int numCells = m_pPartition->NumCells();
+		size_t cellsPerChunk = (std::max)((size_t)1, numCells * (size_t)kChunkSize / m_numAgents);
+		if (pJobSystem && (size_t)numCells > cellsPerChunk)
+		{
+			pJobSystem->parallelFor(0, numCells, cellsPerChunk, [this](size_t first, size_t last) {
+				SumNeighbors((int)first, (int)last);
+			});
+		}
+		else
+		{
+			SumNeighbors(0, numCells);
+		}
+	}
+
+	float dt = deltaMs / 1000.0f;
+	size_t numChunks = (m_numAgents + kChunkSize - 1) / kChunkSize;
+
+	if (pJobSystem && numChunks > 1)
+	{
+		pJobSystem->parallelFor(0, numChunks, 1, [this, dt](size_t first, size_t last) {
+			UpdateChunk(first * kChunkSize, (std::min)(last * kChunkSize, m_numAgents), dt);
+		});
+	}
+	else
+	{
+		UpdateChunk(0, m_numAgents, dt);
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// Copies the agents out of their components; flocking tells whether any of them needs its neighbours.
+//---------------------------------------------------------------------------------------------------------------------
+void SteeringSystem::Gather(ComponentManager& components, bool& flocking)
+{
+	ComponentPool<SteeringComponent>& steering = components.GetPool<SteeringComponent>();
+	ComponentPool<TransformComponent>& transforms = components.GetPool<TransformComponent>();
+	Agents& a = *m_pAgents;
+
+	a.steering.clear();
+	a.transforms.clear();
+	a.ids.clear();
+
+	SteeringComponent* pSteering = steering.Data();
+	const ActorId* pActors = steering.Actors();
+	for (size_t i = 0, count = steering.Size(); i < count; i++)
+	{
+		TransformComponent* pTransform = transforms.Get(pActors[i]);
+		if (!pTransform)
+			continue;
+		a.steering.push_back(&pSteering[i]);
+		a.transforms.push_back(pTransform);
+		a.ids.push_back(pActors[i]);
+	}
+
+	m_numAgents = a.steering.size();
+	a.Resize((m_numAgents + 3) & ~(size_t)3);
+	m_cellPositions.resize(m_numAgents);
+
+	for (size_t i = 0; i < m_numAgents; i++)
+	{
+		SteeringComponent& agent = *a.steering[i];
+		const Vector2D& position = a.transforms[i]->position;
+
+		if (!agent.wanderSeed)
+			agent.wanderSeed = (a.ids[i] * 2654435761u) | 1;
+
+		a.px[i] = (float)position.x;
+		a.py[i] = (float)position.y;
+		a.vx[i] = (float)agent.velocity.x;
+		a.vy[i] = (float)agent.velocity.y;
+		a.hx[i] = (float)agent.heading.x;
+		a.hy[i] = (float)agent.heading.y;
+		a.targetX[i] = (float)agent.target.x;
+		a.targetY[i] = (float)agent.target.y;
+		a.wanderX[i] = (float)agent.wanderTarget.x;
+		a.wanderY[i] = (float)agent.wanderTarget.y;
+		a.maxSpeed[i] = agent.maxSpeed;
+		a.maxForce[i] = agent.maxForce;
+		a.invMass[i] = 1.0f / agent.mass;
+		a.seeds[i] = agent.wanderSeed;
+
+		uint32_t behaviors = agent.behaviors;
+		if (behaviors & STEER_PURSUIT)
+		{
+			const TransformComponent* pEvader = transforms.Get(agent.evader);
+			const SteeringComponent* pEvaderSteering = steering.Get(agent.evader);
+			if (!pEvader)
+			{
+				behaviors &= ~STEER_PURSUIT;
+			}
+			else
+			{
+				a.evaderX[i] = (float)pEvader->position.x;
+				a.evaderY[i] = (float)pEvader->position.y;
+				Vector2D velocity = pEvaderSteering ? pEvaderSteering->velocity : Vector2D();
+				Vector2D heading = pEvaderSteering ? pEvaderSteering->heading
+					: Vector2D(cos(pEvader->yaw), sin(pEvader->yaw));
+				a.evaderVx[i] = (float)velocity.x;
+				a.evaderVy[i] = (float)velocity.y;
+				a.evaderHx[i] = (float)heading.x;
+				a.evaderHy[i] = (float)heading.y;
+			}
+		}
+		a.behaviors[i] = behaviors;
+
+		if (behaviors & STEER_FLOCKING)
+			flocking = true;
+		m_cellPositions[i] = position;
+	}
+
+	// the neighbour sums of the agents not flocking, and of the padding
+	for (size_t i = 0; i < a.neighbors.size(); i++)
+	{
+		a.separationX[i] = a.separationY[i] = 0;
+		a.headingSumX[i] = a.headingSumY[i] = 0;
+		a.centerSumX[i] = a.centerSumY[i] = 0;
+		a.neighbors[i] = 0;
+	}
+}
+
+// Agent i is entity m_cells[i] of the partition, with id i.
+void SteeringSystem::UpdatePartition(void)
+{
+	while (m_cells.size() > m_numAgents)
+	{
+		m_pPartition->RemoveEntity(m_cells.back());
+		m_cells.pop_back();
+	}
+	while (m_cells.size() < m_numAgents)
+	{
+		size_t i = m_cells.size();
+		m_cells.push_back(m_pPartition->AddEntity((ActorId)i, m_cellPositions[i]));
+	}
+
+	m_pPartition->UpdateEntities(m_cells.data(), m_cellPositions.data(), m_numAgents);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// Sums the neighbours of the flocking agents in the cells [beginCell, endCell).  Going through the grid cell by cell
+// rather than by agent keeps the cells around in the cache; the other sums stay zero from Gather.
+//---------------------------------------------------------------------------------------------------------------------
+void SteeringSystem::SumNeighbors(int beginCell, int endCell)
+{
+#ifdef STEERING_SSE2
+	if (GetBatchSimdLevel() != BATCH_SIMD_SCALAR)
+	{
+		SumNeighborsOfCells<SSE2Lanes>(beginCell, endCell);
+		return;
+	}
+#endif
+	SumNeighborsOfCells<ScalarLanes>(beginCell, endCell);
+}
+
+template <class L>
+void SteeringSystem::SumNeighborsOfCells(int beginCell, int endCell)
+{
+	Agents& a = *m_pAgents;
+	const CellSpacePartition& partition = *m_pPartition;
+	const float viewDistance = m_settings.viewDistance;
+	const float radiusSq = viewDistance * viewDistance;
+	const float* hx = a.hx.data();
+	const float* hy = a.hy.data();
+
+	for (int cell = beginCell; cell < endCell; cell++)
+	{
+		partition.VisitCell(cell, [&](const ActorId* agents, const double* agentXs, const double* agentYs, size_t numAgents) {
+			for (size_t n = 0; n < numAgents; n++)
+			{
+				uint32_t i = agents[n];
+				if (!(a.behaviors[i] & STEER_FLOCKING))
+					continue;
+
+				float x = (float)agentXs[n];
+				float y = (float)agentYs[n];
+
+				NeighborSums<L> sums;
+				partition.ForEachCell(Vector2D(agentXs[n], agentYs[n]), viewDistance,
+					[&](const ActorId* ids, const double* xs, const double* ys, size_t count) {
+					SumCandidates<L>(ids, xs, ys, count, i, x, y, radiusSq, hx, hy, sums);
+				});
+
+				a.separationX[i] = L::Sum(sums.separationX);
+				a.separationY[i] = L::Sum(sums.separationY);
+				a.headingSumX[i] = L::Sum(sums.headingX);
+				a.headingSumY[i] = L::Sum(sums.headingY);
+				a.centerSumX[i] = L::Sum(sums.centerX);
+				a.centerSumY[i] = L::Sum(sums.centerY);
+				a.neighbors[i] = L::Sum(sums.count);
+			}
+		});
+	}
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// Steers the chunk's agents and writes them back.  Chunks only write their own agents, so they can run at the same
+// time.
+//---------------------------------------------------------------------------------------------------------------------
+void SteeringSystem::UpdateChunk(size_t begin, size_t end, float dt)
+{
+	Agents& a = *m_pAgents;
+	size_t paddedEnd = (end + 3) & ~(size_t)3;
+
+	SteeringContext context;
+	context.pSettings = &m_settings;
+	context.pWalls = m_walls.data();
+	context.numWalls = m_walls.size();
+	context.dt = dt;
+
+#ifdef STEERING_SSE2
+	if (GetBatchSimdLevel() != BATCH_SIMD_SCALAR)
+		SteerAgents<SSE2Lanes>(a, context, begin, paddedEnd);
+	else
+#endif
+		SteerAgents<ScalarLanes>(a, context, begin, end);
+
+	for (size_t i = begin; i < end; i++)
+	{
+		SteeringComponent& agent = *a.steering[i];
+		TransformComponent& transform = *a.transforms[i];
+
+		agent.velocity = Vector2D(a.newVx[i], a.newVy[i]);
+		agent.wanderTarget = Vector2D(a.wanderX[i], a.wanderY[i]);
+		agent.wanderSeed = a.seeds[i];
+		transform.position += agent.velocity * (double)dt;
+
+		if (a.newHx[i] != a.hx[i] || a.newHy[i] != a.hy[i])
+		{
+			agent.heading = Vector2D(a.newHx[i], a.newHy[i]);
+			transform.yaw = a.newYaw[i];
+		}
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include "componentmanager.h"
+#include "steeringcomponent.h"
+#include "transformcomponent.h"
+#include "math2d/cellspacepartition.h"
+
+// Wall the steering agents avoid; they are pushed back along the normal, which points left of from -> to.
+struct SteeringWall
+{
+	Vector2D from;
+	Vector2D to;
+	Vector2D normal;
+
+	SteeringWall(const Vector2D& from_, const Vector2D& to_);
+};
+
+struct SteeringSettings
+{
+	// weights of the behaviours in the sum of the steering forces
+	float seekWeight;
+	float fleeWeight;
+	float arriveWeight;
+	float pursuitWeight;
+	float wanderWeight;
+	float separationWeight;
+	float alignmentWeight;
+	float cohesionWeight;
+	float wallAvoidanceWeight;
+
+	float viewDistance;		// of separation, alignment and cohesion
+	float panicDistance;	// flee ignores targets farther away
+	float arriveTime;		// arrive slows down to reach the target in about this many seconds
+	float wanderRadius;
+	float wanderDistance;	// of the wander circle, ahead of the agent
+	float wanderJitter;		// per second
+	float feelerLength;		// of wall avoidance
+
+	// of the neighbour grid; agents outside are still found, only slower
+	Vector2D worldMin;
+	Vector2D worldMax;
+
+	SteeringSettings(void);
+};
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Moves the actors with a SteeringComponent and a TransformComponent by the weighted sum of their steering behaviours,
+// truncated to their maxForce.
+//
+// Each update gathers the agents into arrays of floats, one per quantity (positions, velocities, targets...), and
+// computes all the behaviours for four agents at a time with SSE2, also where batchtransform.h runs AVX, masking out
+// the ones an agent does not use; on other CPUs, or at BATCH_SIMD_SCALAR (see math2d/batchtransform.h), one agent at
+// a time with the same results.  Separation, alignment and cohesion sum the neighbours found in a CellSpacePartition
+// kept up to date across updates.  With a JobSystem the agents are split into chunks updated in parallel.  The
+// positions and velocities written back are doubles, only the steering forces are computed in floats.
+//---------------------------------------------------------------------------------------------------------------------
+class SteeringSystem : public ComponentSystem
+{
+public:
+	explicit SteeringSystem(const SteeringSettings& settings = SteeringSettings());
+	~SteeringSystem(void);
+
+	virtual void VUpdate(ComponentManager& components, float deltaMs);
+	virtual void VGetAccess(ComponentAccess& access) const
+	{
+		access.Write<SteeringComponent>().Write<TransformComponent>();
+	}
+
+	const SteeringSettings& GetSettings(void) const { return m_settings; }
+	void SetSettings(const SteeringSettings& settings);
+
+	void AddWall(const Vector2D& from, const Vector2D& to) { m_walls.push_back(SteeringWall(from, to)); }
+	void ClearWalls(void) { m_walls.clear(); }
+	const std::vector<SteeringWall>& GetWalls(void) const { return m_walls; }
+
+	// Agents moved by the last update.
+	size_t GetNumAgents(void) const { return m_numAgents; }
+
+	// Agents per parallel chunk, a multiple of four.
+	enum eConstants { kChunkSize = 256 };
+
+	// defined in steeringsystem.cpp
+	struct Agents;
+
+private:
+	SteeringSettings m_settings;
+	std::vector<SteeringWall> m_walls;
+
+	std::unique_ptr<Agents> m_pAgents;
+	size_t m_numAgents;
+
+	// neighbours of the flocking behaviours, by agent index; m_cells[i] is the entity of agent i
+	std::unique_ptr<CellSpacePartition> m_pPartition;
+	std::vector<unsigned int> m_cells;
+	std::vector<Vector2D> m_cellPositions;
+
+	void Gather(ComponentManager& components, bool& flocking);
+	void UpdatePartition(void);
+	void SumNeighbors(int beginCell, int endCell);
+	template <class Lanes>
+	void SumNeighborsOfCells(int beginCell, int endCell);
+	void UpdateChunk(size_t begin, size_t end, float dt);
+};
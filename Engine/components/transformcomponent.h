@@ -0,0 +1,13 @@
+#pragma once
+
+#include "math2d/vector2d.h"
+
+// Position and heading of an actor, set from the position and yaw passed to CreateActor.
+struct TransformComponent
+{
+	Vector2D position;
+	double yaw;
+
+	TransformComponent(void) : yaw(0) { }
+	TransformComponent(const Vector2D& position_, double yaw_) : position(position_), yaw(yaw_) { }
+};
@@ -1,5 +1,6 @@
 #include "debug.h"
 #include "exceptions.h"
+#include "binary_log.h"
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -32,6 +33,8 @@ void sanity_check_fn(const char *assertion, const char *file,
 		<< std::this_thread::get_id() << ":" << std::endl;
 	errorstream << file << ":" << line << ": " << function
 		<< ": An engine assumption '" << assertion << "' failed." << std::endl;
+	g_logger.flushAsync();
+	g_binary_log.flush();
 
 	abort();
 }
@@ -47,6 +50,8 @@ void fatal_error_fn(const char *msg, const char *file,
 		<< std::this_thread::get_id() << ":" << std::endl;
 	errorstream << file << ":" << line << ": " << function
 		<< ": A fatal error occurred: " << msg << std::endl;
+	g_logger.flushAsync();
+	g_binary_log.flush();
 
 	abort();
 }
\ No newline at end of file
@@ -0,0 +1,102 @@
+#include "EventDispatchPool.h"
+
+EventDispatchPool::EventDispatchPool(unsigned int numThreads)
+    : m_running(0)
+    , m_quit(false)
+{
+    for (unsigned int i = 0; i < numThreads; ++i)
+        m_threads.push_back(std::thread(&EventDispatchPool::WorkerThread, this));
+}
+
+EventDispatchPool::~EventDispatchPool(void)
+{
+    Wait();
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_workAvailable.notify_all();
+
+    for (auto it = m_threads.begin(); it != m_threads.end(); ++it)
+        it->join();
+}
+
+EventDispatchBatch* EventDispatchPool::AcquireBatch(void)
+{
+    if (m_freeBatches.empty())
+    {
+        m_batches.push_back(std::unique_ptr<EventDispatchBatch>(new EventDispatchBatch));
+        return m_batches.back().get();
+    }
+
+    EventDispatchBatch* pBatch = m_freeBatches.back();
+    m_freeBatches.pop_back();
+    return pBatch;
+}
+
+void EventDispatchPool::Submit(EventDispatchBatch* pBatch)
+{
+    m_submitted.push_back(pBatch);
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_pending.push_back(pBatch);
+    }
+    m_workAvailable.notify_one();
+}
+
+void EventDispatchPool::Wait(void)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // help with whatever has not been picked up yet
+    while (!m_pending.empty())
+    {
+        EventDispatchBatch* pBatch = m_pending.front();
+        m_pending.pop_front();
+
+        lock.unlock();
+        Run(pBatch);
+        lock.lock();
+    }
+
+    while (m_running)
+        m_workDone.wait(lock);
+
+    // every submitted batch is finished now, hand them back; one still being filled stays with its owner
+    for (auto it = m_submitted.begin(); it != m_submitted.end(); ++it)
+    {
+        (*it)->Clear();
+        m_freeBatches.push_back(*it);
+    }
+    m_submitted.clear();
+}
+
+void EventDispatchPool::WorkerThread(void)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        while (m_pending.empty() && !m_quit)
+            m_workAvailable.wait(lock);
+        if (m_pending.empty())
+            return;
+
+        EventDispatchBatch* pBatch = m_pending.front();
+        m_pending.pop_front();
+        ++m_running;
+
+        lock.unlock();
+        Run(pBatch);
+        lock.lock();
+
+        if (--m_running == 0 && m_pending.empty())
+            m_workDone.notify_all();
+    }
+}
+
+void EventDispatchPool::Run(EventDispatchBatch* pBatch)
+{
+    for (auto it = pBatch->calls.begin(); it != pBatch->calls.end(); ++it)
+        it->eventDelegate(pBatch->events[it->event]);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "EventListenerTable.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+// Worker threads running the parallel-safe listener calls collected by EventManager::VUpdate.
+//
+// The main thread fills batches while it dispatches the serial listeners and submits each one as soon as it is full,
+// so workers run parallel listeners while the main thread is still busy with the serial ones.  Wait() lets the
+// calling thread take part in the remaining work and returns once every submitted call has finished.  Submitted
+// batches are recycled by Wait; an acquired batch that has not been submitted yet stays valid.
+//
+// Batches are owned by the pool and recycled; AcquireBatch, Submit and Wait must be called from one thread.
+//---------------------------------------------------------------------------------------------------------------------
+class EventDispatchPool
+{
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_workAvailable;
+    std::condition_variable m_workDone;
+    std::deque<EventDispatchBatch*> m_pending;
+    uint32_t m_running;     // batches taken by a thread and not finished yet
+    bool m_quit;
+
+    std::vector<std::unique_ptr<EventDispatchBatch> > m_batches;
+    std::vector<EventDispatchBatch*> m_freeBatches;     // only touched by the owning thread
+    std::vector<EventDispatchBatch*> m_submitted;       // submitted since the last Wait, owning thread only
+
+public:
+    explicit EventDispatchPool(unsigned int numThreads);
+    ~EventDispatchPool(void);
+
+    unsigned int GetNumThreads(void) const { return (unsigned int)m_threads.size(); }
+
+    EventDispatchBatch* AcquireBatch(void);
+    void Submit(EventDispatchBatch* pBatch);
+    void Wait(void);
+
+private:
+    void WorkerThread(void);
+    static void Run(EventDispatchBatch* pBatch);
+};
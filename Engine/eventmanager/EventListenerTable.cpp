@@ -0,0 +1,224 @@
+#include "EventListenerTable.h"
+#include "log.h"
+#include <cassert>
+
+const unsigned int EVENTLISTENERTABLE_INITIAL_SLOTS = 64;
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// EventListenerTable::ListenerList
+//---------------------------------------------------------------------------------------------------------------------
+int EventListenerTable::ListenerList::Find(const EventListenerDelegate& eventDelegate) const
+{
+    for (uint32_t i = 0; i < m_size; ++i)
+    {
+        if (At(i) == eventDelegate)
+            return (int)i;
+    }
+    return -1;
+}
+
+void EventListenerTable::ListenerList::Append(const EventListenerDelegate& eventDelegate)
+{
+    if (m_size < EVENTLISTENERTABLE_INLINE_LISTENERS)
+        m_inline[m_size] = eventDelegate;
+    else
+        m_overflow.push_back(eventDelegate);
+
+    ++m_size;
+    ++m_live;
+}
+
+void EventListenerTable::ListenerList::Clear(uint32_t i)
+{
+    assert(i < m_size && !At(i).empty());
+    At(i).clear();
+    --m_live;
+}
+
+void EventListenerTable::ListenerList::Compact(void)
+{
+    if (m_live == m_size)
+        return;
+
+    // stable: listeners keep their registration order
+    uint32_t out = 0;
+    for (uint32_t i = 0; i < m_size; ++i)
+    {
+        if (At(i).empty())
+            continue;
+        if (out != i)
+            At(out) = At(i);
+        ++out;
+    }
+    for (uint32_t i = out; i < m_size && i < EVENTLISTENERTABLE_INLINE_LISTENERS; ++i)
+        m_inline[i].clear();
+    m_overflow.resize((out > EVENTLISTENERTABLE_INLINE_LISTENERS) ? (out - EVENTLISTENERTABLE_INLINE_LISTENERS) : 0);
+    m_size = out;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// EventListenerTable
+//---------------------------------------------------------------------------------------------------------------------
+EventListenerTable::EventListenerTable(void)
+    : m_keys(EVENTLISTENERTABLE_INITIAL_SLOTS)
+    , m_slots(EVENTLISTENERTABLE_INITIAL_SLOTS, kEmptySlot)
+    , m_mask(EVENTLISTENERTABLE_INITIAL_SLOTS - 1)
+    , m_dispatchDepth(0)
+    , m_needsCompact(false)
+{
+}
+
+bool EventListenerTable::Add(const EventType& type, const EventListenerDelegate& eventDelegate, bool parallelSafe)
+{
+    TypeListeners& listeners = m_lists[FindOrCreateList(type)];
+    if (listeners.groups[kSerial].Find(eventDelegate) >= 0 || listeners.groups[kParallel].Find(eventDelegate) >= 0)
+    {
+        warningstream << ("Attempting to double-register a delegate");
+        return false;
+    }
+
+    listeners.groups[parallelSafe ? kParallel : kSerial].Append(eventDelegate);
+    return true;
+}
+
+bool EventListenerTable::Remove(const EventType& type, const EventListenerDelegate& eventDelegate, bool* pWasParallel)
+{
+    uint32_t list = FindList(type);
+    if (list == kEmptySlot)
+        return false;
+
+    for (int group = 0; group < kNumGroups; ++group)
+    {
+        ListenerList& listeners = m_lists[list].groups[group];
+        int i = listeners.Find(eventDelegate);
+        if (i < 0)
+            continue;
+
+        // never shift entries under a running dispatch; compact once it unwinds
+        listeners.Clear((uint32_t)i);
+        if (m_dispatchDepth)
+            m_needsCompact = true;
+        else
+            listeners.Compact();
+
+        if (pWasParallel)
+            *pWasParallel = (group == kParallel);
+        return true;
+    }
+
+    return false;
+}
+
+bool EventListenerTable::Dispatch(const IEventDataPtr& pEvent, EventDispatchBatch* pParallel) const
+{
+    uint32_t list = FindList(pEvent->VGetEventType());
+    if (list == kEmptySlot)
+        return false;
+
+    bool processed = false;
+
+    ++m_dispatchDepth;
+
+    // Only the listeners registered before the dispatch started are visited.  The list is re-fetched on every
+    // iteration because a delegate may add listeners (growing m_lists or the overflow storage).
+    for (int group = 0; group < kNumGroups; ++group)
+    {
+        if (group == kParallel && pParallel)
+        {
+            // the delegates are copied, so later changes to the list do not affect the batch
+            const ListenerList& listeners = m_lists[list].groups[kParallel];
+            size_t firstCall = pParallel->calls.size();
+            uint32_t event = (uint32_t)pParallel->events.size();
+            for (uint32_t i = 0; i < listeners.Size(); ++i)
+            {
+                if (listeners.At(i).empty())
+                    continue;
+
+                EventDispatchBatch::Call call = { listeners.At(i), event };
+                pParallel->calls.push_back(call);
+            }
+
+            if (pParallel->calls.size() != firstCall)
+            {
+                pParallel->events.push_back(pEvent);
+                processed = true;
+            }
+            continue;
+        }
+
+        uint32_t count = m_lists[list].groups[group].Size();
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            EventListenerDelegate listener = m_lists[list].groups[group].At(i);
+            if (listener.empty())
+                continue;
+
+            listener(pEvent);  // call the delegate
+            processed = true;
+        }
+    }
+
+    if (--m_dispatchDepth == 0 && m_needsCompact)
+        CompactAll();
+
+    return processed;
+}
+
+uint32_t EventListenerTable::FindOrCreateList(const EventType& type)
+{
+    // keep the load factor below 1/2 so probe sequences stay short
+    if ((m_lists.size() + 1) * 2 > m_slots.size())
+        Grow();
+
+    uint32_t i = Hash(type) & m_mask;
+    for (; m_slots[i] != kEmptySlot; i = (i + 1) & m_mask)
+    {
+        if (m_keys[i] == type)
+            return m_slots[i];
+    }
+
+    m_keys[i] = type;
+    m_slots[i] = (uint32_t)m_lists.size();
+    m_lists.push_back(TypeListeners());
+    return m_slots[i];
+}
+
+void EventListenerTable::Grow(void)
+{
+    std::vector<EventType> oldKeys;
+    std::vector<uint32_t> oldSlots;
+    oldKeys.swap(m_keys);
+    oldSlots.swap(m_slots);
+
+    size_t capacity = oldSlots.size() * 2;
+    m_keys.resize(capacity);
+    m_slots.assign(capacity, kEmptySlot);
+    m_mask = (uint32_t)capacity - 1;
+
+    // list indices are unchanged, only their position in the table moves
+    for (size_t j = 0; j < oldSlots.size(); ++j)
+    {
+        if (oldSlots[j] == kEmptySlot)
+            continue;
+
+        uint32_t i = Hash(oldKeys[j]) & m_mask;
+        while (m_slots[i] != kEmptySlot)
+            i = (i + 1) & m_mask;
+
+        m_keys[i] = oldKeys[j];
+        m_slots[i] = oldSlots[j];
+    }
+}
+
+void EventListenerTable::CompactAll(void) const
+{
+    // Compacting does not change which listeners are registered, only where they are stored.
+    for (auto it = m_lists.begin(); it != m_lists.end(); ++it)
+    {
+        for (int group = 0; group < kNumGroups; ++group)
+            it->groups[group].Compact();
+    }
+    m_needsCompact = false;
+}
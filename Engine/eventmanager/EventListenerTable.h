@@ -0,0 +1,148 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "EventManager.h"
+
+const unsigned int EVENTLISTENERTABLE_INLINE_LISTENERS = 4;
+
+//---------------------------------------------------------------------------------------------------------------------
+// Listener calls collected during a dispatch, to be run later (on worker threads) by EventDispatchPool.  Events are
+// stored once and referenced by index from their calls.
+//---------------------------------------------------------------------------------------------------------------------
+struct EventDispatchBatch
+{
+    struct Call
+    {
+        EventListenerDelegate eventDelegate;
+        uint32_t event;
+    };
+
+    std::vector<IEventDataPtr> events;
+    std::vector<Call> calls;
+
+    void Clear(void) { events.clear(); calls.clear(); }
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+// Listener storage for EventManager.
+//
+// Event types are mapped to listener lists through an open-addressed (linear probing) hash table, and every list
+// keeps its first few delegates inline, so a dispatch is one or two cache lines of probing followed by a walk over
+// contiguous delegates.  Lists live in a separate array and are addressed by index, which keeps them valid while the
+// table grows.
+//
+// Listeners may be added or removed from inside a delegate that is being dispatched: removed entries are cleared in
+// place and compacted once the outermost dispatch returns, entries added during a dispatch are first called for the
+// next event.
+//
+// Delegates registered as parallel-safe are kept in a second list per type, so a dispatch can hand them to a batch
+// instead of calling them.
+//---------------------------------------------------------------------------------------------------------------------
+class EventListenerTable
+{
+    class ListenerList
+    {
+        EventListenerDelegate m_inline[EVENTLISTENERTABLE_INLINE_LISTENERS];
+        std::vector<EventListenerDelegate> m_overflow;
+        uint32_t m_size;    // slots in use, including cleared ones
+        uint32_t m_live;    // slots holding a delegate
+
+    public:
+        ListenerList(void) : m_size(0), m_live(0) { }
+
+        uint32_t Size(void) const { return m_size; }
+        uint32_t Live(void) const { return m_live; }
+
+        EventListenerDelegate& At(uint32_t i) { return (i < EVENTLISTENERTABLE_INLINE_LISTENERS) ? m_inline[i] : m_overflow[i - EVENTLISTENERTABLE_INLINE_LISTENERS]; }
+        const EventListenerDelegate& At(uint32_t i) const { return (i < EVENTLISTENERTABLE_INLINE_LISTENERS) ? m_inline[i] : m_overflow[i - EVENTLISTENERTABLE_INLINE_LISTENERS]; }
+
+        int Find(const EventListenerDelegate& eventDelegate) const;
+        void Append(const EventListenerDelegate& eventDelegate);
+        void Clear(uint32_t i);
+        void Compact(void);
+    };
+
+    enum eListenerGroup { kSerial, kParallel, kNumGroups };
+
+    struct TypeListeners
+    {
+        ListenerList groups[kNumGroups];
+        EventPriority priority;
+
+        TypeListeners(void) : priority(EVENTPRIORITY_NORMAL) { }
+
+        uint32_t Live(void) const { return groups[kSerial].Live() + groups[kParallel].Live(); }
+    };
+
+    std::vector<EventType> m_keys;
+    std::vector<uint32_t> m_slots;      // index into m_lists, or kEmptySlot
+    mutable std::vector<TypeListeners> m_lists;  // mutable: compacted when a const dispatch unwinds
+    uint32_t m_mask;
+
+    mutable uint32_t m_dispatchDepth;
+    mutable bool m_needsCompact;
+
+    enum eConstants { kEmptySlot = 0xffffffff };
+
+public:
+    EventListenerTable(void);
+
+    // Returns false if the delegate is already registered for the type.
+    bool Add(const EventType& type, const EventListenerDelegate& eventDelegate, bool parallelSafe = false);
+
+    // Returns false if the pairing was not found.  pWasParallel, if given, tells which kind of listener was removed.
+    bool Remove(const EventType& type, const EventListenerDelegate& eventDelegate, bool* pWasParallel = nullptr);
+
+    bool HasListeners(const EventType& type) const
+    {
+        uint32_t list = FindList(type);
+        return list != kEmptySlot && m_lists[list].Live() != 0;
+    }
+
+    uint32_t GetListenerCount(const EventType& type) const
+    {
+        uint32_t list = FindList(type);
+        return (list != kEmptySlot) ? m_lists[list].Live() : 0;
+    }
+
+    // True while a delegate is being called.
+    bool IsDispatching(void) const { return m_dispatchDepth != 0; }
+
+    // The processing class is kept with the listeners so queueing an event takes a single lookup.
+    void SetPriority(const EventType& type, EventPriority priority) { m_lists[FindOrCreateList(type)].priority = priority; }
+
+    EventPriority GetPriority(const EventType& type) const
+    {
+        uint32_t list = FindList(type);
+        return (list != kEmptySlot) ? m_lists[list].priority : EVENTPRIORITY_NORMAL;
+    }
+
+    // Calls every delegate registered for the event's type, serial listeners first.  If pParallel is given, the 
+    // parallel-safe delegates are appended to it instead of being called.  Returns true if at least one delegate was
+    // called or batched.
+    bool Dispatch(const IEventDataPtr& pEvent, EventDispatchBatch* pParallel = nullptr) const;
+
+private:
+    static uint32_t Hash(const EventType& type)
+    {
+        // Fibonacci hashing; event types are often hashes already, but may also be small sequential ids
+        return (uint32_t)(((uint64_t)type * 0x9E3779B97F4A7C15ull) >> 32);
+    }
+
+    uint32_t FindList(const EventType& type) const
+    {
+        for (uint32_t i = Hash(type) & m_mask; ; i = (i + 1) & m_mask)
+        {
+            uint32_t slot = m_slots[i];
+            if (slot == kEmptySlot)
+                return kEmptySlot;
+            if (m_keys[i] == type)
+                return slot;
+        }
+    }
+
+    uint32_t FindOrCreateList(const EventType& type);
+    void Grow(void);
+    void CompactAll(void) const;
+};
@@ -3,7 +3,7 @@
 #include <cassert>
 
 static IEventManager* g_pEventMgr = NULL;
-GenericObjectFactory<IEventData, EventType> g_eventFactory;
+EventFactory g_eventFactory;
 
 //GCC_MEMORY_WATCHER_DEFINITION(IEventData);
 
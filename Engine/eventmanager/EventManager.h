@@ -1,26 +1,60 @@
 #pragma once
 
 #include <memory>
-#include <strstream>
+#include <unordered_map>
+#include <cstdint>
 
 #include "FastDelegate.h"
-#include "concurrentqueue.h"
-#include "utils/templates.h"
+#include "mpscqueue.h"
+#include "EventMemoryPool.h"
+#include "EventStream.h"
 
 class IEventData;
 
 typedef unsigned long EventType;
 typedef std::shared_ptr<IEventData> IEventDataPtr;
 typedef fastdelegate::FastDelegate1<IEventDataPtr> EventListenerDelegate;
-typedef concurrentqueue<IEventDataPtr> ThreadSafeEventQueue;
-
+typedef mpscqueue<IEventDataPtr> ThreadSafeEventQueue;
 
 //---------------------------------------------------------------------------------------------------------------------
-// Macro for event registration
+// Processing classes for queued events, see IEventManager::VUpdate().
 //---------------------------------------------------------------------------------------------------------------------
-extern GenericObjectFactory<IEventData, EventType> g_eventFactory;
-#define REGISTER_EVENT(eventClass) g_eventFactory.Register<eventClass>(eventClass::sk_EventType)
-#define CREATE_EVENT(eventType) g_eventFactory.Create(eventType)
+enum EventPriority
+{
+	EVENTPRIORITY_CRITICAL,     // always processed in the next update, in queue order, regardless of the time budget
+	EVENTPRIORITY_NORMAL,       // processed while there is time left, the rest is carried to the next update
+	EVENTPRIORITY_DEFERRABLE,   // only processed with the time left after normal events, may wait several updates
+	EVENTPRIORITY_COUNT
+};
+
+struct EventTypeStats
+{
+	uint32_t processed;
+	uint32_t deferred;      // queued events carried over to the next update
+	uint64_t timeNs;        // time spent in listeners
+
+	EventTypeStats(void) : processed(0), deferred(0), timeNs(0) { }
+};
+
+struct EventFrameStats
+{
+	uint32_t processed[EVENTPRIORITY_COUNT];
+	uint32_t deferred[EVENTPRIORITY_COUNT];
+	uint64_t timeNs;        // time spent in the whole update
+	std::unordered_map<EventType, EventTypeStats> types;  // entries are kept (zeroed) between updates
+
+	EventFrameStats(void) { Reset(); }
+
+	void Reset(void)
+	{
+		for (int i = 0; i < EVENTPRIORITY_COUNT; ++i)
+			processed[i] = deferred[i] = 0;
+		timeNs = 0;
+		for (auto it = types.begin(); it != types.end(); ++it)
+			it->second = EventTypeStats();
+	}
+};
+
 
 class IEventData 
 {
@@ -28,8 +62,8 @@ public:
 	virtual ~IEventData(void) {}
 	virtual const EventType& VGetEventType(void) const = 0;
 	virtual float GetTimeStamp(void) const = 0;
-	virtual void VSerialize(std::ostrstream& out) const = 0;
-    virtual void VDeserialize(std::istrstream& in) = 0;
+	virtual void VSerialize(EventWriter& out) const = 0;
+    virtual bool VDeserialize(EventReader& in) = 0;
 	virtual IEventDataPtr VCopy(void) const = 0;
     virtual const char* GetName(void) const = 0;
 
@@ -48,23 +82,80 @@ public:
 
 	float GetTimeStamp(void) const { return m_timeStamp; }
 
-	// Serializing for network input / output
-	virtual void VSerialize(std::ostrstream &out) const	{ }
-    virtual void VDeserialize(std::istrstream& in) { }
+	// Serializing for network input / output and the event log.  Events without data need not override these.
+	virtual void VSerialize(EventWriter& out) const { }
+    virtual bool VDeserialize(EventReader& in) { return true; }
 };
 
+//---------------------------------------------------------------------------------------------------------------------
+// Creates an event whose object and shared_ptr control block share one block from EventMemoryPool.  Use this instead 
+// of std::make_shared / new in event code, including VCopy().
+//---------------------------------------------------------------------------------------------------------------------
+template <class EventClass, class... Args>
+std::shared_ptr<EventClass> MakeEvent(Args&&... args)
+{
+	return std::allocate_shared<EventClass>(EventAllocator<EventClass>(), std::forward<Args>(args)...);
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Creates events by type id.  Unlike GenericObjectFactory it hands out shared pointers, so the events come from 
+// the event pool.
+//---------------------------------------------------------------------------------------------------------------------
+class EventFactory
+{
+    typedef IEventDataPtr (*EventCreationFunction)(void);
+    std::unordered_map<EventType, EventCreationFunction> m_creationFunctions;
+
+    template <class EventClass>
+    static IEventDataPtr CreateEvent(void) { return MakeEvent<EventClass>(); }
+
+public:
+    template <class EventClass>
+    bool Register(EventType type)
+    {
+        return m_creationFunctions.insert(std::make_pair(type, &CreateEvent<EventClass>)).second;
+    }
+
+    IEventDataPtr Create(EventType type) const
+    {
+        auto findIt = m_creationFunctions.find(type);
+        if (findIt != m_creationFunctions.end())
+            return findIt->second();
+
+        return IEventDataPtr();
+    }
+};
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Macro for event registration
+//---------------------------------------------------------------------------------------------------------------------
+extern EventFactory g_eventFactory;
+#define REGISTER_EVENT(eventClass) g_eventFactory.Register<eventClass>(eventClass::sk_EventType)
+#define CREATE_EVENT(eventType) g_eventFactory.Create(eventType)
+
+
 class IEventManager
 {
 public:
 
 	enum eConstants { kINFINITE = 0xffffffff };
 
+	enum eListenerFlags
+	{
+		// The delegate may run on a worker thread, concurrently with other listeners of the same event, while queued
+		// events are processed.  It must treat the event as read-only and must not call back into the event manager
+		// except for VThreadSafeQueueEvent.
+		kParallelSafe = 0x1,
+	};
+
 	explicit IEventManager(const char* pName, bool setAsGlobal);
 	virtual ~IEventManager(void);
 
     // Registers a delegate function that will get called when the event type is triggered.  Returns true if 
-    // successful, false if not.
-    virtual bool VAddListener(const EventListenerDelegate& eventDelegate, const EventType& type) = 0;
+    // successful, false if not.  flags is a combination of eListenerFlags.
+    virtual bool VAddListener(const EventListenerDelegate& eventDelegate, const EventType& type, unsigned int flags = 0) = 0;
 
 	// Removes a delegate / event type pairing from the internal tables.  Returns false if the pairing was not found.
 	virtual bool VRemoveListener(const EventListenerDelegate& eventDelegate, const EventType& type) = 0;
@@ -87,12 +178,23 @@ public:
 	// returns true if the event was found and removed, false otherwise
 	virtual bool VAbortEvent(const EventType& type, bool allOfType = false) = 0;
 
+	// Sets the processing class of an event type; types default to EVENTPRIORITY_NORMAL.  Applies to events queued
+	// from now on.
+	virtual void VSetEventPriority(const EventType& type, EventPriority priority) = 0;
+
 	// Allow for processing of any queued messages, optionally specify a processing time limit so that the event 
     // processing does not take too long. Note the danger of using this artificial limiter is that all messages 
     // may not in fact get processed.
+	//
+	// Critical events are all processed first, in the order they were queued.  Normal and then deferrable events 
+	// follow while the budget lasts; the remainder keeps its order and is processed first in the next update.
 	//
 	// returns true if all messages ready for processing were completed, false otherwise (e.g. timeout )
 	virtual bool VUpdate(unsigned long maxMillis = kINFINITE) = 0;
+	virtual bool VUpdateMicros(unsigned long maxMicros = kINFINITE) = 0;
+
+	// Statistics of the last VUpdate call.
+	virtual const EventFrameStats& VGetFrameStats(void) const = 0;
 
     // Getter for the main global event manager.  This is the event manager that is used by the majority of the 
     // engine, though you are free to define your own as long as you instantiate it with setAsGlobal set to false.
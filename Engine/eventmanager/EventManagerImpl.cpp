@@ -1,12 +1,18 @@
 #include "EventManagerImpl.h"
+#include "EventRecorder.h"
 #include "log.h"
 #include "utils/time_utils.h"
 #include <cassert>
 
 EventManager::EventManager(const char* pName, bool setAsGlobal)
 	: IEventManager(pName, setAsGlobal)
+	, m_realtimeEventQueue(EVENTMANAGER_REALTIME_QUEUE_SIZE)
+	, m_realtimeOverflowed(false)
+	, m_pParallelBatch(nullptr)
+	, m_pRecorder(nullptr)
 {
     m_activeQueue = 0;
+    m_allocStatsAtFrameEnd = EventMemoryPool::GetStats();
 }
 
 
@@ -22,21 +28,9 @@ EventManager::~EventManager()
 //---------------------------------------------------------------------------------------------------------------------
 // EventManager::VAddListener
 //---------------------------------------------------------------------------------------------------------------------
-bool EventManager::VAddListener(const EventListenerDelegate& eventDelegate, const EventType& type)
+bool EventManager::VAddListener(const EventListenerDelegate& eventDelegate, const EventType& type, unsigned int flags)
 {
-    EventListenerList& eventListenerList = m_eventListeners[type];  // this will find or create the entry
-    for (auto it = eventListenerList.begin(); it != eventListenerList.end(); ++it)
-    {
-        if (eventDelegate == (*it))
-        {
-            warningstream<< ("Attempting to double-register a delegate");
-            return false;
-        }
-    }
-
-    eventListenerList.push_back(eventDelegate);
-
-	return true;
+    return m_eventListeners.Add(type, eventDelegate, (flags & kParallelSafe) != 0);
 }
 
 
@@ -45,24 +39,30 @@ bool EventManager::VAddListener(const EventListenerDelegate& eventDelegate, cons
 //---------------------------------------------------------------------------------------------------------------------
 bool EventManager::VRemoveListener(const EventListenerDelegate& eventDelegate, const EventType& type)
 {
-	bool success = false;
+    bool wasParallel = false;
+    if (!m_eventListeners.Remove(type, eventDelegate, &wasParallel))
+        return false;
 
-    auto findIt = m_eventListeners.find(type);
-    if (findIt != m_eventListeners.end())
+    // calls to the delegate may still be pending in a batch; the listener can be destroyed once this returns
+    if (wasParallel && m_pDispatchPool)
     {
-        EventListenerList& listeners = findIt->second;
-        for (auto it = listeners.begin(); it != listeners.end(); ++it)
+        if (m_eventListeners.IsDispatching() && m_pParallelBatch)
+        {
+            // a serial listener removed it from inside ProcessQueue, which keeps filling m_pParallelBatch once we
+            // return: run the calls collected so far from another batch and leave the current one empty
+            EventDispatchBatch* pCollected = m_pDispatchPool->AcquireBatch();
+            pCollected->events.swap(m_pParallelBatch->events);
+            pCollected->calls.swap(m_pParallelBatch->calls);
+            m_pDispatchPool->Submit(pCollected);
+            m_pDispatchPool->Wait();
+        }
+        else
         {
-            if (eventDelegate == (*it))
-            {
-                listeners.erase(it);
-                success = true;
-                break;  // we don't need to continue because it should be impossible for the same delegate function to be registered for the same event more than once
-            }
+            FlushParallelDispatch();
         }
     }
 
-    return success;
+    return true;
 }
 
 
@@ -71,21 +71,10 @@ bool EventManager::VRemoveListener(const EventListenerDelegate& eventDelegate, c
 //---------------------------------------------------------------------------------------------------------------------
 bool EventManager::VTriggerEvent(const IEventDataPtr& pEvent) const
 {
-    bool processed = false;
+    if (m_pRecorder)
+        m_pRecorder->RecordEvent(*pEvent, EVENTRECORD_TRIGGERED, m_eventListeners.IsDispatching());
 
-    auto findIt = m_eventListeners.find(pEvent->VGetEventType());
-	if (findIt != m_eventListeners.end())
-    {
-	    const EventListenerList& eventListenerList = findIt->second;
-	    for (EventListenerList::const_iterator it = eventListenerList.begin(); it != eventListenerList.end(); ++it)
-	    {
-		    EventListenerDelegate listener = (*it);
- 		    listener(pEvent);  // call the delegate
-            processed = true;
-	    }
-    }
-	
-	return processed;
+    return m_eventListeners.Dispatch(pEvent);
 }
 
 
@@ -104,10 +93,12 @@ bool EventManager::VQueueEvent(const IEventDataPtr& pEvent)
         return false;
     }
 
-	auto findIt = m_eventListeners.find(pEvent->VGetEventType());
-    if (findIt != m_eventListeners.end())
+    EventType type = pEvent->VGetEventType();
+    if (m_eventListeners.HasListeners(type))
     {
-        m_queues[m_activeQueue].push_back(pEvent);
+        m_queues[m_activeQueue][m_eventListeners.GetPriority(type)].push_back(pEvent);
+        if (m_pRecorder)
+            m_pRecorder->RecordEvent(*pEvent, EVENTRECORD_QUEUED, m_eventListeners.IsDispatching());
         return true;
     }
     else
@@ -123,7 +114,14 @@ bool EventManager::VQueueEvent(const IEventDataPtr& pEvent)
 //---------------------------------------------------------------------------------------------------------------------
 bool EventManager::VThreadSafeQueueEvent(const IEventDataPtr& pEvent)
 {
-	m_realtimeEventQueue.push(pEvent);
+	// once an event went to the overflow list the following ones have to as well, or they would overtake it
+	if (!m_realtimeOverflowed.load(std::memory_order_acquire) && m_realtimeEventQueue.try_push(pEvent))
+		return true;
+
+	// the ring is full: never spin here, the caller may be the main thread that drains it
+	std::lock_guard<std::mutex> lock(m_realtimeOverflowMutex);
+	m_realtimeOverflow.push_back(pEvent);
+	m_realtimeOverflowed.store(true, std::memory_order_release);
 	return true;
 }
 
@@ -136,12 +134,12 @@ bool EventManager::VAbortEvent(const EventType& inType, bool allOfType)
 	assert(m_activeQueue >= 0);
 	assert(m_activeQueue < EVENTMANAGER_NUM_QUEUES);
 
+    // the type's priority may have changed since the event was queued, so every priority class is searched, in
+    // the order they are processed
     bool success = false;
-	EventListenerMap::iterator findIt = m_eventListeners.find(inType);
-
-	if (findIt != m_eventListeners.end())
+    for (int priority = 0; priority < EVENTPRIORITY_COUNT; ++priority)
     {
-        EventQueue& eventQueue = m_queues[m_activeQueue];
+        EventQueue& eventQueue = m_queues[m_activeQueue][priority];
         auto it = eventQueue.begin();
         while (it != eventQueue.end())
         {
@@ -155,7 +153,7 @@ bool EventManager::VAbortEvent(const EventType& inType, bool allOfType)
 		        eventQueue.erase(thisIt);
 		        success = true;
 		        if (!allOfType)
-			        break;
+			        return true;
 	        }
         }
     }
@@ -164,80 +162,169 @@ bool EventManager::VAbortEvent(const EventType& inType, bool allOfType)
 }
 
 
+//---------------------------------------------------------------------------------------------------------------------
+// EventManager::VSetEventPriority
+//---------------------------------------------------------------------------------------------------------------------
+void EventManager::VSetEventPriority(const EventType& type, EventPriority priority)
+{
+    assert(priority >= 0 && priority < EVENTPRIORITY_COUNT);
+    m_eventListeners.SetPriority(type, priority);
+}
+
+
 //---------------------------------------------------------------------------------------------------------------------
 // EventManager::VTick
 //---------------------------------------------------------------------------------------------------------------------
 bool EventManager::VUpdate(unsigned long maxMillis)
 {
-	unsigned long currMs = GetTickCount();
-	unsigned long maxMs = ((maxMillis == IEventManager::kINFINITE) ? (IEventManager::kINFINITE) : (currMs + maxMillis));
+	if (maxMillis == IEventManager::kINFINITE || maxMillis >= IEventManager::kINFINITE / 1000)
+		return VUpdateMicros(IEventManager::kINFINITE);
+	return VUpdateMicros(maxMillis * 1000);
+}
+
+bool EventManager::VUpdateMicros(unsigned long maxMicros)
+{
+	uint64_t startNs = getTimeNs();
+	uint64_t deadlineNs = ((maxMicros == IEventManager::kINFINITE) ? UINT64_MAX : (startNs + (uint64_t)maxMicros * 1000));
+
+	m_frameStats.Reset();
 
 	// This section added to handle events from other threads.  Check out Chapter 20.
-	IEventDataPtr pRealtimeEvent;
-	while (m_realtimeEventQueue.try_pop(pRealtimeEvent))
+	// The whole backlog is drained in one pass; producers never wait on the main thread.
+	m_realtimeEventQueue.pop_all(m_realtimeEvents);
+	if (m_realtimeOverflowed.load(std::memory_order_acquire))
 	{
-		VQueueEvent(pRealtimeEvent);
+		// after the ring: everything in the overflow list was pushed once the ring was full
+		std::lock_guard<std::mutex> lock(m_realtimeOverflowMutex);
+		m_realtimeEvents.insert(m_realtimeEvents.end(), m_realtimeOverflow.begin(), m_realtimeOverflow.end());
+		m_realtimeOverflow.clear();
+		m_realtimeOverflowed.store(false, std::memory_order_release);
+	}
+	for (auto it = m_realtimeEvents.begin(); it != m_realtimeEvents.end(); ++it)
+		VQueueEvent(*it);
+	m_realtimeEvents.clear();
 
-		currMs = GetTickCount();
-		if (maxMillis != IEventManager::kINFINITE)
-		{
-			if (currMs >= maxMs)
-			{
-				errorstream<<("A realtime process is spamming the event manager!");
-			}
-		}
+	// after the realtime events, which a replay has to queue before updating
+	if (m_pRecorder)
+		m_pRecorder->RecordFrame(maxMicros);
+
+	uint64_t nowNs = getTimeNs();
+	if (nowNs >= deadlineNs)
+	{
+		errorstream<<("A realtime process is spamming the event manager!");
 	}
 
 	// swap active queues and clear the new queue after the swap
     int queueToProcess = m_activeQueue;
 	m_activeQueue = (m_activeQueue + 1) % EVENTMANAGER_NUM_QUEUES;
-	m_queues[m_activeQueue].clear();
+	for (int priority = 0; priority < EVENTPRIORITY_COUNT; ++priority)
+		m_queues[m_activeQueue][priority].clear();
+
+	// Critical events ignore the budget, the other classes get what is left in order
+	nowNs = ProcessQueue(m_queues[queueToProcess][EVENTPRIORITY_CRITICAL], EVENTPRIORITY_CRITICAL, nowNs, UINT64_MAX);
+	nowNs = ProcessQueue(m_queues[queueToProcess][EVENTPRIORITY_NORMAL], EVENTPRIORITY_NORMAL, nowNs, deadlineNs);
+	nowNs = ProcessQueue(m_queues[queueToProcess][EVENTPRIORITY_DEFERRABLE], EVENTPRIORITY_DEFERRABLE, nowNs, deadlineNs);
+
+	// parallel listeners finish within the update they were dispatched in
+	if (m_pDispatchPool)
+		FlushParallelDispatch();
+
+	// If we couldn't process all of the events, move the remaining events to the head of the new active queue so 
+	// they keep their order and run before anything queued during this update.
+	bool queueFlushed = true;
+	for (int priority = 0; priority < EVENTPRIORITY_COUNT; ++priority)
+	{
+		EventQueue& remaining = m_queues[queueToProcess][priority];
+		if (remaining.empty())
+			continue;
 
- 
-	// Process the queue
-	while (!m_queues[queueToProcess].empty())
+		queueFlushed = false;
+		for (auto it = remaining.begin(); it != remaining.end(); ++it)
+		{
+			++m_frameStats.deferred[priority];
+			++m_frameStats.types[(*it)->VGetEventType()].deferred;
+		}
+
+		EventQueue& active = m_queues[m_activeQueue][priority];
+		active.splice(active.begin(), remaining);
+	}
+
+	m_frameStats.timeNs = getTimeNs() - startNs;
+
+	EventAllocStats allocStats = EventMemoryPool::GetStats();
+	m_frameAllocStats = allocStats - m_allocStatsAtFrameEnd;
+	m_allocStatsAtFrameEnd = allocStats;
+	
+	return queueFlushed;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// EventManager::ProcessQueue
+//---------------------------------------------------------------------------------------------------------------------
+uint64_t EventManager::ProcessQueue(EventQueue& eventQueue, EventPriority priority, uint64_t now, uint64_t deadline)
+{
+	while (!eventQueue.empty() && now < deadline)
 	{
         // pop the front of the queue
-		IEventDataPtr pEvent = m_queues[queueToProcess].front();
-        m_queues[queueToProcess].pop_front();
+		IEventDataPtr pEvent = eventQueue.front();
+        eventQueue.pop_front();
   
-		const EventType& eventType = pEvent->VGetEventType();
-
-        // find all the delegate functions registered for this event
-		auto findIt = m_eventListeners.find(eventType);
-		if (findIt != m_eventListeners.end())
+        // call all the delegate functions registered for this event, parallel-safe ones go to the worker threads
+		if (m_pDispatchPool)
 		{
-			const EventListenerList& eventListeners = findIt->second;
-     
-            // call each listener
-			for (auto it = eventListeners.begin(); it != eventListeners.end(); ++it)
+			if (!m_pParallelBatch)
+				m_pParallelBatch = m_pDispatchPool->AcquireBatch();
+
+			m_eventListeners.Dispatch(pEvent, m_pParallelBatch);
+			if (m_pParallelBatch->calls.size() >= EVENTMANAGER_PARALLEL_BATCH_CALLS)
 			{
-                EventListenerDelegate listener = (*it);
-       			listener(pEvent);
+				m_pDispatchPool->Submit(m_pParallelBatch);
+				m_pParallelBatch = nullptr;
 			}
 		}
+		else
+		{
+			m_eventListeners.Dispatch(pEvent);
+		}
 
-        // check to see if time ran out
-		currMs = getTimeMs();
-		if (maxMillis != IEventManager::kINFINITE && currMs >= maxMs)
-        {
-			break;
-        }
+		// one clock read per event serves both the budget check and the per-type time
+		uint64_t end = getTimeNs();
+		EventTypeStats& typeStats = m_frameStats.types[pEvent->VGetEventType()];
+		++typeStats.processed;
+		typeStats.timeNs += end - now;
+		++m_frameStats.processed[priority];
+		now = end;
 	}
-	
-	// If we couldn't process all of the events, push the remaining events to the new active queue.
-	// Note: To preserve sequencing, go back-to-front, inserting them at the head of the active queue
-	bool queueFlushed = (m_queues[queueToProcess].empty());
-	if (!queueFlushed)
+
+	return now;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// EventManager::FlushParallelDispatch
+//---------------------------------------------------------------------------------------------------------------------
+void EventManager::FlushParallelDispatch(void)
+{
+	if (m_pParallelBatch)
 	{
-		while (!m_queues[queueToProcess].empty())
-		{
-			IEventDataPtr pEvent = m_queues[queueToProcess].back();
-			m_queues[queueToProcess].pop_back();
-			m_queues[m_activeQueue].push_front(pEvent);
-		}
+		m_pDispatchPool->Submit(m_pParallelBatch);
+		m_pParallelBatch = nullptr;
 	}
-	
-	return queueFlushed;
+	m_pDispatchPool->Wait();
 }
 
+
+//---------------------------------------------------------------------------------------------------------------------
+// EventManager::SetDispatchThreads
+//---------------------------------------------------------------------------------------------------------------------
+void EventManager::SetDispatchThreads(unsigned int numThreads)
+{
+	if (numThreads == GetDispatchThreads())
+		return;
+
+	if (m_pDispatchPool)
+		FlushParallelDispatch();
+
+	m_pDispatchPool.reset(numThreads ? new EventDispatchPool(numThreads) : nullptr);
+}
@@ -1,28 +1,53 @@
 #pragma once
 
-#include <map>
+#include <atomic>
 #include <list>
+#include <mutex>
+#include <vector>
 #include "EventManager.h"
+#include "EventListenerTable.h"
+#include "EventDispatchPool.h"
+
+class EventRecorder;
 
 const unsigned int EVENTMANAGER_NUM_QUEUES = 2;
 
+// Number of events other threads may have in flight between two VUpdate calls without taking a lock.  Events beyond
+// it go to a mutex-protected overflow list, so producers never wait for the main thread.
+const unsigned int EVENTMANAGER_REALTIME_QUEUE_SIZE = 8192;
+
+// Parallel listener calls handed to the dispatch pool at once.
+const unsigned int EVENTMANAGER_PARALLEL_BATCH_CALLS = 256;
+
 class EventManager : public IEventManager
 {
-    typedef std::list<EventListenerDelegate> EventListenerList;
-    typedef std::map<EventType, EventListenerList> EventListenerMap;
-    typedef std::list<IEventDataPtr> EventQueue;
+    typedef std::list<IEventDataPtr, EventAllocator<IEventDataPtr> > EventQueue;  // nodes come from the event pool
 
-    EventListenerMap m_eventListeners;
-    EventQueue m_queues[EVENTMANAGER_NUM_QUEUES];
+    EventListenerTable m_eventListeners;
+    EventQueue m_queues[EVENTMANAGER_NUM_QUEUES][EVENTPRIORITY_COUNT];
     int m_activeQueue;  // index of actively processing queue; events enque to the opposing queue
 
     ThreadSafeEventQueue m_realtimeEventQueue;
+    std::vector<IEventDataPtr> m_realtimeEvents;  // scratch buffer for draining m_realtimeEventQueue
+    std::vector<IEventDataPtr> m_realtimeOverflow;  // events that did not fit into m_realtimeEventQueue
+    std::mutex m_realtimeOverflowMutex;
+    std::atomic<bool> m_realtimeOverflowed;  // set while m_realtimeOverflow holds events; keeps producers FIFO
+
+    EventAllocStats m_allocStatsAtFrameEnd;
+    EventAllocStats m_frameAllocStats;  // event memory allocations between the last two VUpdate calls
+
+    EventFrameStats m_frameStats;
+
+    std::unique_ptr<EventDispatchPool> m_pDispatchPool;  // null: parallel-safe listeners run on the main thread
+    EventDispatchBatch* m_pParallelBatch;    // batch being filled by the current VUpdate
+
+    EventRecorder* m_pRecorder;
 
 public:
 	explicit EventManager(const char* pName, bool setAsGlobal);
 	virtual ~EventManager(void);
 
-    virtual bool VAddListener(const EventListenerDelegate& eventDelegate, const EventType& type);
+    virtual bool VAddListener(const EventListenerDelegate& eventDelegate, const EventType& type, unsigned int flags = 0);
     virtual bool VRemoveListener(const EventListenerDelegate& eventDelegate, const EventType& type);
 
     virtual bool VTriggerEvent(const IEventDataPtr& pEvent) const;
@@ -30,5 +55,30 @@ public:
     virtual bool VThreadSafeQueueEvent(const IEventDataPtr& pEvent);
     virtual bool VAbortEvent(const EventType& type, bool allOfType = false);
 
+    virtual void VSetEventPriority(const EventType& type, EventPriority priority);
+
     virtual bool VUpdate(unsigned long maxMillis = kINFINITE);
+    virtual bool VUpdateMicros(unsigned long maxMicros = kINFINITE);
+
+    virtual const EventFrameStats& VGetFrameStats(void) const { return m_frameStats; }
+
+    // Allocations of event memory (from any thread) during the last frame, measured VUpdate to VUpdate.
+    const EventAllocStats& GetFrameAllocStats(void) const { return m_frameAllocStats; }
+
+    // Number of worker threads running parallel-safe listeners during VUpdate; 0 runs them on the main thread 
+    // together with the other listeners.
+    void SetDispatchThreads(unsigned int numThreads);
+    unsigned int GetDispatchThreads(void) const { return m_pDispatchPool ? m_pDispatchPool->GetNumThreads() : 0; }
+
+    // Every queued or triggered event and every update is written to the recorder until it is reset to null.  The
+    // recorder is not owned.
+    void SetRecorder(EventRecorder* pRecorder) { m_pRecorder = pRecorder; }
+
+private:
+    // Dispatches events of one priority class until the queue is empty or the deadline (in ns) has passed, 
+    // returns the current time.
+    uint64_t ProcessQueue(EventQueue& eventQueue, EventPriority priority, uint64_t now, uint64_t deadline);
+
+    // Submits the batch being filled and waits for all parallel listener calls to finish.
+    void FlushParallelDispatch(void);
 };
@@ -0,0 +1,259 @@
+#include "EventMemoryPool.h"
+#include "threading/mutex_auto_lock.h"
+
+#include <atomic>
+#include <algorithm>
+#include <vector>
+
+// blocks a thread keeps per size class before spilling to the shared list
+const uint32_t EVENTPOOL_CACHE_MAX = 256;
+// blocks moved between a thread cache and the shared list at once
+const uint32_t EVENTPOOL_BATCH = 64;
+// minimum size of a chunk requested from the system allocator
+const size_t EVENTPOOL_CHUNK_BYTES = 16 * 1024;
+
+namespace
+{
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	struct ThreadCache;
+
+	// set once the thread's cache is gone; a plain bool, so it outlives every thread_local with a destructor
+	thread_local bool t_cacheDestroyed = false;
+
+	struct SharedClass
+	{
+		std::mutex mutex;
+		FreeBlock* head;
+		uint32_t count;
+
+		SharedClass(void) : head(nullptr), count(0) { }
+	};
+
+	struct PoolState
+	{
+		SharedClass classes[EventMemoryPool::kNumClasses];
+
+		std::mutex cachesMutex;
+		std::vector<ThreadCache*> caches;
+
+		std::atomic<uint64_t> heapAllocs;
+		std::atomic<uint64_t> retiredPoolAllocs;  // pool allocations made by threads that have exited
+		std::atomic<bool> enabled;
+
+		PoolState(void) : heapAllocs(0), retiredPoolAllocs(0), enabled(true) { }
+	};
+
+	// Never destroyed: thread caches may still return blocks during static destruction.
+	PoolState& GetState(void)
+	{
+		static PoolState* s_pState = new PoolState;
+		return *s_pState;
+	}
+
+	struct ThreadCache
+	{
+		FreeBlock* heads[EventMemoryPool::kNumClasses];
+		uint32_t counts[EventMemoryPool::kNumClasses];
+
+		// only written by the owning thread; atomic so GetStats() may read it from anywhere
+		std::atomic<uint64_t> poolAllocs;
+
+		ThreadCache(void) : poolAllocs(0)
+		{
+			std::fill(heads, heads + EventMemoryPool::kNumClasses, (FreeBlock*)nullptr);
+			std::fill(counts, counts + EventMemoryPool::kNumClasses, 0u);
+
+			PoolState& state = GetState();
+			MutexAutoLock lock(state.cachesMutex);
+			state.caches.push_back(this);
+		}
+
+		~ThreadCache(void)
+		{
+			// the thread may still free events from other thread_local destructors: see t_cacheDestroyed
+			t_cacheDestroyed = true;
+			for (uint32_t cls = 0; cls < EventMemoryPool::kNumClasses; ++cls)
+				Spill(cls, counts[cls]);
+
+			PoolState& state = GetState();
+			MutexAutoLock lock(state.cachesMutex);
+			state.caches.erase(std::find(state.caches.begin(), state.caches.end(), this));
+			state.retiredPoolAllocs += poolAllocs.load(std::memory_order_relaxed);
+		}
+
+		void Refill(uint32_t cls)
+		{
+			SharedClass& shared = GetState().classes[cls];
+			{
+				MutexAutoLock lock(shared.mutex);
+				while (shared.head && counts[cls] < EVENTPOOL_BATCH)
+				{
+					FreeBlock* block = shared.head;
+					shared.head = block->next;
+					--shared.count;
+					Push(cls, block);
+				}
+			}
+
+			if (counts[cls])
+				return;
+
+			// nothing to recycle, carve a new chunk
+			size_t blockSize = (cls + 1) * EventMemoryPool::kGranularity;
+			size_t numBlocks = std::max<size_t>(EVENTPOOL_BATCH, EVENTPOOL_CHUNK_BYTES / blockSize);
+			char* chunk = static_cast<char*>(::operator new(numBlocks * blockSize));
+			GetState().heapAllocs.fetch_add(1, std::memory_order_relaxed);
+
+			for (size_t i = numBlocks; i-- > 0; )
+				Push(cls, reinterpret_cast<FreeBlock*>(chunk + i * blockSize));
+		}
+
+		void Spill(uint32_t cls, uint32_t numBlocks)
+		{
+			if (!numBlocks)
+				return;
+
+			SharedClass& shared = GetState().classes[cls];
+			MutexAutoLock lock(shared.mutex);
+			while (numBlocks-- && heads[cls])
+			{
+				FreeBlock* block = Pop(cls);
+				block->next = shared.head;
+				shared.head = block;
+				++shared.count;
+			}
+		}
+
+		void Push(uint32_t cls, FreeBlock* block)
+		{
+			block->next = heads[cls];
+			heads[cls] = block;
+			++counts[cls];
+		}
+
+		FreeBlock* Pop(uint32_t cls)
+		{
+			FreeBlock* block = heads[cls];
+			heads[cls] = block->next;
+			--counts[cls];
+			return block;
+		}
+	};
+
+	thread_local ThreadCache t_cache;
+
+	// the shared list of a class, for threads whose cache is destroyed
+	void* PopShared(uint32_t cls)
+	{
+		SharedClass& shared = GetState().classes[cls];
+		MutexAutoLock lock(shared.mutex);
+		FreeBlock* block = shared.head;
+		if (block)
+		{
+			shared.head = block->next;
+			--shared.count;
+		}
+		return block;
+	}
+
+	void PushShared(uint32_t cls, void* p)
+	{
+		SharedClass& shared = GetState().classes[cls];
+		MutexAutoLock lock(shared.mutex);
+		FreeBlock* block = static_cast<FreeBlock*>(p);
+		block->next = shared.head;
+		shared.head = block;
+		++shared.count;
+	}
+
+	inline uint32_t SizeClass(size_t size)
+	{
+		return (uint32_t)((size + EventMemoryPool::kGranularity - 1) / EventMemoryPool::kGranularity) - 1;
+	}
+}
+
+
+void* EventMemoryPool::Allocate(size_t size)
+{
+	if (size == 0 || size > kMaxBlockSize)
+		return AllocateUnpooled(size);
+
+	uint32_t cls = SizeClass(size);
+	if (t_cacheDestroyed)
+	{
+		// a whole block of the class, since it is freed into the pool
+		void* p = PopShared(cls);
+		return p ? p : AllocateUnpooled((cls + 1) * kGranularity);
+	}
+
+	ThreadCache& cache = t_cache;
+	if (!cache.heads[cls])
+		cache.Refill(cls);
+
+	cache.poolAllocs.store(cache.poolAllocs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	return cache.Pop(cls);
+}
+
+void EventMemoryPool::Free(void* p, size_t size)
+{
+	if (!p)
+		return;
+
+	if (size == 0 || size > kMaxBlockSize)
+	{
+		FreeUnpooled(p);
+		return;
+	}
+
+	uint32_t cls = SizeClass(size);
+	if (t_cacheDestroyed)
+	{
+		PushShared(cls, p);
+		return;
+	}
+
+	ThreadCache& cache = t_cache;
+	cache.Push(cls, static_cast<FreeBlock*>(p));
+	if (cache.counts[cls] > EVENTPOOL_CACHE_MAX)
+		cache.Spill(cls, EVENTPOOL_BATCH);
+}
+
+void* EventMemoryPool::AllocateUnpooled(size_t size)
+{
+	GetState().heapAllocs.fetch_add(1, std::memory_order_relaxed);
+	return ::operator new(size);
+}
+
+void EventMemoryPool::FreeUnpooled(void* p)
+{
+	::operator delete(p);
+}
+
+void EventMemoryPool::SetEnabled(bool enabled)
+{
+	GetState().enabled.store(enabled);
+}
+
+bool EventMemoryPool::IsEnabled(void)
+{
+	return GetState().enabled.load(std::memory_order_relaxed);
+}
+
+EventAllocStats EventMemoryPool::GetStats(void)
+{
+	PoolState& state = GetState();
+
+	EventAllocStats stats;
+	stats.heapAllocs = state.heapAllocs.load(std::memory_order_relaxed);
+
+	MutexAutoLock lock(state.cachesMutex);
+	stats.poolAllocs = state.retiredPoolAllocs.load(std::memory_order_relaxed);
+	for (auto it = state.caches.begin(); it != state.caches.end(); ++it)
+		stats.poolAllocs += (*it)->poolAllocs.load(std::memory_order_relaxed);
+
+	return stats;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+//---------------------------------------------------------------------------------------------------------------------
+// Allocation statistics for event memory.  heapAllocs counts calls that reached the system allocator, poolAllocs
+// counts allocations served from recycled blocks.
+//---------------------------------------------------------------------------------------------------------------------
+struct EventAllocStats
+{
+	uint64_t heapAllocs;
+	uint64_t poolAllocs;
+
+	EventAllocStats(void) : heapAllocs(0), poolAllocs(0) { }
+
+	EventAllocStats operator-(const EventAllocStats& other) const
+	{
+		EventAllocStats diff;
+		diff.heapAllocs = heapAllocs - other.heapAllocs;
+		diff.poolAllocs = poolAllocs - other.poolAllocs;
+		return diff;
+	}
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+// Size-class block pool backing events (object + shared_ptr control block) and event queue nodes.
+//
+// Every thread keeps a small cache of free blocks per size class; caches refill from and spill to a shared list in
+// batches, so the common allocate/free pair takes no lock and never reaches malloc.  Blocks freed on another thread
+// (events posted from worker threads are released on the main thread) simply migrate to that thread's cache.  An
+// exiting thread spills its cache to the shared lists; events it frees after that go straight to them.
+// Memory is only ever handed back to the system at process exit.
+//---------------------------------------------------------------------------------------------------------------------
+class EventMemoryPool
+{
+public:
+	enum eConstants
+	{
+		kGranularity = 16,
+		kMaxBlockSize = 512,    // larger requests always go to the system allocator
+		kNumClasses = kMaxBlockSize / kGranularity,
+	};
+
+	static void* Allocate(size_t size);
+	static void Free(void* p, size_t size);
+
+	// Heap allocations bypassing the pool are counted too, so stats compare both modes.
+	static void* AllocateUnpooled(size_t size);
+	static void FreeUnpooled(void* p);
+
+	// Pooling mode used by allocators constructed from now on.  Memory is always returned to where it came from,
+	// so switching at runtime is safe.
+	static void SetEnabled(bool enabled);
+	static bool IsEnabled(void);
+
+	static EventAllocStats GetStats(void);
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+// Standard allocator on top of EventMemoryPool, used with std::allocate_shared and the EventManager queues.
+//---------------------------------------------------------------------------------------------------------------------
+template <class T>
+class EventAllocator
+{
+	template <class U> friend class EventAllocator;
+	bool m_pooled;
+
+public:
+	typedef T value_type;
+
+	EventAllocator(void) : m_pooled(EventMemoryPool::IsEnabled()) { }
+
+	template <class U>
+	EventAllocator(const EventAllocator<U>& other) : m_pooled(other.m_pooled) { }
+
+	T* allocate(size_t n)
+	{
+		void* p = m_pooled ? EventMemoryPool::Allocate(n * sizeof(T)) : EventMemoryPool::AllocateUnpooled(n * sizeof(T));
+		return static_cast<T*>(p);
+	}
+
+	void deallocate(T* p, size_t n)
+	{
+		if (m_pooled)
+			EventMemoryPool::Free(p, n * sizeof(T));
+		else
+			EventMemoryPool::FreeUnpooled(p);
+	}
+
+	template <class U>
+	bool operator==(const EventAllocator<U>& other) const { return m_pooled == other.m_pooled; }
+
+	template <class U>
+	bool operator!=(const EventAllocator<U>& other) const { return m_pooled != other.m_pooled; }
+
+	template <class U>
+	struct rebind { typedef EventAllocator<U> other; };
+};
@@ -0,0 +1,218 @@
+#include "EventRecorder.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cassert>
+
+const char EVENTLOG_MAGIC[4] = { 'E', 'V', 'L', 'G' };
+const uint32_t EVENTLOG_VERSION = 1;
+
+// initial file size and minimum growth step of the recording
+const size_t EVENTLOG_GROW_BYTES = 4 * 1024 * 1024;
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// EventRecorder
+//---------------------------------------------------------------------------------------------------------------------
+EventRecorder::EventRecorder(void)
+    : m_used(0)
+    , m_numEvents(0)
+    , m_numFrames(0)
+{
+}
+
+EventRecorder::~EventRecorder(void)
+{
+    Close();
+}
+
+bool EventRecorder::Open(const std::string& path)
+{
+    Close();
+
+    if (!m_file.openWrite(path, EVENTLOG_GROW_BYTES))
+        return false;
+
+    EventLogHeader header;
+    memcpy(header.magic, EVENTLOG_MAGIC, sizeof(header.magic));
+    header.version = EVENTLOG_VERSION;
+    header.dataSize = 0;
+    memcpy(m_file.data(), &header, sizeof(header));
+
+    m_used = sizeof(header);
+    m_numEvents = 0;
+    m_numFrames = 0;
+    return true;
+}
+
+void EventRecorder::Close(void)
+{
+    if (!m_file.isOpen())
+        return;
+
+    m_file.close(m_used);
+    infostream << "EventRecorder: recorded " << m_numEvents << " events in " << m_numFrames << " frames" << std::endl;
+}
+
+void EventRecorder::RecordEvent(const IEventData& event, EventRecordKind kind, bool nested)
+{
+    if (!m_file.isOpen())
+        return;
+
+    m_writer.Reset();
+    event.VSerialize(m_writer);
+    Append(kind, nested ? EVENTRECORD_NESTED : 0, event.VGetEventType(), m_writer.GetData(), m_writer.GetSize());
+    ++m_numEvents;
+}
+
+void EventRecorder::RecordFrame(unsigned long maxMicros)
+{
+    if (!m_file.isOpen())
+        return;
+
+    uint32_t budget = (uint32_t)maxMicros;
+    Append(EVENTRECORD_FRAME, 0, 0, &budget, sizeof(budget));
+    ++m_numFrames;
+}
+
+void EventRecorder::Append(EventRecordKind kind, uint8_t flags, uint64_t type, const void* pPayload, size_t size)
+{
+    size_t bytes = sizeof(EventRecordHeader) + size;
+    if (m_used + bytes > m_file.size())
+    {
+        size_t newSize = (std::max)(m_file.size() * 2, m_used + bytes + EVENTLOG_GROW_BYTES);
+        if (!m_file.resize(newSize))
+        {
+            errorstream << "EventRecorder: cannot grow the event log, recording stopped" << std::endl;
+            m_file.close(m_used);
+            return;
+        }
+    }
+
+    EventRecordHeader record;
+    record.size = (uint32_t)size;
+    record.kind = (uint8_t)kind;
+    record.flags = flags;
+    record.reserved = 0;
+    record.type = type;
+
+    char* p = m_file.data() + m_used;
+    memcpy(p, &record, sizeof(record));
+    if (size)
+        memcpy(p + sizeof(record), pPayload, size);
+    m_used += bytes;
+
+    // publish the record only once it is complete
+    EventLogHeader* pHeader = reinterpret_cast<EventLogHeader*>(m_file.data());
+    pHeader->dataSize = m_used - sizeof(EventLogHeader);
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// EventReplayer
+//---------------------------------------------------------------------------------------------------------------------
+EventReplayer::EventReplayer(const EventFactory& factory)
+    : m_pos(0)
+    , m_end(0)
+    , m_factory(factory)
+    , m_replayNested(false)
+    , m_ignoreBudget(false)
+    , m_numEvents(0)
+    , m_numSkipped(0)
+{
+}
+
+bool EventReplayer::Open(const std::string& path)
+{
+    Close();
+
+    if (!m_file.openRead(path))
+        return false;
+
+    EventLogHeader header;
+    if (m_file.size() < sizeof(header))
+    {
+        errorstream << "EventReplayer: " << path << " is not an event log" << std::endl;
+        Close();
+        return false;
+    }
+
+    memcpy(&header, m_file.data(), sizeof(header));
+    if (memcmp(header.magic, EVENTLOG_MAGIC, sizeof(header.magic)) != 0 || header.version != EVENTLOG_VERSION)
+    {
+        errorstream << "EventReplayer: " << path << " is not an event log of version " << EVENTLOG_VERSION << std::endl;
+        Close();
+        return false;
+    }
+
+    m_pos = sizeof(header);
+    m_end = sizeof(header) + (size_t)std::min<uint64_t>(header.dataSize, m_file.size() - sizeof(header));
+    m_numEvents = 0;
+    m_numSkipped = 0;
+    return true;
+}
+
+void EventReplayer::Close(void)
+{
+    m_file.close();
+    m_pos = m_end = 0;
+    m_unknownTypes.clear();
+}
+
+bool EventReplayer::ReplayFrame(IEventManager& eventManager)
+{
+    if (IsFinished())
+        return false;
+
+    while (m_pos + sizeof(EventRecordHeader) <= m_end)
+    {
+        EventRecordHeader record;
+        memcpy(&record, m_file.data() + m_pos, sizeof(record));
+        const char* pPayload = m_file.data() + m_pos + sizeof(record);
+        if (record.kind == EVENTRECORD_NONE || m_pos + sizeof(record) + record.size > m_end)
+            break;
+        m_pos += sizeof(record) + record.size;
+
+        if (record.kind == EVENTRECORD_FRAME)
+        {
+            uint32_t budget = IEventManager::kINFINITE;
+            if (!m_ignoreBudget && record.size >= sizeof(budget))
+                memcpy(&budget, pPayload, sizeof(budget));
+
+            eventManager.VUpdateMicros(budget);
+            return true;
+        }
+
+        if ((record.flags & EVENTRECORD_NESTED) && !m_replayNested)
+            continue;
+
+        IEventDataPtr pEvent = m_factory.Create((EventType)record.type);
+        EventReader reader(pPayload, record.size);
+        if (!pEvent || !pEvent->VDeserialize(reader))
+        {
+            if (m_unknownTypes.insert(record.type).second)
+                warningstream << "EventReplayer: cannot recreate events of type " << record.type << std::endl;
+            ++m_numSkipped;
+            continue;
+        }
+
+        if (record.kind == EVENTRECORD_TRIGGERED)
+            eventManager.VTriggerEvent(pEvent);
+        else
+            eventManager.VQueueEvent(pEvent);
+        ++m_numEvents;
+    }
+
+    // the log ended inside a frame (e.g. the process died), process what was sent
+    m_pos = m_end;
+    eventManager.VUpdateMicros(IEventManager::kINFINITE);
+    return true;
+}
+
+uint32_t EventReplayer::ReplayAll(IEventManager& eventManager)
+{
+    uint32_t frames = 0;
+    while (ReplayFrame(eventManager))
+        ++frames;
+    return frames;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <string>
+#include <unordered_set>
+#include "EventManager.h"
+#include "utils/mapped_file.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+// Event log file layout: an EventLogHeader followed by records, each an EventRecordHeader and its payload.  Records
+// are written in the order events reach the EventManager; a frame record marks every VUpdate call.
+//---------------------------------------------------------------------------------------------------------------------
+enum EventRecordKind
+{
+    EVENTRECORD_NONE,       // zeroed file space, ends the log
+    EVENTRECORD_QUEUED,
+    EVENTRECORD_TRIGGERED,
+    EVENTRECORD_FRAME,      // payload: uint32_t time budget in microseconds
+};
+
+enum EventRecordFlags
+{
+    // Sent from inside a listener.  A replay with the same listeners produces these events again.
+    EVENTRECORD_NESTED = 0x1,
+};
+
+struct EventLogHeader
+{
+    char magic[4];          // "EVLG"
+    uint32_t version;
+    uint64_t dataSize;      // bytes of records after the header, updated with every record
+};
+
+struct EventRecordHeader
+{
+    uint32_t size;          // payload bytes
+    uint8_t kind;           // EventRecordKind
+    uint8_t flags;          // EventRecordFlags
+    uint16_t reserved;
+    uint64_t type;
+};
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Writes every event passing through an EventManager to a memory-mapped log file, see EventManager::SetRecorder().
+// The file grows in large steps and is trimmed when closed; the header always holds the size of the complete records,
+// so the log stays readable if the process dies.
+//---------------------------------------------------------------------------------------------------------------------
+class EventRecorder
+{
+    MappedFile m_file;
+    size_t m_used;
+    EventWriter m_writer;
+    uint32_t m_numEvents;
+    uint32_t m_numFrames;
+
+public:
+    EventRecorder(void);
+    ~EventRecorder(void);
+
+    bool Open(const std::string& path);
+    void Close(void);
+    bool IsOpen(void) const { return m_file.isOpen(); }
+
+    void RecordEvent(const IEventData& event, EventRecordKind kind, bool nested);
+    void RecordFrame(unsigned long maxMicros);
+
+    uint32_t GetNumEvents(void) const { return m_numEvents; }
+    uint32_t GetNumFrames(void) const { return m_numFrames; }
+
+private:
+    void Append(EventRecordKind kind, uint8_t flags, uint64_t type, const void* pPayload, size_t size);
+};
+
+
+//---------------------------------------------------------------------------------------------------------------------
+// Feeds a recorded event log back into an event manager as fast as it can take it.  Events are recreated through an
+// EventFactory, so every recorded type needs to be registered there (REGISTER_EVENT); others are skipped.
+//
+// By default nested events are left out, since the listeners produce them again; SetReplayNested(true) replays them
+// too, e.g. when the listeners that sent them are not present.
+//---------------------------------------------------------------------------------------------------------------------
+class EventReplayer
+{
+    MappedFile m_file;
+    size_t m_pos;
+    size_t m_end;
+    const EventFactory& m_factory;
+    bool m_replayNested;
+    bool m_ignoreBudget;
+    uint32_t m_numEvents;
+    uint32_t m_numSkipped;
+    std::unordered_set<uint64_t> m_unknownTypes;
+
+public:
+    explicit EventReplayer(const EventFactory& factory = g_eventFactory);
+
+    bool Open(const std::string& path);
+    void Close(void);
+    bool IsFinished(void) const { return m_pos >= m_end; }
+
+    void SetReplayNested(bool replayNested) { m_replayNested = replayNested; }
+
+    // Runs every frame with an unlimited budget instead of the recorded one.
+    void SetIgnoreBudget(bool ignoreBudget) { m_ignoreBudget = ignoreBudget; }
+
+    // Sends the events of the next frame and updates the event manager.  Returns false once the log is finished.
+    bool ReplayFrame(IEventManager& eventManager);
+
+    // Replays the rest of the log, returns the number of frames.
+    uint32_t ReplayAll(IEventManager& eventManager);
+
+    uint32_t GetNumEvents(void) const { return m_numEvents; }
+    uint32_t GetNumSkipped(void) const { return m_numSkipped; }
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <type_traits>
+
+//---------------------------------------------------------------------------------------------------------------------
+// Binary event serialization, see IEventData::VSerialize / VDeserialize.
+//
+// Values are stored in native byte order without padding or tags; an event reads back exactly what it wrote, in the
+// same order.  Strings are a uint32_t length followed by the bytes.
+//---------------------------------------------------------------------------------------------------------------------
+class EventWriter
+{
+    std::vector<uint8_t> m_buffer;  // reused between events, only ever grows
+    size_t m_size;
+
+public:
+    EventWriter(void) : m_size(0) { }
+
+    // Starts a new event, keeping the memory.
+    void Reset(void) { m_size = 0; }
+
+    const uint8_t* GetData(void) const { return m_buffer.data(); }
+    size_t GetSize(void) const { return m_size; }
+
+    // Returns space for the given number of bytes, valid until the next write.
+    uint8_t* Reserve(size_t bytes)
+    {
+        if (m_size + bytes > m_buffer.size())
+            m_buffer.resize((m_size + bytes) * 2);
+
+        uint8_t* p = m_buffer.data() + m_size;
+        m_size += bytes;
+        return p;
+    }
+
+    template <class T>
+    void Write(const T& value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "EventWriter::Write needs a trivially copyable type");
+        memcpy(Reserve(sizeof(T)), &value, sizeof(T));
+    }
+
+    void WriteBytes(const void* pData, size_t bytes)
+    {
+        if (bytes)
+            memcpy(Reserve(bytes), pData, bytes);
+    }
+
+    void WriteString(const char* pString, size_t length)
+    {
+        Write((uint32_t)length);
+        WriteBytes(pString, length);
+    }
+
+    void WriteString(const std::string& str) { WriteString(str.data(), str.size()); }
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+// Reads events written by EventWriter straight from memory (e.g. a mapped event log) without copying it.  Reading past
+// the end fails and sets the reader to a failed state that later reads keep.
+//---------------------------------------------------------------------------------------------------------------------
+class EventReader
+{
+    const uint8_t* m_pData;
+    size_t m_size;
+    size_t m_pos;
+    bool m_ok;
+
+public:
+    EventReader(const void* pData, size_t size) : m_pData(static_cast<const uint8_t*>(pData)), m_size(size), m_pos(0), m_ok(true) { }
+
+    bool IsOk(void) const { return m_ok; }
+    size_t GetRemaining(void) const { return m_size - m_pos; }
+
+    // Returns a pointer to the next bytes in the source memory, or nullptr if there are not enough left.
+    const uint8_t* ReadBytes(size_t bytes)
+    {
+        if (!m_ok || bytes > m_size - m_pos)
+        {
+            m_ok = false;
+            return nullptr;
+        }
+
+        const uint8_t* p = m_pData + m_pos;
+        m_pos += bytes;
+        return p;
+    }
+
+    template <class T>
+    bool Read(T& value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "EventReader::Read needs a trivially copyable type");
+        const uint8_t* p = ReadBytes(sizeof(T));
+        if (!p)
+            return false;
+
+        memcpy(&value, p, sizeof(T));
+        return true;
+    }
+
+    // Zero-copy: the string points into the source memory and is not terminated.
+    bool ReadString(const char*& pString, uint32_t& length)
+    {
+        if (!Read(length))
+            return false;
+
+        pString = reinterpret_cast<const char*>(ReadBytes(length));
+        return pString != nullptr;
+    }
+
+    bool ReadString(std::string& str)
+    {
+        const char* pString;
+        uint32_t length;
+        if (!ReadString(pString, length))
+            return false;
+
+        str.assign(pString, length);
+        return true;
+    }
+};
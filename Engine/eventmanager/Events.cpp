@@ -16,5 +16,7 @@ bool EvtData_ScriptEventTest_FromLua::VBuildEventFromScript(void)
 
 void RegisterScriptEvents(void)
 {
-	REGISTER_SCRIPT_EVENT(EvtData_ScriptEventTest_FromLua, EvtData_ScriptEventTest_FromLua::sk_EventType);
+	REGISTER_SCRIPT_EVENT(EvtData_ScriptEventTest_FromLua, EvtData_ScriptEventTest_FromLua::sk_EventType,
+		{ "num", SCRIPT_FIELD_INTEGER });
+	REGISTER_EVENT(EvtData_ScriptEventTest_FromLua);
 }
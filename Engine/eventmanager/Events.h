@@ -17,13 +17,16 @@ public:
 
 	virtual IEventDataPtr VCopy(void) const
 	{
-		std::shared_ptr<EvtData_ScriptEventTest_FromLua> pCopy(new EvtData_ScriptEventTest_FromLua(m_num));
+		std::shared_ptr<EvtData_ScriptEventTest_FromLua> pCopy(MakeEvent<EvtData_ScriptEventTest_FromLua>(m_num));
 		pCopy->m_eventData = m_eventData;
 		return pCopy;
 	}
 
 	virtual const char* GetName(void) const { return "EvtData_ScriptEventTest_FromLua"; }
 
+	virtual void VSerialize(EventWriter& out) const { out.Write(m_num); }
+	virtual bool VDeserialize(EventReader& in) { return in.Read(m_num); }
+
 	int GetNum(void) { return m_num; }
 
 protected:
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+
+#define MPSCQUEUE_CACHE_LINE_SIZE 64
+
+/*
+	Bounded lock-free multi-producer / single-consumer queue.
+
+	Drop-in alternative to concurrentqueue<T> for the case where any number
+	of threads push and exactly one thread (usually the main thread) pops.
+	Producers claim a slot with one CAS on the enqueue position, the consumer
+	never takes a lock and can drain the whole backlog in one pass with
+	pop_all() / consume_all().
+
+	Each cell carries a sequence number (D. Vyukov's bounded queue scheme):
+	  seq == pos          cell is free for the producer claiming 'pos'
+	  seq == pos + 1      cell holds the item published for 'pos'
+	  seq == pos + size   cell was consumed and is free for the next lap
+
+	T must be default constructible and move assignable.
+*/
+template <typename T>
+class mpscqueue
+{
+public:
+	// capacity is rounded up to the next power of two
+	explicit mpscqueue(size_t capacity = 4096)
+	{
+		size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+
+		mask_ = size - 1;
+		buffer_ = new cell[size];
+		for (size_t i = 0; i != size; i++)
+			buffer_[i].sequence.store(i, std::memory_order_relaxed);
+
+		enqueue_pos_.store(0, std::memory_order_relaxed);
+		dequeue_pos_ = 0;
+	}
+
+	~mpscqueue()
+	{
+		delete[] buffer_;
+	}
+
+	// Returns false if the queue is full
+	bool try_push(const T& item)
+	{
+		cell *c = claim();
+		if (!c)
+			return false;
+		publish(c, item);
+		return true;
+	}
+
+	bool try_push(T&& item)
+	{
+		cell *c = claim();
+		if (!c)
+			return false;
+		publish(c, std::move(item));
+		return true;
+	}
+
+	// Blocks (yielding) while the queue is full
+	void push(const T& item)
+	{
+		cell *c;
+		while (!(c = claim()))
+			std::this_thread::yield();
+		publish(c, item);
+	}
+
+	void push(T&& item)
+	{
+		cell *c;
+		while (!(c = claim()))
+			std::this_thread::yield();
+		publish(c, std::move(item));
+	}
+
+	// Consumer side; must only be called from one thread at a time
+	bool try_pop(T& item)
+	{
+		cell *c = &buffer_[dequeue_pos_ & mask_];
+		size_t seq = c->sequence.load(std::memory_order_acquire);
+		if (seq != dequeue_pos_ + 1)
+			return false;
+
+		release(c, item);
+		return true;
+	}
+
+	void wait_and_pop(T& item)
+	{
+		while (!try_pop(item))
+			std::this_thread::yield();
+	}
+
+	// Calls f(T&&) for every item published so far, returns the item count.
+	// Items pushed while draining may or may not be included.
+	template <typename F>
+	size_t consume_all(F f)
+	{
+		size_t count = 0;
+		T item;
+		while (try_pop(item)) {
+			f(std::move(item));
+			count++;
+		}
+		return count;
+	}
+
+	// Appends the whole backlog to 'out', returns the item count
+	size_t pop_all(std::vector<T>& out)
+	{
+		return consume_all([&out](T&& item) { out.push_back(std::move(item)); });
+	}
+
+	bool empty() const
+	{
+		const cell *c = &buffer_[dequeue_pos_ & mask_];
+		return c->sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1;
+	}
+
+	size_t capacity() const { return mask_ + 1; }
+
+private:
+	struct cell
+	{
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	cell *claim()
+	{
+		size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+		for (;;) {
+			cell *c = &buffer_[pos & mask_];
+			size_t seq = c->sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if (diff == 0) {
+				if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+						std::memory_order_relaxed))
+					return c;
+			} else if (diff < 0) {
+				// the consumer has not freed this cell yet: full
+				return nullptr;
+			} else {
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	template <typename U>
+	void publish(cell *c, U&& item)
+	{
+		size_t pos = c->sequence.load(std::memory_order_relaxed);
+		c->data = std::forward<U>(item);
+		c->sequence.store(pos + 1, std::memory_order_release);
+	}
+
+	void release(cell *c, T& item)
+	{
+		item = std::move(c->data);
+		c->data = T(); // drop references held by the slot right away
+		c->sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+		dequeue_pos_++;
+	}
+
+	mpscqueue(const mpscqueue&) = delete;
+	mpscqueue& operator=(const mpscqueue&) = delete;
+
+	// producers and the consumer write to different cache lines
+	char pad0_[MPSCQUEUE_CACHE_LINE_SIZE];
+	cell *buffer_;
+	size_t mask_;
+	char pad1_[MPSCQUEUE_CACHE_LINE_SIZE];
+	std::atomic<size_t> enqueue_pos_;
+	char pad2_[MPSCQUEUE_CACHE_LINE_SIZE];
+	size_t dequeue_pos_;
+	char pad3_[MPSCQUEUE_CACHE_LINE_SIZE];
+};
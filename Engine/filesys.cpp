@@ -799,6 +799,8 @@ bool ReadFile(const std::string &path, std::string &out)
 	out.resize(size);
 	is.seekg(0);
 	is.read(&out[0], size);
+	// the file may have shrunk since its size was taken
+	out.resize((size_t)is.gcount());
 
 	return true;
 }
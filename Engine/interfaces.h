@@ -8,6 +8,21 @@ class Component;
 typedef unsigned int ActorId;
 typedef unsigned int ComponentId;
 
+// An ActorId is a generational handle: the low ACTOR_INDEX_BITS select the actor's slot in the ActorManager, the
+// remaining bits count how often that slot has been reused, so the handle of a destroyed actor never resolves to the
+// actor that took over its slot.  Generations start at 1, so 0 is never a valid handle.
+const unsigned int ACTOR_INDEX_BITS = 20;
+const unsigned int ACTOR_INDEX_MASK = (1u << ACTOR_INDEX_BITS) - 1;
+const unsigned int ACTOR_GENERATION_MASK = (1u << (32 - ACTOR_INDEX_BITS)) - 1;
+const ActorId INVALID_ACTOR_ID = 0;
+
+inline unsigned int ActorIndex(ActorId id) { return id & ACTOR_INDEX_MASK; }
+inline unsigned int ActorGeneration(ActorId id) { return id >> ACTOR_INDEX_BITS; }
+inline ActorId MakeActorId(unsigned int index, unsigned int generation)
+{
+	return (ActorId)((generation & ACTOR_GENERATION_MASK) << ACTOR_INDEX_BITS) | (index & ACTOR_INDEX_MASK);
+}
+
 typedef std::shared_ptr<Actor> StrongActorPtr;
 typedef std::weak_ptr<Actor> WeakActorPtr;
 typedef std::shared_ptr<Component> StrongActorComponentPtr;
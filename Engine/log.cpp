@@ -11,9 +11,11 @@
 #include <algorithm>
 #include <cerrno>
 #include <cstring>
+#include <condition_variable>
 
 const int BUFFER_LENGTH = 256;
 
+// Collects a line in place, hands it on at the end of line or when full
 class StringBuffer : public std::streambuf {
 public:
 	StringBuffer() {
@@ -26,8 +28,12 @@ public:
 	void push_back(char c);
 
 private:
+	void append(const char *s, size_t n);
+	void endLine();
+
 	char buffer[BUFFER_LENGTH];
 	int buffer_index;
+	std::string line;	// keeps its capacity from line to line
 };
 
 
@@ -59,29 +65,25 @@ Logger g_logger;
 
 StreamLogOutput stdout_output(std::cout);
 StreamLogOutput stderr_output(std::cerr);
-std::ostream null_stream(NULL);
-
-RawLogBuffer raw_buf;
+thread_local std::ostream null_stream(NULL);
 
-LogBuffer none_buf(g_logger, LL_NONE);
-LogBuffer error_buf(g_logger, LL_ERROR);
-LogBuffer warning_buf(g_logger, LL_WARNING);
-LogBuffer action_buf(g_logger, LL_ACTION);
-LogBuffer info_buf(g_logger, LL_INFO);
-LogBuffer verbose_buf(g_logger, LL_VERBOSE);
+thread_local RawLogBuffer raw_buf;
 
-// Connection
-std::ostream *dout_con_ptr = &null_stream;
-std::ostream *derr_con_ptr = &verbosestream;
+thread_local LogBuffer none_buf(g_logger, LL_NONE);
+thread_local LogBuffer error_buf(g_logger, LL_ERROR);
+thread_local LogBuffer warning_buf(g_logger, LL_WARNING);
+thread_local LogBuffer action_buf(g_logger, LL_ACTION);
+thread_local LogBuffer info_buf(g_logger, LL_INFO);
+thread_local LogBuffer verbose_buf(g_logger, LL_VERBOSE);
 
 // Common streams
-std::ostream rawstream(&raw_buf);
-std::ostream dstream(&none_buf);
-std::ostream errorstream(&error_buf);
-std::ostream warningstream(&warning_buf);
-std::ostream actionstream(&action_buf);
-std::ostream infostream(&info_buf);
-std::ostream verbosestream(&verbose_buf);
+thread_local std::ostream rawstream(&raw_buf);
+thread_local std::ostream dstream(&none_buf);
+thread_local std::ostream t_errorstream(&error_buf);
+thread_local std::ostream t_warningstream(&warning_buf);
+thread_local std::ostream t_actionstream(&action_buf);
+thread_local std::ostream t_infostream(&info_buf);
+thread_local std::ostream t_verbosestream(&verbose_buf);
 
 // Android
 #ifdef __ANDROID__
@@ -123,10 +125,512 @@ AndroidSystemLogOutput g_android_log_output;
 ///////////////////////////////////////////////////////////////////////////////
 
 
+// Same as getTimestamp(), formatted once a second per thread
+static const std::string &getLogTimestamp()
+{
+	struct CachedTimestamp {
+		time_t time = -1;
+		std::string text;
+	};
+	static thread_local CachedTimestamp cached;
+
+	time_t t = time(NULL);
+	if (t != cached.time) {
+		struct tm tm;
+#ifdef _WIN32
+		localtime_s(&tm, &t);
+#else
+		localtime_r(&t, &tm);
+#endif
+		char cs[20]; // YYYY-MM-DD HH:MM:SS + '\0'
+		strftime(cs, 20, "%Y-%m-%d %H:%M:%S", &tm);
+		cached.time = t;
+		cached.text = cs;
+	}
+	return cached.text;
+}
+
+
+////
+//// Async logging
+////
+
+struct LogRecordHeader {
+	uint32_t size;		// of the whole record, multiple of 8
+	uint8_t level;
+	uint8_t flags;
+	uint16_t time_len;	// the combined line starts with the timestamp
+	uint32_t thread_pos;
+	uint16_t thread_len;
+	uint16_t reserved;
+	uint32_t text_pos;
+	uint32_t line_len;
+	uint64_t time_ns;
+};
+
+static_assert(sizeof(LogRecordHeader) == 32, "log record header should stay small");
+
+enum {
+	LOG_RECORD_RAW = 1,		// logRaw(), only line_len is valid
+	LOG_RECORD_PADDING = 2,	// skip to the start of the buffer
+};
+
+/*
+	Byte ring written by one logging thread and read by the writer thread.
+	head and tail count bytes since creation; a record never wraps, the
+	rest of the buffer is skipped instead (marked by a padding record when
+	there is room for its header).
+*/
+struct LogRing {
+	explicit LogRing(size_t capacity) :
+		data(new char[capacity]),
+		mask(capacity - 1),
+		head(0),
+		tail(0),
+		busy(false),
+		closed(false)
+	{}
+
+	size_t capacity() const { return mask + 1; }
+
+	std::unique_ptr<char[]> data;
+	size_t mask;
+
+	// written by the logging thread
+	std::atomic<uint64_t> head;
+	char pad1[64];
+	// written by the writer thread
+	std::atomic<uint64_t> tail;
+	char pad2[64];
+
+	// the owner is between checking Logger::m_async and publishing a record
+	std::atomic<bool> busy;
+	// the owning thread has exited, the writer frees the ring once it is empty
+	std::atomic<bool> closed;
+};
+
+static inline size_t logRecordSize(size_t line_len)
+{
+	return (sizeof(LogRecordHeader) + line_len + 7) & ~(size_t)7;
+}
+
+// Bumped when any thread name changes, invalidates the cached names
+static std::atomic<uint32_t> s_thread_names_version(0);
+
+// Logger session a thread's ring belongs to; a new one after each startAsync
+static std::atomic<uint64_t> s_next_log_session(1);
+
+class LogAsyncWriter {
+public:
+	LogAsyncWriter(Logger &logger) :
+		m_logger(logger),
+		m_session(0),
+		m_ring_size(0),
+		m_policy(LOG_ASYNC_BLOCK),
+		m_dropped(0),
+		m_reported_dropped(0),
+		m_quit(false),
+		m_flush_requested(0),
+		m_flush_done(0)
+	{}
+
+	void start(size_t ring_size, LogAsyncPolicy policy)
+	{
+		// rings are power-of-two sized and hold a few of the longest records
+		size_t capacity = 4096;
+		while (capacity < ring_size)
+			capacity *= 2;
+		m_ring_size = capacity;
+		m_policy = policy;
+		m_dropped.store(0);
+		m_reported_dropped = 0;
+		m_quit = false;
+		m_session = s_next_log_session++;
+		{
+			// rings of threads that raced the last stop
+			MutexAutoLock lock(m_rings_mutex);
+			m_rings.clear();
+		}
+		m_thread = std::thread(&LogAsyncWriter::run, this);
+	}
+
+	// Called after Logger::m_async was cleared: no record is started anymore.
+	void stop()
+	{
+		{
+			MutexAutoLock lock(m_wake_mutex);
+			m_quit = true;
+		}
+		m_wake.notify_one();
+		m_thread.join();
+
+		MutexAutoLock lock(m_rings_mutex);
+		m_rings.clear();
+	}
+
+	LogRing *getRing();
+	bool push(LogRing &ring, LogLevel lev, uint8_t flags, const std::string &line,
+		size_t time_len, size_t thread_pos, size_t thread_len, size_t text_pos);
+
+	void flush()
+	{
+		MutexAutoLock lock(m_wake_mutex);
+		if (m_quit)
+			return;
+		uint64_t request = ++m_flush_requested;
+		m_wake.notify_one();
+		m_flushed.wait(lock, [this, request]() { return m_flush_done >= request; });
+	}
+
+	uint64_t getDropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+	void wake()
+	{
+		m_wake.notify_one();
+	}
+
+private:
+	struct Entry {
+		uint64_t time_ns;
+		const LogRecordHeader *header;
+	};
+
+	void run();
+	bool writeBatch();
+	void reportDropped();
+
+	Logger &m_logger;
+	std::atomic<uint64_t> m_session;
+	size_t m_ring_size;
+	LogAsyncPolicy m_policy;
+	std::atomic<uint64_t> m_dropped;
+	uint64_t m_reported_dropped;
+
+	std::mutex m_rings_mutex;
+	std::vector<std::shared_ptr<LogRing> > m_rings;
+
+	std::thread m_thread;
+	std::mutex m_wake_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_flushed;
+	bool m_quit;
+	uint64_t m_flush_requested;
+	uint64_t m_flush_done;
+
+	// writer thread only
+	std::vector<Entry> m_batch;
+	std::vector<uint64_t> m_batch_ends;
+	std::string m_combined, m_time, m_thread_name, m_text;
+};
+
+// Ring of the calling thread in the current session of a writer
+struct LogThreadRing {
+	uint64_t session = 0;
+	std::shared_ptr<LogRing> ring;
+
+	~LogThreadRing()
+	{
+		if (ring)
+			ring->closed.store(true, std::memory_order_release);
+	}
+};
+
+static thread_local LogThreadRing t_log_ring;
+
+LogRing *LogAsyncWriter::getRing()
+{
+	LogThreadRing &local = t_log_ring;
+	uint64_t session = m_session.load(std::memory_order_relaxed);
+	if (local.session == session)
+		return local.ring.get();
+
+	if (local.ring)
+		local.ring->closed.store(true, std::memory_order_release);
+	local.session = session;
+	local.ring = std::make_shared<LogRing>(m_ring_size);
+
+	MutexAutoLock lock(m_rings_mutex);
+	m_rings.push_back(local.ring);
+	return local.ring.get();
+}
+
+bool LogAsyncWriter::push(LogRing &ring, LogLevel lev, uint8_t flags, const std::string &line,
+	size_t time_len, size_t thread_pos, size_t thread_len, size_t text_pos)
+{
+	size_t size = logRecordSize(line.size());
+	if (size > ring.capacity() / 4)
+		return false;
+
+	uint64_t head = ring.head.load(std::memory_order_relaxed);
+	size_t offset = (size_t)head & ring.mask;
+	size_t contiguous = ring.capacity() - offset;
+	size_t needed = size <= contiguous ? size : contiguous + size;
+
+	if (ring.capacity() - (head - ring.tail.load(std::memory_order_acquire)) < needed) {
+		// full: drop what can be missed, wait for the writer otherwise
+		if (m_policy == LOG_ASYNC_DROP && lev > LL_WARNING) {
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+		wake();
+		while (ring.capacity() - (head - ring.tail.load(std::memory_order_acquire)) < needed)
+			std::this_thread::yield();
+	}
+
+	if (size > contiguous) {
+		if (contiguous >= sizeof(LogRecordHeader)) {
+			LogRecordHeader padding = LogRecordHeader();
+			padding.size = (uint32_t)contiguous;
+			padding.flags = LOG_RECORD_PADDING;
+			memcpy(&ring.data[offset], &padding, sizeof(padding));
+		}
+		head += contiguous;
+		offset = 0;
+	}
+
+	LogRecordHeader header;
+	header.size = (uint32_t)size;
+	header.level = (uint8_t)lev;
+	header.flags = flags;
+	header.time_len = (uint16_t)time_len;
+	header.thread_pos = (uint32_t)thread_pos;
+	header.thread_len = (uint16_t)thread_len;
+	header.reserved = 0;
+	header.text_pos = (uint32_t)text_pos;
+	header.line_len = (uint32_t)line.size();
+	header.time_ns = getTimeNs();
+	memcpy(&ring.data[offset], &header, sizeof(header));
+	memcpy(&ring.data[offset + sizeof(header)], line.data(), line.size());
+	ring.head.store(head + size, std::memory_order_release);
+
+	// the writer also wakes up by itself every few milliseconds
+	if (lev <= LL_ERROR || (head + size - ring.tail.load(std::memory_order_relaxed)) * 2 > ring.capacity())
+		wake();
+	return true;
+}
+
+void LogAsyncWriter::run()
+{
+	for (;;) {
+		uint64_t flush_request;
+		bool quit;
+		{
+			MutexAutoLock lock(m_wake_mutex);
+			if (!m_quit && m_flush_done == m_flush_requested)
+				m_wake.wait_for(lock, std::chrono::milliseconds(5));
+			flush_request = m_flush_requested;
+			quit = m_quit;
+		}
+
+		writeBatch();
+
+		if (quit) {
+			// last records of threads that got past the m_async check
+			for (;;) {
+				bool busy = false;
+				{
+					MutexAutoLock lock(m_rings_mutex);
+					for (auto it = m_rings.begin(); it != m_rings.end(); ++it)
+						busy = busy || (*it)->busy.load();
+				}
+				if (!writeBatch() && !busy)
+					break;
+				std::this_thread::yield();
+			}
+			flush_request = m_flush_requested;
+		}
+
+		if (flush_request != m_flush_done) {
+			MutexAutoLock lock(m_wake_mutex);
+			m_flush_done = flush_request;
+			m_flushed.notify_all();
+		}
+		if (quit)
+			break;
+	}
+}
+
+bool LogAsyncWriter::writeBatch()
+{
+	// rings with records up to their current head, without copying them out
+	std::vector<std::shared_ptr<LogRing> > rings;
+	{
+		MutexAutoLock lock(m_rings_mutex);
+		rings = m_rings;
+	}
+
+	m_batch.clear();
+	m_batch_ends.resize(rings.size());
+	for (size_t i = 0; i < rings.size(); i++) {
+		LogRing &ring = *rings[i];
+		uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+		uint64_t head = ring.head.load(std::memory_order_acquire);
+		while (tail < head) {
+			size_t offset = (size_t)tail & ring.mask;
+			size_t contiguous = ring.capacity() - offset;
+			if (contiguous < sizeof(LogRecordHeader)) {
+				tail += contiguous;
+				continue;
+			}
+			const LogRecordHeader *header = (const LogRecordHeader *)&ring.data[offset];
+			if (!(header->flags & LOG_RECORD_PADDING)) {
+				Entry entry = { header->time_ns, header };
+				m_batch.push_back(entry);
+			}
+			tail += header->size;
+		}
+		m_batch_ends[i] = tail;
+	}
+
+	if (!m_batch.empty()) {
+		// each ring is in time order already
+		std::stable_sort(m_batch.begin(), m_batch.end(),
+			[](const Entry &a, const Entry &b) { return a.time_ns < b.time_ns; });
+
+		MutexAutoLock lock(m_logger.m_mutex);
+		for (auto it = m_batch.begin(); it != m_batch.end(); ++it) {
+			const LogRecordHeader &header = *it->header;
+			const char *line = (const char *)(&header + 1);
+			LogLevel lev = (LogLevel)header.level;
+			std::vector<ILogOutput *> &outputs = m_logger.m_outputs[lev];
+
+			m_combined.assign(line, header.line_len);
+			if (header.flags & LOG_RECORD_RAW) {
+				for (size_t i = 0; i != outputs.size(); i++)
+					outputs[i]->logRaw(lev, m_combined);
+				continue;
+			}
+			m_time.assign(line, header.time_len);
+			m_thread_name.assign(line + header.thread_pos, header.thread_len);
+			m_text.assign(line + header.text_pos, header.line_len - header.text_pos);
+			for (size_t i = 0; i != outputs.size(); i++)
+				outputs[i]->log(lev, m_combined, m_time, m_thread_name, m_text);
+		}
+		reportDropped();
+		m_logger.flushOutputs();
+	} else if (m_reported_dropped != getDropped()) {
+		MutexAutoLock lock(m_logger.m_mutex);
+		reportDropped();
+		m_logger.flushOutputs();
+	}
+
+	for (size_t i = 0; i < rings.size(); i++)
+		rings[i]->tail.store(m_batch_ends[i], std::memory_order_release);
+
+	// forget rings of exited threads once they are written out
+	{
+		MutexAutoLock lock(m_rings_mutex);
+		for (size_t i = 0; i < m_rings.size();) {
+			LogRing &ring = *m_rings[i];
+			if (ring.closed.load(std::memory_order_acquire) &&
+					ring.tail.load(std::memory_order_relaxed) == ring.head.load(std::memory_order_acquire)) {
+				m_rings[i] = m_rings.back();
+				m_rings.pop_back();
+			} else {
+				i++;
+			}
+		}
+	}
+
+	return !m_batch.empty();
+}
+
+// Called with the logger mutex held
+void LogAsyncWriter::reportDropped()
+{
+	uint64_t dropped = getDropped();
+	if (dropped == m_reported_dropped)
+		return;
+
+	std::ostringstream os(std::ios_base::binary);
+	os << (dropped - m_reported_dropped) << " log records dropped, the async log buffer was full";
+	m_reported_dropped = dropped;
+
+	m_time = getLogTimestamp();
+	m_thread_name = "LogWriter";
+	m_text = os.str();
+	m_combined = m_time + ": " + Logger::getLevelLabel(LL_WARNING) + "[" + m_thread_name + "]: " + m_text;
+	std::vector<ILogOutput *> &outputs = m_logger.m_outputs[LL_WARNING];
+	for (size_t i = 0; i != outputs.size(); i++)
+		outputs[i]->log(LL_WARNING, m_combined, m_time, m_thread_name, m_text);
+}
+
+
 ////
 //// Logger
 ////
 
+Logger::Logger() :
+	m_trace_enabled(false),
+	m_async(false)
+{
+	for (size_t i = 0; i < LL_MAX; i++)
+		m_silenced_levels[i] = false;
+	// a new logger may reuse the address of one whose names are cached
+	s_thread_names_version++;
+}
+
+Logger::~Logger()
+{
+	stopAsync();
+}
+
+void Logger::startAsync(size_t ring_size, LogAsyncPolicy policy)
+{
+	if (isAsync())
+		return;
+	if (!m_async_writer)
+		m_async_writer.reset(new LogAsyncWriter(*this));
+	m_async_writer->start(ring_size, policy);
+	m_async.store(true);
+}
+
+void Logger::stopAsync()
+{
+	if (!isAsync())
+		return;
+	// pairs with the busy flag in logAsync
+	m_async.store(false);
+	m_async_writer->stop();
+}
+
+void Logger::flushAsync()
+{
+	if (isAsync())
+		m_async_writer->flush();
+}
+
+uint64_t Logger::getAsyncDropped() const
+{
+	return m_async_writer ? m_async_writer->getDropped() : 0;
+}
+
+bool Logger::logAsync(LogLevel lev, bool raw, const std::string &line,
+	size_t time_len, size_t thread_pos, size_t thread_len, size_t text_pos)
+{
+	if (!isAsync())
+		return false;
+
+	LogAsyncWriter &writer = *m_async_writer;
+	LogRing *ring = writer.getRing();
+
+	// Announce the record before checking m_async again: stopAsync either
+	// sees the ring busy and waits for the record, or this sees it stopped.
+	ring->busy.store(true);
+	if (!m_async.load()) {
+		ring->busy.store(false);
+		return false;
+	}
+	bool queued = writer.push(*ring, lev, raw ? LOG_RECORD_RAW : 0, line,
+		time_len, thread_pos, thread_len, text_pos);
+	ring->busy.store(false, std::memory_order_release);
+
+	// too long for the ring, write it directly after what is queued
+	if (!queued)
+		writer.flush();
+	return queued;
+}
+
 LogLevel Logger::stringToLevel(const std::string &name)
 {
 	if (name == "none")
@@ -152,11 +656,13 @@ void Logger::addOutput(ILogOutput *out)
 
 void Logger::addOutput(ILogOutput *out, LogLevel lev)
 {
+	MutexAutoLock lock(m_mutex);
 	m_outputs[lev].push_back(out);
 }
 
 void Logger::addOutputMasked(ILogOutput *out, LogLevelMask mask)
 {
+	MutexAutoLock lock(m_mutex);
 	for (size_t i = 0; i < LL_MAX; i++) {
 		if (mask & LOGLEVEL_TO_MASKLEVEL(i))
 			m_outputs[i].push_back(out);
@@ -166,6 +672,7 @@ void Logger::addOutputMasked(ILogOutput *out, LogLevelMask mask)
 void Logger::addOutputMaxLevel(ILogOutput *out, LogLevel lev)
 {
 	assert(lev < LL_MAX);
+	MutexAutoLock lock(m_mutex);
 	for (size_t i = 0; i <= lev; i++)
 		m_outputs[i].push_back(out);
 }
@@ -173,6 +680,7 @@ void Logger::addOutputMaxLevel(ILogOutput *out, LogLevel lev)
 LogLevelMask Logger::removeOutput(ILogOutput *out)
 {
 	LogLevelMask ret_mask = 0;
+	MutexAutoLock lock(m_mutex);
 	for (size_t i = 0; i < LL_MAX; i++) {
 		std::vector<ILogOutput *>::iterator it;
 
@@ -195,6 +703,7 @@ void Logger::registerThread(const std::string &name)
 	std::thread::id id = std::this_thread::get_id();
 	MutexAutoLock lock(m_mutex);
 	m_thread_names[id] = name;
+	s_thread_names_version++;
 }
 
 void Logger::deregisterThread()
@@ -202,6 +711,7 @@ void Logger::deregisterThread()
 	std::thread::id id = std::this_thread::get_id();
 	MutexAutoLock lock(m_mutex);
 	m_thread_names.erase(id);
+	s_thread_names_version++;
 }
 
 const std::string Logger::getLevelLabel(LogLevel lev)
@@ -222,18 +732,40 @@ const std::string Logger::getLevelLabel(LogLevel lev)
 
 LogColor Logger::color_mode = LOG_COLOR_AUTO;
 
-const std::string Logger::getThreadName()
+// Name of the calling thread, looked up again after any thread was renamed
+struct LogThreadName {
+	const Logger *logger = nullptr;
+	uint32_t version = 0;
+	std::string name;
+};
+
+static thread_local LogThreadName t_log_thread_name;
+
+// Line being formatted by the calling thread, reused to avoid allocating
+static thread_local std::string t_log_line;
+
+const std::string &Logger::getThreadName()
 {
-	std::map<std::thread::id, std::string>::const_iterator it;
+	LogThreadName &cached = t_log_thread_name;
+	uint32_t version = s_thread_names_version.load(std::memory_order_acquire);
+	if (cached.logger == this && cached.version == version)
+		return cached.name;
 
 	std::thread::id id = std::this_thread::get_id();
-	it = m_thread_names.find(id);
-	if (it != m_thread_names.end())
-		return it->second;
-
-	std::ostringstream os;
-	os << "#0x" << std::hex << id;
-	return os.str();
+	{
+		MutexAutoLock lock(m_mutex);
+		std::map<std::thread::id, std::string>::const_iterator it = m_thread_names.find(id);
+		if (it != m_thread_names.end()) {
+			cached.name = it->second;
+		} else {
+			std::ostringstream os;
+			os << "#0x" << std::hex << id;
+			cached.name = os.str();
+		}
+	}
+	cached.logger = this;
+	cached.version = version;
+	return cached.name;
 }
 
 void Logger::log(LogLevel lev, const std::string &text)
@@ -241,13 +773,23 @@ void Logger::log(LogLevel lev, const std::string &text)
 	if (m_silenced_levels[lev])
 		return;
 
-	const std::string thread_name = getThreadName();
-	const std::string label = getLevelLabel(lev);
-	const std::string timestamp = getTimestamp();
-	std::ostringstream os(std::ios_base::binary);
-	os << timestamp << ": " << label << "[" << thread_name << "]: " << text;
+	const std::string &thread_name = getThreadName();
+	std::string &line = t_log_line;
+	line = getLogTimestamp();
+	size_t time_len = line.size();
+	line += ": ";
+	line += getLevelLabel(lev);
+	line += "[";
+	size_t thread_pos = line.size();
+	line += thread_name;
+	line += "]: ";
+	size_t text_pos = line.size();
+	line += text;
+
+	if (logAsync(lev, false, line, time_len, thread_pos, thread_name.size(), text_pos))
+		return;
 
-	logToOutputs(lev, os.str(), timestamp, thread_name, text);
+	logToOutputs(lev, line, line.substr(0, time_len), thread_name, text);
 }
 
 void Logger::logRaw(LogLevel lev, const std::string &text)
@@ -255,14 +797,19 @@ void Logger::logRaw(LogLevel lev, const std::string &text)
 	if (m_silenced_levels[lev])
 		return;
 
+	if (logAsync(lev, true, text, 0, 0, 0, 0))
+		return;
+
 	logToOutputsRaw(lev, text);
 }
 
 void Logger::logToOutputsRaw(LogLevel lev, const std::string &line)
 {
 	MutexAutoLock lock(m_mutex);
-	for (size_t i = 0; i != m_outputs[lev].size(); i++)
+	for (size_t i = 0; i != m_outputs[lev].size(); i++) {
 		m_outputs[lev][i]->logRaw(lev, line);
+		m_outputs[lev][i]->flush();
+	}
 }
 
 void Logger::logToOutputs(LogLevel lev, const std::string &combined,
@@ -270,8 +817,26 @@ void Logger::logToOutputs(LogLevel lev, const std::string &combined,
 	const std::string &payload_text)
 {
 	MutexAutoLock lock(m_mutex);
-	for (size_t i = 0; i != m_outputs[lev].size(); i++)
+	for (size_t i = 0; i != m_outputs[lev].size(); i++) {
 		m_outputs[lev][i]->log(lev, combined, time, thread_name, payload_text);
+		m_outputs[lev][i]->flush();
+	}
+}
+
+// Called with m_mutex held
+void Logger::flushOutputs()
+{
+	// an output is usually registered for several levels, flush it once
+	std::vector<ILogOutput *> flushed;
+	for (size_t lev = 0; lev < LL_MAX; lev++) {
+		for (size_t i = 0; i != m_outputs[lev].size(); i++) {
+			ILogOutput *out = m_outputs[lev][i];
+			if (std::find(flushed.begin(), flushed.end(), out) == flushed.end()) {
+				out->flush();
+				flushed.push_back(out);
+			}
+		}
+	}
 }
 
 
@@ -296,6 +861,7 @@ void FileLogOutput::setFile(const std::string &filename, int64_t file_size_max)
 		remove(filename_secondary.c_str());
 		rename(filename.c_str(), filename_secondary.c_str());
 	}
+	m_stream.rdbuf()->pubsetbuf(m_buffer, sizeof(m_buffer));
 	m_stream.open(filename, std::ios::app | std::ios::ate);
 
 	if (!m_stream.good())
@@ -335,7 +901,7 @@ void StreamLogOutput::logRaw(LogLevel lev, const std::string &line)
 		}
 	}
 
-	m_stream << line << std::endl;
+	m_stream << line << '\n';
 
 	if (colored_message) {
 		// reset to white color
@@ -388,31 +954,57 @@ void LogOutputBuffer::logRaw(LogLevel lev, const std::string &line)
 
 int StringBuffer::overflow(int c)
 {
-	push_back(c);
-	return c;
+	if (c != traits_type::eof())
+		push_back(c);
+	return traits_type::not_eof(c);
 }
 
 
 std::streamsize StringBuffer::xsputn(const char *s, std::streamsize n)
 {
-	for (int i = 0; i < n; ++i)
-		push_back(s[i]);
+	// copy everything up to each line break at once
+	const char *end = s + n;
+	while (s != end) {
+		const char *line_end = s;
+		while (line_end != end && *line_end != '\n' && *line_end != '\r')
+			line_end++;
+		append(s, line_end - s);
+		if (line_end == end)
+			break;
+		endLine();
+		s = line_end + 1;
+	}
 	return n;
 }
 
 void StringBuffer::push_back(char c)
 {
-	if (c == '\n' || c == '\r') {
-		if (buffer_index)
-			flush(std::string(buffer, buffer_index));
-		buffer_index = 0;
-	} else {
-		buffer[buffer_index++] = c;
-		if (buffer_index >= BUFFER_LENGTH) {
-			flush(std::string(buffer, buffer_index));
-			buffer_index = 0;
-		}
+	if (c == '\n' || c == '\r')
+		endLine();
+	else
+		append(&c, 1);
+}
+
+void StringBuffer::append(const char *s, size_t n)
+{
+	while (n > 0) {
+		size_t count = (std::min)(n, (size_t)(BUFFER_LENGTH - buffer_index));
+		memcpy(buffer + buffer_index, s, count);
+		buffer_index += (int)count;
+		s += count;
+		n -= count;
+		if (buffer_index >= BUFFER_LENGTH)
+			endLine();
+	}
+}
+
+void StringBuffer::endLine()
+{
+	if (buffer_index) {
+		line.assign(buffer, buffer_index);
+		flush(line);
 	}
+	buffer_index = 0;
 }
 
 
@@ -1,16 +1,20 @@
 #pragma once
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <queue>
 #include <string>
 #include <fstream>
 #include <thread>
 #include <mutex>
+#include <vector>
 #if !defined(_WIN32)  // POSIX
 	#include <unistd.h>
 #endif
 
 class ILogOutput;
+class LogAsyncWriter;
 
 enum LogLevel {
 	LL_NONE, // Special level that is always printed
@@ -28,11 +32,23 @@ enum LogColor {
 	LOG_COLOR_AUTO,
 };
 
+// What a logging thread does when its async ring buffer is full
+enum LogAsyncPolicy {
+	// Drop action, info and verbose records (counted and reported);
+	// errors and warnings wait for the writer.
+	LOG_ASYNC_DROP,
+	// Every record waits for the writer.
+	LOG_ASYNC_BLOCK,
+};
+
 typedef uint8_t LogLevelMask;
 #define LOGLEVEL_TO_MASKLEVEL(x) (1 << x)
 
 class Logger {
 public:
+	Logger();
+	~Logger();
+
 	void addOutput(ILogOutput *out);
 	void addOutput(ILogOutput *out, LogLevel lev);
 	void addOutputMasked(ILogOutput *out, LogLevelMask mask);
@@ -42,6 +58,8 @@ public:
 
 	void registerThread(const std::string &name);
 	void deregisterThread();
+	// Name of the calling thread in log lines
+	const std::string &getThreadName();
 
 	void log(LogLevel lev, const std::string &text);
 	// Logs without a prefix
@@ -50,18 +68,34 @@ public:
 	void setTraceEnabled(bool enable) { m_trace_enabled = enable; }
 	bool getTraceEnabled() { return m_trace_enabled; }
 
+	// Async mode: logging threads format their records into per-thread
+	// lock-free ring buffers of ring_size bytes and a writer thread hands
+	// them to the outputs in batches, ordered by time. Outputs are only
+	// called from the writer thread while it is running.
+	void startAsync(size_t ring_size, LogAsyncPolicy policy);
+	// Writes out everything queued and goes back to logging synchronously.
+	void stopAsync();
+	bool isAsync() const { return m_async.load(std::memory_order_acquire); }
+	// Returns once everything logged before the call has been written.
+	void flushAsync();
+	// Records dropped by LOG_ASYNC_DROP since startAsync
+	uint64_t getAsyncDropped() const;
+
 	static LogLevel stringToLevel(const std::string &name);
 	static const std::string getLevelLabel(LogLevel lev);
 
 	static LogColor color_mode;
 
 private:
+	friend class LogAsyncWriter;
+
 	void logToOutputsRaw(LogLevel, const std::string &line);
 	void logToOutputs(LogLevel, const std::string &combined,
 		const std::string &time, const std::string &thread_name,
 		const std::string &payload_text);
-
-	const std::string getThreadName();
+	bool logAsync(LogLevel lev, bool raw, const std::string &line,
+		size_t time_len, size_t thread_pos, size_t thread_len, size_t text_pos);
+	void flushOutputs();
 
 	std::vector<ILogOutput *> m_outputs[LL_MAX];
 
@@ -72,6 +106,9 @@ private:
 	std::map<std::thread::id, std::string> m_thread_names;
 	mutable std::mutex m_mutex;
 	bool m_trace_enabled;
+
+	std::atomic<bool> m_async;
+	std::unique_ptr<LogAsyncWriter> m_async_writer;	// kept until destruction once created
 };
 
 class ILogOutput {
@@ -80,6 +117,9 @@ public:
 	virtual void log(LogLevel, const std::string &combined,
 		const std::string &time, const std::string &thread_name,
 		const std::string &payload_text) = 0;
+	// Called after every line when logging synchronously and after every
+	// batch of lines in async mode.
+	virtual void flush() {}
 };
 
 class ICombinedLogOutput : public ILogOutput {
@@ -105,6 +145,7 @@ public:
 	}
 
 	void logRaw(LogLevel lev, const std::string &line);
+	void flush() { m_stream.flush(); }
 
 private:
 	std::ostream &m_stream;
@@ -117,10 +158,15 @@ public:
 
 	void logRaw(LogLevel lev, const std::string &line)
 	{
-		m_stream << line << std::endl;
+		m_stream.write(line.data(), line.size());
+		m_stream.put('\n');
 	}
 
+	void flush() { m_stream.flush(); }
+
 private:
+	// lines collect here until flush() writes them out together
+	char m_buffer[64 * 1024];
 	std::ofstream m_stream;
 };
 
@@ -168,23 +214,60 @@ private:
 
 extern StreamLogOutput stdout_output;
 extern StreamLogOutput stderr_output;
-extern std::ostream null_stream;
-
-extern std::ostream *dout_con_ptr;
-extern std::ostream *derr_con_ptr;
-extern std::ostream *derr_server_ptr;
 
 extern Logger g_logger;
 
+/*
+	The log streams are per thread: each thread formats its lines into its
+	own fixed buffers, so threads never mix their lines and a line costs no
+	allocation once the thread has logged a few.
+*/
+extern thread_local std::ostream null_stream;
+
 // Writes directly to all LL_NONE log outputs for g_logger with no prefix.
-extern std::ostream rawstream;
+extern thread_local std::ostream rawstream;
+
+extern thread_local std::ostream t_errorstream;
+extern thread_local std::ostream t_warningstream;
+extern thread_local std::ostream t_actionstream;
+extern thread_local std::ostream t_infostream;
+extern thread_local std::ostream t_verbosestream;
+extern thread_local std::ostream dstream;
+
+/*
+	Levels above LOG_COMPILED_LEVEL are compiled out: with verbose left out,
+	"verbosestream << describe(x);" neither calls describe() nor formats
+	anything. Release builds leave out verbose unless the level is defined.
+*/
+#ifndef LOG_COMPILED_LEVEL
+	#ifdef NDEBUG
+		#define LOG_COMPILED_LEVEL LL_INFO
+	#else
+		#define LOG_COMPILED_LEVEL LL_VERBOSE
+	#endif
+#endif
+
+#define LOG_LEVEL_COMPILED(lev) ((lev) <= LOG_COMPILED_LEVEL)
+
+// Turns "stream << a << b" into a void expression; & binds looser than <<.
+struct LogVoidify
+{
+	void operator&(std::ostream &) {}
+};
+
+/*
+	Only usable as a whole statement, "errorstream << ...;". An expression
+	rather than an if/else, so it does not capture the else of an unbraced
+	if around it.
+*/
+#define LOG_STREAM(lev, stream) \
+	!LOG_LEVEL_COMPILED(lev) ? (void)0 : LogVoidify() & (stream)
 
-extern std::ostream errorstream;
-extern std::ostream warningstream;
-extern std::ostream actionstream;
-extern std::ostream infostream;
-extern std::ostream verbosestream;
-extern std::ostream dstream;
+#define errorstream   LOG_STREAM(LL_ERROR, t_errorstream)
+#define warningstream LOG_STREAM(LL_WARNING, t_warningstream)
+#define actionstream  LOG_STREAM(LL_ACTION, t_actionstream)
+#define infostream    LOG_STREAM(LL_INFO, t_infostream)
+#define verbosestream LOG_STREAM(LL_VERBOSE, t_verbosestream)
 
 #define TRACEDO(x) do {               \
 	if (g_logger.getTraceEnabled()) { \
@@ -194,6 +277,6 @@ extern std::ostream dstream;
 
 #define TRACESTREAM(x) TRACEDO(verbosestream x)
 
-#define dout_con (*dout_con_ptr)
-#define derr_con (*derr_con_ptr)
+#define dout_con null_stream
+#define derr_con verbosestream
 
@@ -0,0 +1,597 @@
+#include "batchtransform.h"
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MATH2D_X86
+#endif
+
+#ifdef MATH2D_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+//MSVC takes the intrinsics of any instruction set, GCC and Clang only in
+//functions compiled for it
+#if defined(MATH2D_X86) && !defined(_MSC_VER)
+#define MATH2D_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MATH2D_TARGET(isa)
+#endif
+
+namespace
+{
+    //the affine part of a Matrix2D: x' = m[0]x + m[2]y + m[4]
+    //                               y' = m[1]x + m[3]y + m[5]
+    typedef void (*TransformKernel)(const double *m,
+                                    const double *inX, const double *inY,
+                                    double *outX, double *outY,
+                                    size_t count);
+
+    typedef void (*LengthKernel)(const double *x, const double *y, double *lengths, size_t count);
+
+    typedef void (*NormalizeKernel)(const double *inX, const double *inY,
+                                    double *outX, double *outY,
+                                    size_t count);
+
+    //over x0 y0 x1 y1 ... floats, the memory of a std::vector<Vector2F>
+    typedef void (*TransformFloatKernel)(const float *m, const float *in, float *out, size_t count);
+
+    struct BatchKernels
+    {
+        BatchSimdLevel  level;
+        TransformKernel transform;
+        LengthKernel    length;
+        NormalizeKernel normalize;
+        TransformFloatKernel transformFloat;
+    };
+
+    const double kEpsilon = std::numeric_limits<double>::epsilon();
+
+
+    //------------------------ scalar ------------------------------------
+    //
+    //  also the tails of the SIMD kernels. The operations are in the same
+    //  order as in Matrix2D and Vector2D so the results are the same.
+    //--------------------------------------------------------------------
+    void TransformScalar(const double *m,
+                         const double *inX, const double *inY,
+                         double *outX, double *outY,
+                         size_t count)
+    {
+        for (size_t i=0; i<count; ++i)
+        {
+            double x = inX[i];
+            double y = inY[i];
+
+            outX[i] = (m[0]*x) + (m[2]*y) + m[4];
+            outY[i] = (m[1]*x) + (m[3]*y) + m[5];
+        }
+    }
+
+    void LengthScalar(const double *x, const double *y, double *lengths, size_t count)
+    {
+        for (size_t i=0; i<count; ++i)
+        {
+            lengths[i] = sqrt(x[i] * x[i] + y[i] * y[i]);
+        }
+    }
+
+    void NormalizeScalar(const double *inX, const double *inY,
+                         double *outX, double *outY,
+                         size_t count)
+    {
+        for (size_t i=0; i<count; ++i)
+        {
+            double x = inX[i];
+            double y = inY[i];
+            double length = sqrt(x * x + y * y);
+
+            if (length > kEpsilon)
+            {
+                x /= length;
+                y /= length;
+            }
+
+            outX[i] = x;
+            outY[i] = y;
+        }
+    }
+
+    void TransformFloatScalar(const float *m, const float *in, float *out, size_t count)
+    {
+        for (size_t i=0; i<count; ++i)
+        {
+            float x = in[2 * i];
+            float y = in[2 * i + 1];
+
+            out[2 * i] = (m[0]*x) + (m[2]*y) + m[4];
+            out[2 * i + 1] = (m[1]*x) + (m[3]*y) + m[5];
+        }
+    }
+
+    const BatchKernels s_scalarKernels = { BATCH_SIMD_SCALAR, TransformScalar, LengthScalar, NormalizeScalar, TransformFloatScalar };
+
+
+#ifdef MATH2D_X86
+
+    //------------------------ SSE2 --------------------------------------
+    //--------------------------------------------------------------------
+    MATH2D_TARGET("sse2")
+    void TransformSSE2(const double *m,
+                       const double *inX, const double *inY,
+                       double *outX, double *outY,
+                       size_t count)
+    {
+        const __m128d m11 = _mm_set1_pd(m[0]);
+        const __m128d m12 = _mm_set1_pd(m[1]);
+        const __m128d m21 = _mm_set1_pd(m[2]);
+        const __m128d m22 = _mm_set1_pd(m[3]);
+        const __m128d m31 = _mm_set1_pd(m[4]);
+        const __m128d m32 = _mm_set1_pd(m[5]);
+
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2)
+        {
+            __m128d x = _mm_loadu_pd(inX + i);
+            __m128d y = _mm_loadu_pd(inY + i);
+
+            _mm_storeu_pd(outX + i, _mm_add_pd(_mm_add_pd(_mm_mul_pd(m11, x), _mm_mul_pd(m21, y)), m31));
+            _mm_storeu_pd(outY + i, _mm_add_pd(_mm_add_pd(_mm_mul_pd(m12, x), _mm_mul_pd(m22, y)), m32));
+        }
+
+        TransformScalar(m, inX + i, inY + i, outX + i, outY + i, count - i);
+    }
+
+    MATH2D_TARGET("sse2")
+    void LengthSSE2(const double *x, const double *y, double *lengths, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2)
+        {
+            __m128d vx = _mm_loadu_pd(x + i);
+            __m128d vy = _mm_loadu_pd(y + i);
+
+            _mm_storeu_pd(lengths + i, _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(vx, vx), _mm_mul_pd(vy, vy))));
+        }
+
+        LengthScalar(x + i, y + i, lengths + i, count - i);
+    }
+
+    MATH2D_TARGET("sse2")
+    void NormalizeSSE2(const double *inX, const double *inY,
+                       double *outX, double *outY,
+                       size_t count)
+    {
+        const __m128d epsilon = _mm_set1_pd(kEpsilon);
+        const __m128d one = _mm_set1_pd(1.0);
+
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2)
+        {
+            __m128d x = _mm_loadu_pd(inX + i);
+            __m128d y = _mm_loadu_pd(inY + i);
+            __m128d length = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y)));
+
+            //dividing by one leaves the short ones as they are
+            __m128d mask = _mm_cmpgt_pd(length, epsilon);
+            __m128d divisor = _mm_or_pd(_mm_and_pd(mask, length), _mm_andnot_pd(mask, one));
+
+            _mm_storeu_pd(outX + i, _mm_div_pd(x, divisor));
+            _mm_storeu_pd(outY + i, _mm_div_pd(y, divisor));
+        }
+
+        NormalizeScalar(inX + i, inY + i, outX + i, outY + i, count - i);
+    }
+
+    //two points a register: the x and the y of each point are spread over
+    //the two lanes of the point, times (_11 _12) and (_21 _22)
+    MATH2D_TARGET("sse2")
+    void TransformFloatSSE2(const float *m, const float *in, float *out, size_t count)
+    {
+        const __m128 row1 = _mm_setr_ps(m[0], m[1], m[0], m[1]);
+        const __m128 row2 = _mm_setr_ps(m[2], m[3], m[2], m[3]);
+        const __m128 row3 = _mm_setr_ps(m[4], m[5], m[4], m[5]);
+
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2)
+        {
+            __m128 p = _mm_loadu_ps(in + 2 * i);
+            __m128 x = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 0, 0));
+            __m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 1, 1));
+
+            _mm_storeu_ps(out + 2 * i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(row1, x), _mm_mul_ps(row2, y)), row3));
+        }
+
+        TransformFloatScalar(m, in + 2 * i, out + 2 * i, count - i);
+    }
+
+    const BatchKernels s_sse2Kernels = { BATCH_SIMD_SSE2, TransformSSE2, LengthSSE2, NormalizeSSE2, TransformFloatSSE2 };
+
+
+    //------------------------ AVX ---------------------------------------
+    //
+    //  no FMA: a fused multiply-add rounds once and would not give the
+    //  results of the scalar code
+    //--------------------------------------------------------------------
+    MATH2D_TARGET("avx")
+    void TransformAVX(const double *m,
+                      const double *inX, const double *inY,
+                      double *outX, double *outY,
+                      size_t count)
+    {
+        const __m256d m11 = _mm256_set1_pd(m[0]);
+        const __m256d m12 = _mm256_set1_pd(m[1]);
+        const __m256d m21 = _mm256_set1_pd(m[2]);
+        const __m256d m22 = _mm256_set1_pd(m[3]);
+        const __m256d m31 = _mm256_set1_pd(m[4]);
+        const __m256d m32 = _mm256_set1_pd(m[5]);
+
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m256d x = _mm256_loadu_pd(inX + i);
+            __m256d y = _mm256_loadu_pd(inY + i);
+
+            _mm256_storeu_pd(outX + i, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m11, x), _mm256_mul_pd(m21, y)), m31));
+            _mm256_storeu_pd(outY + i, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m12, x), _mm256_mul_pd(m22, y)), m32));
+        }
+
+        _mm256_zeroupper();
+
+        TransformScalar(m, inX + i, inY + i, outX + i, outY + i, count - i);
+    }
+
+    MATH2D_TARGET("avx")
+    void LengthAVX(const double *x, const double *y, double *lengths, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m256d vx = _mm256_loadu_pd(x + i);
+            __m256d vy = _mm256_loadu_pd(y + i);
+
+            _mm256_storeu_pd(lengths + i, _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(vx, vx), _mm256_mul_pd(vy, vy))));
+        }
+
+        _mm256_zeroupper();
+
+        LengthScalar(x + i, y + i, lengths + i, count - i);
+    }
+
+    MATH2D_TARGET("avx")
+    void NormalizeAVX(const double *inX, const double *inY,
+                      double *outX, double *outY,
+                      size_t count)
+    {
+        const __m256d epsilon = _mm256_set1_pd(kEpsilon);
+        const __m256d one = _mm256_set1_pd(1.0);
+
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m256d x = _mm256_loadu_pd(inX + i);
+            __m256d y = _mm256_loadu_pd(inY + i);
+            __m256d length = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y)));
+
+            __m256d mask = _mm256_cmp_pd(length, epsilon, _CMP_GT_OQ);
+            __m256d divisor = _mm256_blendv_pd(one, length, mask);
+
+            _mm256_storeu_pd(outX + i, _mm256_div_pd(x, divisor));
+            _mm256_storeu_pd(outY + i, _mm256_div_pd(y, divisor));
+        }
+
+        _mm256_zeroupper();
+
+        NormalizeScalar(inX + i, inY + i, outX + i, outY + i, count - i);
+    }
+
+    MATH2D_TARGET("avx")
+    void TransformFloatAVX(const float *m, const float *in, float *out, size_t count)
+    {
+        const __m256 row1 = _mm256_setr_ps(m[0], m[1], m[0], m[1], m[0], m[1], m[0], m[1]);
+        const __m256 row2 = _mm256_setr_ps(m[2], m[3], m[2], m[3], m[2], m[3], m[2], m[3]);
+        const __m256 row3 = _mm256_setr_ps(m[4], m[5], m[4], m[5], m[4], m[5], m[4], m[5]);
+
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m256 p = _mm256_loadu_ps(in + 2 * i);
+            __m256 x = _mm256_permute_ps(p, _MM_SHUFFLE(2, 2, 0, 0));
+            __m256 y = _mm256_permute_ps(p, _MM_SHUFFLE(3, 3, 1, 1));
+
+            _mm256_storeu_ps(out + 2 * i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(row1, x), _mm256_mul_ps(row2, y)), row3));
+        }
+
+        _mm256_zeroupper();
+
+        TransformFloatScalar(m, in + 2 * i, out + 2 * i, count - i);
+    }
+
+    const BatchKernels s_avxKernels = { BATCH_SIMD_AVX, TransformAVX, LengthAVX, NormalizeAVX, TransformFloatAVX };
+
+
+    //------------------------ DetectSimdLevel ---------------------------
+    //
+    //  AVX needs the OS to save the upper halves of the registers too
+    //--------------------------------------------------------------------
+    BatchSimdLevel DetectSimdLevel()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+
+        bool sse2 = (info[3] & (1 << 26)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0 && (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+#else
+        __builtin_cpu_init();
+
+        bool sse2 = __builtin_cpu_supports("sse2") != 0;
+        bool avx = __builtin_cpu_supports("avx") != 0;
+#endif
+        if (avx)
+        {
+            return BATCH_SIMD_AVX;
+        }
+
+        return sse2 ? BATCH_SIMD_SSE2 : BATCH_SIMD_SCALAR;
+    }
+
+#else
+
+    BatchSimdLevel DetectSimdLevel()
+    {
+        return BATCH_SIMD_SCALAR;
+    }
+
+#endif //MATH2D_X86
+
+
+    const BatchKernels* GetKernelsOfLevel(BatchSimdLevel level)
+    {
+        switch (level)
+        {
+#ifdef MATH2D_X86
+        case BATCH_SIMD_AVX:
+            return &s_avxKernels;
+
+        case BATCH_SIMD_SSE2:
+            return &s_sse2Kernels;
+#endif
+        default:
+            return &s_scalarKernels;
+        }
+    }
+
+    std::atomic<const BatchKernels*> s_pKernels(NULL);
+
+    const BatchKernels& GetKernels()
+    {
+        const BatchKernels *pKernels = s_pKernels.load(std::memory_order_acquire);
+
+        if (!pKernels)
+        {
+            pKernels = GetKernelsOfLevel(GetBestBatchSimdLevel());
+            s_pKernels.store(pKernels, std::memory_order_release);
+        }
+
+        return *pKernels;
+    }
+
+    template <typename T>
+    void GetAffine(const Matrix2x3<T> &mat, T *m)
+    {
+        m[0] = mat._11(); m[1] = mat._12();
+        m[2] = mat._21(); m[3] = mat._22();
+        m[4] = mat._31(); m[5] = mat._32();
+    }
+}
+
+
+BatchSimdLevel GetBatchSimdLevel()
+{
+    return GetKernels().level;
+}
+
+BatchSimdLevel GetBestBatchSimdLevel()
+{
+    static const BatchSimdLevel s_best = DetectSimdLevel();
+
+    return s_best;
+}
+
+BatchSimdLevel SetBatchSimdLevel(BatchSimdLevel level)
+{
+    if (level > GetBestBatchSimdLevel())
+    {
+        level = GetBestBatchSimdLevel();
+    }
+
+    const BatchKernels *pKernels = GetKernelsOfLevel(level);
+    s_pKernels.store(pKernels, std::memory_order_release);
+
+    return pKernels->level;
+}
+
+const char* GetBatchSimdLevelName(BatchSimdLevel level)
+{
+    switch (level)
+    {
+    case BATCH_SIMD_AVX:
+        return "AVX";
+
+    case BATCH_SIMD_SSE2:
+        return "SSE2";
+
+    default:
+        return "scalar";
+    }
+}
+
+
+void TransformPoints(const Matrix2D &mat,
+                     const double *inX, const double *inY,
+                     double *outX, double *outY,
+                     size_t count)
+{
+    double m[6];
+    GetAffine(mat, m);
+
+    GetKernels().transform(m, inX, inY, outX, outY, count);
+}
+
+void TransformPoints(const Matrix2F &mat, const Vector2F *in, Vector2F *out, size_t count)
+{
+    static_assert(sizeof(Vector2F) == 2 * sizeof(float), "Vector2F is not two packed floats");
+
+    float m[6];
+    GetAffine(mat, m);
+
+    GetKernels().transformFloat(m, &in->x, &out->x, count);
+}
+
+template <>
+void Matrix2x3<float>::TransformVector2Ds(std::vector<Vector2<float> > &vPoint)const
+{
+    if (!vPoint.empty())
+    {
+        TransformPoints(*this, &vPoint[0], &vPoint[0], vPoint.size());
+    }
+}
+
+void PointLengths(const double *x, const double *y, double *lengths, size_t count)
+{
+    GetKernels().length(x, y, lengths, count);
+}
+
+void NormalizePoints(const double *inX, const double *inY,
+                     double *outX, double *outY,
+                     size_t count)
+{
+    GetKernels().normalize(inX, inY, outX, outY, count);
+}
+
+
+void TransformPoints(const Matrix2D &mat, const PointBuffer &in, PointBuffer &out)
+{
+    out.Resize(in.Size());
+
+    TransformPoints(mat, in.X(), in.Y(), out.X(), out.Y(), in.Size());
+}
+
+//------------------------ WorldTransformPoints --------------------------
+//
+//  the matrices are built as in transformations.h
+//------------------------------------------------------------------------
+void WorldTransformPoints(const PointBuffer &in,
+                          const Vector2D    &pos,
+                          const Vector2D    &forward,
+                          const Vector2D    &side,
+                          const Vector2D    &scale,
+                          PointBuffer       &out)
+{
+    Matrix2D matTransform;
+
+    if ( (scale.x != 1.0) || (scale.y != 1.0) )
+    {
+        matTransform.Scale(scale.x, scale.y);
+    }
+
+    matTransform.Rotate(forward, side);
+
+    matTransform.Translate(pos.x, pos.y);
+
+    TransformPoints(matTransform, in, out);
+}
+
+void WorldTransformPoints(const PointBuffer &in,
+                          const Vector2D    &pos,
+                          const Vector2D    &forward,
+                          const Vector2D    &side,
+                          PointBuffer       &out)
+{
+    Matrix2D matTransform;
+
+    matTransform.Rotate(forward, side);
+
+    matTransform.Translate(pos.x, pos.y);
+
+    TransformPoints(matTransform, in, out);
+}
+
+void PointsToWorldSpace(const PointBuffer &in,
+                        const Vector2D    &AgentHeading,
+                        const Vector2D    &AgentSide,
+                        const Vector2D    &AgentPosition,
+                        PointBuffer       &out)
+{
+    WorldTransformPoints(in, AgentPosition, AgentHeading, AgentSide, out);
+}
+
+void VectorsToWorldSpace(const PointBuffer &in,
+                         const Vector2D    &AgentHeading,
+                         const Vector2D    &AgentSide,
+                         PointBuffer       &out)
+{
+    Matrix2D matTransform;
+
+    matTransform.Rotate(AgentHeading, AgentSide);
+
+    TransformPoints(matTransform, in, out);
+}
+
+void PointsToLocalSpace(const PointBuffer &in,
+                        const Vector2D    &AgentHeading,
+                        const Vector2D    &AgentSide,
+                        const Vector2D    &AgentPosition,
+                        PointBuffer       &out)
+{
+    Matrix2D matTransform;
+
+    double Tx = -AgentPosition.Dot(AgentHeading);
+    double Ty = -AgentPosition.Dot(AgentSide);
+
+    matTransform._11(AgentHeading.x); matTransform._12(AgentSide.x);
+    matTransform._21(AgentHeading.y); matTransform._22(AgentSide.y);
+    matTransform._31(Tx);           matTransform._32(Ty);
+
+    TransformPoints(matTransform, in, out);
+}
+
+void VectorsToLocalSpace(const PointBuffer &in,
+                         const Vector2D    &AgentHeading,
+                         const Vector2D    &AgentSide,
+                         PointBuffer       &out)
+{
+    Matrix2D matTransform;
+
+    matTransform._11(AgentHeading.x); matTransform._12(AgentSide.x);
+    matTransform._21(AgentHeading.y); matTransform._22(AgentSide.y);
+
+    TransformPoints(matTransform, in, out);
+}
+
+void RotatePointsAroundOrigin(const PointBuffer &in, double ang, PointBuffer &out)
+{
+    Matrix2D mat;
+
+    mat.Rotate(ang);
+
+    TransformPoints(mat, in, out);
+}
+
+void PointLengths(const PointBuffer &in, double *lengths)
+{
+    PointLengths(in.X(), in.Y(), lengths, in.Size());
+}
+
+void NormalizePoints(const PointBuffer &in, PointBuffer &out)
+{
+    out.Resize(in.Size());
+
+    NormalizePoints(in.X(), in.Y(), out.X(), out.Y(), in.Size());
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+
+#include "vector2d.h"
+#include "matrix2d.h"
+#include "pointbuffer.h"
+
+//------------------------------------------------------------------------
+//
+//  Name:   batchtransform.h
+//
+//  Desc:   the functions of transformations.h over a whole PointBuffer:
+//          unit hulls, sensor whiskers and the like for many agents in
+//          one call. They write into a buffer given by the caller, which
+//          may be the input, and give the same results as transforming
+//          the points one at a time.
+//
+//          The kernels are SSE2 (2 points a step) and AVX (4 points) where
+//          the CPU has them, scalar otherwise; the best level is chosen
+//          on first use.
+//
+//------------------------------------------------------------------------
+
+enum BatchSimdLevel
+{
+    BATCH_SIMD_SCALAR,
+    BATCH_SIMD_SSE2,
+    BATCH_SIMD_AVX
+};
+
+//the level the kernels run at
+BatchSimdLevel GetBatchSimdLevel();
+
+//the best level of this CPU
+BatchSimdLevel GetBestBatchSimdLevel();
+
+//forces a level, for the tests and benchmarks. It is lowered to what the
+//CPU has; returns the level set. Not to be called while kernels run.
+BatchSimdLevel SetBatchSimdLevel(BatchSimdLevel level);
+
+const char* GetBatchSimdLevelName(BatchSimdLevel level);
+
+
+//------------------------ the kernels -----------------------------------
+//
+//  over count points in separate x and y arrays. The output arrays may be
+//  the input ones but must not overlap them otherwise.
+//------------------------------------------------------------------------
+void TransformPoints(const Matrix2D &mat,
+                     const double *inX, const double *inY,
+                     double *outX, double *outY,
+                     size_t count);
+
+//over points of floats, which the kernels take two (SSE2) or four (AVX) at
+//a time as they are. Matrix2F::TransformVector2Ds() runs it.
+void TransformPoints(const Matrix2F &mat, const Vector2F *in, Vector2F *out, size_t count);
+
+void PointLengths(const double *x, const double *y, double *lengths, size_t count);
+
+//as Vector2D::Normalize(): points shorter than epsilon are left as they are
+void NormalizePoints(const double *inX, const double *inY,
+                     double *outX, double *outY,
+                     size_t count);
+
+
+//------------------------ PointBuffer versions --------------------------
+//
+//  out is resized to the size of in
+//------------------------------------------------------------------------
+void TransformPoints(const Matrix2D &mat, const PointBuffer &in, PointBuffer &out);
+
+//as worldTransform()
+void WorldTransformPoints(const PointBuffer &in,
+                          const Vector2D    &pos,
+                          const Vector2D    &forward,
+                          const Vector2D    &side,
+                          const Vector2D    &scale,
+                          PointBuffer       &out);
+
+void WorldTransformPoints(const PointBuffer &in,
+                          const Vector2D    &pos,
+                          const Vector2D    &forward,
+                          const Vector2D    &side,
+                          PointBuffer       &out);
+
+//as pointToWorldSpace() and VectorToWorldSpace()
+void PointsToWorldSpace(const PointBuffer &in,
+                        const Vector2D    &AgentHeading,
+                        const Vector2D    &AgentSide,
+                        const Vector2D    &AgentPosition,
+                        PointBuffer       &out);
+
+void VectorsToWorldSpace(const PointBuffer &in,
+                         const Vector2D    &AgentHeading,
+                         const Vector2D    &AgentSide,
+                         PointBuffer       &out);
+
+//as pointToLocalSpace() and VectorToLocalSpace()
+void PointsToLocalSpace(const PointBuffer &in,
+                        const Vector2D    &AgentHeading,
+                        const Vector2D    &AgentSide,
+                        const Vector2D    &AgentPosition,
+                        PointBuffer       &out);
+
+void VectorsToLocalSpace(const PointBuffer &in,
+                         const Vector2D    &AgentHeading,
+                         const Vector2D    &AgentSide,
+                         PointBuffer       &out);
+
+//as Vec2DRotateAroundOrigin()
+void RotatePointsAroundOrigin(const PointBuffer &in, double ang, PointBuffer &out);
+
+//lengths holds in.Size() doubles
+void PointLengths(const PointBuffer &in, double *lengths);
+
+void NormalizePoints(const PointBuffer &in, PointBuffer &out);
@@ -0,0 +1,499 @@
+#include "cellspacepartition.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "threading/job_system.h"
+
+namespace
+{
+    //below this much left-behind room compacting is not worth it
+    const size_t kMinUnusedToCompact = 4096;
+
+    //jobs per thread for CalculateAllNeighbors(), to even out crowded cells
+    const size_t kChunksPerThread = 8;
+
+    uint32_t RoundUpToBlock(uint32_t count)
+    {
+        return (count + CellSpacePartition::kCellBlock - 1) / CellSpacePartition::kCellBlock * CellSpacePartition::kCellBlock;
+    }
+}
+
+
+CellSpacePartition::CellSpacePartition(const Vector2D &worldMin, const Vector2D &worldMax, double cellSize):
+    m_WorldMin(worldMin),
+    m_CellSize(cellSize),
+    m_InvCellSize(1.0 / cellSize),
+    m_ArenaSize(0),
+    m_Unused(0),
+    m_FreeEntity(kNoEntity),
+    m_NumEntities(0)
+{
+    m_NumCellsX = (std::max)(1, (int)ceil((worldMax.x - worldMin.x) * m_InvCellSize));
+    m_NumCellsY = (std::max)(1, (int)ceil((worldMax.y - worldMin.y) * m_InvCellSize));
+
+    Cell empty = { 0, 0, 0 };
+    m_Cells.assign((size_t)m_NumCellsX * m_NumCellsY, empty);
+}
+
+//------------------------------ CellX / CellY ---------------------------
+//
+//  clamped to the grid, NaNs to the first cell
+//------------------------------------------------------------------------
+int CellSpacePartition::CellX(double x)const
+{
+    double cell = (x - m_WorldMin.x) * m_InvCellSize;
+
+    if (!(cell >= 0.0)) return 0;
+
+    if (cell >= m_NumCellsX) return m_NumCellsX - 1;
+
+    return (int)cell;
+}
+
+int CellSpacePartition::CellY(double y)const
+{
+    double cell = (y - m_WorldMin.y) * m_InvCellSize;
+
+    if (!(cell >= 0.0)) return 0;
+
+    if (cell >= m_NumCellsY) return m_NumCellsY - 1;
+
+    return (int)cell;
+}
+
+int CellSpacePartition::PositionToIndex(const Vector2D &pos)const
+{
+    return CellY(pos.y) * m_NumCellsX + CellX(pos.x);
+}
+
+void CellSpacePartition::CellRange(double minX, double minY, double maxX, double maxY,
+                                   int &x0, int &y0, int &x1, int &y1)const
+{
+    x0 = CellX(minX);
+    y0 = CellY(minY);
+    x1 = CellX(maxX);
+    y1 = CellY(maxY);
+}
+
+Vector2D CellSpacePartition::GetPosition(unsigned int entity)const
+{
+    uint32_t index = m_Entities[entity].index;
+
+    return Vector2D(m_Positions.X()[index], m_Positions.Y()[index]);
+}
+
+
+//------------------------------ AddEntity -------------------------------
+//------------------------------------------------------------------------
+unsigned int CellSpacePartition::AddEntity(ActorId id, const Vector2D &pos)
+{
+    unsigned int entity = m_FreeEntity;
+
+    if (entity != kNoEntity)
+    {
+        m_FreeEntity = m_Entities[entity].index;
+    }
+    else
+    {
+        entity = (unsigned int)m_Entities.size();
+        m_Entities.push_back(Entity());
+    }
+
+    Insert(entity, PositionToIndex(pos), id, pos.x, pos.y);
+    ++m_NumEntities;
+
+    CompactIfWasteful();
+
+    return entity;
+}
+
+void CellSpacePartition::RemoveEntity(unsigned int entity)
+{
+    Erase(entity);
+
+    m_Entities[entity].cell = kNoEntity;
+    m_Entities[entity].index = m_FreeEntity;
+    m_FreeEntity = entity;
+    --m_NumEntities;
+}
+
+//------------------------------ UpdateEntity ----------------------------
+//
+//  an entity staying in its cell only has its position written
+//------------------------------------------------------------------------
+void CellSpacePartition::UpdateEntity(unsigned int entity, const Vector2D &pos)
+{
+    Entity &e = m_Entities[entity];
+    uint32_t cell = PositionToIndex(pos);
+
+    if (cell == e.cell)
+    {
+        m_Positions.X()[e.index] = pos.x;
+        m_Positions.Y()[e.index] = pos.y;
+        return;
+    }
+
+    ActorId id = m_Ids[e.index];
+
+    Erase(entity);
+    Insert(entity, cell, id, pos.x, pos.y);
+}
+
+void CellSpacePartition::UpdateEntities(const unsigned int *entities, const Vector2D *positions, size_t count)
+{
+    for (size_t i=0; i<count; ++i)
+    {
+        UpdateEntity(entities[i], positions[i]);
+    }
+
+    CompactIfWasteful();
+}
+
+void CellSpacePartition::Clear()
+{
+    Cell empty = { 0, 0, 0 };
+    std::fill(m_Cells.begin(), m_Cells.end(), empty);
+
+    m_ArenaSize = 0;
+    m_Unused = 0;
+
+    m_Entities.clear();
+    m_FreeEntity = kNoEntity;
+    m_NumEntities = 0;
+}
+
+
+//------------------------------ Insert / Erase --------------------------
+//
+//  the entities of a cell are packed at its start; erasing moves the last
+//  one into the hole
+//------------------------------------------------------------------------
+void CellSpacePartition::Insert(unsigned int entity, uint32_t cell, ActorId id, double x, double y)
+{
+    if (m_Cells[cell].count == m_Cells[cell].capacity)
+    {
+        Grow(cell);
+    }
+
+    Cell &c = m_Cells[cell];
+    uint32_t index = c.offset + c.count++;
+
+    m_Positions.X()[index] = x;
+    m_Positions.Y()[index] = y;
+    m_Ids[index] = id;
+    m_Owners[index] = entity;
+
+    m_Entities[entity].cell = cell;
+    m_Entities[entity].index = index;
+}
+
+void CellSpacePartition::Erase(unsigned int entity)
+{
+    Entity &e = m_Entities[entity];
+    Cell &c = m_Cells[e.cell];
+    uint32_t last = c.offset + --c.count;
+
+    if (e.index != last)
+    {
+        m_Positions.X()[e.index] = m_Positions.X()[last];
+        m_Positions.Y()[e.index] = m_Positions.Y()[last];
+        m_Ids[e.index] = m_Ids[last];
+        m_Owners[e.index] = m_Owners[last];
+
+        m_Entities[m_Owners[e.index]].index = e.index;
+    }
+}
+
+//------------------------------ Grow ------------------------------------
+//
+//  moves a full cell to the end of the arrays with twice the room
+//------------------------------------------------------------------------
+void CellSpacePartition::Grow(uint32_t cell)
+{
+    Cell &c = m_Cells[cell];
+    uint32_t capacity = c.capacity ? c.capacity * 2 : (uint32_t)kCellBlock;
+    uint32_t offset = (uint32_t)m_ArenaSize;
+
+    ReserveArena(m_ArenaSize + capacity);
+
+    double *pX = m_Positions.X();
+    double *pY = m_Positions.Y();
+
+    for (uint32_t i=0; i<c.count; ++i)
+    {
+        pX[offset + i] = pX[c.offset + i];
+        pY[offset + i] = pY[c.offset + i];
+        m_Ids[offset + i] = m_Ids[c.offset + i];
+        m_Owners[offset + i] = m_Owners[c.offset + i];
+
+        m_Entities[m_Owners[offset + i]].index = offset + i;
+    }
+
+    m_Unused += c.capacity;
+    m_ArenaSize += capacity;
+
+    c.offset = offset;
+    c.capacity = capacity;
+}
+
+void CellSpacePartition::ReserveArena(size_t size)
+{
+    if (size <= m_Positions.Size())
+    {
+        return;
+    }
+
+    size = (std::max)(size, m_Positions.Size() * 2);
+
+    m_Positions.Resize(size);
+    m_Ids.resize(size);
+    m_Owners.resize(size);
+}
+
+void CellSpacePartition::CompactIfWasteful()
+{
+    if (m_Unused >= kMinUnusedToCompact && m_Unused * 2 > m_ArenaSize)
+    {
+        Compact();
+    }
+}
+
+//------------------------------ Compact ---------------------------------
+//
+//  lays the cells out again in grid order, each with its entities and
+//  half a block to spare
+//------------------------------------------------------------------------
+void CellSpacePartition::Compact()
+{
+    size_t size = 0;
+
+    for (size_t i=0; i<m_Cells.size(); ++i)
+    {
+        uint32_t count = m_Cells[i].count;
+
+        size += count ? RoundUpToBlock(count + kCellBlock / 2) : 0;
+    }
+
+    PointBuffer positions(size);
+    std::vector<ActorId> ids(size);
+    std::vector<unsigned int> owners(size);
+
+    uint32_t offset = 0;
+
+    for (size_t i=0; i<m_Cells.size(); ++i)
+    {
+        Cell &c = m_Cells[i];
+        uint32_t capacity = c.count ? RoundUpToBlock(c.count + kCellBlock / 2) : 0;
+
+        if (c.count)
+        {
+            memcpy(positions.X() + offset, m_Positions.X() + c.offset, c.count * sizeof(double));
+            memcpy(positions.Y() + offset, m_Positions.Y() + c.offset, c.count * sizeof(double));
+            memcpy(&ids[offset], &m_Ids[c.offset], c.count * sizeof(ActorId));
+            memcpy(&owners[offset], &m_Owners[c.offset], c.count * sizeof(unsigned int));
+
+            for (uint32_t j=0; j<c.count; ++j)
+            {
+                m_Entities[owners[offset + j]].index = offset + j;
+            }
+        }
+
+        c.offset = offset;
+        c.capacity = capacity;
+        offset += capacity;
+    }
+
+    m_Positions = std::move(positions);
+    m_Ids.swap(ids);
+    m_Owners.swap(owners);
+
+    m_ArenaSize = size;
+    m_Unused = 0;
+}
+
+
+//------------------------------ CalculateNeighbors ----------------------
+//------------------------------------------------------------------------
+size_t CellSpacePartition::CalculateNeighbors(const Vector2D &TargetPos, double QueryRadius, std::vector<ActorId> &ids)const
+{
+    size_t before = ids.size();
+
+    ForEachNeighbor(TargetPos, QueryRadius, [&ids](ActorId id, const Vector2D &)
+    {
+        ids.push_back(id);
+    });
+
+    return ids.size() - before;
+}
+
+size_t CellSpacePartition::QueryAABB(const Vector2D &boxMin, const Vector2D &boxMax, std::vector<ActorId> &ids)const
+{
+    size_t before = ids.size();
+
+    int x0, y0, x1, y1;
+    CellRange(boxMin.x, boxMin.y, boxMax.x, boxMax.y, x0, y0, x1, y1);
+
+    const double *pX = m_Positions.X();
+    const double *pY = m_Positions.Y();
+
+    for (int cy=y0; cy<=y1; ++cy)
+    {
+        for (int cx=x0; cx<=x1; ++cx)
+        {
+            const Cell &cell = m_Cells[cy * m_NumCellsX + cx];
+
+            for (uint32_t i=cell.offset, end=cell.offset + cell.count; i<end; ++i)
+            {
+                if (pX[i] >= boxMin.x && pX[i] <= boxMax.x &&
+                    pY[i] >= boxMin.y && pY[i] <= boxMax.y)
+                {
+                    ids.push_back(m_Ids[i]);
+                }
+            }
+        }
+    }
+
+    return ids.size() - before;
+}
+
+
+//------------------------------ CalculateAllNeighbors -------------------
+//
+//  the cells are split in chunks, each collecting the neighbours of its
+//  entities on its own; the chunks' lists are then copied into place by
+//  entity handle
+//------------------------------------------------------------------------
+void CellSpacePartition::CalculateAllNeighbors(double QueryRadius, NeighborLists &lists, JobSystem *pJobSystem)const
+{
+    size_t numCells = m_Cells.size();
+    size_t numChunks = pJobSystem ? (pJobSystem->getNumWorkers() + 1) * kChunksPerThread : 1;
+    numChunks = (std::min)(numChunks, numCells);
+    size_t cellsPerChunk = (numCells + numChunks - 1) / numChunks;
+
+    lists.m_Chunks.resize(numChunks);
+
+    auto findNeighbors = [this, &lists, numCells, cellsPerChunk, QueryRadius](size_t begin, size_t end)
+    {
+        for (size_t chunk=begin; chunk<end; ++chunk)
+        {
+            NeighborsOfCells(chunk * cellsPerChunk, (std::min)((chunk + 1) * cellsPerChunk, numCells),
+                             QueryRadius, lists.m_Chunks[chunk]);
+        }
+    };
+
+    if (pJobSystem)
+    {
+        pJobSystem->parallelFor(0, numChunks, 1, findNeighbors);
+    }
+    else
+    {
+        findNeighbors(0, numChunks);
+    }
+
+    //free handles have no neighbours
+    lists.m_Offsets.assign(m_Entities.size() + 1, 0);
+
+    for (size_t chunk=0; chunk<numChunks; ++chunk)
+    {
+        const NeighborLists::Chunk &c = lists.m_Chunks[chunk];
+
+        for (size_t i=0; i<c.entities.size(); ++i)
+        {
+            lists.m_Offsets[c.entities[i] + 1] = c.counts[i];
+        }
+    }
+
+    for (size_t i=1; i<lists.m_Offsets.size(); ++i)
+    {
+        lists.m_Offsets[i] += lists.m_Offsets[i - 1];
+    }
+
+    lists.m_Ids.resize(lists.m_Offsets.back());
+
+    auto copyLists = [&lists](size_t begin, size_t end)
+    {
+        for (size_t chunk=begin; chunk<end; ++chunk)
+        {
+            const NeighborLists::Chunk &c = lists.m_Chunks[chunk];
+            const ActorId *pIds = c.ids.data();
+
+            for (size_t i=0; i<c.entities.size(); ++i)
+            {
+                if (c.counts[i])
+                {
+                    memcpy(&lists.m_Ids[lists.m_Offsets[c.entities[i]]], pIds, c.counts[i] * sizeof(ActorId));
+                    pIds += c.counts[i];
+                }
+            }
+        }
+    };
+
+    if (pJobSystem)
+    {
+        pJobSystem->parallelFor(0, numChunks, 1, copyLists);
+    }
+    else
+    {
+        copyLists(0, numChunks);
+    }
+}
+
+void CellSpacePartition::NeighborsOfCells(size_t beginCell, size_t endCell, double QueryRadius, NeighborLists::Chunk &chunk)const
+{
+    chunk.entities.clear();
+    chunk.counts.clear();
+
+    const double radiusSq = QueryRadius * QueryRadius;
+    const double *pX = m_Positions.X();
+    const double *pY = m_Positions.Y();
+
+    //every candidate is written and only kept by advancing past it: about
+    //a third of them are neighbours, a branch would be mispredicted a lot
+    size_t found = 0;
+
+    for (size_t cellIndex=beginCell; cellIndex<endCell; ++cellIndex)
+    {
+        const Cell &cell = m_Cells[cellIndex];
+
+        for (uint32_t i=cell.offset, end=cell.offset + cell.count; i<end; ++i)
+        {
+            double x = pX[i];
+            double y = pY[i];
+            size_t before = found;
+
+            int x0, y0, x1, y1;
+            CellRange(x - QueryRadius, y - QueryRadius, x + QueryRadius, y + QueryRadius, x0, y0, x1, y1);
+
+            for (int cy=y0; cy<=y1; ++cy)
+            {
+                for (int cx=x0; cx<=x1; ++cx)
+                {
+                    const Cell &other = m_Cells[cy * m_NumCellsX + cx];
+
+                    if (chunk.ids.size() < found + other.count)
+                    {
+                        chunk.ids.resize((std::max)(chunk.ids.size() * 2, found + other.count));
+                    }
+
+                    ActorId *pFound = chunk.ids.data();
+
+                    for (uint32_t j=other.offset, otherEnd=other.offset + other.count; j<otherEnd; ++j)
+                    {
+                        double dx = pX[j] - x;
+                        double dy = pY[j] - y;
+
+                        pFound[found] = m_Ids[j];
+                        found += (dx*dx + dy*dy <= radiusSq) & (j != i);
+                    }
+                }
+            }
+
+            chunk.entities.push_back(m_Owners[i]);
+            chunk.counts.push_back((uint32_t)(found - before));
+        }
+    }
+
+    chunk.ids.resize(found);
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "interfaces.h"
+#include "vector2d.h"
+#include "pointbuffer.h"
+
+class JobSystem;
+
+//------------------------------------------------------------------------
+//
+//  Name:   cellspacepartition.h
+//
+//  Desc:   uniform grid over the world for neighbour queries: which actors
+//          are within a radius of a point or inside a box, or the
+//          neighbours of every actor at once.
+//
+//          The actors of a cell are kept together in flat arrays of ids,
+//          xs and ys, each cell starting on a cache line, so a query reads
+//          the few cells it overlaps front to back. A cell that fills up
+//          moves to the end of the arrays with twice the room; Compact()
+//          packs them again once half of the room is left behind.
+//
+//          Entities are referred to by the handle AddEntity() returns.
+//          Moving one within its cell only writes the position; only the
+//          ones that changed cell are re-bucketed.
+//
+//          Positions outside the world are kept in the border cells, so
+//          they are still found, only slower.
+//
+//------------------------------------------------------------------------
+
+//------------------------ NeighborLists ---------------------------------
+//
+//  result of CellSpacePartition::CalculateAllNeighbors(): the ids of the
+//  neighbours of each entity, by entity handle. Keep it across frames, it
+//  reuses its memory.
+//------------------------------------------------------------------------
+class NeighborLists
+{
+public:
+
+    size_t         Count(unsigned int entity)const{return m_Offsets[entity + 1] - m_Offsets[entity];}
+
+    const ActorId* Begin(unsigned int entity)const{return m_Ids.data() + m_Offsets[entity];}
+
+    const ActorId* End(unsigned int entity)const{return m_Ids.data() + m_Offsets[entity + 1];}
+
+    //of all the entities
+    size_t         Total()const{return m_Ids.size();}
+
+private:
+
+    friend class CellSpacePartition;
+
+    //what one job found: the neighbours of the entities of its cells
+    struct Chunk
+    {
+        std::vector<unsigned int> entities;
+        std::vector<uint32_t>     counts;
+        std::vector<ActorId>      ids;
+    };
+
+    std::vector<uint32_t> m_Offsets;   //entity handle + 1 entries
+    std::vector<ActorId>  m_Ids;
+    std::vector<Chunk>    m_Chunks;
+};
+
+
+class CellSpacePartition
+{
+public:
+
+    enum
+    {
+        kNoEntity = 0xffffffff,
+
+        //room of the cells is a multiple of a cache line of doubles
+        kCellBlock = PointBuffer::kAlignment / sizeof(double)
+    };
+
+    //cells of cellSize by cellSize over [worldMin, worldMax)
+    CellSpacePartition(const Vector2D &worldMin, const Vector2D &worldMax, double cellSize);
+
+    //returns the handle of the entity
+    unsigned int AddEntity(ActorId id, const Vector2D &pos);
+
+    void         RemoveEntity(unsigned int entity);
+
+    void         UpdateEntity(unsigned int entity, const Vector2D &pos);
+
+    //the per-frame update: entity i moved to positions[i]
+    void         UpdateEntities(const unsigned int *entities, const Vector2D *positions, size_t count);
+
+    void         Clear();
+
+    //packs the cells, also done by the updates when half of the room is unused
+    void         Compact();
+
+    size_t       Size()const{return m_NumEntities;}
+
+    bool         IsEntity(unsigned int entity)const{return entity < m_Entities.size() && m_Entities[entity].cell != kNoEntity;}
+
+    ActorId      GetId(unsigned int entity)const{return m_Ids[m_Entities[entity].index];}
+
+    Vector2D     GetPosition(unsigned int entity)const;
+
+    int          NumCellsX()const{return m_NumCellsX;}
+    int          NumCellsY()const{return m_NumCellsY;}
+    int          NumCells()const{return m_NumCellsX * m_NumCellsY;}
+    double       CellSize()const{return m_CellSize;}
+
+    //the cell a position falls in, the border one outside the world
+    int          PositionToIndex(const Vector2D &pos)const;
+
+    //room of the cells, used or not, and room left behind by cells that grew
+    size_t       Capacity()const{return m_ArenaSize;}
+    size_t       Unused()const{return m_Unused;}
+
+
+    //------------------------ queries -----------------------------------
+    //
+    //  append to ids and return how many they appended. The entity at the
+    //  target itself is included.
+    //--------------------------------------------------------------------
+    size_t CalculateNeighbors(const Vector2D &TargetPos, double QueryRadius, std::vector<ActorId> &ids)const;
+
+    //inside [boxMin, boxMax], edges included
+    size_t QueryAABB(const Vector2D &boxMin, const Vector2D &boxMax, std::vector<ActorId> &ids)const;
+
+    //calls visit(ActorId, const Vector2D &pos) for the entities within the
+    //radius, without collecting them
+    template <class Visitor>
+    void   ForEachNeighbor(const Vector2D &TargetPos, double QueryRadius, Visitor visit)const;
+
+    //calls visit(const ActorId *ids, const double *xs, const double *ys,
+    //size_t count) for each cell overlapping the box around the circle,
+    //for callers testing the distances themselves, e.g. without branches.
+    //The arrays have room for count rounded up to kCellBlock: the entries
+    //past count can be read, to test whole SIMD registers, but are stale.
+    template <class Visitor>
+    void   ForEachCell(const Vector2D &TargetPos, double QueryRadius, Visitor visit)const;
+
+    //the same for one cell, a PositionToIndex(), to walk the entities in
+    //grid order: nearby entities, and their cells, one after the other
+    template <class Visitor>
+    void   VisitCell(int cell, Visitor visit)const;
+
+    //the neighbours within the radius of every entity, itself excluded. With
+    //a JobSystem, the cells are split between its threads.
+    void   CalculateAllNeighbors(double QueryRadius, NeighborLists &lists, JobSystem *pJobSystem = NULL)const;
+
+private:
+
+    struct Cell
+    {
+        uint32_t offset;    //in the arrays
+        uint32_t count;
+        uint32_t capacity;
+    };
+
+    struct Entity
+    {
+        uint32_t cell;      //kNoEntity when free
+        uint32_t index;     //in the arrays, the next free handle when free
+    };
+
+    Vector2D            m_WorldMin;
+    double              m_CellSize;
+    double              m_InvCellSize;
+    int                 m_NumCellsX;
+    int                 m_NumCellsY;
+
+    std::vector<Cell>   m_Cells;
+
+    //the cells' room, in the order of m_Cells' offsets
+    PointBuffer         m_Positions;
+    std::vector<ActorId>      m_Ids;
+    std::vector<unsigned int> m_Owners;    //entity handle at each place
+    size_t              m_ArenaSize;
+    size_t              m_Unused;
+
+    std::vector<Entity> m_Entities;
+    unsigned int        m_FreeEntity;
+    size_t              m_NumEntities;
+
+    //the cells overlapped by a box, clamped to the grid
+    void         CellRange(double minX, double minY, double maxX, double maxY,
+                           int &x0, int &y0, int &x1, int &y1)const;
+
+    int          CellX(double x)const;
+    int          CellY(double y)const;
+
+    void         Insert(unsigned int entity, uint32_t cell, ActorId id, double x, double y);
+    void         Erase(unsigned int entity);
+    void         Grow(uint32_t cell);
+    void         ReserveArena(size_t size);
+    void         CompactIfWasteful();
+
+    void         NeighborsOfCells(size_t beginCell, size_t endCell, double QueryRadius, NeighborLists::Chunk &chunk)const;
+};
+
+
+//------------------------ ForEachNeighbor -------------------------------
+//------------------------------------------------------------------------
+template <class Visitor>
+void CellSpacePartition::ForEachNeighbor(const Vector2D &TargetPos, double QueryRadius, Visitor visit)const
+{
+    const double radiusSq = QueryRadius * QueryRadius;
+
+    ForEachCell(TargetPos, QueryRadius,
+                [&](const ActorId *ids, const double *pX, const double *pY, size_t count)
+    {
+        for (size_t i=0; i<count; ++i)
+        {
+            double dx = pX[i] - TargetPos.x;
+            double dy = pY[i] - TargetPos.y;
+
+            if (dx*dx + dy*dy <= radiusSq)
+            {
+                visit(ids[i], Vector2D(pX[i], pY[i]));
+            }
+        }
+    });
+}
+
+//------------------------ ForEachCell -----------------------------------
+//------------------------------------------------------------------------
+template <class Visitor>
+void CellSpacePartition::ForEachCell(const Vector2D &TargetPos, double QueryRadius, Visitor visit)const
+{
+    int x0, y0, x1, y1;
+    CellRange(TargetPos.x - QueryRadius, TargetPos.y - QueryRadius,
+              TargetPos.x + QueryRadius, TargetPos.y + QueryRadius,
+              x0, y0, x1, y1);
+
+    for (int cy=y0; cy<=y1; ++cy)
+    {
+        for (int cx=x0; cx<=x1; ++cx)
+        {
+            VisitCell(cy * m_NumCellsX + cx, visit);
+        }
+    }
+}
+
+//------------------------ VisitCell -------------------------------------
+//------------------------------------------------------------------------
+template <class Visitor>
+void CellSpacePartition::VisitCell(int cell, Visitor visit)const
+{
+    const Cell &c = m_Cells[cell];
+
+    if (c.count)
+    {
+        visit(m_Ids.data() + c.offset, m_Positions.X() + c.offset, m_Positions.Y() + c.offset, (size_t)c.count);
+    }
+}
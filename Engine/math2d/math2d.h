@@ -3,4 +3,7 @@
 #include "mathutil.h"
 #include "vector2d.h"
 #include "matrix2d.h"
-#include "transformations.h"
\ No newline at end of file
+#include "transformations.h"
+#include "pointbuffer.h"
+#include "batchtransform.h"
+#include "cellspacepartition.h"
@@ -4,132 +4,155 @@
 #include <vector>
 #include "vector2d.h"
 
-class Matrix2D
+//------------------------------------------------------------------------
+//
+//  Name:   matrix2d.h
+//
+//  Desc:   2D affine transformation of doubles (Matrix2D) or of floats
+//          (Matrix2F). Points are row vectors: p' = p * M. Only the first
+//          two columns are stored, the third is always (0, 0, 1), and
+//          the matrices multiply as such: 12 multiplies instead of 27.
+//
+//------------------------------------------------------------------------
+template <typename T>
+class Matrix2x3
 {
 private:
-  
+
     struct Matrix
     {
 
-        double _11, _12, _13;
-        double _21, _22, _23;
-        double _31, _32, _33;
+        T _11, _12;
+        T _21, _22;
+        T _31, _32;
 
-        Matrix()
-        {
-            _11=0.0; _12=0.0; _13=0.0;
-            _21=0.0; _22=0.0; _23=0.0;
-            _31=0.0; _32=0.0; _33=0.0;
-        }
+        constexpr Matrix(T m11, T m12, T m21, T m22, T m31, T m32)
+            :_11(m11),_12(m12),_21(m21),_22(m22),_31(m31),_32(m32){}
     };
 
     Matrix m_Matrix;
 
     //multiplies m_Matrix with mIn
-    inline void  MatrixMultiply(Matrix &mIn);
+    inline void  MatrixMultiply(const Matrix &mIn);
 
 
 public:
 
-    Matrix2D()
-    {
-        //initialize the matrix to an identity matrix
-        Identity();
-    }
+    typedef T value_type;
+
+    //an identity matrix
+    constexpr Matrix2x3():m_Matrix(1,0, 0,1, 0,0){}
+
+    constexpr Matrix2x3(T m11, T m12,
+                        T m21, T m22,
+                        T m31, T m32):m_Matrix(m11,m12, m21,m22, m31,m32){}
+
+    //from the other precision
+    template <typename U>
+    constexpr explicit Matrix2x3(const Matrix2x3<U> &rhs)
+        :m_Matrix(static_cast<T>(rhs._11()), static_cast<T>(rhs._12()),
+                  static_cast<T>(rhs._21()), static_cast<T>(rhs._22()),
+                  static_cast<T>(rhs._31()), static_cast<T>(rhs._32())){}
 
     //create an identity matrix
     inline void Identity();
-    
-    inline void Translate(const Vector2D &pos)
+
+    inline void Translate(const Vector2<T> &pos)
     {
         Translate(pos.x,pos.y);
     }
-    
+
     //create a transformation matrix
-    inline void Translate(double x, double y);
+    inline void Translate(T x, T y);
 
     //create a scale matrix
-    inline void Scale(double xScale, double yScale);
+    inline void Scale(T xScale, T yScale);
 
     //create a rotation matrix
-    inline void Rotate(double rotation);
+    inline void Rotate(T rotation);
 
     //create a rotation matrix from a fwd and side 2D vector
-    inline void Rotate(const Vector2D &fwd, const Vector2D &side);
+    inline void Rotate(const Vector2<T> &fwd, const Vector2<T> &side);
+
+    //this matrix followed by rhs
+    inline void Multiply(const Matrix2x3 &rhs){MatrixMultiply(rhs.m_Matrix);}
 
     //applys a transformation matrix to a std::vector of points
-    inline void TransformVector2Ds(std::vector<Vector2D> &vPoints);
+    inline void TransformVector2Ds(std::vector<Vector2<T> > &vPoints)const;
 
     //applys a transformation matrix to a point
-    inline void TransformVector2Ds(Vector2D &vPoint);
-    
-    
-    inline Vector2D GetTranslation() { return {m_Matrix._31,m_Matrix._32}; }
-    
-    const Matrix2D& operator=(const Matrix2D &rhs)
-    {
-        m_Matrix._11 = rhs.m_Matrix._11;
-        m_Matrix._12 = rhs.m_Matrix._12;
-        m_Matrix._13 = rhs.m_Matrix._13;
-        
-        m_Matrix._21 = rhs.m_Matrix._21;
-        m_Matrix._22 = rhs.m_Matrix._22;
-        m_Matrix._23 = rhs.m_Matrix._23;
-        
-        m_Matrix._31 = rhs.m_Matrix._31;
-        m_Matrix._32 = rhs.m_Matrix._32;
-        m_Matrix._33 = rhs.m_Matrix._33;
-        
-        return *this;
-    }
-    
+    inline void TransformVector2Ds(Vector2<T> &vPoint)const;
+
+
+    constexpr Vector2<T> GetTranslation()const { return Vector2<T>(m_Matrix._31,m_Matrix._32); }
+
     //accessors to the matrix elements
-    void _11(double val){m_Matrix._11 = val;}
-    void _12(double val){m_Matrix._12 = val;}
-    void _13(double val){m_Matrix._13 = val;}
+    void _11(T val){m_Matrix._11 = val;}
+    void _12(T val){m_Matrix._12 = val;}
+
+    void _21(T val){m_Matrix._21 = val;}
+    void _22(T val){m_Matrix._22 = val;}
 
-    void _21(double val){m_Matrix._21 = val;}
-    void _22(double val){m_Matrix._22 = val;}
-    void _23(double val){m_Matrix._23 = val;}
+    void _31(T val){m_Matrix._31 = val;}
+    void _32(T val){m_Matrix._32 = val;}
 
-    void _31(double val){m_Matrix._31 = val;}
-    void _32(double val){m_Matrix._32 = val;}
-    void _33(double val){m_Matrix._33 = val;}
+    constexpr T _11()const{return m_Matrix._11;}
+    constexpr T _12()const{return m_Matrix._12;}
+    constexpr T _13()const{return 0;}
+
+    constexpr T _21()const{return m_Matrix._21;}
+    constexpr T _22()const{return m_Matrix._22;}
+    constexpr T _23()const{return 0;}
+
+    constexpr T _31()const{return m_Matrix._31;}
+    constexpr T _32()const{return m_Matrix._32;}
+    constexpr T _33()const{return 1;}
 };
 
+typedef Matrix2x3<double> Matrix2D;
+typedef Matrix2x3<float>  Matrix2F;
 
+//two points per SSE register, see batchtransform.cpp
+template <>
+void Matrix2x3<float>::TransformVector2Ds(std::vector<Vector2<float> > &vPoint)const;
 
-//multiply two matrices together
-inline void Matrix2D::MatrixMultiply(Matrix &mIn)
+
+//the product of two matrices
+template <typename T>
+inline Matrix2x3<T> operator*(const Matrix2x3<T> &lhs, const Matrix2x3<T> &rhs)
 {
-    Matrix2D::Matrix mat_temp;
+    Matrix2x3<T> result(lhs);
+    result.Multiply(rhs);
+    return result;
+}
 
-    //first row
-    mat_temp._11 = (m_Matrix._11*mIn._11) + (m_Matrix._12*mIn._21) + (m_Matrix._13*mIn._31);
-    mat_temp._12 = (m_Matrix._11*mIn._12) + (m_Matrix._12*mIn._22) + (m_Matrix._13*mIn._32);
-    mat_temp._13 = (m_Matrix._11*mIn._13) + (m_Matrix._12*mIn._23) + (m_Matrix._13*mIn._33);
 
-    //second
-    mat_temp._21 = (m_Matrix._21*mIn._11) + (m_Matrix._22*mIn._21) + (m_Matrix._23*mIn._31);
-    mat_temp._22 = (m_Matrix._21*mIn._12) + (m_Matrix._22*mIn._22) + (m_Matrix._23*mIn._32);
-    mat_temp._23 = (m_Matrix._21*mIn._13) + (m_Matrix._22*mIn._23) + (m_Matrix._23*mIn._33);
+//multiply two matrices together, the third column being (0, 0, 1)
+template <typename T>
+inline void Matrix2x3<T>::MatrixMultiply(const Matrix &mIn)
+{
+    Matrix mat_temp(
+        (m_Matrix._11*mIn._11) + (m_Matrix._12*mIn._21),
+        (m_Matrix._11*mIn._12) + (m_Matrix._12*mIn._22),
+
+        (m_Matrix._21*mIn._11) + (m_Matrix._22*mIn._21),
+        (m_Matrix._21*mIn._12) + (m_Matrix._22*mIn._22),
 
-    //third
-    mat_temp._31 = (m_Matrix._31*mIn._11) + (m_Matrix._32*mIn._21) + (m_Matrix._33*mIn._31);
-    mat_temp._32 = (m_Matrix._31*mIn._12) + (m_Matrix._32*mIn._22) + (m_Matrix._33*mIn._32);
-    mat_temp._33 = (m_Matrix._31*mIn._13) + (m_Matrix._32*mIn._23) + (m_Matrix._33*mIn._33);
+        (m_Matrix._31*mIn._11) + (m_Matrix._32*mIn._21) + mIn._31,
+        (m_Matrix._31*mIn._12) + (m_Matrix._32*mIn._22) + mIn._32);
 
     m_Matrix = mat_temp;
 }
 
 //applies a 2D transformation matrix to a std::vector of Vector2Ds
-inline void Matrix2D::TransformVector2Ds(std::vector<Vector2D> &vPoint)
+template <typename T>
+inline void Matrix2x3<T>::TransformVector2Ds(std::vector<Vector2<T> > &vPoint)const
 {
     for (unsigned int i=0; i<vPoint.size(); ++i)
     {
-        double tempX =(m_Matrix._11*vPoint[i].x) + (m_Matrix._21*vPoint[i].y) + (m_Matrix._31);
+        T tempX =(m_Matrix._11*vPoint[i].x) + (m_Matrix._21*vPoint[i].y) + (m_Matrix._31);
 
-        double tempY = (m_Matrix._12*vPoint[i].x) + (m_Matrix._22*vPoint[i].y) + (m_Matrix._32);
+        T tempY = (m_Matrix._12*vPoint[i].x) + (m_Matrix._22*vPoint[i].y) + (m_Matrix._32);
 
         vPoint[i].x = tempX;
 
@@ -138,11 +161,12 @@ inline void Matrix2D::TransformVector2Ds(std::vector<Vector2D> &vPoint)
 }
 
 //applies a 2D transformation matrix to a single Vector2D
-inline void Matrix2D::TransformVector2Ds(Vector2D &vPoint)
+template <typename T>
+inline void Matrix2x3<T>::TransformVector2Ds(Vector2<T> &vPoint)const
 {
-    double tempX =(m_Matrix._11*vPoint.x) + (m_Matrix._21*vPoint.y) + (m_Matrix._31);
+    T tempX =(m_Matrix._11*vPoint.x) + (m_Matrix._21*vPoint.y) + (m_Matrix._31);
 
-    double tempY = (m_Matrix._12*vPoint.x) + (m_Matrix._22*vPoint.y) + (m_Matrix._32);
+    T tempY = (m_Matrix._12*vPoint.x) + (m_Matrix._22*vPoint.y) + (m_Matrix._32);
 
     vPoint.x = tempX;
 
@@ -151,40 +175,26 @@ inline void Matrix2D::TransformVector2Ds(Vector2D &vPoint)
 
 
 //create an identity matrix
-inline void Matrix2D::Identity()
+template <typename T>
+inline void Matrix2x3<T>::Identity()
 {
-    m_Matrix._11 = 1; m_Matrix._12 = 0; m_Matrix._13 = 0;
-
-    m_Matrix._21 = 0; m_Matrix._22 = 1; m_Matrix._23 = 0;
-
-    m_Matrix._31 = 0; m_Matrix._32 = 0; m_Matrix._33 = 1;
+    m_Matrix = Matrix(1,0, 0,1, 0,0);
 }
 
 //create a transformation matrix
-inline void Matrix2D::Translate(double x, double y)
+template <typename T>
+inline void Matrix2x3<T>::Translate(T x, T y)
 {
-    Matrix mat;
-
-    mat._11 = 1; mat._12 = 0; mat._13 = 0;
-
-    mat._21 = 0; mat._22 = 1; mat._23 = 0;
-
-    mat._31 = x;    mat._32 = y; mat._33 = 1;
-
-    //and multiply
-    MatrixMultiply(mat);
+    //only the last row changes
+    m_Matrix._31 += x;
+    m_Matrix._32 += y;
 }
 
 //create a scale matrix
-inline void Matrix2D::Scale(double xScale, double yScale)
+template <typename T>
+inline void Matrix2x3<T>::Scale(T xScale, T yScale)
 {
-    Matrix2D::Matrix mat;
-
-    mat._11 = xScale; mat._12 = 0; mat._13 = 0;
-
-    mat._21 = 0; mat._22 = yScale; mat._23 = 0;
-
-    mat._31 = 0; mat._32 = 0; mat._33 = 1;
+    Matrix mat(xScale,0, 0,yScale, 0,0);
 
     //and multiply
     MatrixMultiply(mat);
@@ -192,18 +202,13 @@ inline void Matrix2D::Scale(double xScale, double yScale)
 
 
 //create a rotation matrix
-inline void Matrix2D::Rotate(double rot)
+template <typename T>
+inline void Matrix2x3<T>::Rotate(T rot)
 {
-    Matrix2D::Matrix mat;
-
-    double Sin = sin(rot);
-    double Cos = cos(rot);
-
-    mat._11 = Cos;  mat._12 = Sin; mat._13 = 0;
+    T Sin = std::sin(rot);
+    T Cos = std::cos(rot);
 
-    mat._21 = -Sin; mat._22 = Cos; mat._23 = 0;
-
-    mat._31 = 0; mat._32 = 0;mat._33 = 1;
+    Matrix mat(Cos,Sin, -Sin,Cos, 0,0);
 
     //and multiply
     MatrixMultiply(mat);
@@ -211,15 +216,10 @@ inline void Matrix2D::Rotate(double rot)
 
 
 //create a rotation matrix from a 2D vector
-inline void Matrix2D::Rotate(const Vector2D &fwd, const Vector2D &side)
+template <typename T>
+inline void Matrix2x3<T>::Rotate(const Vector2<T> &fwd, const Vector2<T> &side)
 {
-    Matrix2D::Matrix mat;
-
-    mat._11 = fwd.x;  mat._12 = fwd.y; mat._13 = 0;
-
-    mat._21 = side.x; mat._22 = side.y; mat._23 = 0;
-
-    mat._31 = 0; mat._32 = 0;mat._33 = 1;
+    Matrix mat(fwd.x,fwd.y, side.x,side.y, 0,0);
 
     //and multiply
     MatrixMultiply(mat);
@@ -0,0 +1,190 @@
+#include "pointbuffer.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace
+{
+    //doubles in kAlignment bytes: capacities are a multiple of it
+    const size_t kBlock = PointBuffer::kAlignment / sizeof(double);
+
+    double* AllocateAligned(size_t count)
+    {
+        void *p = NULL;
+#ifdef _WIN32
+        p = _aligned_malloc(count * sizeof(double), PointBuffer::kAlignment);
+#else
+        if (posix_memalign(&p, PointBuffer::kAlignment, count * sizeof(double)) != 0)
+        {
+            p = NULL;
+        }
+#endif
+        if (!p)
+        {
+            throw std::bad_alloc();
+        }
+
+        return static_cast<double*>(p);
+    }
+
+    void FreeAligned(double *p)
+    {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+}
+
+
+PointBuffer::PointBuffer(size_t size):m_pX(NULL),m_pY(NULL),m_Size(0),m_Capacity(0)
+{
+    Resize(size);
+}
+
+PointBuffer::PointBuffer(const std::vector<Vector2D> &points):m_pX(NULL),m_pY(NULL),m_Size(0),m_Capacity(0)
+{
+    Assign(points);
+}
+
+PointBuffer::PointBuffer(const PointBuffer &rhs):m_pX(NULL),m_pY(NULL),m_Size(0),m_Capacity(0)
+{
+    Reserve(rhs.m_Size);
+
+    if (rhs.m_Size)
+    {
+        memcpy(m_pX, rhs.m_pX, rhs.m_Size * sizeof(double));
+        memcpy(m_pY, rhs.m_pY, rhs.m_Size * sizeof(double));
+    }
+
+    m_Size = rhs.m_Size;
+}
+
+PointBuffer::PointBuffer(PointBuffer &&rhs):m_pX(NULL),m_pY(NULL),m_Size(0),m_Capacity(0)
+{
+    Swap(rhs);
+}
+
+PointBuffer::~PointBuffer()
+{
+    FreeAligned(m_pX);
+}
+
+PointBuffer& PointBuffer::operator=(const PointBuffer &rhs)
+{
+    if (this != &rhs)
+    {
+        PointBuffer copy(rhs);
+
+        Swap(copy);
+    }
+
+    return *this;
+}
+
+PointBuffer& PointBuffer::operator=(PointBuffer &&rhs)
+{
+    Swap(rhs);
+
+    return *this;
+}
+
+void PointBuffer::Swap(PointBuffer &rhs)
+{
+    std::swap(m_pX, rhs.m_pX);
+    std::swap(m_pY, rhs.m_pY);
+    std::swap(m_Size, rhs.m_Size);
+    std::swap(m_Capacity, rhs.m_Capacity);
+}
+
+//------------------------------ Reserve ---------------------------------
+//
+//  grows the arrays to hold at least capacity points
+//------------------------------------------------------------------------
+void PointBuffer::Reserve(size_t capacity)
+{
+    if (capacity <= m_Capacity)
+    {
+        return;
+    }
+
+    capacity = (capacity + kBlock - 1) / kBlock * kBlock;
+
+    double *pX = AllocateAligned(capacity * 2);
+    double *pY = pX + capacity;
+
+    if (m_Size)
+    {
+        memcpy(pX, m_pX, m_Size * sizeof(double));
+        memcpy(pY, m_pY, m_Size * sizeof(double));
+    }
+
+    FreeAligned(m_pX);
+
+    m_pX = pX;
+    m_pY = pY;
+    m_Capacity = capacity;
+}
+
+//------------------------------ Resize ----------------------------------
+//------------------------------------------------------------------------
+void PointBuffer::Resize(size_t size)
+{
+    if (size > m_Capacity)
+    {
+        //grow geometrically for PushBack()
+        Reserve(size > m_Capacity * 2 ? size : m_Capacity * 2);
+    }
+
+    if (size > m_Size)
+    {
+        memset(m_pX + m_Size, 0, (size - m_Size) * sizeof(double));
+        memset(m_pY + m_Size, 0, (size - m_Size) * sizeof(double));
+    }
+
+    m_Size = size;
+}
+
+void PointBuffer::PushBack(const Vector2D &point)
+{
+    if (m_Size == m_Capacity)
+    {
+        Reserve(m_Capacity ? m_Capacity * 2 : kBlock);
+    }
+
+    m_pX[m_Size] = point.x;
+    m_pY[m_Size] = point.y;
+    ++m_Size;
+}
+
+void PointBuffer::Assign(const std::vector<Vector2D> &points)
+{
+    m_Size = 0;
+    Reserve(points.size());
+
+    for (size_t i=0; i<points.size(); ++i)
+    {
+        m_pX[i] = points[i].x;
+        m_pY[i] = points[i].y;
+    }
+
+    m_Size = points.size();
+}
+
+void PointBuffer::CopyTo(std::vector<Vector2D> &points)const
+{
+    points.resize(m_Size);
+
+    for (size_t i=0; i<m_Size; ++i)
+    {
+        points[i].x = m_pX[i];
+        points[i].y = m_pY[i];
+    }
+}
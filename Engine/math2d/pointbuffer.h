@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "vector2d.h"
+
+//------------------------------------------------------------------------
+//
+//  Name:   pointbuffer.h
+//
+//  Desc:   a structure-of-arrays buffer of 2D points: the x and the y of
+//          the points in two separate arrays, aligned to cache lines for
+//          the SIMD batch transforms in batchtransform.h.
+//
+//------------------------------------------------------------------------
+class PointBuffer
+{
+public:
+
+    //a cache line, which also suits AVX
+    enum { kAlignment = 64 };
+
+    PointBuffer():m_pX(NULL),m_pY(NULL),m_Size(0),m_Capacity(0){}
+
+    explicit PointBuffer(size_t size);
+
+    explicit PointBuffer(const std::vector<Vector2D> &points);
+
+    PointBuffer(const PointBuffer &rhs);
+
+    PointBuffer(PointBuffer &&rhs);
+
+    ~PointBuffer();
+
+    PointBuffer& operator=(const PointBuffer &rhs);
+
+    PointBuffer& operator=(PointBuffer &&rhs);
+
+    size_t Size()const{return m_Size;}
+
+    bool   Empty()const{return m_Size == 0;}
+
+    size_t Capacity()const{return m_Capacity;}
+
+    //the new points are zero, the existing ones are kept
+    void   Resize(size_t size);
+
+    void   Reserve(size_t capacity);
+
+    void   Clear(){m_Size = 0;}
+
+    void   PushBack(const Vector2D &point);
+
+    Vector2D Get(size_t i)const{return Vector2D(m_pX[i], m_pY[i]);}
+
+    void   Set(size_t i, const Vector2D &point){m_pX[i] = point.x; m_pY[i] = point.y;}
+
+    //the arrays, aligned to kAlignment
+    double*       X(){return m_pX;}
+    const double* X()const{return m_pX;}
+
+    double*       Y(){return m_pY;}
+    const double* Y()const{return m_pY;}
+
+    //conversions from and to the usual array of Vector2Ds
+    void   Assign(const std::vector<Vector2D> &points);
+
+    void   CopyTo(std::vector<Vector2D> &points)const;
+
+private:
+
+    //x and y share one allocation, y starts at m_pX + m_Capacity
+    double* m_pX;
+    double* m_pY;
+
+    size_t  m_Size;
+    size_t  m_Capacity;
+
+    void    Swap(PointBuffer &rhs);
+};
@@ -2,21 +2,24 @@
 
 #include <vector>
 
-#include "vector2D.h"
-#include "matrix2D.h"
-
-
-inline std::vector<Vector2D> worldTransform(std::vector<Vector2D> &points,
-                                            const Vector2D   &pos,
-                                            const Vector2D   &forward,
-                                            const Vector2D   &side,
-                                            const Vector2D   &scale)
+#include "vector2d.h"
+#include "matrix2d.h"
+
+//the functions are templates over the precision: Vector2D and Matrix2D,
+//or Vector2F and Matrix2F
+
+template <typename T>
+inline std::vector<Vector2<T> > worldTransform(std::vector<Vector2<T> > &points,
+                                              const Vector2<T> &pos,
+                                              const Vector2<T> &forward,
+                                              const Vector2<T> &side,
+                                              const Vector2<T> &scale)
 {
     //copy the original vertices into the buffer about to be transformed
-    std::vector<Vector2D> TranVector2Ds = points;
+    std::vector<Vector2<T> > TranVector2Ds = points;
 
     //create a transformation matrix
-    Matrix2D matTransform;
+    Matrix2x3<T> matTransform;
 
     //scale
     if ( (scale.x != 1.0) || (scale.y != 1.0) )
@@ -37,16 +40,17 @@ inline std::vector<Vector2D> worldTransform(std::vector<Vector2D> &points,
 }
 
 
-inline std::vector<Vector2D> worldTransform(std::vector<Vector2D> &points,
-                                            const Vector2D   &pos,
-                                            const Vector2D   &forward,
-                                            const Vector2D   &side)
+template <typename T>
+inline std::vector<Vector2<T> > worldTransform(std::vector<Vector2<T> > &points,
+                                              const Vector2<T> &pos,
+                                              const Vector2<T> &forward,
+                                              const Vector2<T> &side)
 {
     //copy the original vertices into the buffer about to be transformed
-    std::vector<Vector2D> TranVector2Ds = points;
+    std::vector<Vector2<T> > TranVector2Ds = points;
 
     //create a transformation matrix
-    Matrix2D matTransform;
+    Matrix2x3<T> matTransform;
 
     //rotate
     matTransform.Rotate(forward, side);
@@ -61,16 +65,17 @@ inline std::vector<Vector2D> worldTransform(std::vector<Vector2D> &points,
 }
 
 
-inline Vector2D pointToWorldSpace(const Vector2D &point,
-                                  const Vector2D &AgentHeading,
-                                  const Vector2D &AgentSide,
-                                  const Vector2D &AgentPosition)
+template <typename T>
+inline Vector2<T> pointToWorldSpace(const Vector2<T> &point,
+                                    const Vector2<T> &AgentHeading,
+                                    const Vector2<T> &AgentSide,
+                                    const Vector2<T> &AgentPosition)
 {
     //make a copy of the point
-    Vector2D TransPoint = point;
+    Vector2<T> TransPoint = point;
 
     //create a transformation matrix
-    Matrix2D matTransform;
+    Matrix2x3<T> matTransform;
 
     //rotate
     matTransform.Rotate(AgentHeading, AgentSide);
@@ -85,15 +90,16 @@ inline Vector2D pointToWorldSpace(const Vector2D &point,
 }
 
 
-inline Vector2D VectorToWorldSpace(const Vector2D &vec,
-                                     const Vector2D &AgentHeading,
-                                     const Vector2D &AgentSide)
+template <typename T>
+inline Vector2<T> VectorToWorldSpace(const Vector2<T> &vec,
+                                     const Vector2<T> &AgentHeading,
+                                     const Vector2<T> &AgentSide)
 {
     //make a copy of the point
-    Vector2D TransVec = vec;
+    Vector2<T> TransVec = vec;
 
     //create a transformation matrix
-    Matrix2D matTransform;
+    Matrix2x3<T> matTransform;
 
     //rotate
     matTransform.Rotate(AgentHeading, AgentSide);
@@ -105,20 +111,21 @@ inline Vector2D VectorToWorldSpace(const Vector2D &vec,
 }
 
 
-inline Vector2D pointToLocalSpace(const Vector2D &point,
-                                        Vector2D &AgentHeading,
-                                  const Vector2D &AgentSide,
-                                        Vector2D &AgentPosition)
+template <typename T>
+inline Vector2<T> pointToLocalSpace(const Vector2<T> &point,
+                                          Vector2<T> &AgentHeading,
+                                    const Vector2<T> &AgentSide,
+                                          Vector2<T> &AgentPosition)
 {
 
     //make a copy of the point
-    Vector2D TransPoint = point;
+    Vector2<T> TransPoint = point;
 
     //create a transformation matrix
-    Matrix2D matTransform;
+    Matrix2x3<T> matTransform;
 
-    double Tx = -AgentPosition.Dot(AgentHeading);
-    double Ty = -AgentPosition.Dot(AgentSide);
+    T Tx = -AgentPosition.Dot(AgentHeading);
+    T Ty = -AgentPosition.Dot(AgentSide);
 
     //create the transformation matrix
     matTransform._11(AgentHeading.x); matTransform._12(AgentSide.x);
@@ -134,16 +141,17 @@ inline Vector2D pointToLocalSpace(const Vector2D &point,
 //--------------------- VectorToLocalSpace --------------------------------
 //
 //------------------------------------------------------------------------
-inline Vector2D VectorToLocalSpace(const Vector2D &vec,
-                             const Vector2D &AgentHeading,
-                             const Vector2D &AgentSide)
+template <typename T>
+inline Vector2<T> VectorToLocalSpace(const Vector2<T> &vec,
+                                     const Vector2<T> &AgentHeading,
+                                     const Vector2<T> &AgentSide)
 { 
 
     //make a copy of the point
-    Vector2D TransPoint = vec;
+    Vector2<T> TransPoint = vec;
 
     //create a transformation matrix
-    Matrix2D matTransform;
+    Matrix2x3<T> matTransform;
 
     //create the transformation matrix
     matTransform._11(AgentHeading.x); matTransform._12(AgentSide.x);
@@ -159,10 +167,11 @@ inline Vector2D VectorToLocalSpace(const Vector2D &vec,
 //
 //  rotates a vector ang rads around the origin
 //-----------------------------------------------------------------------------
-inline void Vec2DRotateAroundOrigin(Vector2D& v, double ang)
+template <typename T>
+inline void Vec2DRotateAroundOrigin(Vector2<T>& v, typename Vector2<T>::value_type ang)
 {
     //create a transformation matrix
-    Matrix2D mat;
+    Matrix2x3<T> mat;
 
     //rotate
     mat.Rotate(ang);
@@ -179,18 +188,19 @@ inline void Vec2DRotateAroundOrigin(Vector2D& v, double ang)
 //  of whiskers radiating away from the origin and with equal distance between
 //  them. (like the spokes of a wheel clipped to a specific segment size)
 //----------------------------------------------------------------------------
-inline std::vector<Vector2D> CreateWhiskers(unsigned int  NumWhiskers,
-                                            double        WhiskerLength,
-                                            double        fov,
-                                            Vector2D      facing,
-                                            Vector2D      origin)
+template <typename T>
+inline std::vector<Vector2<T> > CreateWhiskers(unsigned int  NumWhiskers,
+                                               typename Vector2<T>::value_type WhiskerLength,
+                                               typename Vector2<T>::value_type fov,
+                                               Vector2<T>    facing,
+                                               Vector2<T>    origin)
 {
     //this is the magnitude of the angle separating each whisker
-    double SectorSize = fov/(double)(NumWhiskers-1);
+    T SectorSize = fov/(T)(NumWhiskers-1);
 
-    std::vector<Vector2D> whiskers;
-    Vector2D temp;
-    double angle = -fov*0.5;
+    std::vector<Vector2<T> > whiskers;
+    Vector2<T> temp;
+    T angle = -fov*T(0.5);
 
     for (unsigned int w=0; w<NumWhiskers; ++w)
     {
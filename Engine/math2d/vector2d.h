@@ -5,55 +5,72 @@
 
 #include "mathutil.h"
 
-class Vector2D
+//------------------------------------------------------------------------
+//
+//  Name:   vector2d.h
+//
+//  Desc:   2D vector of doubles (Vector2D) or of floats (Vector2F). The
+//          float one is half the memory and packs twice the points in a
+//          SIMD register, for the simulation code that can do with the
+//          precision.
+//
+//------------------------------------------------------------------------
+template <typename T>
+class Vector2
 {
 public:
-    Vector2D():x(0.0),y(0.0){}
-    
-    Vector2D(double a,double b):x(a),y(b){}
-    
-    void Set(double a,double b) {x = a; y = b; }
+    typedef T value_type;
+
+    constexpr Vector2():x(0),y(0){}
+
+    constexpr Vector2(T a,T b):x(a),y(b){}
+
+    //from the other precision
+    template <typename U>
+    constexpr explicit Vector2(const Vector2<U> &v):x(static_cast<T>(v.x)),y(static_cast<T>(v.y)){}
+
+    void Set(T a,T b) {x = a; y = b; }
 
-    void Zero(){x=0.0; y=0.0;}
+    void Zero(){x=0; y=0;}
 
-    bool isZero()const{return (x*x + y*y) < MIN_DOUBLE;}
+    bool isZero()const{return (x*x + y*y) < (std::numeric_limits<T>::min)();}
 
     //returns the length of the vector
-    inline double    Length()const;
+    inline T         Length()const;
 
     //returns the squared length of the vector (thereby avoiding the sqrt)
-    inline double    LengthSq()const;
+    inline T         LengthSq()const;
 
     inline void      Normalize();
-    
-    inline double    Cross(const Vector2D& other) const;
-    
-    inline double    Dot(const Vector2D& v2)const;
+
+    inline T         Cross(const Vector2& other) const;
+
+    inline T         Dot(const Vector2& v2)const;
 
     //returns positive if v2 is clockwise of this vector,
     //negative if anticlockwise (assuming the Y axis is pointing down,
     //X axis to right like a Window app)
-    inline int       Sign(const Vector2D& v2)const;
+    inline int       Sign(const Vector2& v2)const;
 
     //returns the vector that is perpendicular to this one.
-    inline Vector2D  Perp()const;
+    inline Vector2   Perp()const;
 
     //adjusts x and y so that the length of the vector does not exceed max
-    inline void      Truncate(double max);
+    inline void      Truncate(T max);
 
     //returns the distance between this vector and th one passed as a parameter
-    inline double    Distance(const Vector2D &v2)const;
+    inline T         Distance(const Vector2 &v2)const;
 
     //squared version of above.
-    inline double    DistanceSq(const Vector2D &v2)const;
+    inline T         DistanceSq(const Vector2 &v2)const;
 
-    inline void      Reflect(const Vector2D& norm);
+    inline void      Reflect(const Vector2& norm);
 
     //returns the vector that is the reverse of this vector
-    inline Vector2D  GetReverse()const;
-    
+    inline Vector2   GetReverse()const;
+
     //we need some overloaded operators
-    const Vector2D& operator+=(const Vector2D &rhs)
+    const Vector2& operator+=(const Vector2 &rhs)
     {
         x += rhs.x;
         y += rhs.y;
@@ -61,7 +78,7 @@ public:
         return *this;
     }
 
-    const Vector2D& operator-=(const Vector2D &rhs)
+    const Vector2& operator-=(const Vector2 &rhs)
     {
         x -= rhs.x;
         y -= rhs.y;
@@ -69,7 +86,7 @@ public:
         return *this;
     }
 
-    const Vector2D& operator*=(const double& rhs)
+    const Vector2& operator*=(const T& rhs)
     {
         x *= rhs;
         y *= rhs;
@@ -77,7 +94,7 @@ public:
         return *this;
     }
 
-    const Vector2D& operator/=(const double& rhs)
+    const Vector2& operator/=(const T& rhs)
     {
         x /= rhs;
         y /= rhs;
@@ -85,46 +102,58 @@ public:
         return *this;
     }
 
-    bool operator==(const Vector2D& rhs)const
+    bool operator==(const Vector2& rhs)const
     {
-        return (Mathd::isEqual(x, rhs.x) && Mathd::isEqual(y,rhs.y) );
+        return (Math<T>::isEqual(x, rhs.x) && Math<T>::isEqual(y,rhs.y) );
     }
 
-    bool operator!=(const Vector2D& rhs)const
+    bool operator!=(const Vector2& rhs)const
     {
         return (x != rhs.x) || (y != rhs.y);
     }
-    
 
-    double x;
-    double y;
+
+    T x;
+    T y;
 
 };
 
-inline Vector2D operator*(const Vector2D &lhs, double rhs);
-inline Vector2D operator*(double lhs, const Vector2D &rhs);
-inline Vector2D operator-(const Vector2D &lhs, const Vector2D &rhs);
-inline Vector2D operator+(const Vector2D &lhs, const Vector2D &rhs);
-inline Vector2D operator/(const Vector2D &lhs, double val);
+typedef Vector2<double> Vector2D;
+typedef Vector2<float>  Vector2F;
 
+template <typename T>
+inline Vector2<T> operator*(const Vector2<T> &lhs, typename Vector2<T>::value_type rhs);
+template <typename T>
+inline Vector2<T> operator*(typename Vector2<T>::value_type lhs, const Vector2<T> &rhs);
+template <typename T>
+inline Vector2<T> operator-(const Vector2<T> &lhs, const Vector2<T> &rhs);
+template <typename T>
+inline Vector2<T> operator+(const Vector2<T> &lhs, const Vector2<T> &rhs);
+template <typename T>
+inline Vector2<T> operator/(const Vector2<T> &lhs, typename Vector2<T>::value_type val);
 
-inline double Vector2D::Length()const
+
+template <typename T>
+inline T Vector2<T>::Length()const
 {
-    return sqrt(x * x + y * y);
+    return std::sqrt(x * x + y * y);
 }
 
 
-inline double Vector2D::LengthSq()const
+template <typename T>
+inline T Vector2<T>::LengthSq()const
 {
     return (x * x + y * y);
 }
 
-inline double Vector2D::Dot(const Vector2D &v2) const
+template <typename T>
+inline T Vector2<T>::Dot(const Vector2 &v2) const
 {
     return x*v2.x + y*v2.y;
 }
 
-inline double Vector2D::Cross(const Vector2D& v2) const
+template <typename T>
+inline T Vector2<T>::Cross(const Vector2& v2) const
 {
     return x*v2.y - y*v2.x;
 }
@@ -136,7 +165,8 @@ inline double Vector2D::Cross(const Vector2D& v2) const
 //------------------------------------------------------------------------
 enum {clockwise = 1, anticlockwise = -1};
 
-inline int Vector2D::Sign(const Vector2D& v2)const
+template <typename T>
+inline int Vector2<T>::Sign(const Vector2& v2)const
 {
     if (y*v2.x > x*v2.y)
     {
@@ -152,32 +182,35 @@ inline int Vector2D::Sign(const Vector2D& v2)const
 //
 //  Returns a vector perpendicular to this vector
 //------------------------------------------------------------------------
-inline Vector2D Vector2D::Perp()const
+template <typename T>
+inline Vector2<T> Vector2<T>::Perp()const
 {
-    return Vector2D(-y, x);
+    return Vector2(-y, x);
 }
 
 //------------------------------ Distance --------------------------------
 //
 //  calculates the euclidean distance between two vectors
 //------------------------------------------------------------------------
-inline double Vector2D::Distance(const Vector2D &v2)const
+template <typename T>
+inline T Vector2<T>::Distance(const Vector2 &v2)const
 {
-    double ySeparation = v2.y - y;
-    double xSeparation = v2.x - x;
+    T ySeparation = v2.y - y;
+    T xSeparation = v2.x - x;
 
-    return sqrt(ySeparation*ySeparation + xSeparation*xSeparation);
+    return std::sqrt(ySeparation*ySeparation + xSeparation*xSeparation);
 }
 
 
 //------------------------------ DistanceSq ------------------------------
 //
-//  calculates the euclidean distance squared between two vectors 
+//  calculates the euclidean distance squared between two vectors
 //------------------------------------------------------------------------
-inline double Vector2D::DistanceSq(const Vector2D &v2)const
+template <typename T>
+inline T Vector2<T>::DistanceSq(const Vector2 &v2)const
 {
-    double ySeparation = v2.y - y;
-    double xSeparation = v2.x - x;
+    T ySeparation = v2.y - y;
+    T xSeparation = v2.x - x;
 
     return ySeparation*ySeparation + xSeparation*xSeparation;
 }
@@ -186,7 +219,8 @@ inline double Vector2D::DistanceSq(const Vector2D &v2)const
 //
 //  truncates a vector so that its length does not exceed max
 //------------------------------------------------------------------------
-inline void Vector2D::Truncate(double max)
+template <typename T>
+inline void Vector2<T>::Truncate(T max)
 {
     if (this->Length() > max)
     {
@@ -201,18 +235,20 @@ inline void Vector2D::Truncate(double max)
 //  given a normalized vector this method reflects the vector it
 //  is operating upon. (like the path of a ball bouncing off a wall)
 //------------------------------------------------------------------------
-inline void Vector2D::Reflect(const Vector2D& norm)
+template <typename T>
+inline void Vector2<T>::Reflect(const Vector2& norm)
 {
-    *this += 2.0 * this->Dot(norm) * norm.GetReverse();
+    *this += T(2) * this->Dot(norm) * norm.GetReverse();
 }
 
 //----------------------- GetReverse ----------------------------------------
 //
 //  returns the vector that is the reverse of this vector
 //------------------------------------------------------------------------
-inline Vector2D Vector2D::GetReverse()const
+template <typename T>
+inline Vector2<T> Vector2<T>::GetReverse()const
 {
-    return Vector2D(-this->x, -this->y);
+    return Vector2(-this->x, -this->y);
 }
 
 
@@ -220,11 +256,12 @@ inline Vector2D Vector2D::GetReverse()const
 //
 //  normalizes a 2D Vector
 //------------------------------------------------------------------------
-inline void Vector2D::Normalize()
-{ 
-    double vector_length = this->Length();
+template <typename T>
+inline void Vector2<T>::Normalize()
+{
+    T vector_length = this->Length();
 
-    if (vector_length > std::numeric_limits<double>::epsilon())
+    if (vector_length > std::numeric_limits<T>::epsilon())
     {
         this->x /= vector_length;
         this->y /= vector_length;
@@ -234,13 +271,14 @@ inline void Vector2D::Normalize()
 
 //------------------------------------------------------------------------non member functions
 
-inline Vector2D Vec2DNormalize(const Vector2D &v)
+template <typename T>
+inline Vector2<T> Vec2DNormalize(const Vector2<T> &v)
 {
-    Vector2D vec = v;
+    Vector2<T> vec = v;
 
-    double vector_length = vec.Length();
+    T vector_length = vec.Length();
 
-    if (vector_length > std::numeric_limits<double>::epsilon())
+    if (vector_length > std::numeric_limits<T>::epsilon())
     {
         vec.x /= vector_length;
         vec.y /= vector_length;
@@ -250,52 +288,62 @@ inline Vector2D Vec2DNormalize(const Vector2D &v)
 }
 
 
-inline double Vec2DDistance(const Vector2D &v1, const Vector2D &v2)
+template <typename T>
+inline T Vec2DDistance(const Vector2<T> &v1, const Vector2<T> &v2)
 {
-    double ySeparation = v2.y - v1.y;
-    double xSeparation = v2.x - v1.x;
+    T ySeparation = v2.y - v1.y;
+    T xSeparation = v2.x - v1.x;
 
-    return sqrt(ySeparation*ySeparation + xSeparation*xSeparation);
+    return std::sqrt(ySeparation*ySeparation + xSeparation*xSeparation);
 }
 
-inline double Vec2DDistanceSq(const Vector2D &v1, const Vector2D &v2)
+template <typename T>
+inline T Vec2DDistanceSq(const Vector2<T> &v1, const Vector2<T> &v2)
 {
-    double ySeparation = v2.y - v1.y;
-    double xSeparation = v2.x - v1.x;
+    T ySeparation = v2.y - v1.y;
+    T xSeparation = v2.x - v1.x;
 
     return ySeparation*ySeparation + xSeparation*xSeparation;
 }
 
-inline double Vec2DLength(const Vector2D& v)
+template <typename T>
+inline T Vec2DLength(const Vector2<T>& v)
 {
-    return sqrt(v.x*v.x + v.y*v.y);
+    return std::sqrt(v.x*v.x + v.y*v.y);
 }
 
-inline double Vec2DLengthSq(const Vector2D& v)
+template <typename T>
+inline T Vec2DLengthSq(const Vector2<T>& v)
 {
     return (v.x*v.x + v.y*v.y);
 }
 
 
 //------------------------------------------------------------------------operator overloads
-inline Vector2D operator*(const Vector2D &lhs, double rhs)
+//
+//  the scalars are not deduced, so v * 2 is a vector of v's precision
+//------------------------------------------------------------------------
+template <typename T>
+inline Vector2<T> operator*(const Vector2<T> &lhs, typename Vector2<T>::value_type rhs)
 {
-    Vector2D result(lhs);
+    Vector2<T> result(lhs);
     result *= rhs;
     return result;
 }
 
-inline Vector2D operator*(double lhs, const Vector2D &rhs)
+template <typename T>
+inline Vector2<T> operator*(typename Vector2<T>::value_type lhs, const Vector2<T> &rhs)
 {
-    Vector2D result(rhs);
+    Vector2<T> result(rhs);
     result *= lhs;
     return result;
 }
 
 //overload the - operator
-inline Vector2D operator-(const Vector2D &lhs, const Vector2D &rhs)
+template <typename T>
+inline Vector2<T> operator-(const Vector2<T> &lhs, const Vector2<T> &rhs)
 {
-    Vector2D result(lhs);
+    Vector2<T> result(lhs);
     result.x -= rhs.x;
     result.y -= rhs.y;
 
@@ -303,9 +351,10 @@ inline Vector2D operator-(const Vector2D &lhs, const Vector2D &rhs)
 }
 
 //overload the + operator
-inline Vector2D operator+(const Vector2D &lhs, const Vector2D &rhs)
+template <typename T>
+inline Vector2<T> operator+(const Vector2<T> &lhs, const Vector2<T> &rhs)
 {
-    Vector2D result(lhs);
+    Vector2<T> result(lhs);
     result.x += rhs.x;
     result.y += rhs.y;
 
@@ -313,9 +362,10 @@ inline Vector2D operator+(const Vector2D &lhs, const Vector2D &rhs)
 }
 
 //overload the / operator
-inline Vector2D operator/(const Vector2D &lhs, double val)
+template <typename T>
+inline Vector2<T> operator/(const Vector2<T> &lhs, typename Vector2<T>::value_type val)
 {
-    Vector2D result(lhs);
+    Vector2<T> result(lhs);
     result.x /= val;
     result.y /= val;
 
@@ -323,12 +373,13 @@ inline Vector2D operator/(const Vector2D &lhs, double val)
 }
 
 
-inline bool isSecondInFOVOfFirst(Vector2D posFirst,
-                                 Vector2D facingFirst,
-                                 Vector2D posSecond,
-                                 double   fov)
+template <typename T>
+inline bool isSecondInFOVOfFirst(Vector2<T> posFirst,
+                                 Vector2<T> facingFirst,
+                                 Vector2<T> posSecond,
+                                 typename Vector2<T>::value_type fov)
 {
-    Vector2D toTarget = Vec2DNormalize(posSecond - posFirst);
+    Vector2<T> toTarget = Vec2DNormalize(posSecond - posFirst);
 
-    return facingFirst.Dot(toTarget) >= cos(fov/2.0);
+    return facingFirst.Dot(toTarget) >= std::cos(fov/T(2));
 }
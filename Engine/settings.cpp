@@ -8,8 +8,13 @@
 #include "debug.h"
 #include "log.h"
 #include "filesys.h"
+#include "utils/mapped_file.h"
 #include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <algorithm>
+#include <limits>
 
 Settings *g_settings = nullptr; // Populated in main()
 
@@ -131,11 +136,14 @@ std::string Settings::getMultiline(std::istream &is, size_t *num_lines)
 
 bool Settings::readConfigFile(const char *filename)
 {
-	std::ifstream is(filename);
-	if (!is.good())
+	if (!fs::PathExists(filename))
+		return false;
+
+	MappedFile file;
+	if (!file.openRead(filename))
 		return false;
 
-	return parseConfigLines(is);
+	return parseConfigBuffer(file.data(), file.size());
 }
 
 
@@ -179,6 +187,131 @@ bool Settings::parseConfigLines(std::istream &is)
 }
 
 
+namespace {
+
+// A piece of the text being parsed
+struct TextSpan {
+	const char *data;
+	size_t size;
+
+	TextSpan(const char *data, size_t size) : data(data), size(size) {}
+
+	bool operator == (const char *s) const
+	{
+		return strlen(s) == size && memcmp(data, s, size) == 0;
+	}
+	bool operator == (const std::string &s) const
+	{
+		return s.size() == size && memcmp(data, s.data(), size) == 0;
+	}
+
+	// Like trim()
+	TextSpan trimmed() const
+	{
+		const char *begin = data, *end = data + size;
+		while (begin != end && std::isspace((unsigned char)*begin))
+			++begin;
+		while (end != begin && std::isspace((unsigned char)end[-1]))
+			--end;
+		return TextSpan(begin, end - begin);
+	}
+};
+
+}
+
+// Reads lines like std::getline on a file opened in text mode
+struct Settings::ConfigCursor {
+	const char *pos;
+	const char *end;
+	bool eof;
+
+	ConfigCursor(const char *data, size_t size) :
+		pos(data), end(data + size), eof(false)
+	{}
+
+	bool good() const { return !eof; }
+
+	TextSpan nextLine()
+	{
+		const char *begin = pos;
+		const char *nl = pos != end ? (const char *)memchr(pos, '\n', end - pos) : nullptr;
+		if (!nl) {
+			// the last line, or nothing after the last line break
+			pos = end;
+			eof = true;
+			return TextSpan(begin, end - begin);
+		}
+		pos = nl + 1;
+		if (nl != begin && nl[-1] == '\r')
+			--nl;
+		return TextSpan(begin, nl - begin);
+	}
+};
+
+
+bool Settings::parseConfigBuffer(const char *data, size_t size)
+{
+	MutexAutoLock lock(m_mutex);
+
+	// one entry per line at most, so the table never grows while parsing
+	size_t lines = std::count(data, data + size, '\n') + 1;
+	m_settings.reserve(m_settings.size() + lines);
+
+	ConfigCursor cursor(data, size);
+	return parseConfigBufferNoLock(cursor);
+}
+
+
+bool Settings::parseConfigBufferNoLock(ConfigCursor &cursor)
+{
+	while (cursor.good()) {
+		TextSpan line = cursor.nextLine().trimmed();
+
+		if (line.size == 0 || line.data[0] == '#')
+			continue;
+		if (line == m_end_tag)
+			return true;
+
+		const char *eq = (const char *)memchr(line.data, '=', line.size);
+		if (!eq)
+			continue;
+
+		TextSpan name = TextSpan(line.data, eq - line.data).trimmed();
+		TextSpan value = TextSpan(eq + 1, line.data + line.size - eq - 1).trimmed();
+
+		if (value == "{") {
+			Settings *group = new Settings("}");
+			if (!group->parseConfigBufferNoLock(cursor)) {
+				delete group;
+				return false;
+			}
+			m_settings[std::string(name.data, name.size)] = SettingsEntry(group);
+		} else if (value == "\"\"\"") {
+			std::string text;
+			while (cursor.good()) {
+				TextSpan text_line = cursor.nextLine();
+				if (text_line == "\"\"\"")
+					break;
+				text.append(text_line.data, text_line.size);
+				text.push_back('\n');
+			}
+			if (!text.empty())
+				text.erase(text.size() - 1);
+			m_settings[std::string(name.data, name.size)] = SettingsEntry(text);
+		} else {
+			// assigned in place, the key is the only other allocation
+			SettingsEntry &entry = m_settings[std::string(name.data, name.size)];
+			entry.value.assign(value.data, value.size);
+			entry.group = nullptr;
+			entry.is_group = false;
+		}
+	}
+
+	// false (failure) if end tag not found
+	return m_end_tag.empty();
+}
+
+
 void Settings::writeLines(std::ostream &os, uint32_t tab_depth) const
 {
 	MutexAutoLock lock(m_mutex);
@@ -919,6 +1052,93 @@ void Settings::removeSecureSettings()
 	}
 }
 
+std::vector<std::string> Settings::diff(const Settings &other) const
+{
+	MutexAutoLock lock(m_mutex);
+	MutexAutoLock lock2(other.m_mutex);
+
+	std::vector<std::string> changed;
+	for (const auto &it : other.m_settings) {
+		SettingEntries::const_iterator n = m_settings.find(it.first);
+		if (n == m_settings.end() || !entriesEqual(n->second, it.second))
+			changed.push_back(it.first);
+	}
+	return changed;
+}
+
+
+bool Settings::equalsNoLock(const Settings &other) const
+{
+	if (m_settings.size() != other.m_settings.size())
+		return false;
+
+	for (const auto &it : m_settings) {
+		SettingEntries::const_iterator n = other.m_settings.find(it.first);
+		if (n == other.m_settings.end() || !entriesEqual(it.second, n->second))
+			return false;
+	}
+	return true;
+}
+
+
+bool Settings::entriesEqual(const SettingsEntry &a, const SettingsEntry &b)
+{
+	if (a.is_group != b.is_group)
+		return false;
+	if (!a.is_group)
+		return a.value == b.value;
+
+	MutexAutoLock lock(a.group->m_mutex);
+	MutexAutoLock lock2(b.group->m_mutex);
+	return a.group->equalsNoLock(*b.group);
+}
+
+
+void Settings::applyChanges(const Settings &source, const std::vector<std::string> &changed,
+	const std::vector<std::string> &removed)
+{
+	std::vector<std::string> applied;
+	std::vector<Settings *> old_groups;
+	{
+		MutexAutoLock lock(m_mutex);
+		MutexAutoLock lock2(source.m_mutex);
+
+		for (const std::string &name : changed) {
+			SettingEntries::const_iterator from = source.m_settings.find(name);
+			if (from == source.m_settings.end())
+				continue;
+			applied.push_back(name);
+
+			SettingsEntry &entry = m_settings[name];
+			old_groups.push_back(entry.group);
+			if (from->second.is_group) {
+				// the group is owned here, copy it
+				Settings *copy = new Settings("}");
+				*copy = *from->second.group;
+				entry = SettingsEntry(copy);
+			} else {
+				entry = SettingsEntry(from->second.value);
+			}
+		}
+
+		for (const std::string &name : removed) {
+			SettingEntries::iterator it = m_settings.find(name);
+			if (it == m_settings.end())
+				continue;
+			applied.push_back(name);
+			old_groups.push_back(it->second.group);
+			m_settings.erase(it);
+		}
+	}
+
+	for (Settings *group : old_groups)
+		delete group;
+
+	for (const std::string &name : applied)
+		doCallbacks(name);
+}
+
+
 void Settings::doCallbacks(const std::string &name) const
 {
 	MutexAutoLock lock(m_callback_mutex);
@@ -930,3 +1150,149 @@ void Settings::doCallbacks(const std::string &name) const
 			(it->first)(name, it->second);
 	}
 }
+
+
+/*******************
+ * Setting handles *
+ *******************/
+
+SettingHandleBase::SettingHandleBase(Settings *settings, const std::string &name) :
+	m_settings(settings),
+	m_name(name),
+	m_exists(false)
+{
+}
+
+
+SettingHandleBase::~SettingHandleBase()
+{
+	detach();
+}
+
+
+void SettingHandleBase::attach()
+{
+	// the value comes from the first layer that has it, a change in any
+	// of them can change it
+	m_layers.push_back(m_settings);
+	SettingsLayer sl = m_settings->getLayerType();
+	if (sl < SL_TOTAL_COUNT) {
+		for (int i = (int)sl - 1; i >= 0; --i) {
+			if (Settings *layer = Settings::getLayer((SettingsLayer)i))
+				m_layers.push_back(layer);
+		}
+	}
+
+	// registered first, so no change is missed between reading and registering
+	for (Settings *layer : m_layers)
+		layer->registerChangedCallback(m_name, &SettingHandleBase::changedCallback, this);
+	refresh();
+}
+
+
+void SettingHandleBase::detach()
+{
+	for (Settings *layer : m_layers)
+		layer->deregisterChangedCallback(m_name, &SettingHandleBase::changedCallback, this);
+	m_layers.clear();
+}
+
+
+void SettingHandleBase::refresh()
+{
+	MutexAutoLock lock(m_refresh_mutex);
+
+	bool found = load(*m_settings);
+	if (!found)
+		reset();
+	m_exists.store(found, std::memory_order_relaxed);
+}
+
+
+void SettingHandleBase::changedCallback(const std::string &name, void *data)
+{
+	((SettingHandleBase *)data)->refresh();
+}
+
+
+// Like the typed getters, but a value that does not parse is missing
+// rather than whatever stoi makes of it
+
+bool readSettingValue(const Settings &settings, const std::string &name, bool &val)
+{
+	std::string s;
+	if (!settings.getNoEx(name, s))
+		return false;
+	val = is_yes(s);
+	return true;
+}
+
+
+template <class T>
+static bool readSettingInteger(const Settings &settings, const std::string &name, T &val)
+{
+	std::string s;
+	if (!settings.getNoEx(name, s))
+		return false;
+	const char *begin = s.c_str();
+	char *end;
+	errno = 0;
+	if (std::is_signed<T>::value) {
+		long long v = strtoll(begin, &end, 10);
+		if (end == begin || errno)
+			return false;
+		v = (std::max)(v, (long long)(std::numeric_limits<T>::min)());
+		val = (T)(std::min)(v, (long long)(std::numeric_limits<T>::max)());
+	} else {
+		unsigned long long v = strtoull(begin, &end, 10);
+		if (end == begin || errno || s.find('-') != std::string::npos)
+			return false;
+		val = (T)(std::min)(v, (unsigned long long)(std::numeric_limits<T>::max)());
+	}
+	return true;
+}
+
+
+bool readSettingValue(const Settings &settings, const std::string &name, int16_t &val)
+{
+	return readSettingInteger(settings, name, val);
+}
+
+
+bool readSettingValue(const Settings &settings, const std::string &name, uint16_t &val)
+{
+	return readSettingInteger(settings, name, val);
+}
+
+
+bool readSettingValue(const Settings &settings, const std::string &name, int32_t &val)
+{
+	return readSettingInteger(settings, name, val);
+}
+
+
+bool readSettingValue(const Settings &settings, const std::string &name, uint32_t &val)
+{
+	return readSettingInteger(settings, name, val);
+}
+
+
+bool readSettingValue(const Settings &settings, const std::string &name, uint64_t &val)
+{
+	return readSettingInteger(settings, name, val);
+}
+
+
+bool readSettingValue(const Settings &settings, const std::string &name, float &val)
+{
+	std::string s;
+	if (!settings.getNoEx(name, s))
+		return false;
+	const char *begin = s.c_str();
+	char *end;
+	float v = strtof(begin, &end);
+	if (end == begin)
+		return false;
+	val = v;
+	return true;
+}
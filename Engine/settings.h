@@ -3,6 +3,7 @@
 #include "utils/string_utils.h"
 #include "math2d/math2d.h"
 
+#include <atomic>
 #include <string>
 #include <list>
 #include <set>
@@ -97,7 +98,8 @@ public:
 	 * Reading and writing *
 	 ***********************/
 
-	// Read configuration file.  Returns success.
+	// Read configuration file.  Returns success.  The file is mapped, so it
+	// must not be truncated while it is read; see SettingsReloader.
 	bool readConfigFile(const char *filename);
 	//Updates configuration file.  Returns success.
 	bool updateConfigFile(const char *filename);
@@ -105,6 +107,8 @@ public:
 	bool parseCommandLine(int argc, char *argv[],
 			std::map<std::string, ValueSpec> &allowed_options);
 	bool parseConfigLines(std::istream &is);
+	// Same as parseConfigLines, reading the text in place
+	bool parseConfigBuffer(const char *data, size_t size);
 	void writeLines(std::ostream &os, uint32_t tab_depth=0) const;
 
 	/***********
@@ -191,6 +195,13 @@ public:
 
 	void removeSecureSettings();
 
+	// Names of the entries of other that are missing here or differ
+	std::vector<std::string> diff(const Settings &other) const;
+	// Copies the changed entries from source and removes the removed ones
+	// in one step, then calls back once per name that was there
+	void applyChanges(const Settings &source, const std::vector<std::string> &changed,
+		const std::vector<std::string> &removed);
+
 private:
 	/***********************
 	 * Reading and writing *
@@ -198,6 +209,8 @@ private:
 
 	SettingsParseEvent parseConfigObject(const std::string &line,
 		std::string &name, std::string &value);
+	struct ConfigCursor;
+	bool parseConfigBufferNoLock(ConfigCursor &cursor);
 	bool updateConfigObject(std::istream &is, std::ostream &os,
 		uint32_t tab_depth=0);
 
@@ -220,6 +233,8 @@ private:
 	void updateNoLock(const Settings &other);
 	void clearNoLock();
 	void clearDefaultsNoLock();
+	bool equalsNoLock(const Settings &other) const;
+	static bool entriesEqual(const SettingsEntry &a, const SettingsEntry &b);
 
 	void doCallbacks(const std::string &name) const;
 
@@ -236,3 +251,93 @@ private:
 	SettingsLayer m_settingslayer = SL_TOTAL_COUNT;
 	static std::unordered_map<std::string, const FlagDesc *> s_flags;
 };
+
+
+/*
+	A setting resolved once, for code that reads it every frame.
+
+	SettingHandle<float> speed(g_settings, "unit_speed", 1.0f);
+	float s = speed.get(); // one atomic load
+
+	The value is parsed when the handle is created and again when the
+	setting is changed with set() or remove() in its Settings or in a
+	layer below (through registerChangedCallback). parseConfigLines()
+	does not call back, call refresh() after reading a file. Handles must
+	be destroyed before the Settings they read.
+*/
+class SettingHandleBase {
+public:
+	SettingHandleBase(Settings *settings, const std::string &name);
+	virtual ~SettingHandleBase();
+
+	const std::string &getName() const { return m_name; }
+	// False if the setting is missing or cannot be parsed: get() returns the fallback
+	bool exists() const { return m_exists.load(std::memory_order_relaxed); }
+
+	// Reads the setting again
+	void refresh();
+
+protected:
+	// Parses the current value, returns false if there is none
+	virtual bool load(const Settings &settings) = 0;
+	virtual void reset() = 0;
+	// Called by the subclass constructor and destructor: load() may only
+	// be called back in between
+	void attach();
+	void detach();
+
+private:
+	static void changedCallback(const std::string &name, void *data);
+
+	Settings *m_settings;
+	std::string m_name;
+	std::vector<Settings *> m_layers;	// called back from, m_settings and its parents
+	std::atomic<bool> m_exists;
+	// reading and storing the value is one step, so the last change wins
+	std::mutex m_refresh_mutex;
+};
+
+bool readSettingValue(const Settings &settings, const std::string &name, bool &val);
+bool readSettingValue(const Settings &settings, const std::string &name, int16_t &val);
+bool readSettingValue(const Settings &settings, const std::string &name, uint16_t &val);
+bool readSettingValue(const Settings &settings, const std::string &name, int32_t &val);
+bool readSettingValue(const Settings &settings, const std::string &name, uint32_t &val);
+bool readSettingValue(const Settings &settings, const std::string &name, uint64_t &val);
+bool readSettingValue(const Settings &settings, const std::string &name, float &val);
+
+template <class T>
+class SettingHandle : public SettingHandleBase {
+public:
+	SettingHandle(Settings *settings, const std::string &name, T fallback = T()) :
+		SettingHandleBase(settings, name),
+		m_fallback(fallback),
+		m_value(fallback)
+	{
+		attach();
+	}
+
+	~SettingHandle()
+	{
+		// no callback may reach load() of a destroyed subclass
+		detach();
+	}
+
+	T get() const { return m_value.load(std::memory_order_relaxed); }
+	operator T() const { return get(); }
+
+protected:
+	bool load(const Settings &settings)
+	{
+		T value;
+		if (!readSettingValue(settings, getName(), value))
+			return false;
+		m_value.store(value, std::memory_order_relaxed);
+		return true;
+	}
+
+	void reset() { m_value.store(m_fallback, std::memory_order_relaxed); }
+
+private:
+	const T m_fallback;
+	std::atomic<T> m_value;
+};
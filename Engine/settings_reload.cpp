@@ -0,0 +1,291 @@
+#include "settings_reload.h"
+#include "settings.h"
+#include "log.h"
+#include "filesys.h"
+
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <sys/stat.h>
+
+#ifdef __linux__
+	#include <poll.h>
+	#include <sys/inotify.h>
+	#include <unistd.h>
+#endif
+
+// after a change, the file must stay the same this long before it is read,
+// so a file being written is not read half done
+static const uint32_t RELOAD_SETTLE_MS = 50;
+
+// how often a watching thread checks for stop()
+static const uint32_t RELOAD_WAKE_MS = 100;
+
+
+SettingsReloader::SettingsReloader(Settings *settings, const std::string &path) :
+	m_settings(settings),
+	m_path(path),
+	m_poll_interval_ms(500),
+	m_polling(true),
+	m_watch_fd(-1),
+	m_stop(false),
+	m_reloads(0)
+{
+	m_stamp.exists = false;
+	m_stamp.size = 0;
+	m_stamp.mtime_ns = 0;
+}
+
+
+SettingsReloader::~SettingsReloader()
+{
+	stop();
+}
+
+
+bool SettingsReloader::start(uint32_t poll_interval_ms, bool force_polling)
+{
+	if (isRunning())
+		return true;
+
+	m_poll_interval_ms = std::max<uint32_t>(poll_interval_ms, 1);
+	m_polling = force_polling || !openWatch();
+	m_stop = false;
+
+	// what the file holds now is the base for the first change
+	m_file.reset();
+	m_stamp = getStamp();
+	reload();
+
+	m_thread = std::thread(&SettingsReloader::run, this);
+	infostream << "SettingsReloader: watching " << m_path
+		<< (m_polling ? " (polling)" : "") << std::endl;
+	return true;
+}
+
+
+void SettingsReloader::stop()
+{
+	if (!isRunning())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_stop_cond.notify_all();
+	m_thread.join();
+	closeWatch();
+}
+
+
+size_t SettingsReloader::update()
+{
+	std::unique_ptr<Reload> reload;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		reload = std::move(m_pending);
+	}
+	if (!reload)
+		return 0;
+
+	m_settings->applyChanges(*reload->file, reload->changed, reload->removed);
+
+	size_t count = reload->changed.size() + reload->removed.size();
+	infostream << "SettingsReloader: " << m_path << ": " << reload->changed.size()
+		<< " changed, " << reload->removed.size() << " removed" << std::endl;
+	return count;
+}
+
+
+void SettingsReloader::run()
+{
+	for (;;) {
+		bool changed = waitForChange(m_polling ? m_poll_interval_ms : RELOAD_WAKE_MS);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_stop)
+				return;
+		}
+		if (!changed)
+			continue;
+
+		FileStamp stamp = getStamp();
+		if (stamp == m_stamp)
+			continue;
+
+		// wait for the writer to finish
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				if (m_stop_cond.wait_for(lock, std::chrono::milliseconds(RELOAD_SETTLE_MS),
+						[this]() { return m_stop; }))
+					return;
+			}
+			FileStamp settled = getStamp();
+			if (settled == stamp)
+				break;
+			stamp = settled;
+		}
+
+		m_stamp = stamp;
+		if (stamp.exists) {
+			reload();
+			m_reloads++;
+		}
+	}
+}
+
+
+void SettingsReloader::reload()
+{
+	// copied rather than mapped: an editor may truncate the file while it is
+	// parsed, which would fault on a mapping
+	std::string text;
+	std::shared_ptr<Settings> file = std::make_shared<Settings>();
+	if (!fs::ReadFile(m_path, text) || !file->parseConfigBuffer(text.data(), text.size())) {
+		errorstream << "SettingsReloader: cannot read " << m_path
+			<< ", keeping the current settings" << std::endl;
+		return;
+	}
+
+	std::shared_ptr<Settings> last = m_file;
+	m_file = file;
+	if (!last)
+		return;
+
+	// keys the file changed, and those of a reload the main thread did not apply yet
+	std::vector<std::string> edited = last->diff(*file);
+	std::set<std::string> candidates(edited.begin(), edited.end());
+	std::set<std::string> removed;
+	for (const std::string &name : last->getNames()) {
+		if (!file->exists(name))
+			removed.insert(name);
+	}
+
+	// taken back while comparing, so update() never waits for a diff
+	std::unique_ptr<Reload> pending;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		pending = std::move(m_pending);
+	}
+	if (pending) {
+		candidates.insert(pending->changed.begin(), pending->changed.end());
+		for (const std::string &name : pending->removed) {
+			if (!file->exists(name))
+				removed.insert(name);
+		}
+	}
+
+	// only what differs from the live layer, found here so the main thread
+	// only has to copy the changed keys
+	std::unique_ptr<Reload> result(new Reload());
+	result->file = file;
+	std::vector<std::string> differing = m_settings->diff(*file);
+	for (const std::string &name : differing) {
+		if (candidates.find(name) != candidates.end())
+			result->changed.push_back(name);
+	}
+	result->removed.assign(removed.begin(), removed.end());
+	if (result->changed.empty() && result->removed.empty())
+		return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_pending = std::move(result);
+}
+
+
+SettingsReloader::FileStamp SettingsReloader::getStamp() const
+{
+	FileStamp stamp;
+	struct stat st;
+	stamp.exists = stat(m_path.c_str(), &st) == 0;
+	stamp.size = stamp.exists ? (uint64_t)st.st_size : 0;
+#if defined(__linux__)
+	stamp.mtime_ns = stamp.exists ? (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec : 0;
+#elif defined(__APPLE__)
+	stamp.mtime_ns = stamp.exists ? (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec : 0;
+#else
+	stamp.mtime_ns = stamp.exists ? (int64_t)st.st_mtime * 1000000000 : 0;
+#endif
+	return stamp;
+}
+
+
+////
+//// File watching
+////
+
+#ifdef __linux__
+
+bool SettingsReloader::openWatch()
+{
+	m_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (m_watch_fd < 0)
+		return false;
+
+	// the directory, so editors that save by renaming a new file are seen too
+	std::string dir = m_path;
+	size_t pos = dir.find_last_of(DIR_DELIM_CHAR == '/' ? "/" : "/\\");
+	dir = pos == std::string::npos ? "." : dir.substr(0, pos + 1);
+
+	if (inotify_add_watch(m_watch_fd, dir.c_str(),
+			IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE | IN_DELETE) < 0) {
+		warningstream << "SettingsReloader: cannot watch " << dir
+			<< ", polling instead" << std::endl;
+		closeWatch();
+		return false;
+	}
+	return true;
+}
+
+
+void SettingsReloader::closeWatch()
+{
+	if (m_watch_fd >= 0)
+		close(m_watch_fd);
+	m_watch_fd = -1;
+}
+
+
+bool SettingsReloader::waitForChange(uint32_t ms)
+{
+	if (m_polling) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_stop_cond.wait_for(lock, std::chrono::milliseconds(ms), [this]() { return m_stop; });
+		return true;
+	}
+
+	struct pollfd pfd;
+	pfd.fd = m_watch_fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, (int)ms) <= 0)
+		return false;
+
+	// any event in the directory: the stamp tells whether it was the file
+	char buf[4096];
+	while (read(m_watch_fd, buf, sizeof(buf)) > 0) {}
+	return true;
+}
+
+#else
+
+bool SettingsReloader::openWatch()
+{
+	return false;
+}
+
+
+void SettingsReloader::closeWatch()
+{
+}
+
+
+bool SettingsReloader::waitForChange(uint32_t ms)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_stop_cond.wait_for(lock, std::chrono::milliseconds(ms), [this]() { return m_stop; });
+	return true;
+}
+
+#endif
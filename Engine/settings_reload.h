@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Settings;
+
+/*
+	Reloads a settings file while the game runs.
+
+	A background thread watches the file (inotify on Linux, otherwise by
+	polling its size and modification time), parses it when it changed and
+	compares it with the live layer. update(), called once per frame on the
+	main thread, applies the changed keys in one step and calls the changed
+	callbacks once per key.
+
+	The file is the source of truth for the keys it contains: a key set at
+	runtime keeps its value until the file changes it. Keys removed from the
+	file are removed from the layer, keys that never were in the file stay.
+*/
+class SettingsReloader {
+public:
+	SettingsReloader(Settings *settings, const std::string &path);
+	~SettingsReloader();
+
+	// poll_interval_ms is how often the file is checked when it cannot be
+	// watched, or with force_polling
+	bool start(uint32_t poll_interval_ms = 500, bool force_polling = false);
+	void stop();
+	bool isRunning() const { return m_thread.joinable(); }
+	bool isPolling() const { return m_polling; }
+
+	// Main thread. Applies the last reload, returns the number of changed keys
+	size_t update();
+
+	// Reloads completed by the background thread, applied or not
+	uint32_t getReloadCount() const { return m_reloads.load(); }
+
+private:
+	struct Reload {
+		std::shared_ptr<Settings> file;
+		std::vector<std::string> changed;
+		std::vector<std::string> removed;
+	};
+
+	struct FileStamp {
+		bool exists;
+		uint64_t size;
+		int64_t mtime_ns;
+
+		bool operator == (const FileStamp &other) const
+		{
+			return exists == other.exists && size == other.size &&
+				mtime_ns == other.mtime_ns;
+		}
+		bool operator != (const FileStamp &other) const { return !(*this == other); }
+	};
+
+	void run();
+	// Waits up to ms; returns true if the file may have changed
+	bool waitForChange(uint32_t ms);
+	bool openWatch();
+	void closeWatch();
+	void reload();
+	FileStamp getStamp() const;
+
+	Settings *m_settings;
+	std::string m_path;
+	uint32_t m_poll_interval_ms;
+	bool m_polling;
+	int m_watch_fd;
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_stop_cond;
+	bool m_stop;
+
+	// worker thread only
+	FileStamp m_stamp;
+	std::shared_ptr<Settings> m_file;	// as last read
+
+	// handed to the main thread, under m_mutex; a newer reload replaces an unapplied one
+	std::unique_ptr<Reload> m_pending;
+	std::atomic<uint32_t> m_reloads;
+};
@@ -0,0 +1,69 @@
+#include "job_graph.h"
+#include "job_system.h"
+#include "debug.h"
+
+#include <algorithm>
+
+size_t JobGraph::addJob(Function function)
+{
+	m_nodes.push_back(Node());
+	m_nodes.back().function = std::move(function);
+	m_nodes.back().num_predecessors = 0;
+	return m_nodes.size() - 1;
+}
+
+void JobGraph::addDependency(size_t before, size_t after)
+{
+	FATAL_ERROR_IF(before >= after || after >= m_nodes.size(), "JobGraph: dependency must point to an earlier job");
+	if (hasDependency(before, after))
+		return;
+	m_nodes[before].successors.push_back(after);
+	m_nodes[after].num_predecessors++;
+}
+
+bool JobGraph::hasDependency(size_t before, size_t after) const
+{
+	const std::vector<size_t> &successors = m_nodes[before].successors;
+	return std::find(successors.begin(), successors.end(), after) != successors.end();
+}
+
+void JobGraph::clear()
+{
+	m_nodes.clear();
+}
+
+void JobGraph::run(JobSystem *jobs)
+{
+	if (!jobs) {
+		for (auto it = m_nodes.begin(); it != m_nodes.end(); ++it)
+			it->function();
+		return;
+	}
+
+	if (m_remaining_size < m_nodes.size()) {
+		m_remaining.reset(new std::atomic<int>[m_nodes.size()]);
+		m_remaining_size = m_nodes.size();
+	}
+	for (size_t i = 0; i < m_nodes.size(); i++)
+		m_remaining[i].store(m_nodes[i].num_predecessors, std::memory_order_relaxed);
+
+	JobCounter counter;
+	for (size_t i = 0; i < m_nodes.size(); i++) {
+		if (m_nodes[i].num_predecessors == 0)
+			jobs->submit(&counter, [this, jobs, &counter, i]() { runNode(*jobs, counter, i); });
+	}
+	jobs->wait(counter);
+}
+
+void JobGraph::runNode(JobSystem &jobs, JobCounter &counter, size_t index)
+{
+	Node &node = m_nodes[index];
+	node.function();
+
+	// the last predecessor to finish starts the job
+	for (auto it = node.successors.begin(); it != node.successors.end(); ++it) {
+		size_t next = *it;
+		if (m_remaining[next].fetch_sub(1, std::memory_order_acq_rel) == 1)
+			jobs.submit(&counter, [this, &jobs, &counter, next]() { runNode(jobs, counter, next); });
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class JobSystem;
+class JobCounter;
+
+/*
+	Set of jobs with ordering constraints, built once and run many times.
+
+	A job starts as soon as every job it depends on has finished, so
+	independent chains run side by side on the JobSystem workers. Without a
+	JobSystem the jobs run in the order they were added, which is a valid
+	order because dependencies may only point to earlier jobs.
+*/
+class JobGraph
+{
+public:
+	typedef std::function<void()> Function;
+
+	size_t addJob(Function function);
+
+	// after does not start before before has finished; before < after
+	void addDependency(size_t before, size_t after);
+
+	// Runs every job once and returns when all are done.
+	void run(JobSystem *jobs);
+
+	void clear();
+	size_t size() const { return m_nodes.size(); }
+	bool hasDependency(size_t before, size_t after) const;
+
+private:
+	struct Node
+	{
+		Function function;
+		std::vector<size_t> successors;
+		int num_predecessors;
+	};
+
+	void runNode(JobSystem &jobs, JobCounter &counter, size_t index);
+
+	std::vector<Node> m_nodes;
+	std::unique_ptr<std::atomic<int>[]> m_remaining;	// unfinished predecessors during run()
+	size_t m_remaining_size = 0;
+};
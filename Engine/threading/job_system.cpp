@@ -0,0 +1,407 @@
+#include "job_system.h"
+#include "threading/mutex_auto_lock.h"
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace
+{
+	// Jobs hold over-aligned function storage, which plain new[] does not
+	// promise to align before C++17
+	void *allocate_aligned(size_t size, size_t alignment)
+	{
+		void *p = nullptr;
+#ifdef _WIN32
+		p = _aligned_malloc(size, alignment);
+#else
+		if (posix_memalign(&p, alignment, size) != 0)
+			p = nullptr;
+#endif
+		if (!p)
+			throw std::bad_alloc();
+		return p;
+	}
+
+	void free_aligned(void *p)
+	{
+#ifdef _WIN32
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+}
+
+/*
+	Job records of one thread. Only the owner allocates; any thread may
+	release, onto a lock-free list the owner takes over in one exchange
+	when its private free list runs dry.
+*/
+class JobSystem::JobPool
+{
+public:
+	JobPool() : m_free(nullptr), m_returned(nullptr) {}
+
+	~JobPool()
+	{
+		for (auto it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+			for (size_t i = 0; i < BLOCK_SIZE; i++)
+				(*it)[i].~Job();
+			free_aligned(*it);
+		}
+	}
+
+	Job *allocate()
+	{
+		if (!m_free)
+			m_free = m_returned.exchange(nullptr, std::memory_order_acquire);
+		if (!m_free)
+			grow();
+		Job *job = m_free;
+		m_free = job->next;
+		return job;
+	}
+
+	void release(Job *job)
+	{
+		Job *head = m_returned.load(std::memory_order_relaxed);
+		do {
+			job->next = head;
+		} while (!m_returned.compare_exchange_weak(head, job,
+				std::memory_order_release, std::memory_order_relaxed));
+	}
+
+private:
+	enum { BLOCK_SIZE = 256 };
+
+	void grow()
+	{
+		m_blocks.reserve(m_blocks.size() + 1);
+		Job *block = static_cast<Job *>(allocate_aligned(
+				BLOCK_SIZE * sizeof(Job), alignof(Job)));
+		m_blocks.push_back(block);
+		for (size_t i = 0; i < BLOCK_SIZE; i++) {
+			new (&block[i]) Job;
+			block[i].pool = this;
+			block[i].next = i + 1 < BLOCK_SIZE ? &block[i + 1] : nullptr;
+		}
+		m_free = block;
+	}
+
+	Job *m_free;
+	std::atomic<Job *> m_returned;
+	std::vector<Job *> m_blocks;
+};
+
+/*
+	Chase-Lev work-stealing deque (Le et al., "Correct and Efficient
+	Work-Stealing for Weak Memory Models"). The owner pushes and takes at the
+	bottom, thieves take from the top; only the last item needs a CAS.
+	Grown buffers are kept until destruction since a thief may still be
+	reading the old one.
+*/
+class JobSystem::WorkDeque
+{
+public:
+	typedef Job *Item;
+
+	WorkDeque() : m_top(0), m_bottom(0)
+	{
+		m_buffers.push_back(std::unique_ptr<Buffer>(new Buffer(256)));
+		m_buffer.store(m_buffers.back().get(), std::memory_order_relaxed);
+	}
+
+	void push(Item item)
+	{
+		int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+		int64_t top = m_top.load(std::memory_order_acquire);
+		Buffer *buffer = m_buffer.load(std::memory_order_relaxed);
+		if (bottom - top >= (int64_t)buffer->size)
+			buffer = grow(buffer, top, bottom);
+		buffer->put(bottom, item);
+		m_bottom.store(bottom + 1, std::memory_order_release);
+	}
+
+	Item take()
+	{
+		int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+		Buffer *buffer = m_buffer.load(std::memory_order_relaxed);
+		m_bottom.store(bottom, std::memory_order_seq_cst);
+		int64_t top = m_top.load(std::memory_order_seq_cst);
+
+		if (top > bottom) {
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		Item item = buffer->get(bottom);
+		if (top == bottom) {
+			// last item, race the thieves for it
+			if (!m_top.compare_exchange_strong(top, top + 1,
+					std::memory_order_seq_cst, std::memory_order_relaxed))
+				item = nullptr;
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		}
+		return item;
+	}
+
+	Item steal()
+	{
+		int64_t top = m_top.load(std::memory_order_seq_cst);
+		int64_t bottom = m_bottom.load(std::memory_order_seq_cst);
+		if (top >= bottom)
+			return nullptr;
+
+		Buffer *buffer = m_buffer.load(std::memory_order_acquire);
+		Item item = buffer->get(top);
+		if (!m_top.compare_exchange_strong(top, top + 1,
+				std::memory_order_seq_cst, std::memory_order_relaxed))
+			return nullptr;
+		return item;
+	}
+
+	bool empty() const
+	{
+		return m_top.load(std::memory_order_seq_cst) >= m_bottom.load(std::memory_order_seq_cst);
+	}
+
+private:
+	struct Buffer
+	{
+		size_t size;
+		std::unique_ptr<std::atomic<Item>[]> items;
+
+		explicit Buffer(size_t size_) : size(size_), items(new std::atomic<Item>[size_]) {}
+
+		Item get(int64_t i) const { return items[i & (size - 1)].load(std::memory_order_relaxed); }
+		void put(int64_t i, Item item) { items[i & (size - 1)].store(item, std::memory_order_relaxed); }
+	};
+
+	Buffer *grow(Buffer *old, int64_t top, int64_t bottom)
+	{
+		Buffer *buffer = new Buffer(old->size * 2);
+		for (int64_t i = top; i < bottom; i++)
+			buffer->put(i, old->get(i));
+		m_buffers.push_back(std::unique_ptr<Buffer>(buffer));
+		m_buffer.store(buffer, std::memory_order_release);
+		return buffer;
+	}
+
+	// top and bottom are written by different threads, keep them apart
+	std::atomic<int64_t> m_top;
+	char m_pad[64];
+	std::atomic<int64_t> m_bottom;
+	std::atomic<Buffer *> m_buffer;
+	std::vector<std::unique_ptr<Buffer> > m_buffers;	// owner only
+};
+
+struct JobSystem::ThreadState
+{
+	WorkDeque deque;
+	JobPool pool;
+	std::atomic<uint64_t> executed;
+	std::atomic<uint64_t> stolen;
+
+	ThreadState() : executed(0), stolen(0) {}
+};
+
+// Thread index in the JobSystem with id system
+struct JobThreadIdentity
+{
+	uint64_t system;
+	unsigned int index;
+};
+
+static thread_local JobThreadIdentity t_job_thread = { 0, 0 };
+static thread_local uint32_t t_steal_rng = 0x9e3779b9u;
+static std::atomic<uint64_t> s_next_job_system_id(1);
+
+// Spins through the other queues before a worker goes to sleep
+static const int JOB_IDLE_SPINS = 64;
+
+
+JobSystem::JobSystem(unsigned int num_workers) :
+	m_id(s_next_job_system_id++),
+	m_external_count(0),
+	m_sleeping(0),
+	m_quit(false)
+{
+	for (unsigned int i = 0; i <= num_workers; i++)
+		m_states.push_back(std::unique_ptr<ThreadState>(new ThreadState));
+	m_external_state.reset(new ThreadState);
+
+	// the creating thread owns the last deque
+	t_job_thread.system = m_id;
+	t_job_thread.index = num_workers;
+
+	for (unsigned int i = 0; i < num_workers; i++)
+		m_threads.push_back(std::thread(&JobSystem::workerThread, this, i));
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		MutexAutoLock lock(m_sleep_mutex);
+		m_quit = true;
+	}
+	m_wake.notify_all();
+
+	for (auto it = m_threads.begin(); it != m_threads.end(); ++it)
+		it->join();
+
+	if (t_job_thread.system == m_id)
+		t_job_thread.system = 0;
+}
+
+unsigned int JobSystem::currentThread() const
+{
+	return t_job_thread.system == m_id ? t_job_thread.index : (unsigned int)m_states.size();
+}
+
+JobSystem::Job *JobSystem::allocateJob()
+{
+	unsigned int index = currentThread();
+	if (index < m_states.size())
+		return m_states[index]->pool.allocate();
+
+	MutexAutoLock lock(m_external_mutex);
+	return m_external_state->pool.allocate();
+}
+
+void JobSystem::push(Job *job)
+{
+	unsigned int index = currentThread();
+	if (index < m_states.size()) {
+		m_states[index]->deque.push(job);
+	} else {
+		MutexAutoLock lock(m_external_mutex);
+		m_external.push_back(job);
+		m_external_count.fetch_add(1);
+	}
+
+	// pairs with the sleeping count and work check in workerThread
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_sleeping.load(std::memory_order_relaxed) > 0) {
+		MutexAutoLock lock(m_sleep_mutex);
+		m_wake.notify_one();
+	}
+}
+
+JobSystem::Job *JobSystem::findJob(unsigned int index)
+{
+	ThreadState *self = index < m_states.size() ? m_states[index].get() : m_external_state.get();
+
+	if (index < m_states.size()) {
+		if (Job *job = self->deque.take())
+			return job;
+	}
+
+	if (m_external_count.load(std::memory_order_relaxed) > 0) {
+		MutexAutoLock lock(m_external_mutex);
+		if (!m_external.empty()) {
+			Job *job = m_external.front();
+			m_external.pop_front();
+			m_external_count.fetch_sub(1);
+			return job;
+		}
+	}
+
+	// start at a random victim so thieves spread out
+	unsigned int count = (unsigned int)m_states.size();
+	t_steal_rng ^= t_steal_rng << 13;
+	t_steal_rng ^= t_steal_rng >> 17;
+	t_steal_rng ^= t_steal_rng << 5;
+	unsigned int start = t_steal_rng % count;
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned int victim = (start + i) % count;
+		if (victim == index)
+			continue;
+		if (Job *job = m_states[victim]->deque.steal()) {
+			self->stolen.fetch_add(1, std::memory_order_relaxed);
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+void JobSystem::execute(Job *job)
+{
+	job->function();
+	job->function.reset();
+
+	JobCounter *counter = job->counter;
+	job->pool->release(job);
+
+	if (counter)
+		counter->m_pending.fetch_sub(1, std::memory_order_release);
+}
+
+void JobSystem::wait(JobCounter &counter)
+{
+	unsigned int index = currentThread();
+	ThreadState *self = index < m_states.size() ? m_states[index].get() : m_external_state.get();
+
+	while (!counter.isDone()) {
+		if (Job *job = findJob(index)) {
+			execute(job);
+			self->executed.fetch_add(1, std::memory_order_relaxed);
+		} else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+bool JobSystem::hasWork() const
+{
+	if (m_external_count.load() > 0)
+		return true;
+	for (auto it = m_states.begin(); it != m_states.end(); ++it) {
+		if (!(*it)->deque.empty())
+			return true;
+	}
+	return false;
+}
+
+void JobSystem::workerThread(unsigned int index)
+{
+	t_job_thread.system = m_id;
+	t_job_thread.index = index;
+	t_steal_rng = 0x9e3779b9u * (index + 1);
+	ThreadState &self = *m_states[index];
+
+	int idle = 0;
+	while (!m_quit.load(std::memory_order_relaxed)) {
+		if (Job *job = findJob(index)) {
+			execute(job);
+			self.executed.fetch_add(1, std::memory_order_relaxed);
+			idle = 0;
+			continue;
+		}
+
+		if (++idle < JOB_IDLE_SPINS) {
+			std::this_thread::yield();
+			continue;
+		}
+		idle = 0;
+
+		MutexAutoLock lock(m_sleep_mutex);
+		m_sleeping.fetch_add(1);
+		while (!m_quit && !hasWork())
+			m_wake.wait(lock);
+		m_sleeping.fetch_sub(1);
+	}
+}
+
+JobSystem::Stats JobSystem::getStats() const
+{
+	Stats stats = { 0, 0 };
+	for (auto it = m_states.begin(); it != m_states.end(); ++it) {
+		stats.executed += (*it)->executed.load(std::memory_order_relaxed);
+		stats.stolen += (*it)->stolen.load(std::memory_order_relaxed);
+	}
+	stats.executed += m_external_state->executed.load(std::memory_order_relaxed);
+	stats.stolen += m_external_state->stolen.load(std::memory_order_relaxed);
+	return stats;
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+	Number of jobs submitted with it that have not finished yet.
+	A job may submit more jobs to the counter it runs under; the counter
+	only reaches zero once all of them are done. Waiting for a counter is
+	the fence between a batch of jobs and whatever depends on it.
+*/
+class JobCounter
+{
+public:
+	JobCounter() : m_pending(0) {}
+
+	bool isDone() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class JobSystem;
+	std::atomic<int> m_pending;
+};
+
+// Bytes of captured state a job can carry, see JobFunction
+const size_t JOB_FUNCTION_SIZE = 48;
+
+/*
+	Callable stored inline in a job, so submitting never allocates.
+	Captures larger than JOB_FUNCTION_SIZE do not compile; capture a pointer
+	to the state instead.
+*/
+class JobFunction
+{
+public:
+	JobFunction() : m_invoke(nullptr), m_destroy(nullptr) {}
+	~JobFunction() { reset(); }
+
+	template <class F>
+	void assign(F &&function)
+	{
+		typedef typename std::decay<F>::type Callable;
+		static_assert(sizeof(Callable) <= JOB_FUNCTION_SIZE,
+			"job function too large, capture a pointer to its state");
+		static_assert(alignof(Callable) <= alignof(Storage),
+			"job function over-aligned");
+
+		reset();
+		new (&m_storage) Callable(std::forward<F>(function));
+		m_invoke = [](void *storage) { (*static_cast<Callable *>(storage))(); };
+		m_destroy = [](void *storage) { static_cast<Callable *>(storage)->~Callable(); };
+	}
+
+	void operator()() { m_invoke(&m_storage); }
+
+	void reset()
+	{
+		if (m_destroy)
+			m_destroy(&m_storage);
+		m_invoke = nullptr;
+		m_destroy = nullptr;
+	}
+
+private:
+	typedef std::aligned_storage<JOB_FUNCTION_SIZE, 16>::type Storage;
+
+	JobFunction(const JobFunction &);
+	JobFunction &operator=(const JobFunction &);
+
+	void (*m_invoke)(void *storage);
+	void (*m_destroy)(void *storage);
+	Storage m_storage;
+};
+
+/*
+	Work-stealing job scheduler.
+
+	Every worker, and the thread that created the JobSystem, owns a
+	Chase-Lev deque: the owner pushes and takes jobs at the bottom without
+	locking, so recently submitted (cache-warm) work runs first, and idle
+	threads steal the oldest jobs from the top. Other threads submit
+	through a shared, locked queue. Job records come from per-thread pools
+	and are recycled, so a job costs no heap allocation.
+
+	wait() runs jobs on the calling thread until the counter is done, so
+	waiting from the main thread or from inside a job never blocks a core
+	and a scheduler with zero workers still makes progress.
+*/
+class JobSystem
+{
+public:
+	explicit JobSystem(unsigned int num_workers);
+	~JobSystem();
+
+	unsigned int getNumWorkers() const { return (unsigned int)m_threads.size(); }
+
+	// counter may be null for fire-and-forget jobs
+	template <class F>
+	void submit(JobCounter *counter, F &&function)
+	{
+		Job *job = allocateJob();
+		job->function.assign(std::forward<F>(function));
+		job->counter = counter;
+		if (counter)
+			counter->m_pending.fetch_add(1, std::memory_order_relaxed);
+		push(job);
+	}
+
+	void wait(JobCounter &counter);
+
+	// Calls function(begin, end) for subranges of [begin, end) of at most
+	// grain elements, in parallel, and returns once all are done.
+	template <class F>
+	void parallelFor(size_t begin, size_t end, size_t grain, const F &function)
+	{
+		if (begin >= end)
+			return;
+		JobCounter counter;
+		runRange(&counter, begin, end, grain ? grain : 1, &function);
+		wait(counter);
+	}
+
+	struct Stats
+	{
+		uint64_t executed;	// jobs run
+		uint64_t stolen;	// of which taken from another thread
+	};
+	Stats getStats() const;
+
+private:
+	class JobPool;
+	class WorkDeque;
+	struct ThreadState;
+
+	struct Job
+	{
+		JobFunction function;
+		JobCounter *counter;
+		JobPool *pool;
+		Job *next;		// pool free list link
+	};
+
+	template <class F>
+	void runRange(JobCounter *counter, size_t begin, size_t end, size_t grain, const F *function)
+	{
+		// hand the upper halves to other threads, keep splitting the lower one
+		while (end - begin > grain) {
+			size_t middle = begin + (end - begin) / 2;
+			submit(counter, [this, counter, middle, end, grain, function]() {
+				runRange(counter, middle, end, grain, function);
+			});
+			end = middle;
+		}
+		(*function)(begin, end);
+	}
+
+	Job *allocateJob();
+	void push(Job *job);
+	Job *findJob(unsigned int index);
+	void execute(Job *job);
+	bool hasWork() const;
+	void workerThread(unsigned int index);
+	unsigned int currentThread() const;
+
+	uint64_t m_id;	// tells thread-local state of different JobSystems apart
+
+	// workers, then the creating thread
+	std::vector<std::unique_ptr<ThreadState> > m_states;
+	std::vector<std::thread> m_threads;
+
+	// jobs submitted by other threads
+	std::mutex m_external_mutex;
+	std::deque<Job *> m_external;
+	std::atomic<size_t> m_external_count;
+	std::unique_ptr<ThreadState> m_external_state;
+
+	std::atomic<int> m_sleeping;
+	std::mutex m_sleep_mutex;
+	std::condition_variable m_wake;
+	std::atomic<bool> m_quit;
+};
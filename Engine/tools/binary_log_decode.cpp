@@ -0,0 +1,72 @@
+/*
+	Prints a binary log (see binary_log.h) as text, one line per record in
+	the format of the text log.
+
+	binary_log_decode [--file-order] [--source] <log file>
+
+	--file-order  keep the order the thread buffers were written in, instead
+	              of sorting the records by time
+	--source      append the file and line of the logging call
+
+	Built from the engine sources, from Engine/ (the engine headers rely on
+	the Windows headers for <cstdint> and <cstdarg>, hence the -include):
+	g++ -std=c++14 -O2 -pthread -include cstdint -include cstdarg -I.
+		tools/binary_log_decode.cpp binary_log.cpp
+		log.cpp settings.cpp debug.cpp filesys.cpp utils/mapped_file.cpp
+		utils/string_utils.cpp utils/time_utils.cpp math2d/mathutil.cpp
+		-o binary_log_decode
+*/
+
+#include "binary_log.h"
+
+#include <cstring>
+#include <iostream>
+
+int main(int argc, char *argv[])
+{
+	bool sort = true;
+	bool source = false;
+	bool usage = false;
+	const char *path = nullptr;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--file-order") == 0)
+			sort = false;
+		else if (strcmp(argv[i], "--source") == 0)
+			source = true;
+		else if (argv[i][0] != '-' && !path)
+			path = argv[i];
+		else
+			usage = true;
+	}
+
+	if (usage || !path) {
+		std::cerr << "usage: binary_log_decode [--file-order] [--source] <log file>" << std::endl;
+		return 2;
+	}
+
+	BinaryLogReader reader;
+	bool complete = reader.load(path);
+	if (!complete && reader.getEntries().empty()) {
+		std::cerr << "binary_log_decode: " << reader.getError() << std::endl;
+		return 1;
+	}
+
+	if (sort)
+		reader.sortByTime();
+
+	const std::vector<BinaryLogReader::Entry> &entries = reader.getEntries();
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		std::cout << BinaryLogReader::formatEntry(*it);
+		if (source)
+			std::cout << " (" << it->file << ":" << it->line << ")";
+		std::cout << '\n';
+	}
+
+	// what could be read is printed, a damaged log still fails
+	if (!complete) {
+		std::cerr << "binary_log_decode: " << reader.getError() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,274 @@
+#include "mapped_file.h"
+#include "log.h"
+
+#include <cstdint>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+MappedFile::MappedFile() :
+	m_data(nullptr),
+	m_size(0),
+	m_open(false),
+	m_writable(false)
+#ifdef _WIN32
+	, m_file(INVALID_HANDLE_VALUE)
+	, m_mapping(NULL)
+#else
+	, m_fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::openRead(const std::string &path)
+{
+	close();
+
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		errorstream << "MappedFile: cannot open " << path << std::endl;
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(m_file, &size);
+	m_size = (size_t)size.QuadPart;
+	m_writable = false;
+	m_open = true;
+
+	if (!map()) {
+		errorstream << "MappedFile: cannot map " << path << std::endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool MappedFile::openWrite(const std::string &path, size_t size)
+{
+	close();
+
+	m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+		NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		errorstream << "MappedFile: cannot create " << path << std::endl;
+		return false;
+	}
+
+	m_writable = true;
+	m_open = true;
+	if (!resize(size)) {
+		errorstream << "MappedFile: cannot map " << path << std::endl;
+		close(0);
+		return false;
+	}
+	return true;
+}
+
+bool MappedFile::resize(size_t size)
+{
+	if (!m_writable)
+		return false;
+
+	size_t old_size = m_size;
+	unmap();
+
+	LARGE_INTEGER pos;
+	pos.QuadPart = (LONGLONG)size;
+	if (!SetFilePointerEx(m_file, pos, NULL, FILE_BEGIN) || !SetEndOfFile(m_file)) {
+		m_size = old_size;
+		map();
+		return false;
+	}
+
+	m_size = size;
+	if (map())
+		return true;
+
+	// back to the old size and mapping
+	pos.QuadPart = (LONGLONG)old_size;
+	SetFilePointerEx(m_file, pos, NULL, FILE_BEGIN);
+	SetEndOfFile(m_file);
+	m_size = old_size;
+	map();
+	return false;
+}
+
+void MappedFile::close(size_t final_size)
+{
+	if (!m_open)
+		return;
+
+	unmap();
+	if (m_writable && final_size != (size_t)-1) {
+		LARGE_INTEGER pos;
+		pos.QuadPart = (LONGLONG)final_size;
+		SetFilePointerEx(m_file, pos, NULL, FILE_BEGIN);
+		SetEndOfFile(m_file);
+	}
+
+	CloseHandle(m_file);
+	m_file = INVALID_HANDLE_VALUE;
+	m_size = 0;
+	m_open = false;
+	m_writable = false;
+}
+
+bool MappedFile::map()
+{
+	// empty files cannot be mapped
+	if (m_size == 0)
+		return true;
+
+	m_mapping = CreateFileMappingA(m_file, NULL, m_writable ? PAGE_READWRITE : PAGE_READONLY,
+		(DWORD)((uint64_t)m_size >> 32), (DWORD)(m_size & 0xffffffff), NULL);
+	if (!m_mapping)
+		return false;
+
+	m_data = (char *)MapViewOfFile(m_mapping, m_writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, m_size);
+	if (!m_data) {
+		CloseHandle(m_mapping);
+		m_mapping = NULL;
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::unmap()
+{
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	m_data = nullptr;
+	m_mapping = NULL;
+}
+
+#else // POSIX
+
+bool MappedFile::openRead(const std::string &path)
+{
+	close();
+
+	m_fd = ::open(path.c_str(), O_RDONLY);
+	if (m_fd < 0) {
+		errorstream << "MappedFile: cannot open " << path << std::endl;
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(m_fd, &st) != 0) {
+		::close(m_fd);
+		m_fd = -1;
+		return false;
+	}
+	m_size = (size_t)st.st_size;
+	m_writable = false;
+	m_open = true;
+
+	if (!map()) {
+		errorstream << "MappedFile: cannot map " << path << std::endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool MappedFile::openWrite(const std::string &path, size_t size)
+{
+	close();
+
+	m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (m_fd < 0) {
+		errorstream << "MappedFile: cannot create " << path << std::endl;
+		return false;
+	}
+
+	m_writable = true;
+	m_open = true;
+	if (!resize(size)) {
+		errorstream << "MappedFile: cannot map " << path << std::endl;
+		close(0);
+		return false;
+	}
+	return true;
+}
+
+bool MappedFile::resize(size_t size)
+{
+	if (!m_writable)
+		return false;
+
+	if (ftruncate(m_fd, (off_t)size) != 0)
+		return false;
+
+	// mapped before the old mapping goes, so a failure keeps it
+	void *p = NULL;
+	if (size != 0) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+		if (p == MAP_FAILED) {
+			if (ftruncate(m_fd, (off_t)m_size) != 0)
+				warningstream << "MappedFile: cannot restore the file size" << std::endl;
+			return false;
+		}
+	}
+
+	unmap();
+	m_data = (char *)p;
+	m_size = size;
+	return true;
+}
+
+void MappedFile::close(size_t final_size)
+{
+	if (!m_open)
+		return;
+
+	unmap();
+	if (m_writable && final_size != (size_t)-1 && ftruncate(m_fd, (off_t)final_size) != 0)
+		warningstream << "MappedFile: cannot truncate file" << std::endl;
+
+	::close(m_fd);
+	m_fd = -1;
+	m_size = 0;
+	m_open = false;
+	m_writable = false;
+}
+
+bool MappedFile::map()
+{
+	// empty files cannot be mapped
+	if (m_size == 0)
+		return true;
+
+	void *p = mmap(NULL, m_size, m_writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+		MAP_SHARED, m_fd, 0);
+	if (p == MAP_FAILED)
+		return false;
+
+	m_data = (char *)p;
+	return true;
+}
+
+void MappedFile::unmap()
+{
+	if (m_data)
+		munmap(m_data, m_size);
+	m_data = nullptr;
+}
+
+#endif
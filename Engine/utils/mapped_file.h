@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/*
+	A file mapped into memory.
+
+	Read mode maps the whole file read-only.  Write mode creates (or truncates)
+	the file and maps it read-write; the file can be resized while open, which
+	remaps it, so pointers into data() are only valid until the next resize().
+*/
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool openRead(const std::string &path);
+	bool openWrite(const std::string &path, size_t size);
+
+	// Write mode only. Returns false on error; the file then keeps its old
+	// size and contents and stays mapped (on Windows, possibly at another
+	// address).
+	bool resize(size_t size);
+
+	// Unmaps and closes the file. In write mode the file is first truncated
+	// to final_size bytes, unless it is (size_t)-1.
+	void close(size_t final_size = (size_t)-1);
+
+	bool isOpen() const { return m_open; }
+	bool isWritable() const { return m_writable; }
+
+	char *data() { return m_data; }
+	const char *data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	bool map();
+	void unmap();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	char *m_data;
+	size_t m_size;
+	bool m_open;
+	bool m_writable;
+#ifdef _WIN32
+	void *m_file;  // HANDLEs, so this header does not need windows.h
+	void *m_mapping;
+#else
+	int m_fd;
+#endif
+};
@@ -0,0 +1,285 @@
+#include "random_utils.h"
+#include "math2d/batchtransform.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <random>
+
+// SSE2 is part of x86-64, so it needs neither a check of the CPU nor functions compiled for it
+#if defined(_M_X64) || defined(__x86_64__)
+#define RANDOM_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // xoshiro128+ lanes of fillFloats(), one state word of eight lanes per row
+    const size_t kFillLanes = 8;
+
+    struct FillLanes
+    {
+        uint32_t s[4][kFillLanes];
+    };
+
+    uint64_t splitmix64(uint64_t &x)
+    {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    uint32_t rotl32(uint32_t x, int k)
+    {
+        return (x << k) | (x >> (32 - k));
+    }
+
+    // the largest float below b, which rounding must not reach
+    float below(float a, float b)
+    {
+        return a < b ? std::nextafter(b, a) : a;
+    }
+
+    double below(double a, double b)
+    {
+        return a < b ? std::nextafter(b, a) : a;
+    }
+
+    // one number of lane i, then its next state
+    float nextLane(FillLanes &lanes, size_t i, float a, float range, float last)
+    {
+        uint32_t *s0 = &lanes.s[0][i], *s1 = &lanes.s[1][i], *s2 = &lanes.s[2][i], *s3 = &lanes.s[3][i];
+        const uint32_t result = *s0 + *s3;
+        const uint32_t t = *s1 << 9;
+
+        *s2 ^= *s0;
+        *s3 ^= *s1;
+        *s1 ^= *s2;
+        *s0 ^= *s3;
+        *s2 ^= t;
+        *s3 = rotl32(*s3, 11);
+
+        // the low bits of xoshiro128+ are weak, a float needs only the high 24
+        const float unit = (float)(result >> 8) * (1.0f / 16777216.0f);
+        return (std::min)(a + unit * range, last);
+    }
+
+    size_t fillScalar(FillLanes &lanes, float *out, size_t count, float a, float range, float last)
+    {
+        size_t i = 0;
+        for (; i + kFillLanes <= count; i += kFillLanes)
+            for (size_t lane = 0; lane < kFillLanes; lane++)
+                out[i + lane] = nextLane(lanes, lane, a, range, last);
+        return i;
+    }
+
+#ifdef RANDOM_SSE2
+    struct Lanes4
+    {
+        __m128i s0, s1, s2, s3;
+
+        void load(const FillLanes &lanes, size_t first)
+        {
+            s0 = _mm_loadu_si128((const __m128i *)&lanes.s[0][first]);
+            s1 = _mm_loadu_si128((const __m128i *)&lanes.s[1][first]);
+            s2 = _mm_loadu_si128((const __m128i *)&lanes.s[2][first]);
+            s3 = _mm_loadu_si128((const __m128i *)&lanes.s[3][first]);
+        }
+
+        void store(FillLanes &lanes, size_t first) const
+        {
+            _mm_storeu_si128((__m128i *)&lanes.s[0][first], s0);
+            _mm_storeu_si128((__m128i *)&lanes.s[1][first], s1);
+            _mm_storeu_si128((__m128i *)&lanes.s[2][first], s2);
+            _mm_storeu_si128((__m128i *)&lanes.s[3][first], s3);
+        }
+
+        __m128 next(__m128 a, __m128 range, __m128 last)
+        {
+            const __m128i result = _mm_add_epi32(s0, s3);
+            const __m128i t = _mm_slli_epi32(s1, 9);
+
+            s2 = _mm_xor_si128(s2, s0);
+            s3 = _mm_xor_si128(s3, s1);
+            s1 = _mm_xor_si128(s1, s2);
+            s0 = _mm_xor_si128(s0, s3);
+            s2 = _mm_xor_si128(s2, t);
+            s3 = _mm_or_si128(_mm_slli_epi32(s3, 11), _mm_srli_epi32(s3, 21));
+
+            // exact: 24 bits fit a float
+            const __m128 unit = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(result, 8)),
+                    _mm_set1_ps(1.0f / 16777216.0f));
+            return _mm_min_ps(_mm_add_ps(a, _mm_mul_ps(unit, range)), last);
+        }
+    };
+
+    // the two halves of the lanes are independent, which hides the latency of each
+    size_t fillSSE2(FillLanes &lanes, float *out, size_t count, float a, float range, float last)
+    {
+        Lanes4 low, high;
+        low.load(lanes, 0);
+        high.load(lanes, 4);
+
+        const __m128 va = _mm_set1_ps(a), vrange = _mm_set1_ps(range), vlast = _mm_set1_ps(last);
+        size_t i = 0;
+        for (; i + kFillLanes <= count; i += kFillLanes) {
+            _mm_storeu_ps(out + i, low.next(va, vrange, vlast));
+            _mm_storeu_ps(out + i + 4, high.next(va, vrange, vlast));
+        }
+
+        low.store(lanes, 0);
+        high.store(lanes, 4);
+        return i;
+    }
+#endif
+
+    // where the threads split their generators off, see thread_random()
+    struct SharedRandom
+    {
+        std::mutex mutex;
+        RandomGenerator streams;
+
+        SharedRandom() : streams(((uint64_t)std::random_device{}() << 32) ^ std::random_device{}()) {}
+    };
+
+    SharedRandom &shared_random()
+    {
+        static SharedRandom shared;
+        return shared;
+    }
+
+    // bumped by set_random_seed(), the threads still on an older one split off again
+    std::atomic<uint32_t> s_seed_epoch(1);
+
+    struct ThreadRandom
+    {
+        RandomGenerator generator;
+        uint32_t epoch;
+
+        ThreadRandom() : epoch(0) {}
+    };
+
+    thread_local ThreadRandom t_random;
+}
+
+
+void RandomGenerator::setSeed(uint64_t seed)
+{
+    // splitmix64 spreads any seed, 0 included, over the state, which must not be all zero
+    for (int i = 0; i < 4; i++)
+        m_state[i] = splitmix64(seed);
+}
+
+int RandomGenerator::nextInt(int a, int b)
+{
+    if (b <= a)
+        return a;
+
+    // Lemire's multiply-shift, rejecting the few products that would bias it
+    const uint64_t range = (uint64_t)((uint32_t)b - (uint32_t)a) + 1;
+    if (range > 0xFFFFFFFFULL)
+        return (int)nextU32();
+
+    uint64_t m = (uint64_t)nextU32() * range;
+    if ((uint32_t)m < range) {
+        const uint32_t threshold = (uint32_t)(0x100000000ULL % range);
+        while ((uint32_t)m < threshold)
+            m = (uint64_t)nextU32() * range;
+    }
+    return (int)((uint32_t)a + (uint32_t)(m >> 32));
+}
+
+float RandomGenerator::nextFloat(float a, float b)
+{
+    const float result = a + nextFloat() * (b - a);
+    return result < b ? result : below(a, b);
+}
+
+double RandomGenerator::nextDouble(double a, double b)
+{
+    const double result = a + nextDouble() * (b - a);
+    return result < b ? result : below(a, b);
+}
+
+void RandomGenerator::jump()
+{
+    static const uint64_t kJump[] = {
+        0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+
+    uint64_t state[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 4; i++) {
+        for (int b = 0; b < 64; b++) {
+            if (kJump[i] & ((uint64_t)1 << b)) {
+                for (int j = 0; j < 4; j++)
+                    state[j] ^= m_state[j];
+            }
+            next();
+        }
+    }
+    for (int j = 0; j < 4; j++)
+        m_state[j] = state[j];
+}
+
+RandomGenerator RandomGenerator::split()
+{
+    RandomGenerator stream(*this);
+    jump();
+    return stream;
+}
+
+void RandomGenerator::fillFloats(float *out, size_t count, float a, float b)
+{
+    if (count == 0)
+        return;
+
+    FillLanes lanes;
+    for (size_t lane = 0; lane < kFillLanes; lane++) {
+        const uint64_t low = next(), high = next();
+        lanes.s[0][lane] = (uint32_t)low;
+        lanes.s[1][lane] = (uint32_t)(low >> 32);
+        lanes.s[2][lane] = (uint32_t)high;
+        lanes.s[3][lane] = (uint32_t)(high >> 32) | (low == 0 && high == 0);
+    }
+
+    const float range = b - a, last = below(a, b);
+    size_t done;
+#ifdef RANDOM_SSE2
+    if (GetBatchSimdLevel() != BATCH_SIMD_SCALAR)
+        done = fillSSE2(lanes, out, count, a, range, last);
+    else
+#endif
+        done = fillScalar(lanes, out, count, a, range, last);
+
+    for (size_t lane = 0; done < count; lane++, done++)
+        out[done] = nextLane(lanes, lane, a, range, last);
+}
+
+bool RandomGenerator::operator==(const RandomGenerator &other) const
+{
+    return std::equal(m_state, m_state + 4, other.m_state);
+}
+
+
+RandomGenerator &thread_random()
+{
+    ThreadRandom &local = t_random;
+    if (local.epoch != s_seed_epoch.load(std::memory_order_acquire)) {
+        SharedRandom &shared = shared_random();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        local.generator = shared.streams.split();
+        local.epoch = s_seed_epoch.load(std::memory_order_relaxed);
+    }
+    return local.generator;
+}
+
+void set_random_seed(uint64_t seed)
+{
+    SharedRandom &shared = shared_random();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    shared.streams.setSeed(seed);
+    ThreadRandom &local = t_random;
+    local.generator = shared.streams.split();
+    local.epoch = s_seed_epoch.fetch_add(1, std::memory_order_release) + 1;
+}
@@ -1,35 +1,107 @@
 #pragma once
 
-#include <random>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ ** xoshiro256** pseudo-random generator (Blackman and Vigna).
+ **
+ ** It is seeded explicitly, so the same seed gives the same numbers on every
+ ** platform and at every SIMD level; see read_seed() in string_utils.h for seeds
+ ** given as text. jump() skips 2^128 numbers. split() hands out the next 2^128
+ ** as a new generator and jumps past them, so generators split off for the job
+ ** threads never overlap. A generator is not thread-safe: give each thread its own.
+ */
+class RandomGenerator
+{
+public:
+    explicit RandomGenerator(uint64_t seed = 0) { setSeed(seed); }
+
+    void setSeed(uint64_t seed);
+
+    uint64_t next()
+    {
+        const uint64_t result = rotl(m_state[1] * 5, 7) * 9;
+        const uint64_t t = m_state[1] << 17;
+
+        m_state[2] ^= m_state[0];
+        m_state[3] ^= m_state[1];
+        m_state[1] ^= m_state[2];
+        m_state[0] ^= m_state[3];
+        m_state[2] ^= t;
+        m_state[3] = rotl(m_state[3], 45);
+
+        return result;
+    }
+
+    uint32_t nextU32() { return (uint32_t)(next() >> 32); }
+
+    // in [a, b]
+    int nextInt(int a, int b);
+
+    // in [0, 1)
+    float nextFloat() { return (float)(next() >> 40) * (1.0f / 16777216.0f); }
+    double nextDouble() { return (double)(next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    // in [a, b), a < b
+    float nextFloat(float a, float b);
+    double nextDouble(double a, double b);
+
+    bool nextBool() { return (int64_t)next() < 0; }
+
+    void jump();
+    RandomGenerator split();
+
+    /*
+     ** Fills out with count floats in [a, b), a < b, four to eight at a time with
+     ** SSE2. The numbers come from xoshiro128+ lanes seeded from this generator,
+     ** so they differ from count calls to nextFloat(a, b), but not between the
+     ** SIMD levels (see math2d/batchtransform.h).
+     */
+    void fillFloats(float *out, size_t count, float a, float b);
+
+    bool operator==(const RandomGenerator &other) const;
+    bool operator!=(const RandomGenerator &other) const { return !(*this == other); }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    uint64_t m_state[4];
+};
+
+/*
+ ** The generator of the calling thread, used by the functions below.
+ **
+ ** Until set_random_seed() is called they start from a seed read from
+ ** std::random_device. After it, the calling thread draws from the seed itself
+ ** and every other thread from a stream split off for it the first time it draws,
+ ** in that order. Jobs that must replay the same numbers should get generators
+ ** split off in a fixed order instead.
+ */
+RandomGenerator &thread_random();
+
+// reseeds the generators of all threads, see thread_random()
+void set_random_seed(uint64_t seed);
 
 /*
  ** return a random integer in the interval [a, b]
  */
 inline int random_int(int a, int b) {
-    static std::default_random_engine e{std::random_device{}()}; // avoid "Most vexing parse"
-    static std::uniform_int_distribution<int> u;
-    
-    return u(e, decltype(u)::param_type(a, b));
+    return thread_random().nextInt(a, b);
 }
 
 /*
- ** return a random real in the interval [a, b] (also [a, b))
+ ** return a random real in the interval [a, b)
  */
 inline float random_float(float a, float b) {
-    static std::default_random_engine e{std::random_device{}()};
-    static std::uniform_real_distribution<float> u;
-    
-    return u(e, decltype(u)::param_type(a, b));
+    return thread_random().nextFloat(a, b);
 }
 
 /*
- ** return a random real in the interval [a, b] (also [a, b))
+ ** return a random real in the interval [a, b)
  */
 inline double random_double(double a, double b) {
-    static std::default_random_engine e{std::random_device{}()};
-    static std::uniform_real_distribution<double> u;
-    
-    return u(e, decltype(u)::param_type(a, b));
+    return thread_random().nextDouble(a, b);
 }
 
 //returns a random double in the range -1 < n < 1
@@ -41,12 +113,10 @@ inline double random_clamped()
 //returns a random bool
 inline bool random_bool()
 {
-    if (random_float(0,1) > 0.5) return true;
-    
-    else return false;
+    return thread_random().nextBool();
 }
 
 inline float random_float()
 {
-    return random_float(0,1);
+    return thread_random().nextFloat();
 }
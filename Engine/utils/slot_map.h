@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+//---------------------------------------------------------------------------------------------------------------------
+// Objects stored by value in a slot array and referred to by generational handles, like the actors of the
+// ActorManager: the low kIndexBits of a handle select the slot, the rest is the generation the slot had when the
+// handle was made.  Insert, remove and lookup are an index into the array, and a stale handle simply resolves to
+// nothing.  Freed slots are reused in FIFO order so a slot's generation advances as slowly as possible.  0 is never a
+// valid handle.
+//
+// Removing resets the slot to ValueType(), so resources held by the value are released at once.  Pointers to values
+// are invalidated by Insert().
+//---------------------------------------------------------------------------------------------------------------------
+template <class ValueType>
+class SlotMap
+{
+public:
+	typedef uint32_t Handle;
+
+	enum eConstants
+	{
+		kIndexBits = 20,
+		kIndexMask = (1u << kIndexBits) - 1,
+		kGenerationMask = (1u << (32 - kIndexBits)) - 1,
+	};
+
+private:
+	enum eFreeList
+	{
+		kNoSlot = 0xffffffff,
+		kSlotInUse = 0xfffffffe,
+	};
+
+	struct Slot
+	{
+		ValueType value;
+		Handle handle;		// of the current or last value, 0 if the slot never held one
+		uint32_t nextFree;	// free list link, kSlotInUse while the slot holds a value
+	};
+
+	std::vector<Slot> m_slots;
+	uint32_t m_freeHead;	// oldest free slot
+	uint32_t m_freeTail;	// newest free slot
+	size_t m_size;
+
+public:
+	SlotMap(void) : m_freeHead(kNoSlot), m_freeTail(kNoSlot), m_size(0) { }
+
+	static uint32_t HandleIndex(Handle handle) { return handle & kIndexMask; }
+	static uint32_t HandleGeneration(Handle handle) { return handle >> kIndexBits; }
+
+	// Returns the handle of the new value, 0 if all slots are in use
+	Handle Insert(ValueType value)
+	{
+		uint32_t index;
+		uint32_t generation;
+
+		if (m_freeHead != kNoSlot)
+		{
+			index = m_freeHead;
+			m_freeHead = m_slots[index].nextFree;
+			if (m_freeHead == kNoSlot)
+				m_freeTail = kNoSlot;
+
+			generation = (HandleGeneration(m_slots[index].handle) + 1) & kGenerationMask;
+			if (generation == 0)
+				generation = 1;
+		}
+		else
+		{
+			if (m_slots.size() > kIndexMask)
+				return 0;
+			index = (uint32_t)m_slots.size();
+			m_slots.push_back(Slot());
+			generation = 1;
+		}
+
+		Slot& slot = m_slots[index];
+		slot.value = std::move(value);
+		slot.handle = (generation << kIndexBits) | index;
+		slot.nextFree = kSlotInUse;
+		m_size++;
+		return slot.handle;
+	}
+
+	bool Remove(Handle handle)
+	{
+		if (!Contains(handle))
+			return false;
+
+		uint32_t index = HandleIndex(handle);
+		m_slots[index].value = ValueType();
+		m_slots[index].nextFree = kNoSlot;
+
+		// append to the free list, the slot is reused after all slots freed before it
+		if (m_freeTail != kNoSlot)
+			m_slots[m_freeTail].nextFree = index;
+		else
+			m_freeHead = index;
+		m_freeTail = index;
+		m_size--;
+		return true;
+	}
+
+	bool Contains(Handle handle) const
+	{
+		uint32_t index = HandleIndex(handle);
+		return handle != 0 && index < m_slots.size() && m_slots[index].handle == handle &&
+			m_slots[index].nextFree == kSlotInUse;
+	}
+
+	ValueType* Get(Handle handle) { return Contains(handle) ? &m_slots[HandleIndex(handle)].value : nullptr; }
+	const ValueType* Get(Handle handle) const { return Contains(handle) ? &m_slots[HandleIndex(handle)].value : nullptr; }
+
+	size_t Size(void) const { return m_size; }
+	bool Empty(void) const { return m_size == 0; }
+
+	// Removes every value; the slots keep their generations so that old handles stay stale
+	void Clear(void)
+	{
+		for (size_t index = 0; index < m_slots.size(); ++index)
+		{
+			if (m_slots[index].nextFree == kSlotInUse)
+				Remove(m_slots[index].handle);
+		}
+	}
+
+	// Calls func(handle, value) for every value, in slot order.  func must not insert.
+	template <class Func>
+	void ForEach(Func func)
+	{
+		for (size_t index = 0; index < m_slots.size(); ++index)
+		{
+			if (m_slots[index].nextFree == kSlotInUse)
+				func(m_slots[index].handle, m_slots[index].value);
+		}
+	}
+};
@@ -281,6 +281,26 @@ char *mystrtok_r(char *s, const char *sep, char **lasts)
 	return s;
 }
 
+uint64_t read_seed(const char *str)
+{
+	char *endptr;
+	uint64_t num;
+
+	if (str[0] == '0' && str[1] == 'x')
+		num = strtoull(str, &endptr, 16);
+	else
+		num = strtoull(str, &endptr, 10);
+
+	// any other text is a seed too: hash it (64-bit FNV-1a)
+	if (*str == '\0' || *endptr) {
+		num = 0xcbf29ce484222325ULL;
+		for (const char *c = str; *c; c++)
+			num = (num ^ (unsigned char)*c) * 0x100000001b3ULL;
+	}
+
+	return num;
+}
+
 void str_replace(std::string &str, char from, char to)
 {
 	std::replace(str.begin(), str.end(), from, to);
@@ -1,6 +1,7 @@
 #include "TotalWarsApp.h"
 #include "filesys.h"
 #include "log.h"
+#include "settings.h"
 #include "LUAScripting/LuaStateManager.h"
 #include "scripting/lua-bindings/manual/CCLuaEngine.h"
 
@@ -40,7 +41,9 @@ bool TotalWarsApp::init_lua_manager()
 	auto engine = LuaEngine::getInstance();
 	lua_State* L = engine->getLuaStack()->getLuaState();
 
-	if (!LuaStateManager::Create(L))
+	// lua_allocator = false keeps the allocator of the cocos state; LuaJIT always keeps it
+	bool pooledAllocator = !g_settings->exists("lua_allocator") || g_settings->getBool("lua_allocator");
+	if (!LuaStateManager::Create(L, pooledAllocator))
 	{
 		errorstream << ("Failed to initialize Lua");
 		return false;
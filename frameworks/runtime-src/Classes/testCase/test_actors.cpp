@@ -0,0 +1,277 @@
+#include "unittest/test.h"
+#include "Actors/ActorManager.h"
+#include "components/transformcomponent.h"
+#include "settings.h"
+#include "log.h"
+#include "utils/time_utils.h"
+
+#include <vector>
+
+struct TestHealth
+{
+	int hp;
+
+	TestHealth(void) : hp(0) { }
+};
+
+static bool parseHealth(const LuaPlus::LuaObject &data, TestHealth &health)
+{
+	LuaPlus::LuaObject hp = data.GetByName("hp");
+	if (!hp.IsNumber())
+		return false;
+	health.hp = hp.GetInteger();
+	return true;
+}
+
+class TestActors :public TestBase {
+public:
+	TestActors() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestActors"; }
+
+	void runTests();
+
+	void testHandles();
+	void testSlotReuse();
+	void testArchetypes();
+	void testLifespan();
+	void benchActors();
+
+	static void damageSystem(ComponentPool<TestHealth> &pool, float dt);
+
+	static ActorManager *s_actors;
+};
+
+ActorManager *TestActors::s_actors = nullptr;
+
+static TestActors g_test_instance;
+
+void TestActors::runTests()
+{
+	TEST(testHandles);
+	TEST(testSlotReuse);
+	TEST(testArchetypes);
+	TEST(testLifespan);
+
+	if (g_settings->getFlag("unittest_benchmark")) {
+		TEST(benchActors);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestActors::testHandles()
+{
+	UASSERT(ActorIndex(MakeActorId(5, 3)) == 5);
+	UASSERT(ActorGeneration(MakeActorId(5, 3)) == 3);
+
+	ComponentManager components;
+	ActorManager actors(&components);
+	UASSERT(!actors.GetActor(INVALID_ACTOR_ID));
+
+	ActorId a = actors.CreateActor();
+	ActorId b = actors.CreateActor();
+	UASSERT(a != INVALID_ACTOR_ID && b != INVALID_ACTOR_ID && a != b);
+	UASSERTEQ(size_t, actors.GetNumActors(), 2);
+	UASSERT(actors.GetActor(a)->GetId() == a);
+
+	components.AddComponent<TestHealth>(a).hp = 10;
+	UASSERT(actors.GetActor(a)->GetComponent<TestHealth>()->hp == 10);
+
+	UASSERT(actors.DestroyActor(a));
+	UASSERT(!actors.DestroyActor(a));
+	UASSERT(!actors.IsAlive(a));
+	UASSERT(actors.IsAlive(b));
+	UASSERT(!components.GetComponent<TestHealth>(a));
+	UASSERTEQ(size_t, actors.GetNumActors(), 1);
+
+	// the slot comes back with a new generation, the old handle stays dead
+	ActorId c = actors.CreateActor();
+	UASSERT(ActorIndex(c) == ActorIndex(a));
+	UASSERT(c != a);
+	UASSERT(!actors.GetActor(a));
+	UASSERT(actors.GetActor(c));
+
+	// components of a stale handle are not visible through the new one
+	components.AddComponent<TestHealth>(c).hp = 5;
+	UASSERT(!components.GetComponent<TestHealth>(a));
+	UASSERT(!components.RemoveComponent<TestHealth>(a));
+	UASSERT(components.GetComponent<TestHealth>(c)->hp == 5);
+}
+
+void TestActors::testSlotReuse()
+{
+	ComponentManager components;
+	ActorManager actors(&components);
+
+	std::vector<ActorId> ids;
+	for (int i = 0; i != 8; i++)
+		ids.push_back(actors.CreateActor());
+	for (int i = 0; i != 8; i += 2)
+		actors.DestroyActor(ids[i]);
+
+	// slots are reused oldest first
+	for (int i = 0; i != 8; i += 2) {
+		ActorId id = actors.CreateActor();
+		UASSERT(ActorIndex(id) == ActorIndex(ids[i]));
+		UASSERT(ActorGeneration(id) == ActorGeneration(ids[i]) + 1);
+	}
+	UASSERTEQ(size_t, actors.GetNumActors(), 8);
+
+	// the generation wraps without producing generation 0
+	ActorId id = ids[1];
+	for (unsigned int i = 0; i != ACTOR_GENERATION_MASK + 1; i++) {
+		UASSERT(actors.DestroyActor(id));
+		id = actors.CreateActor();
+		UASSERT(ActorIndex(id) == ActorIndex(ids[1]));
+		UASSERT(ActorGeneration(id) != 0);
+	}
+
+	int alive = 0;
+	actors.ForEach([&](Actor &actor) { alive++; });
+	UASSERTEQ(int, alive, 8);
+
+	actors.Clear();
+	UASSERTEQ(size_t, actors.GetNumActors(), 0);
+	UASSERT(!actors.IsAlive(id));
+}
+
+void TestActors::testArchetypes()
+{
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	UASSERT(pState->DoString(
+		"ActorArchetypes = {\n"
+		"  Soldier = { Transform = { x = 1, y = 2, yaw = 0.5 }, Health = { hp = 100 } },\n"
+		"  Bullet = { lifespan = 100, Transform = {} },\n"
+		"  Broken = { Health = { } },\n"
+		"}\n") == 0);
+
+	{
+		ComponentManager components;
+		ActorManager actors(&components, pState);
+		actors.RegisterComponentType<TestHealth>("Health", &parseHealth);
+
+		ActorId soldier = actors.CreateActor("Soldier");
+		UASSERT(soldier != INVALID_ACTOR_ID);
+		UASSERT(actors.GetActor(soldier)->GetArchetype() == actors.FindArchetype("Soldier"));
+		UASSERT(components.GetComponent<TestHealth>(soldier)->hp == 100);
+		TransformComponent *pTransform = components.GetComponent<TransformComponent>(soldier);
+		UASSERT(pTransform && pTransform->position.x == 1.0 && pTransform->position.y == 2.0 && pTransform->yaw == 0.5);
+
+		// every actor gets its own copy of the archetype's components
+		ActorId other = actors.CreateActor("Soldier");
+		components.GetComponent<TestHealth>(other)->hp = 1;
+		UASSERT(components.GetComponent<TestHealth>(soldier)->hp == 100);
+
+		ActorId bullet = actors.CreateActor("Bullet");
+		UASSERT(actors.GetActor(bullet)->GetLifespan() == 100.0f);
+		UASSERT(!components.GetComponent<TestHealth>(bullet));
+
+		UASSERT(actors.CreateActor("Broken") == INVALID_ACTOR_ID);
+		UASSERT(actors.CreateActor("Missing") == INVALID_ACTOR_ID);
+
+		// explicit registration wins over the Lua global and is parsed once
+		pState->DoString("Custom = { Health = { hp = 7 } }");
+		UASSERT(actors.RegisterArchetype("Soldier", pState->GetGlobal("Custom")));
+		UASSERT(components.GetComponent<TestHealth>(actors.CreateActor("Soldier"))->hp == 7);
+		UASSERT(actors.GetActor(soldier)->GetArchetype()->name == "Soldier");
+
+		// destroying the manager removes the actors' components
+		actors.Clear();
+		UASSERTEQ(size_t, components.GetPool<TestHealth>().Size(), 0);
+	}
+
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestActors::damageSystem(ComponentPool<TestHealth> &pool, float dt)
+{
+	const ActorId *owners = pool.Actors();
+	TestHealth *health = pool.Data();
+	for (size_t i = 0; i < pool.Size(); i++) {
+		health[i].hp -= 1;
+		// destroyed while the pool is walked, removed after the update
+		if (health[i].hp <= 0)
+			UASSERT(s_actors->DestroyActor(owners[i]));
+	}
+}
+
+void TestActors::testLifespan()
+{
+	ComponentManager components;
+	ActorManager actors(&components);
+	components.AddBatchUpdate<TestHealth>(&TestActors::damageSystem);
+	s_actors = &actors;
+
+	ActorId shortLived = actors.CreateActor();
+	actors.GetActor(shortLived)->SetLifespan(25.0f);
+	ActorId forever = actors.CreateActor();
+
+	ActorId weak = actors.CreateActor();
+	components.AddComponent<TestHealth>(weak).hp = 2;
+	ActorId strong = actors.CreateActor();
+	components.AddComponent<TestHealth>(strong).hp = 3;
+
+	actors.update(10.0f);
+	UASSERT(actors.GetActor(shortLived)->GetTimeAlive() == 10.0f);
+	UASSERTEQ(size_t, actors.GetNumActors(), 4);
+
+	actors.update(10.0f);
+	UASSERT(!actors.IsAlive(weak));
+	UASSERT(actors.IsAlive(strong));
+	UASSERTEQ(size_t, components.GetPool<TestHealth>().Size(), 1);
+
+	actors.update(10.0f);
+	UASSERT(!actors.IsAlive(shortLived));
+	UASSERT(!actors.IsAlive(strong));
+	UASSERT(actors.IsAlive(forever));
+	UASSERT(actors.GetActor(forever)->GetTimeAlive() == 30.0f);
+	UASSERTEQ(size_t, actors.GetNumActors(), 1);
+	UASSERTEQ(size_t, components.GetPool<TestHealth>().Size(), 0);
+
+	s_actors = nullptr;
+}
+
+void TestActors::benchActors()
+{
+	const int count = 20000;
+	const int frames = 600;
+
+	ComponentManager components;
+	ActorManager actors(&components);
+	actors.Reserve(count);
+	actors.RegisterComponentType<TestHealth>("Health", &parseHealth);
+
+	std::vector<ActorId> ids;
+	uint64_t t1 = getTimeUs();
+	for (int i = 0; i != count; i++) {
+		ActorId id = actors.CreateActor();
+		components.AddComponent<TransformComponent>(id);
+		ids.push_back(id);
+	}
+	uint64_t t2 = getTimeUs();
+
+	// one simulated second at 60 Hz, replacing 1% of the actors every frame
+	uint64_t lookups = 0;
+	for (int f = 0; f != frames / 10; f++) {
+		for (int i = 0; i != count / 100; i++) {
+			size_t n = (f * 7919 + i * 104729) % ids.size();
+			actors.DestroyActor(ids[n]);
+			ids[n] = actors.CreateActor();
+			components.AddComponent<TransformComponent>(ids[n]);
+		}
+		for (size_t i = 0; i != ids.size(); i++)
+			lookups += actors.GetActor(ids[i]) != nullptr;
+		actors.update(16.0f);
+	}
+	uint64_t t3 = getTimeUs();
+	for (int f = 0; f != frames; f++)
+		actors.update(16.0f);
+	uint64_t t4 = getTimeUs();
+
+	UASSERTEQ(size_t, actors.GetNumActors(), count);
+	UASSERT(lookups == (uint64_t)count * (frames / 10));
+
+	rawstream << "    " << count << " actors: create " << (t2 - t1) << "us, frame with "
+		<< count / 100 << " replaced and " << count << " lookups " << (t3 - t2) / (frames / 10)
+		<< "us, update " << (t4 - t3) / frames << "us/frame" << std::endl;
+}
@@ -0,0 +1,278 @@
+#include "unittest/test.h"
+#include "binary_log.h"
+#include "filesys.h"
+#include "log.h"
+#include "settings.h"
+#include "utils/time_utils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TestBinaryLog :public TestBase {
+public:
+	TestBinaryLog() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestBinaryLog"; }
+
+	void runTests();
+
+	void testRoundTrip();
+	void testThreads();
+	void testLevels();
+	void testReadWhileOpen();
+	void benchBinaryLog();
+};
+
+static TestBinaryLog g_test_instance;
+
+void TestBinaryLog::runTests()
+{
+	TEST(testRoundTrip);
+	TEST(testThreads);
+	TEST(testLevels);
+	TEST(testReadWhileOpen);
+
+	if (g_settings->getFlag("unittest_benchmark")) {
+		TEST(benchBinaryLog);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+enum TestEnum { TEST_ENUM_A = -3 };
+
+std::string testPath(const char *name)
+{
+	return fs::TempPath() + DIR_DELIM + name;
+}
+
+}
+
+void TestBinaryLog::testRoundTrip()
+{
+	std::string path = testPath("test_binary_log.blog");
+	UASSERT(g_binary_log.open(path));
+
+	std::string name = "archer";
+	BLOG(LL_ACTION, "started");
+	BLOG(LL_INFO, "unit {} ({}) at {},{}", 42, name, 1.5f, -2.25);
+	BLOG(LL_WARNING, "{} {} {} {} {}", true, 'x', -1234567890123ll, (uint64_t)-1, TEST_ENUM_A);
+	BLOG(LL_ERROR, "literal {} and pointer {}", "text", name.c_str());
+	BLOG(LL_INFO, "too few {} {}", 1);
+	BLOG(LL_INFO, "too many {}", 1, 2);
+	BLOG(LL_INFO, "cut {}", std::string(BLOG_MAX_STRING + 100, 'y'));
+	UASSERTEQ(uint64_t, g_binary_log.getRecordCount(), 7);
+	g_binary_log.close();
+	UASSERT(!g_binary_log.isOpen());
+
+	BinaryLogReader reader;
+	UASSERT(reader.load(path));
+	const std::vector<BinaryLogReader::Entry> &entries = reader.getEntries();
+	UASSERTEQ(size_t, entries.size(), 7);
+
+	UASSERT(entries[0].level == LL_ACTION);
+	UASSERTEQ(std::string, entries[0].text, "started");
+	UASSERTEQ(std::string, entries[0].thread_name, g_logger.getThreadName());
+	UASSERT(entries[0].line > 0);
+	UASSERT(entries[0].file.find("test_binary_log.cpp") != std::string::npos);
+
+	UASSERT(entries[1].level == LL_INFO);
+	UASSERTEQ(std::string, entries[1].text, "unit 42 (archer) at 1.5,-2.25");
+	UASSERTEQ(std::string, entries[2].text, "true x -1234567890123 18446744073709551615 -3");
+	UASSERTEQ(std::string, entries[3].text, "literal text and pointer archer");
+	UASSERTEQ(std::string, entries[4].text, "too few 1 {?}");
+	UASSERTEQ(std::string, entries[5].text, "too many 1 2");
+	UASSERTEQ(size_t, entries[6].text.size(), 4 + BLOG_MAX_STRING);
+
+	// times only go forward within a thread
+	for (size_t i = 1; i < entries.size(); i++)
+		UASSERT(entries[i].time_ns >= entries[i - 1].time_ns);
+
+	// same layout as the text log
+	std::string line = BinaryLogReader::formatEntry(entries[1]);
+	UASSERT(line.find(": INFO[" + entries[1].thread_name + "]: unit 42") != std::string::npos);
+	UASSERTEQ(char, line[4], '-');
+	UASSERTEQ(char, line[19], '.');
+
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+}
+
+void TestBinaryLog::testThreads()
+{
+	const int num_threads = 4;
+	const int count = 5000;
+	std::string path = testPath("test_binary_log_threads.blog");
+	UASSERT(g_binary_log.open(path));
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t != num_threads; t++) {
+		threads.push_back(std::thread([t, count]() {
+			g_logger.registerThread("B" + std::to_string(t));
+			for (int i = 0; i != count; i++)
+				BLOG(LL_INFO, "{} {}", t, i);
+			g_logger.deregisterThread();
+		}));
+	}
+	for (auto it = threads.begin(); it != threads.end(); ++it)
+		it->join();
+	g_binary_log.close();
+
+	BinaryLogReader reader;
+	UASSERT(reader.load(path));
+	reader.sortByTime();
+	const std::vector<BinaryLogReader::Entry> &entries = reader.getEntries();
+	UASSERTEQ(size_t, entries.size(), (size_t)(num_threads * count));
+
+	std::vector<int> next(num_threads, 0);
+	for (size_t i = 0; i < entries.size(); i++) {
+		int t = -1, n = -1;
+		UASSERT(sscanf(entries[i].text.c_str(), "%d %d", &t, &n) == 2);
+		UASSERT(t >= 0 && t < num_threads);
+		UASSERTEQ(std::string, entries[i].thread_name, "B" + std::to_string(t));
+		UASSERTEQ(int, n, next[t]);
+		next[t]++;
+		if (i > 0)
+			UASSERT(entries[i].time_ns >= entries[i - 1].time_ns);
+	}
+
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+}
+
+void TestBinaryLog::testLevels()
+{
+	std::string path = testPath("test_binary_log_levels.blog");
+
+	// closed: nothing happens
+	BLOG(LL_ERROR, "not written");
+
+	// each file registers its sites again
+	for (int pass = 0; pass != 2; pass++) {
+		UASSERT(g_binary_log.open(path));
+		g_binary_log.setMaxLevel(LL_INFO);
+		for (int i = 0; i != 3; i++) {
+			BLOG(LL_VERBOSE, "verbose {}", i);
+			BLOG(LL_INFO, "info {}", i);
+		}
+		g_binary_log.setMaxLevel(LL_VERBOSE);
+		g_binary_log.close();
+
+		BinaryLogReader reader;
+		UASSERT(reader.load(path));
+		UASSERTEQ(size_t, reader.getEntries().size(), 3);
+		UASSERTEQ(std::string, reader.getEntries()[2].text, "info 2");
+	}
+
+	// not a binary log
+	BinaryLogReader reader;
+	UASSERT(!reader.load(path + ".missing"));
+	FILE *f = fopen(path.c_str(), "wb");
+	fputs("plain text, long enough to hold a header.....", f);
+	fclose(f);
+	UASSERT(!reader.load(path));
+	UASSERT(!reader.getError().empty());
+
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+}
+
+void TestBinaryLog::testReadWhileOpen()
+{
+	// what was flushed is readable even if the process never closes the log
+	std::string path = testPath("test_binary_log_open.blog");
+	UASSERT(g_binary_log.open(path));
+	for (int i = 0; i != 10; i++)
+		BLOG(LL_INFO, "record {}", i);
+	g_binary_log.flush();
+	BLOG(LL_INFO, "still buffered");
+
+	BinaryLogReader reader;
+	UASSERT(reader.load(path));
+	UASSERTEQ(size_t, reader.getEntries().size(), 10);
+
+	g_binary_log.close();
+	UASSERT(reader.load(path));
+	UASSERTEQ(size_t, reader.getEntries().size(), 11);
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+}
+
+void TestBinaryLog::benchBinaryLog()
+{
+	const int count = 1000000;
+	std::string path = testPath("test_binary_log_bench.blog");
+	std::string text_path = testPath("test_binary_log_bench.txt");
+
+	// the same lines in the text log, written synchronously to a file
+	uint64_t text_ns;
+	{
+		fs::DeleteSingleFileOrEmptyDirectory(text_path);
+		Logger logger;
+		FileLogOutput output;
+		output.setFile(text_path, 0);
+		logger.addOutputMaxLevel(&output, LL_INFO);
+		const int text_count = count / 10;
+		std::string line;
+		uint64_t t1 = getTimeNs();
+		for (int i = 0; i != text_count; i++) {
+			line = "unit " + std::to_string(i) + " moved to (" + std::to_string(i * 0.5f) + ", "
+				+ std::to_string(-i * 0.25f) + "), path of " + std::to_string(i % 97)
+				+ " nodes took " + std::to_string(i % 13) + " us";
+			logger.log(LL_INFO, line);
+		}
+		text_ns = (getTimeNs() - t1) / text_count;
+		logger.removeOutput(&output);
+	}
+	FILE *f = fopen(text_path.c_str(), "rb");
+	fseek(f, 0, SEEK_END);
+	double text_bytes = (double)ftell(f) / (count / 10);
+	fclose(f);
+
+	UASSERT(g_binary_log.open(path));
+	uint64_t t1 = getTimeNs();
+	for (int i = 0; i != count; i++) {
+		BLOG(LL_INFO, "unit {} moved to ({}, {}), path of {} nodes took {} us",
+			i, i * 0.5f, -i * 0.25f, i % 97, i % 13);
+	}
+	uint64_t binary_ns = (getTimeNs() - t1) / count;
+	g_binary_log.close();
+
+	f = fopen(path.c_str(), "rb");
+	fseek(f, 0, SEEK_END);
+	double binary_bytes = (double)ftell(f) / count;
+	fclose(f);
+
+	rawstream << "    text log:   " << text_ns << " ns/call, " << text_bytes << " bytes/line" << std::endl;
+	rawstream << "    binary log: " << binary_ns << " ns/call, " << binary_bytes << " bytes/record ("
+		<< text_bytes / binary_bytes << "x smaller)" << std::endl;
+
+	// four threads at once
+	const int num_threads = 4;
+	UASSERT(g_binary_log.open(path));
+	std::vector<std::thread> threads;
+	t1 = getTimeNs();
+	for (int t = 0; t != num_threads; t++) {
+		threads.push_back(std::thread([count, num_threads]() {
+			for (int i = 0; i != count / num_threads; i++) {
+				BLOG(LL_INFO, "unit {} moved to ({}, {}), path of {} nodes took {} us",
+					i, i * 0.5f, -i * 0.25f, i % 97, i % 13);
+			}
+		}));
+	}
+	for (auto it = threads.begin(); it != threads.end(); ++it)
+		it->join();
+	uint64_t threads_ns = getTimeNs() - t1;
+	g_binary_log.close();
+	rawstream << "    binary log, " << num_threads << " threads: " << threads_ns / count
+		<< " ns/call wall time" << std::endl;
+
+	BinaryLogReader reader;
+	t1 = getTimeNs();
+	UASSERT(reader.load(path));
+	UASSERTEQ(size_t, reader.getEntries().size(), (size_t)count);
+	rawstream << "    decoding: " << (getTimeNs() - t1) / count << " ns/record" << std::endl;
+
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+	fs::DeleteSingleFileOrEmptyDirectory(text_path);
+}
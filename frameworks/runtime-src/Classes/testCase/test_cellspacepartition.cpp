@@ -0,0 +1,333 @@
+#include "unittest/test.h"
+#include "math2d/cellspacepartition.h"
+#include "threading/job_system.h"
+#include "settings.h"
+#include "log.h"
+#include "utils/time_utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+class TestCellSpacePartition :public TestBase {
+public:
+	TestCellSpacePartition() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestCellSpacePartition"; }
+
+	void runTests();
+
+	void testEntities();
+	void testQueries();
+	void testMovingEntities();
+	void testAllNeighbors();
+	void benchRebucketing();
+	void benchAllNeighbors();
+};
+
+static TestCellSpacePartition g_test_instance;
+
+void TestCellSpacePartition::runTests()
+{
+	TEST(testEntities);
+	TEST(testQueries);
+	TEST(testMovingEntities);
+	TEST(testAllNeighbors);
+
+	if (g_settings->getFlag("unittest_benchmark")) {
+		TEST(benchRebucketing);
+		TEST(benchAllNeighbors);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// what the grid should find, by looking at every entity
+struct Agents
+{
+	std::vector<ActorId> ids;
+	std::vector<Vector2D> positions;
+	std::vector<unsigned int> entities;
+
+	std::vector<ActorId> inRadius(const Vector2D &target, double radius) const
+	{
+		std::vector<ActorId> found;
+		for (size_t i = 0; i < ids.size(); i++) {
+			if (Vec2DDistanceSq(positions[i], target) <= radius * radius)
+				found.push_back(ids[i]);
+		}
+		return found;
+	}
+
+	std::vector<ActorId> inBox(const Vector2D &boxMin, const Vector2D &boxMax) const
+	{
+		std::vector<ActorId> found;
+		for (size_t i = 0; i < ids.size(); i++) {
+			const Vector2D &pos = positions[i];
+			if (pos.x >= boxMin.x && pos.x <= boxMax.x && pos.y >= boxMin.y && pos.y <= boxMax.y)
+				found.push_back(ids[i]);
+		}
+		return found;
+	}
+};
+
+// 1000 x 1000 world, some agents outside it
+Agents addAgents(CellSpacePartition &grid, size_t count, std::mt19937 &rng)
+{
+	std::uniform_real_distribution<double> coord(-50.0, 1050.0);
+	Agents agents;
+	for (size_t i = 0; i < count; i++) {
+		ActorId id = MakeActorId((unsigned int)i + 1, 1);
+		Vector2D pos(coord(rng), coord(rng));
+		agents.ids.push_back(id);
+		agents.positions.push_back(pos);
+		agents.entities.push_back(grid.AddEntity(id, pos));
+	}
+	return agents;
+}
+
+bool sameIds(std::vector<ActorId> found, std::vector<ActorId> expected)
+{
+	std::sort(found.begin(), found.end());
+	std::sort(expected.begin(), expected.end());
+	return found == expected;
+}
+
+bool queriesMatch(const CellSpacePartition &grid, const Agents &agents, std::mt19937 &rng)
+{
+	std::uniform_real_distribution<double> coord(-100.0, 1100.0);
+	std::uniform_real_distribution<double> size(0.0, 80.0);
+	for (int query = 0; query < 50; query++) {
+		Vector2D target(coord(rng), coord(rng));
+		double radius = size(rng);
+		std::vector<ActorId> found;
+		size_t count = grid.CalculateNeighbors(target, radius, found);
+		if (count != found.size() || !sameIds(found, agents.inRadius(target, radius)))
+			return false;
+
+		Vector2D boxMax = target + Vector2D(size(rng), size(rng));
+		found.clear();
+		grid.QueryAABB(target, boxMax, found);
+		if (!sameIds(found, agents.inBox(target, boxMax)))
+			return false;
+	}
+	return true;
+}
+
+}
+
+void TestCellSpacePartition::testEntities()
+{
+	CellSpacePartition grid(Vector2D(0, 0), Vector2D(100, 50), 10.0);
+	UASSERTEQ(int, grid.NumCellsX(), 10);
+	UASSERTEQ(int, grid.NumCellsY(), 5);
+	UASSERTEQ(int, grid.PositionToIndex(Vector2D(15, 25)), 2 * 10 + 1);
+	// outside the world: the border cells
+	UASSERTEQ(int, grid.PositionToIndex(Vector2D(-5, 500)), 4 * 10 + 0);
+
+	unsigned int first = grid.AddEntity(11, Vector2D(1, 1));
+	unsigned int second = grid.AddEntity(12, Vector2D(2, 2));
+	unsigned int third = grid.AddEntity(13, Vector2D(55, 25));
+	UASSERTEQ(size_t, grid.Size(), 3);
+	UASSERT(grid.IsEntity(second));
+	UASSERTEQ(ActorId, grid.GetId(third), 13);
+	UASSERT(grid.GetPosition(third) == Vector2D(55, 25));
+
+	// within the cell, then to another one
+	grid.UpdateEntity(first, Vector2D(3, 4));
+	UASSERT(grid.GetPosition(first) == Vector2D(3, 4));
+	grid.UpdateEntity(first, Vector2D(95, 45));
+	UASSERT(grid.GetPosition(first) == Vector2D(95, 45));
+	UASSERTEQ(ActorId, grid.GetId(first), 11);
+	UASSERTEQ(ActorId, grid.GetId(second), 12);
+
+	grid.RemoveEntity(second);
+	UASSERT(!grid.IsEntity(second));
+	UASSERTEQ(size_t, grid.Size(), 2);
+	std::vector<ActorId> found;
+	UASSERTEQ(size_t, grid.CalculateNeighbors(Vector2D(0, 0), 20.0, found), 0);
+
+	// handles are reused
+	UASSERTEQ(unsigned int, grid.AddEntity(14, Vector2D(0, 0)), second);
+	UASSERTEQ(size_t, grid.CalculateNeighbors(Vector2D(0, 0), 20.0, found), 1);
+	UASSERTEQ(ActorId, found[0], 14);
+
+	grid.Clear();
+	UASSERTEQ(size_t, grid.Size(), 0);
+	found.clear();
+	UASSERTEQ(size_t, grid.CalculateNeighbors(Vector2D(50, 25), 100.0, found), 0);
+}
+
+void TestCellSpacePartition::testQueries()
+{
+	std::mt19937 rng(1);
+	CellSpacePartition grid(Vector2D(0, 0), Vector2D(1000, 1000), 25.0);
+	Agents agents = addAgents(grid, 3000, rng);
+	UASSERT(queriesMatch(grid, agents, rng));
+
+	// the visitor sees what the query collects
+	size_t visited = 0;
+	grid.ForEachNeighbor(Vector2D(500, 500), 60.0, [&](ActorId id, const Vector2D &pos) {
+		UASSERT(Vec2DDistance(pos, Vector2D(500, 500)) <= 60.0);
+		visited++;
+	});
+	UASSERTEQ(size_t, visited, agents.inRadius(Vector2D(500, 500), 60.0).size());
+
+	// a radius larger than the world
+	std::vector<ActorId> found;
+	UASSERTEQ(size_t, grid.CalculateNeighbors(Vector2D(500, 500), 5000.0, found), agents.ids.size());
+}
+
+// random walks re-bucket, grow and compact the cells, and adds and removals reuse the handles
+void TestCellSpacePartition::testMovingEntities()
+{
+	std::mt19937 rng(2);
+	CellSpacePartition grid(Vector2D(0, 0), Vector2D(1000, 1000), 20.0);
+	Agents agents = addAgents(grid, 5000, rng);
+	std::normal_distribution<double> step(0.0, 8.0);
+	std::uniform_real_distribution<double> coord(0.0, 1000.0);
+
+	bool compacted = false;
+	for (int frame = 0; frame < 60; frame++) {
+		// everyone drifts towards a corner, so cells empty and fill up
+		for (Vector2D &pos : agents.positions)
+			pos += Vector2D(step(rng) - 2.0, step(rng) - 2.0);
+		grid.UpdateEntities(agents.entities.data(), agents.positions.data(), agents.entities.size());
+		compacted = compacted || grid.Unused() == 0;
+
+		// swap a few agents for new ones
+		for (int i = 0; i < 10; i++) {
+			size_t index = rng() % agents.ids.size();
+			grid.RemoveEntity(agents.entities[index]);
+			agents.ids[index] = MakeActorId((unsigned int)index + 1, frame + 2);
+			agents.positions[index] = Vector2D(coord(rng), coord(rng));
+			agents.entities[index] = grid.AddEntity(agents.ids[index], agents.positions[index]);
+		}
+
+		if (frame % 10 == 0)
+			UASSERT(queriesMatch(grid, agents, rng));
+	}
+	UASSERTEQ(size_t, grid.Size(), agents.ids.size());
+	UASSERT(queriesMatch(grid, agents, rng));
+
+	for (size_t i = 0; i < agents.ids.size(); i++) {
+		UASSERTEQ(ActorId, grid.GetId(agents.entities[i]), agents.ids[i]);
+		UASSERT(grid.GetPosition(agents.entities[i]) == agents.positions[i]);
+	}
+
+	grid.Compact();
+	UASSERTEQ(size_t, grid.Unused(), 0);
+	UASSERT(grid.Capacity() >= grid.Size());
+	UASSERT(queriesMatch(grid, agents, rng));
+	infostream << "TestCellSpacePartition: compacted while moving: " << compacted << std::endl;
+}
+
+void TestCellSpacePartition::testAllNeighbors()
+{
+	std::mt19937 rng(3);
+	CellSpacePartition grid(Vector2D(0, 0), Vector2D(1000, 1000), 30.0);
+	Agents agents = addAgents(grid, 2000, rng);
+	// a free handle in the middle
+	grid.RemoveEntity(agents.entities[7]);
+	agents.ids.erase(agents.ids.begin() + 7);
+	agents.positions.erase(agents.positions.begin() + 7);
+	unsigned int removed = agents.entities[7];
+	agents.entities.erase(agents.entities.begin() + 7);
+
+	const double radius = 40.0;
+	NeighborLists serial;
+	grid.CalculateAllNeighbors(radius, serial);
+	UASSERTEQ(size_t, serial.Count(removed), 0);
+
+	size_t total = 0;
+	for (size_t i = 0; i < agents.ids.size(); i++) {
+		std::vector<ActorId> expected = agents.inRadius(agents.positions[i], radius);
+		expected.erase(std::find(expected.begin(), expected.end(), agents.ids[i]));
+		std::vector<ActorId> found(serial.Begin(agents.entities[i]), serial.End(agents.entities[i]));
+		UASSERT(sameIds(found, expected));
+		total += found.size();
+	}
+	UASSERTEQ(size_t, serial.Total(), total);
+
+	// the same lists from the worker threads, into lists used before
+	JobSystem jobs(3);
+	NeighborLists parallel;
+	grid.CalculateAllNeighbors(radius * 2, parallel, &jobs);
+	grid.CalculateAllNeighbors(radius, parallel, &jobs);
+	UASSERTEQ(size_t, parallel.Total(), serial.Total());
+	for (unsigned int entity : agents.entities) {
+		std::vector<ActorId> found(parallel.Begin(entity), parallel.End(entity));
+		std::vector<ActorId> expected(serial.Begin(entity), serial.End(entity));
+		UASSERT(sameIds(found, expected));
+	}
+}
+
+// 20000 agents moving at up to 60 units per second, re-bucketed every frame of 60 Hz
+void TestCellSpacePartition::benchRebucketing()
+{
+	const size_t numAgents = 20000;
+	const int frames = 120;
+	std::mt19937 rng(4);
+	CellSpacePartition grid(Vector2D(0, 0), Vector2D(2000, 2000), 20.0);
+	Agents agents = addAgents(grid, numAgents, rng);
+	std::uniform_real_distribution<double> speed(-60.0, 60.0);
+	std::vector<Vector2D> velocities(numAgents);
+	for (Vector2D &velocity : velocities)
+		velocity.Set(speed(rng) / 60.0, speed(rng) / 60.0);
+
+	uint64_t totalNs = 0;
+	uint64_t worstNs = 0;
+	for (int frame = 0; frame < frames; frame++) {
+		for (size_t i = 0; i < numAgents; i++)
+			agents.positions[i] += velocities[i];
+		uint64_t start = getTimeNs();
+		grid.UpdateEntities(agents.entities.data(), agents.positions.data(), numAgents);
+		uint64_t ns = getTimeNs() - start;
+		totalNs += ns;
+		worstNs = (std::max)(worstNs, ns);
+	}
+
+	rawstream << "    " << numAgents << " agents re-bucketed: " << totalNs / frames / 1000
+		<< " us per frame, worst " << worstNs / 1000 << " us" << std::endl;
+}
+
+void TestCellSpacePartition::benchAllNeighbors()
+{
+	const size_t numAgents = 20000;
+	const double radius = 20.0;
+	std::mt19937 rng(5);
+	CellSpacePartition grid(Vector2D(0, 0), Vector2D(1000, 1000), radius);
+	Agents agents = addAgents(grid, numAgents, rng);
+
+	NeighborLists lists;
+	uint64_t serialNs = UINT64_MAX;
+	for (int round = 0; round < 5; round++) {
+		uint64_t start = getTimeNs();
+		grid.CalculateAllNeighbors(radius, lists);
+		serialNs = (std::min)(serialNs, getTimeNs() - start);
+	}
+
+	JobSystem jobs(3);
+	uint64_t parallelNs = UINT64_MAX;
+	for (int round = 0; round < 5; round++) {
+		uint64_t start = getTimeNs();
+		grid.CalculateAllNeighbors(radius, lists, &jobs);
+		parallelNs = (std::min)(parallelNs, getTimeNs() - start);
+	}
+
+	// what it replaces: every pair, for a tenth of the agents
+	uint64_t start = getTimeNs();
+	size_t pairs = 0;
+	for (size_t i = 0; i < numAgents / 10; i++) {
+		for (size_t j = 0; j < numAgents; j++)
+			pairs += Vec2DDistanceSq(agents.positions[i], agents.positions[j]) <= radius * radius;
+	}
+	uint64_t bruteNs = (getTimeNs() - start) * 10;
+
+	rawstream << "    " << numAgents << " agents, all neighbours within " << radius << " ("
+		<< lists.Total() / numAgents << " each): " << serialNs / 1000 << " us, "
+		<< parallelNs / 1000 << " us on 4 threads, every pair ~" << bruteNs / 1000
+		<< " us (" << pairs << ")" << std::endl;
+}
@@ -0,0 +1,270 @@
+#include "unittest/test.h"
+#include "components/componentmanager.h"
+#include "settings.h"
+#include "log.h"
+#include "utils/time_utils.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+struct TestPosition
+{
+	float x, y;
+
+	TestPosition(void) : x(0), y(0) { }
+	TestPosition(float x_, float y_) : x(x_), y(y_) { }
+};
+
+struct TestVelocity
+{
+	float dx, dy;
+
+	TestVelocity(void) : dx(0), dy(0) { }
+	TestVelocity(float dx_, float dy_) : dx(dx_), dy(dy_) { }
+};
+
+class TestComponents :public TestBase {
+public:
+	TestComponents() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestComponents"; }
+
+	void runTests();
+
+	void testPool();
+	void testPoolSparseIds();
+	void testManager();
+	void testSystems();
+	void benchUpdate();
+
+	static void moveSystem(ComponentPool<TestVelocity> &pool, float dt);
+	static void countSystem(ComponentPool<TestPosition> &pool, float dt);
+
+	static ComponentManager *s_manager;
+	static int s_order;
+};
+
+ComponentManager *TestComponents::s_manager = nullptr;
+int TestComponents::s_order = 0;
+
+static TestComponents g_test_instance;
+
+void TestComponents::runTests()
+{
+	TEST(testPool);
+	TEST(testPoolSparseIds);
+	TEST(testManager);
+	TEST(testSystems);
+
+	if (g_settings->getFlag("unittest_benchmark")) {
+		TEST(benchUpdate);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestComponents::moveSystem(ComponentPool<TestVelocity> &pool, float dt)
+{
+	UASSERTEQ(int, s_order++, 0);
+
+	// join with the positions through the dense owner array
+	const ActorId *actors = pool.Actors();
+	TestVelocity *velocities = pool.Data();
+	for (size_t i = 0; i < pool.Size(); i++) {
+		TestPosition *p = s_manager->GetComponent<TestPosition>(actors[i]);
+		if (p) {
+			p->x += velocities[i].dx * dt;
+			p->y += velocities[i].dy * dt;
+		}
+	}
+}
+
+void TestComponents::countSystem(ComponentPool<TestPosition> &pool, float dt)
+{
+	UASSERTEQ(int, s_order++, 1);
+}
+
+void TestComponents::testPool()
+{
+	ComponentPool<TestPosition> pool;
+	UASSERTEQ(size_t, pool.Size(), 0);
+	UASSERT(!pool.Get(3));
+
+	for (ActorId id = 0; id != 10; id++)
+		pool.Add(id, (float)id, 0.0f);
+	UASSERTEQ(size_t, pool.Size(), 10);
+	UASSERT(pool.VHas(9));
+	UASSERT(pool.Get(7)->x == 7.0f);
+
+	// removal keeps the array dense and every remaining actor mapped
+	UASSERT(pool.VRemove(2));
+	UASSERT(!pool.VRemove(2));
+	UASSERTEQ(size_t, pool.Size(), 9);
+	UASSERT(!pool.VHas(2));
+	for (ActorId id = 0; id != 10; id++) {
+		if (id != 2)
+			UASSERT(pool.Get(id) && pool.Get(id)->x == (float)id);
+	}
+	for (size_t i = 0; i < pool.Size(); i++)
+		UASSERT(pool.Data()[i].x == (float)pool.Actors()[i]);
+
+	// adding twice replaces
+	pool.Add(5, 50.0f, 1.0f);
+	UASSERTEQ(size_t, pool.Size(), 9);
+	UASSERT(pool.Get(5)->x == 50.0f);
+
+	float sum = 0;
+	for (auto it = pool.begin(); it != pool.end(); ++it)
+		sum += it->y;
+	UASSERT(sum == 1.0f);
+
+	pool.VClear();
+	UASSERTEQ(size_t, pool.Size(), 0);
+	UASSERT(!pool.Get(5));
+}
+
+void TestComponents::testPoolSparseIds()
+{
+	ComponentPool<TestVelocity> pool;
+	pool.Add(0x7fffff00, 1.0f, 2.0f);
+	pool.Add(5, 3.0f, 4.0f);
+	UASSERT(pool.Get(0x7fffff00)->dy == 2.0f);
+	UASSERT(!pool.Get(0x7ffffe00));
+	UASSERT(pool.VRemove(0x7fffff00));
+	UASSERT(pool.Get(5)->dx == 3.0f);
+}
+
+void TestComponents::testManager()
+{
+	ComponentManager components;
+	UASSERT(!components.GetComponent<TestPosition>(1));
+	UASSERT(!components.HasComponent<TestPosition>(1));
+
+	components.AddComponent<TestPosition>(1, 1.0f, 2.0f);
+	components.AddComponent<TestVelocity>(1, 3.0f, 4.0f);
+	components.AddComponent<TestPosition>(2);
+	UASSERT(components.HasComponent<TestPosition>(1));
+	UASSERT(components.GetComponent<TestPosition>(1)->y == 2.0f);
+	UASSERT(components.GetComponent<TestVelocity>(1)->dx == 3.0f);
+	UASSERT(!components.GetComponent<TestVelocity>(2));
+
+	int visited = 0;
+	components.ForEach<TestPosition>([&](ActorId id, TestPosition &p) {
+		visited++;
+		p.x += 1.0f;
+	});
+	UASSERTEQ(int, visited, 2);
+	UASSERT(components.GetComponent<TestPosition>(2)->x == 1.0f);
+
+	UASSERT(components.RemoveComponent<TestVelocity>(1));
+	UASSERT(!components.HasComponent<TestVelocity>(1));
+
+	components.RemoveActor(1);
+	UASSERT(!components.GetComponent<TestPosition>(1));
+	UASSERT(components.GetComponent<TestPosition>(2));
+	UASSERTEQ(size_t, components.GetPool<TestPosition>().Size(), 1);
+}
+
+void TestComponents::testSystems()
+{
+	ComponentManager components;
+	s_manager = &components;
+	components.AddBatchUpdate<TestVelocity>(&TestComponents::moveSystem);
+	components.AddBatchUpdate<TestPosition>(&TestComponents::countSystem);
+
+	components.AddComponent<TestPosition>(1);
+	components.AddComponent<TestVelocity>(1, 1.0f, -1.0f);
+	components.AddComponent<TestPosition>(2);
+
+	s_order = 0;
+	components.update(2.0f);
+	UASSERTEQ(int, s_order, 2);
+	UASSERT(components.GetComponent<TestPosition>(1)->x == 2.0f);
+	UASSERT(components.GetComponent<TestPosition>(1)->y == -2.0f);
+	UASSERT(components.GetComponent<TestPosition>(2)->x == 0.0f);
+	s_manager = nullptr;
+}
+
+// the per-actor layout this storage replaces: a map of virtual components per actor
+class LegacyComponent
+{
+public:
+	virtual ~LegacyComponent() { }
+	virtual void VUpdate(float deltaMs) = 0;
+};
+
+class LegacyMover : public LegacyComponent
+{
+public:
+	TestPosition m_pos;
+	TestVelocity m_vel;
+
+	virtual void VUpdate(float deltaMs)
+	{
+		m_pos.x += m_vel.dx * deltaMs;
+		m_pos.y += m_vel.dy * deltaMs;
+	}
+};
+
+// components without per-frame work still get their virtual call
+class LegacyIdle : public LegacyComponent
+{
+public:
+	virtual void VUpdate(float deltaMs) { }
+};
+
+struct TestMover
+{
+	TestPosition pos;
+	TestVelocity vel;
+};
+
+static void updateMovers(ComponentPool<TestMover> &pool, float dt)
+{
+	TestMover *movers = pool.Data();
+	for (size_t i = 0, count = pool.Size(); i < count; i++) {
+		movers[i].pos.x += movers[i].vel.dx * dt;
+		movers[i].pos.y += movers[i].vel.dy * dt;
+	}
+}
+
+void TestComponents::benchUpdate()
+{
+	const int frames = 100;
+
+	for (int actors = 1000; actors <= 10000; actors *= 10) {
+		typedef std::map<ComponentId, std::shared_ptr<LegacyComponent> > ActorComponents;
+		std::vector<ActorComponents> legacy(actors);
+		ComponentManager components;
+		components.AddBatchUpdate<TestMover>(&updateMovers);
+
+		for (int i = 0; i != actors; i++) {
+			std::shared_ptr<LegacyMover> mover = std::make_shared<LegacyMover>();
+			mover->m_vel = TestVelocity(1.0f, 0.5f);
+			legacy[i][1] = mover;
+			// other components the actor would have
+			legacy[i][2] = std::make_shared<LegacyIdle>();
+			legacy[i][3] = std::make_shared<LegacyIdle>();
+
+			TestMover &m = components.AddComponent<TestMover>(i);
+			m.vel = TestVelocity(1.0f, 0.5f);
+		}
+
+		uint64_t t1 = getTimeUs();
+		for (int f = 0; f != frames; f++) {
+			for (auto actor = legacy.begin(); actor != legacy.end(); ++actor)
+				for (auto it = actor->begin(); it != actor->end(); ++it)
+					it->second->VUpdate(1.0f);
+		}
+		uint64_t t2 = getTimeUs();
+		for (int f = 0; f != frames; f++)
+			components.update(1.0f);
+		uint64_t t3 = getTimeUs();
+
+		UASSERT(components.GetComponent<TestMover>(actors - 1)->pos.x == (float)frames);
+
+		rawstream << "    " << actors << " actors: map of virtual components "
+			<< (t2 - t1) / frames << "us/frame, component pools "
+			<< (t3 - t2) / frames << "us/frame" << std::endl;
+	}
+}
@@ -0,0 +1,693 @@
+#include "unittest/test.h"
+#include "eventmanager/EventManagerImpl.h"
+#include "eventmanager/EventListenerTable.h"
+#include "settings.h"
+#include "log.h"
+#include "utils/time_utils.h"
+
+#include <map>
+#include <list>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+class EvtData_Test : public BaseEventData
+{
+	EventType m_type;
+
+public:
+	static const EventType sk_EventType;
+
+	EvtData_Test(void) : m_type(sk_EventType) { }
+	explicit EvtData_Test(EventType type) : m_type(type) { }
+
+	virtual const EventType& VGetEventType(void) const { return m_type; }
+	virtual IEventDataPtr VCopy(void) const { return MakeEvent<EvtData_Test>(m_type); }
+	virtual const char* GetName(void) const { return "EvtData_Test"; }
+};
+
+const EventType EvtData_Test::sk_EventType(0x1e57e7e7);
+
+class TestEventManager :public TestBase {
+public:
+	TestEventManager() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestEventManager"; }
+
+	void runTests();
+
+	void testAddRemove();
+	void testManyTypes();
+	void testRemoveDuringDispatch();
+	void testAddDuringDispatch();
+	void testQueueAndUpdate();
+	void testPriorities();
+	void testBudget();
+	void testParallelDispatch();
+	void testRemoveParallelDuringDispatch();
+	void testEventPool();
+	void testEventPoolThreads();
+	void testEventFactory();
+	void benchDispatch();
+	void benchFrameAllocations();
+	void benchParallelDispatch();
+
+	// listener callbacks
+	void onEvent(IEventDataPtr pEvent) { m_calls++; }
+	void onEventOther(IEventDataPtr pEvent) { m_other_calls++; }
+	void onEventRemoveOther(IEventDataPtr pEvent);
+	void onEventAddOther(IEventDataPtr pEvent);
+	void onEventRecord(IEventDataPtr pEvent) { m_order.push_back(pEvent->VGetEventType()); }
+	void onEventSlow(IEventDataPtr pEvent);
+	void onEventParallel(IEventDataPtr pEvent);
+	void onEventParallelWork(IEventDataPtr pEvent);
+	void onEventRemoveParallel(IEventDataPtr pEvent);
+
+	int m_calls;
+	int m_other_calls;
+	EventListenerTable *m_table;
+	EventManager *m_mgr;
+	std::vector<EventType> m_order;
+	std::atomic<int> m_parallel_calls;
+	std::atomic<uint32_t> m_parallel_sum;
+};
+
+static TestEventManager g_test_instance;
+
+// Holds events until its thread exits, after the event pool's cache of the thread when constructed before it.
+struct ThreadExitEvents
+{
+	std::vector<IEventDataPtr> events;
+	std::atomic<int>* pReleased;
+
+	ThreadExitEvents(void) : pReleased(nullptr) { }
+	~ThreadExitEvents(void)
+	{
+		// one more allocation and free on the way out
+		events.push_back(MakeEvent<EvtData_Test>(1));
+		if (pReleased)
+			*pReleased += (int)events.size();
+		events.clear();
+	}
+};
+
+void TestEventManager::runTests()
+{
+	TEST(testAddRemove);
+	TEST(testManyTypes);
+	TEST(testRemoveDuringDispatch);
+	TEST(testAddDuringDispatch);
+	TEST(testQueueAndUpdate);
+	TEST(testPriorities);
+	TEST(testBudget);
+	TEST(testParallelDispatch);
+	TEST(testRemoveParallelDuringDispatch);
+	TEST(testEventPool);
+	TEST(testEventPoolThreads);
+	TEST(testEventFactory);
+
+	if (g_settings->getFlag("unittest_benchmark")) {
+		TEST(benchDispatch);
+		TEST(benchFrameAllocations);
+		TEST(benchParallelDispatch);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestEventManager::onEventRemoveOther(IEventDataPtr pEvent)
+{
+	m_calls++;
+	m_table->Remove(pEvent->VGetEventType(),
+		fastdelegate::MakeDelegate(this, &TestEventManager::onEventOther));
+}
+
+void TestEventManager::onEventAddOther(IEventDataPtr pEvent)
+{
+	m_calls++;
+	m_table->Add(pEvent->VGetEventType(),
+		fastdelegate::MakeDelegate(this, &TestEventManager::onEventOther));
+}
+
+void TestEventManager::testAddRemove()
+{
+	EventListenerTable table;
+	EventListenerDelegate d1 = fastdelegate::MakeDelegate(this, &TestEventManager::onEvent);
+	EventListenerDelegate d2 = fastdelegate::MakeDelegate(this, &TestEventManager::onEventOther);
+
+	UASSERT(!table.HasListeners(1));
+	UASSERT(table.Add(1, d1));
+	UASSERT(!table.Add(1, d1));
+	UASSERT(table.Add(1, d2));
+	UASSERT(table.Add(2, d1));
+	UASSERTEQ(uint32_t, table.GetListenerCount(1), 2);
+
+	m_calls = m_other_calls = 0;
+	IEventDataPtr pEvent(new EvtData_Test(1));
+	UASSERT(table.Dispatch(pEvent));
+	UASSERTEQ(int, m_calls, 1);
+	UASSERTEQ(int, m_other_calls, 1);
+
+	UASSERT(table.Remove(1, d1));
+	UASSERT(!table.Remove(1, d1));
+	UASSERT(!table.Remove(3, d1));
+	UASSERT(table.Dispatch(pEvent));
+	UASSERTEQ(int, m_calls, 1);
+	UASSERTEQ(int, m_other_calls, 2);
+
+	UASSERT(table.Remove(1, d2));
+	UASSERT(!table.HasListeners(1));
+	UASSERT(!table.Dispatch(pEvent));
+	UASSERT(table.HasListeners(2));
+}
+
+void TestEventManager::testManyTypes()
+{
+	// forces the table to grow several times, with both hashed and sequential types
+	EventListenerTable table;
+	EventListenerDelegate d1 = fastdelegate::MakeDelegate(this, &TestEventManager::onEvent);
+	for (EventType t = 0; t != 1000; t++) {
+		UASSERT(table.Add(t, d1));
+		UASSERT(table.Add(t * 0x53fbab61, d1) || t == 0);
+	}
+
+	m_calls = 0;
+	for (EventType t = 0; t != 1000; t++) {
+		UASSERT(table.Dispatch(IEventDataPtr(new EvtData_Test(t))));
+		UASSERT(table.HasListeners(t * 0x53fbab61));
+	}
+	UASSERTEQ(int, m_calls, 1000);
+	UASSERT(!table.HasListeners(1000));
+}
+
+void TestEventManager::testRemoveDuringDispatch()
+{
+	EventListenerTable table;
+	m_table = &table;
+
+	UASSERT(table.Add(7, fastdelegate::MakeDelegate(this, &TestEventManager::onEventRemoveOther)));
+	UASSERT(table.Add(7, fastdelegate::MakeDelegate(this, &TestEventManager::onEvent)));
+	UASSERT(table.Add(7, fastdelegate::MakeDelegate(this, &TestEventManager::onEventAddOther)));
+	UASSERT(table.Add(7, fastdelegate::MakeDelegate(this, &TestEventManager::onEventOther)));
+
+	// the first listener removes the last one before it is reached; the third adds it
+	// back, which must only take effect for the next event
+	m_calls = m_other_calls = 0;
+	UASSERT(table.Dispatch(IEventDataPtr(new EvtData_Test(7))));
+	UASSERTEQ(int, m_calls, 3);
+	UASSERTEQ(int, m_other_calls, 0);
+	UASSERTEQ(uint32_t, table.GetListenerCount(7), 4);
+}
+
+void TestEventManager::testAddDuringDispatch()
+{
+	EventListenerTable table;
+	m_table = &table;
+
+	UASSERT(table.Add(9, fastdelegate::MakeDelegate(this, &TestEventManager::onEventAddOther)));
+
+	m_calls = m_other_calls = 0;
+	table.Dispatch(IEventDataPtr(new EvtData_Test(9)));
+	UASSERTEQ(int, m_calls, 1);
+	UASSERTEQ(int, m_other_calls, 0);
+
+	table.Dispatch(IEventDataPtr(new EvtData_Test(9)));
+	UASSERTEQ(int, m_calls, 2);
+	UASSERTEQ(int, m_other_calls, 1);
+	UASSERTEQ(uint32_t, table.GetListenerCount(9), 2);
+}
+
+void TestEventManager::testQueueAndUpdate()
+{
+	EventManager mgr("TestEventManager", false);
+	EventListenerDelegate d1 = fastdelegate::MakeDelegate(this, &TestEventManager::onEvent);
+
+	UASSERT(!mgr.VQueueEvent(IEventDataPtr(new EvtData_Test(5))));
+	UASSERT(mgr.VAddListener(d1, 5));
+	UASSERT(mgr.VQueueEvent(IEventDataPtr(new EvtData_Test(5))));
+	UASSERT(mgr.VThreadSafeQueueEvent(IEventDataPtr(new EvtData_Test(5))));
+
+	// realtime events are moved to the queue before it is processed
+	m_calls = 0;
+	UASSERT(mgr.VUpdate());
+	UASSERTEQ(int, m_calls, 2);
+	UASSERT(mgr.VUpdate());
+	UASSERTEQ(int, m_calls, 2);
+
+	UASSERT(mgr.VTriggerEvent(IEventDataPtr(new EvtData_Test(5))));
+	UASSERTEQ(int, m_calls, 3);
+	UASSERT(mgr.VRemoveListener(d1, 5));
+	UASSERT(!mgr.VTriggerEvent(IEventDataPtr(new EvtData_Test(5))));
+
+	// more realtime events than the ring holds, pushed by its consumer: they spill over in order instead of blocking
+	EventListenerDelegate d2 = fastdelegate::MakeDelegate(this, &TestEventManager::onEventRecord);
+	UASSERT(mgr.VAddListener(d2, 6));
+	UASSERT(mgr.VAddListener(d2, 7));
+	const unsigned int count = EVENTMANAGER_REALTIME_QUEUE_SIZE * 2 + 10;
+	for (unsigned int i = 0; i < count; i++)
+		UASSERT(mgr.VThreadSafeQueueEvent(IEventDataPtr(new EvtData_Test((i % 3) ? 6 : 7))));
+
+	m_order.clear();
+	UASSERT(mgr.VUpdate());
+	UASSERTEQ(size_t, m_order.size(), count);
+	for (unsigned int i = 0; i < count; i++)
+		UASSERTEQ(EventType, m_order[i], (i % 3) ? 6 : 7);
+
+	UASSERT(mgr.VThreadSafeQueueEvent(IEventDataPtr(new EvtData_Test(6))));
+	UASSERT(mgr.VUpdate());
+	UASSERTEQ(size_t, m_order.size(), count + 1);
+}
+
+void TestEventManager::onEventSlow(IEventDataPtr pEvent)
+{
+	m_calls++;
+	uint64_t end = getTimeNs() + 2000000;
+	while (getTimeNs() < end)
+		;
+}
+
+void TestEventManager::testPriorities()
+{
+	EventManager mgr("TestEventManager", false);
+	EventListenerDelegate d = fastdelegate::MakeDelegate(this, &TestEventManager::onEventRecord);
+
+	const EventType critical = 10, normal = 11, deferrable = 12, normal2 = 13;
+	mgr.VSetEventPriority(critical, EVENTPRIORITY_CRITICAL);
+	mgr.VSetEventPriority(deferrable, EVENTPRIORITY_DEFERRABLE);
+	UASSERT(mgr.VAddListener(d, critical));
+	UASSERT(mgr.VAddListener(d, normal));
+	UASSERT(mgr.VAddListener(d, deferrable));
+	UASSERT(mgr.VAddListener(d, normal2));
+
+	UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(deferrable)));
+	UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(normal)));
+	UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(critical)));
+	UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(normal)));
+	UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(deferrable)));
+	UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(critical)));
+
+	// without a budget only critical events run, the rest is carried over
+	m_order.clear();
+	UASSERT(!mgr.VUpdateMicros(0));
+	UASSERT(m_order == std::vector<EventType>({ critical, critical }));
+
+	const EventFrameStats& stats = mgr.VGetFrameStats();
+	UASSERTEQ(uint32_t, stats.processed[EVENTPRIORITY_CRITICAL], 2);
+	UASSERTEQ(uint32_t, stats.processed[EVENTPRIORITY_NORMAL], 0);
+	UASSERTEQ(uint32_t, stats.deferred[EVENTPRIORITY_NORMAL], 2);
+	UASSERTEQ(uint32_t, stats.deferred[EVENTPRIORITY_DEFERRABLE], 2);
+	UASSERTEQ(uint32_t, stats.types.at(critical).processed, 2);
+	UASSERTEQ(uint32_t, stats.types.at(normal).deferred, 2);
+	UASSERTEQ(uint32_t, stats.types.at(deferrable).deferred, 2);
+
+	// carried events keep their order and run before newer ones of their class; normal runs before deferrable
+	UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(normal2)));
+	m_order.clear();
+	UASSERT(mgr.VUpdate());
+	UASSERT(m_order == std::vector<EventType>({ normal, normal, normal2, deferrable, deferrable }));
+	UASSERTEQ(uint32_t, stats.processed[EVENTPRIORITY_NORMAL], 3);
+	UASSERTEQ(uint32_t, stats.processed[EVENTPRIORITY_DEFERRABLE], 2);
+	UASSERTEQ(uint32_t, stats.deferred[EVENTPRIORITY_DEFERRABLE], 0);
+	UASSERTEQ(uint32_t, stats.types.at(critical).processed, 0);
+
+	// aborting finds events in their priority queue
+	UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(deferrable)));
+	UASSERT(mgr.VAbortEvent(deferrable));
+	m_order.clear();
+	UASSERT(mgr.VUpdate());
+	UASSERT(m_order.empty());
+
+	// and in the queue of the priority they were queued at, after the type changed class
+	UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(deferrable)));
+	UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(deferrable)));
+	mgr.VSetEventPriority(deferrable, EVENTPRIORITY_CRITICAL);
+	UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(deferrable)));
+	UASSERT(mgr.VAbortEvent(deferrable, true));
+	UASSERT(!mgr.VAbortEvent(deferrable));
+	m_order.clear();
+	UASSERT(mgr.VUpdate());
+	UASSERT(m_order.empty());
+}
+
+void TestEventManager::testBudget()
+{
+	EventManager mgr("TestEventManager", false);
+	EventListenerDelegate d = fastdelegate::MakeDelegate(this, &TestEventManager::onEventSlow);
+	UASSERT(mgr.VAddListener(d, 5));
+
+	// 2ms per event against a 5ms budget
+	for (int i = 0; i != 10; i++)
+		UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(5)));
+
+	m_calls = 0;
+	UASSERT(!mgr.VUpdateMicros(5000));
+	const EventFrameStats& stats = mgr.VGetFrameStats();
+	UASSERT(m_calls >= 1 && m_calls <= 3);
+	UASSERTEQ(uint32_t, stats.processed[EVENTPRIORITY_NORMAL], (uint32_t)m_calls);
+	UASSERTEQ(uint32_t, stats.deferred[EVENTPRIORITY_NORMAL], (uint32_t)(10 - m_calls));
+	UASSERT(stats.types.at(5).timeNs >= (uint64_t)m_calls * 2000000);
+	UASSERT(stats.timeNs >= stats.types.at(5).timeNs);
+
+	while (!mgr.VUpdateMicros(5000))
+		;
+	UASSERTEQ(int, m_calls, 10);
+}
+
+void TestEventManager::onEventParallel(IEventDataPtr pEvent)
+{
+	m_parallel_calls.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TestEventManager::onEventParallelWork(IEventDataPtr pEvent)
+{
+	// stands in for a pure listener, e.g. a stat aggregation
+	uint32_t h = pEvent->VGetEventType();
+	for (int i = 0; i != 200; i++)
+		h = (h ^ (h >> 15)) * 0x2c1b3c6d + i;
+	m_parallel_sum.fetch_add(h, std::memory_order_relaxed);
+}
+
+void TestEventManager::testParallelDispatch()
+{
+	EventManager mgr("TestEventManager", false);
+	mgr.SetDispatchThreads(3);
+	UASSERTEQ(unsigned int, mgr.GetDispatchThreads(), 3);
+
+	EventListenerDelegate serial = fastdelegate::MakeDelegate(this, &TestEventManager::onEventRecord);
+	EventListenerDelegate parallel = fastdelegate::MakeDelegate(this, &TestEventManager::onEventParallel);
+	UASSERT(mgr.VAddListener(serial, 5));
+	UASSERT(mgr.VAddListener(parallel, 5, IEventManager::kParallelSafe));
+	UASSERT(mgr.VAddListener(parallel, 6, IEventManager::kParallelSafe));
+	UASSERT(!mgr.VAddListener(parallel, 5));
+
+	// serial listeners keep the queue order, every parallel call has finished when VUpdate returns
+	const int count = 2000;
+	for (int i = 0; i != count; i++)
+		UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(5 + i % 2)));
+
+	m_order.clear();
+	m_parallel_calls = 0;
+	UASSERT(mgr.VUpdate());
+	UASSERTEQ(size_t, m_order.size(), (size_t)count / 2);
+	UASSERTEQ(int, m_parallel_calls.load(), count);
+	UASSERTEQ(uint32_t, mgr.VGetFrameStats().processed[EVENTPRIORITY_NORMAL], (uint32_t)count);
+
+	// triggered events call parallel-safe listeners directly
+	UASSERT(mgr.VTriggerEvent(MakeEvent<EvtData_Test>(6)));
+	UASSERTEQ(int, m_parallel_calls.load(), count + 1);
+
+	// a removed parallel listener is never called again
+	UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(6)));
+	UASSERT(mgr.VRemoveListener(parallel, 6));
+	UASSERT(mgr.VUpdate());
+	UASSERTEQ(int, m_parallel_calls.load(), count + 1);
+
+	// without workers the same listeners run on the main thread
+	mgr.SetDispatchThreads(0);
+	UASSERTEQ(unsigned int, mgr.GetDispatchThreads(), 0);
+	UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(5)));
+	UASSERT(mgr.VUpdate());
+	UASSERTEQ(int, m_parallel_calls.load(), count + 2);
+}
+
+void TestEventManager::onEventRemoveParallel(IEventDataPtr pEvent)
+{
+	m_calls++;
+	m_mgr->VRemoveListener(fastdelegate::MakeDelegate(this, &TestEventManager::onEventParallel), 5);
+}
+
+void TestEventManager::testRemoveParallelDuringDispatch()
+{
+	EventManager mgr("TestEventManager", false);
+	mgr.SetDispatchThreads(2);
+	m_mgr = &mgr;
+
+	EventListenerDelegate parallel = fastdelegate::MakeDelegate(this, &TestEventManager::onEventParallel);
+	UASSERT(mgr.VAddListener(parallel, 5, IEventManager::kParallelSafe));
+	UASSERT(mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventManager::onEventRemoveParallel), 6));
+
+	// a serial listener removes the parallel one in the middle of a batch: the calls collected before still run,
+	// the ones after never do, and ProcessQueue keeps filling its batch
+	const int before = (int)EVENTMANAGER_PARALLEL_BATCH_CALLS + 10;
+	for (int i = 0; i != before; i++)
+		UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(5)));
+	UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(6)));
+	for (int i = 0; i != 100; i++)
+		UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(5)));
+
+	m_calls = 0;
+	m_parallel_calls = 0;
+	mgr.VUpdate();
+	UASSERTEQ(int, m_calls, 1);
+	UASSERTEQ(int, m_parallel_calls.load(), before);
+	UASSERT(!mgr.VRemoveListener(parallel, 5));
+
+	// the manager keeps dispatching parallel listeners afterwards
+	UASSERT(mgr.VAddListener(parallel, 5, IEventManager::kParallelSafe));
+	for (int i = 0; i != 1000; i++)
+		UASSERT(mgr.VQueueEvent(MakeEvent<EvtData_Test>(5)));
+	UASSERT(mgr.VUpdate());
+	UASSERTEQ(int, m_parallel_calls.load(), before + 1000);
+}
+
+void TestEventManager::testEventPool()
+{
+	bool was_enabled = EventMemoryPool::IsEnabled();
+	EventMemoryPool::SetEnabled(true);
+
+	// warm up the size classes used below
+	{
+		std::vector<IEventDataPtr> events;
+		for (int i = 0; i != 100; i++)
+			events.push_back(MakeEvent<EvtData_Test>(i));
+	}
+
+	// recycled blocks must not reach the heap again
+	EventAllocStats before = EventMemoryPool::GetStats();
+	for (int round = 0; round != 10; round++) {
+		std::vector<IEventDataPtr> events;
+		for (int i = 0; i != 100; i++)
+			events.push_back(MakeEvent<EvtData_Test>(i));
+		for (int i = 0; i != 100; i++)
+			UASSERTEQ(EventType, events[i]->VGetEventType(), (EventType)i);
+	}
+	EventAllocStats diff = EventMemoryPool::GetStats() - before;
+	UASSERTEQ(uint64_t, diff.heapAllocs, 0);
+	UASSERTEQ(uint64_t, diff.poolAllocs, 1000);
+
+	// unpooled events are counted as heap allocations
+	EventMemoryPool::SetEnabled(false);
+	before = EventMemoryPool::GetStats();
+	IEventDataPtr pEvent = MakeEvent<EvtData_Test>(3);
+	diff = EventMemoryPool::GetStats() - before;
+	UASSERTEQ(uint64_t, diff.heapAllocs, 1);
+
+	// memory goes back to where it came from even after the mode changed
+	EventMemoryPool::SetEnabled(true);
+	pEvent.reset();
+
+	// oversized requests bypass the pool
+	void *p = EventMemoryPool::Allocate(EventMemoryPool::kMaxBlockSize + 1);
+	UASSERT(p != nullptr);
+	EventMemoryPool::Free(p, EventMemoryPool::kMaxBlockSize + 1);
+
+	EventMemoryPool::SetEnabled(was_enabled);
+}
+
+void TestEventManager::testEventPoolThreads()
+{
+	// events created on workers and released on this thread, like VThreadSafeQueueEvent
+	const int num_threads = 4;
+	const int per_thread = 5000;
+
+	mpscqueue<IEventDataPtr> q(1024);
+	std::vector<std::thread> producers;
+	for (int t = 0; t != num_threads; t++) {
+		producers.emplace_back([&q, per_thread]() {
+			for (int i = 0; i != per_thread; i++)
+				q.push(MakeEvent<EvtData_Test>(i));
+		});
+	}
+
+	int received = 0;
+	bool valid = true;
+	while (received != num_threads * per_thread) {
+		size_t n = q.consume_all([&](IEventDataPtr &&pEvent) {
+			if (pEvent->VGetEventType() >= (EventType)per_thread)
+				valid = false;
+			received++;
+		});
+		if (n == 0)
+			std::this_thread::yield();
+	}
+
+	for (size_t i = 0; i != producers.size(); i++)
+		producers[i].join();
+
+	UASSERT(valid);
+
+	// events a thread still holds in a thread_local destroyed after its cache go to the shared lists
+	std::atomic<int> released(0);
+	std::thread exiting([&released]() {
+		static thread_local ThreadExitEvents t_events;
+		t_events.pReleased = &released;
+		for (int i = 0; i != 1000; i++)
+			t_events.events.push_back(MakeEvent<EvtData_Test>(i));
+	});
+	exiting.join();
+	UASSERTEQ(int, released.load(), 1001);
+}
+
+void TestEventManager::testEventFactory()
+{
+	REGISTER_EVENT(EvtData_Test);
+	UASSERT(!REGISTER_EVENT(EvtData_Test));
+
+	IEventDataPtr pEvent = CREATE_EVENT(EvtData_Test::sk_EventType);
+	UASSERT(pEvent);
+	UASSERTEQ(EventType, pEvent->VGetEventType(), EvtData_Test::sk_EventType);
+
+	IEventDataPtr pCopy = pEvent->VCopy();
+	UASSERT(pCopy && pCopy != pEvent);
+	UASSERT(!CREATE_EVENT(0xdeadbeef));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestEventManager::benchDispatch()
+{
+	const int num_types = 200;
+	const int events_per_frame = 10000;
+	const int frames = 50;
+
+	// event types are hashed strings in practice
+	std::vector<EventType> types;
+	for (int i = 0; i != num_types; i++)
+		types.push_back((EventType)((i + 1) * 2654435761u));
+
+	std::vector<IEventDataPtr> events;
+	for (int i = 0; i != events_per_frame; i++)
+		events.push_back(IEventDataPtr(new EvtData_Test(types[(i * 7) % num_types])));
+
+	// the storage EventManager used before: std::map of std::list
+	std::map<EventType, std::list<EventListenerDelegate>> old_listeners;
+	EventListenerTable table;
+	for (int i = 0; i != num_types; i++) {
+		EventListenerDelegate d1 = fastdelegate::MakeDelegate(this, &TestEventManager::onEvent);
+		EventListenerDelegate d2 = fastdelegate::MakeDelegate(this, &TestEventManager::onEventOther);
+		old_listeners[types[i]].push_back(d1);
+		old_listeners[types[i]].push_back(d2);
+		table.Add(types[i], d1);
+		table.Add(types[i], d2);
+	}
+
+	m_calls = 0;
+	uint64_t t1 = getTimeUs();
+	for (int f = 0; f != frames; f++) {
+		for (size_t i = 0; i != events.size(); i++) {
+			auto findIt = old_listeners.find(events[i]->VGetEventType());
+			if (findIt == old_listeners.end())
+				continue;
+			const std::list<EventListenerDelegate> &listeners = findIt->second;
+			for (auto it = listeners.begin(); it != listeners.end(); ++it) {
+				EventListenerDelegate listener = (*it);
+				listener(events[i]);
+			}
+		}
+	}
+	uint64_t old_us = getTimeUs() - t1;
+
+	t1 = getTimeUs();
+	for (int f = 0; f != frames; f++) {
+		for (size_t i = 0; i != events.size(); i++)
+			table.Dispatch(events[i]);
+	}
+	uint64_t table_us = getTimeUs() - t1;
+
+	// whole pipeline: queue every event, then process the frame
+	EventManager mgr("TestEventManager", false);
+	for (int i = 0; i != num_types; i++)
+		mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventManager::onEvent), types[i]);
+	t1 = getTimeUs();
+	for (int f = 0; f != frames; f++) {
+		for (size_t i = 0; i != events.size(); i++)
+			mgr.VQueueEvent(events[i]);
+		mgr.VUpdate();
+	}
+	uint64_t mgr_us = getTimeUs() - t1;
+
+	rawstream << "    " << events_per_frame << " events/frame, " << num_types << " types: "
+		<< "map+list " << old_us / frames << "us/frame, "
+		<< "EventListenerTable " << table_us / frames << "us/frame, "
+		<< "EventManager queue+update " << mgr_us / frames << "us/frame" << std::endl;
+}
+
+void TestEventManager::benchFrameAllocations()
+{
+	const int events_per_frame = 10000;
+	const int frames = 20;
+
+	bool was_enabled = EventMemoryPool::IsEnabled();
+	for (int pooled = 0; pooled != 2; pooled++) {
+		EventMemoryPool::SetEnabled(pooled != 0);
+
+		// queues pick up the allocation mode when they are created
+		EventManager mgr("TestEventManager", false);
+		mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventManager::onEvent),
+			EvtData_Test::sk_EventType);
+
+		uint64_t t1 = getTimeUs();
+		EventAllocStats last;
+		for (int f = 0; f != frames; f++) {
+			// every frame creates, queues, dispatches and releases its events
+			for (int i = 0; i != events_per_frame; i++)
+				mgr.VQueueEvent(MakeEvent<EvtData_Test>());
+			mgr.VUpdate();
+			last = mgr.GetFrameAllocStats();
+		}
+		uint64_t tdiff = getTimeUs() - t1;
+
+		rawstream << "    " << (pooled ? "pooled:   " : "unpooled: ")
+			<< last.heapAllocs << " heap allocations/frame, "
+			<< last.poolAllocs << " pool allocations/frame, "
+			<< tdiff / frames << "us/frame" << std::endl;
+	}
+	EventMemoryPool::SetEnabled(was_enabled);
+}
+
+void TestEventManager::benchParallelDispatch()
+{
+	const int events_per_frame = 50000;
+	const int frames = 10;
+	unsigned int workers = (std::max)(std::thread::hardware_concurrency(), 2u) - 1;
+
+	for (int mode = 0; mode != 2; mode++) {
+		EventManager mgr("TestEventManager", false);
+		mgr.SetDispatchThreads(mode ? workers : 0);
+
+		// one cheap serial listener and two pure ones per event
+		mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventManager::onEvent),
+			EvtData_Test::sk_EventType);
+		mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventManager::onEventParallelWork),
+			EvtData_Test::sk_EventType, IEventManager::kParallelSafe);
+		mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventManager::onEventParallel),
+			EvtData_Test::sk_EventType, IEventManager::kParallelSafe);
+
+		m_calls = 0;
+		m_parallel_calls = 0;
+		uint64_t dispatch_us = 0;
+		for (int f = 0; f != frames; f++) {
+			for (int i = 0; i != events_per_frame; i++)
+				mgr.VQueueEvent(MakeEvent<EvtData_Test>());
+
+			uint64_t t1 = getTimeUs();
+			mgr.VUpdate();
+			dispatch_us += getTimeUs() - t1;
+		}
+		UASSERTEQ(int, m_calls, events_per_frame * frames);
+		UASSERTEQ(int, m_parallel_calls.load(), events_per_frame * frames);
+
+		rawstream << "    " << mgr.GetDispatchThreads() << " dispatch threads: "
+			<< dispatch_us / frames << "us/frame for " << events_per_frame << " events" << std::endl;
+	}
+}
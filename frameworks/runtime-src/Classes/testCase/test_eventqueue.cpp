@@ -0,0 +1,193 @@
+#include "unittest/test.h"
+#include "eventmanager/concurrentqueue.h"
+#include "eventmanager/mpscqueue.h"
+#include "settings.h"
+#include "log.h"
+#include "utils/time_utils.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+class TestEventQueue :public TestBase {
+public:
+	TestEventQueue() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestEventQueue"; }
+
+	void runTests();
+
+	void testSingleThread();
+	void testBatchDrain();
+	void testMultiProducer();
+	void benchContention();
+};
+
+static TestEventQueue g_test_instance;
+
+void TestEventQueue::runTests()
+{
+	TEST(testSingleThread);
+	TEST(testBatchDrain);
+	TEST(testMultiProducer);
+
+	if (g_settings->getFlag("unittest_benchmark"))
+		TEST(benchContention);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestEventQueue::testSingleThread()
+{
+	mpscqueue<int> q(5);
+	UASSERTEQ(size_t, q.capacity(), 8);
+	UASSERT(q.empty());
+
+	int item = -1;
+	UASSERT(!q.try_pop(item));
+
+	for (int i = 0; i != 8; i++)
+		UASSERT(q.try_push(i));
+	UASSERT(!q.try_push(8));
+	UASSERT(!q.empty());
+
+	for (int i = 0; i != 8; i++) {
+		UASSERT(q.try_pop(item));
+		UASSERTEQ(int, item, i);
+	}
+	UASSERT(q.empty());
+
+	// wrap around a few laps
+	for (int i = 0; i != 100; i++) {
+		q.push(i);
+		q.wait_and_pop(item);
+		UASSERTEQ(int, item, i);
+	}
+}
+
+void TestEventQueue::testBatchDrain()
+{
+	mpscqueue<std::shared_ptr<int>> q(64);
+	std::weak_ptr<int> watch;
+	for (int i = 0; i != 40; i++) {
+		std::shared_ptr<int> p = std::make_shared<int>(i);
+		if (i == 0)
+			watch = p;
+		q.push(std::move(p));
+	}
+
+	std::vector<std::shared_ptr<int>> out;
+	UASSERTEQ(size_t, q.pop_all(out), 40);
+	UASSERTEQ(size_t, out.size(), 40);
+	for (int i = 0; i != 40; i++)
+		UASSERTEQ(int, *out[i], i);
+	UASSERT(q.empty());
+
+	// the queue must not keep drained items alive
+	out.clear();
+	UASSERT(watch.expired());
+
+	size_t n = q.consume_all([](std::shared_ptr<int> &&) {});
+	UASSERTEQ(size_t, n, 0);
+}
+
+void TestEventQueue::testMultiProducer()
+{
+	const int num_producers = 4;
+	const int per_producer = 20000;
+
+	// small capacity so producers hit the full queue and back off
+	mpscqueue<int> q(256);
+	std::vector<std::thread> producers;
+	for (int p = 0; p != num_producers; p++) {
+		producers.emplace_back([&q, p, per_producer]() {
+			for (int i = 0; i != per_producer; i++)
+				q.push(p * per_producer + i);
+		});
+	}
+
+	// every producer's items must arrive exactly once and in its own order
+	std::vector<int> next(num_producers, 0);
+	int received = 0;
+	bool in_order = true;
+	while (received != num_producers * per_producer) {
+		size_t n = q.consume_all([&](int &&v) {
+			int p = v / per_producer;
+			if (v % per_producer != next[p])
+				in_order = false;
+			next[p]++;
+			received++;
+		});
+		if (n == 0)
+			std::this_thread::yield();
+	}
+
+	for (size_t i = 0; i != producers.size(); i++)
+		producers[i].join();
+
+	UASSERT(in_order);
+	UASSERT(q.empty());
+	for (int p = 0; p != num_producers; p++)
+		UASSERTEQ(int, next[p], per_producer);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename Queue, typename Drain>
+static uint64_t run_contention(Queue &q, int num_producers, int per_producer, Drain drain)
+{
+	std::atomic<bool> go(false);
+	std::vector<std::thread> producers;
+	for (int p = 0; p != num_producers; p++) {
+		producers.emplace_back([&q, &go, per_producer]() {
+			while (!go.load())
+				std::this_thread::yield();
+			for (int i = 0; i != per_producer; i++)
+				q.push(i);
+		});
+	}
+
+	uint64_t t1 = getTimeUs();
+	go.store(true);
+
+	int total = num_producers * per_producer;
+	int received = 0;
+	while (received != total) {
+		int n = drain(q);
+		if (n == 0)
+			std::this_thread::yield();
+		received += n;
+	}
+
+	uint64_t tdiff = getTimeUs() - t1;
+	for (size_t i = 0; i != producers.size(); i++)
+		producers[i].join();
+
+	return tdiff ? tdiff : 1;
+}
+
+void TestEventQueue::benchContention()
+{
+	const int per_producer = 100000;
+
+	for (int num_producers = 1; num_producers <= 16; num_producers *= 2) {
+		concurrentqueue<int> locked;
+		uint64_t locked_us = run_contention(locked, num_producers, per_producer,
+			[](concurrentqueue<int> &q) {
+				int n = 0, item;
+				while (q.try_pop(item))
+					n++;
+				return n;
+			});
+
+		mpscqueue<int> lockfree(8192);
+		uint64_t lockfree_us = run_contention(lockfree, num_producers, per_producer,
+			[](mpscqueue<int> &q) {
+				return (int)q.consume_all([](int &&) {});
+			});
+
+		uint64_t items = (uint64_t)num_producers * per_producer;
+		rawstream << "    " << num_producers << " producers: concurrentqueue "
+			<< items * 1000 / locked_us << " kitems/s, mpscqueue "
+			<< items * 1000 / lockfree_us << " kitems/s" << std::endl;
+	}
+}
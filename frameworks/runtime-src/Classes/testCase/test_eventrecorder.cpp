@@ -0,0 +1,259 @@
+#include "unittest/test.h"
+#include "eventmanager/EventManagerImpl.h"
+#include "eventmanager/EventRecorder.h"
+#include "filesys.h"
+#include "utils/time_utils.h"
+#include "log.h"
+
+#include <string>
+#include <vector>
+
+class EvtData_LogTest : public BaseEventData
+{
+public:
+	static const EventType sk_EventType;
+	static const EventType sk_ReplyType;
+
+	EventType m_type;
+	int32_t m_id;
+	std::string m_name;
+
+	EvtData_LogTest(void) : m_type(sk_EventType), m_id(0) { }
+	EvtData_LogTest(EventType type, int32_t id, const std::string &name) : m_type(type), m_id(id), m_name(name) { }
+
+	virtual const EventType& VGetEventType(void) const { return m_type; }
+	virtual IEventDataPtr VCopy(void) const { return MakeEvent<EvtData_LogTest>(m_type, m_id, m_name); }
+	virtual const char* GetName(void) const { return "EvtData_LogTest"; }
+
+	virtual void VSerialize(EventWriter& out) const
+	{
+		out.Write(m_id);
+		out.WriteString(m_name);
+	}
+
+	virtual bool VDeserialize(EventReader& in)
+	{
+		return in.Read(m_id) && in.ReadString(m_name);
+	}
+};
+
+class EvtData_LogReply : public EvtData_LogTest
+{
+public:
+	EvtData_LogReply(void) { m_type = sk_ReplyType; }
+};
+
+const EventType EvtData_LogTest::sk_EventType(0x10675e7e);
+const EventType EvtData_LogTest::sk_ReplyType(0x10675e7f);
+
+class TestEventRecorder :public TestBase {
+public:
+	TestEventRecorder() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestEventRecorder"; }
+
+	void runTests();
+
+	void testStream();
+	void testRecordReplay();
+	void testReplayNested();
+	void testTruncatedLog();
+
+	// records a session: 3 frames, every event gets a queued reply from a listener
+	void recordSession(const std::string &path, EventManager &mgr);
+
+	void onEvent(IEventDataPtr pEvent);
+	void onReply(IEventDataPtr pEvent) { m_replies++; }
+	void onIgnore(IEventDataPtr pEvent) { }
+
+	EventManager *m_mgr;
+	std::vector<int32_t> m_ids;
+	std::vector<std::string> m_names;
+	int m_replies;
+};
+
+static TestEventRecorder g_test_instance;
+
+void TestEventRecorder::runTests()
+{
+	g_eventFactory.Register<EvtData_LogTest>(EvtData_LogTest::sk_EventType);
+	g_eventFactory.Register<EvtData_LogReply>(EvtData_LogTest::sk_ReplyType);
+
+	TEST(testStream);
+	TEST(testRecordReplay);
+	TEST(testReplayNested);
+	TEST(testTruncatedLog);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestEventRecorder::onEvent(IEventDataPtr pEvent)
+{
+	EvtData_LogTest *pData = static_cast<EvtData_LogTest *>(pEvent.get());
+	m_ids.push_back(pData->m_id);
+	m_names.push_back(pData->m_name);
+	m_mgr->VQueueEvent(MakeEvent<EvtData_LogTest>(EvtData_LogTest::sk_ReplyType, pData->m_id, ""));
+}
+
+void TestEventRecorder::recordSession(const std::string &path, EventManager &mgr)
+{
+	EventRecorder recorder;
+	UASSERT(recorder.Open(path));
+	mgr.SetRecorder(&recorder);
+
+	m_mgr = &mgr;
+	int id = 0;
+	for (int frame = 0; frame != 3; frame++) {
+		for (int i = 0; i != 100; i++, id++)
+			mgr.VQueueEvent(MakeEvent<EvtData_LogTest>(EvtData_LogTest::sk_EventType, id, "unit" + std::to_string(id)));
+		mgr.VTriggerEvent(MakeEvent<EvtData_LogTest>(EvtData_LogTest::sk_EventType, -frame, "trigger"));
+		mgr.VUpdate();
+	}
+	mgr.VUpdate();
+
+	mgr.SetRecorder(nullptr);
+	UASSERTEQ(uint32_t, recorder.GetNumFrames(), 4);
+	// 303 root events and as many replies
+	UASSERTEQ(uint32_t, recorder.GetNumEvents(), 606);
+	recorder.Close();
+}
+
+void TestEventRecorder::testStream()
+{
+	EventWriter writer;
+	writer.Write((int32_t)-5);
+	writer.Write(1.5f);
+	writer.WriteString("hello");
+	writer.WriteString(std::string());
+	UASSERTEQ(size_t, writer.GetSize(), 4 + 4 + 4 + 5 + 4);
+
+	EventReader reader(writer.GetData(), writer.GetSize());
+	int32_t i;
+	float f;
+	const char *pString;
+	uint32_t length;
+	std::string str;
+	UASSERT(reader.Read(i) && i == -5);
+	UASSERT(reader.Read(f) && f == 1.5f);
+	UASSERT(reader.ReadString(pString, length));
+	UASSERT(std::string(pString, length) == "hello");
+	// zero-copy: the string points into the buffer
+	UASSERT((const uint8_t *)pString == writer.GetData() + 12);
+	UASSERT(reader.ReadString(str) && str.empty());
+	UASSERTEQ(size_t, reader.GetRemaining(), 0);
+
+	// reading past the end fails for good
+	UASSERT(!reader.Read(i));
+	UASSERT(!reader.IsOk());
+
+	// the buffer is reused
+	writer.Reset();
+	UASSERTEQ(size_t, writer.GetSize(), 0);
+	writer.Write((uint8_t)7);
+	UASSERTEQ(size_t, writer.GetSize(), 1);
+}
+
+void TestEventRecorder::testRecordReplay()
+{
+	std::string path = fs::TempPath() + DIR_DELIM "test_eventrecorder.evlog";
+
+	{
+		EventManager mgr("TestEventRecorder", false);
+		mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventRecorder::onEvent), EvtData_LogTest::sk_EventType);
+		mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventRecorder::onReply), EvtData_LogTest::sk_ReplyType);
+
+		m_ids.clear();
+		m_names.clear();
+		m_replies = 0;
+		recordSession(path, mgr);
+	}
+	std::vector<int32_t> ids = m_ids;
+	std::vector<std::string> names = m_names;
+	UASSERTEQ(size_t, ids.size(), 303);
+	UASSERTEQ(int, m_replies, 303);
+
+	// the same listeners see the same events, replies are produced by the listener again
+	EventManager mgr("TestEventRecorder", false);
+	mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventRecorder::onEvent), EvtData_LogTest::sk_EventType);
+	mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventRecorder::onReply), EvtData_LogTest::sk_ReplyType);
+	m_mgr = &mgr;
+	m_ids.clear();
+	m_names.clear();
+	m_replies = 0;
+
+	EventReplayer replayer;
+	UASSERT(replayer.Open(path));
+	UASSERT(replayer.ReplayFrame(mgr));
+	UASSERTEQ(size_t, m_ids.size(), 101);
+	UASSERTEQ(uint32_t, replayer.ReplayAll(mgr), 3);
+	UASSERT(replayer.IsFinished());
+	UASSERT(!replayer.ReplayFrame(mgr));
+
+	UASSERT(m_ids == ids);
+	UASSERT(m_names == names);
+	UASSERTEQ(int, m_replies, 303);
+	UASSERTEQ(uint32_t, replayer.GetNumEvents(), 303);
+	UASSERTEQ(uint32_t, replayer.GetNumSkipped(), 0);
+
+	replayer.Close();
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+}
+
+void TestEventRecorder::testReplayNested()
+{
+	std::string path = fs::TempPath() + DIR_DELIM "test_eventrecorder_nested.evlog";
+	{
+		EventManager mgr("TestEventRecorder", false);
+		mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventRecorder::onEvent), EvtData_LogTest::sk_EventType);
+		mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventRecorder::onReply), EvtData_LogTest::sk_ReplyType);
+		recordSession(path, mgr);
+	}
+
+	// the listener sending replies is not present, they come from the log
+	EventManager mgr("TestEventRecorder", false);
+	mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventRecorder::onIgnore), EvtData_LogTest::sk_EventType);
+	mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventRecorder::onReply), EvtData_LogTest::sk_ReplyType);
+	m_replies = 0;
+
+	EventReplayer replayer;
+	replayer.SetReplayNested(true);
+	replayer.SetIgnoreBudget(true);
+	UASSERT(replayer.Open(path));
+	replayer.ReplayAll(mgr);
+	UASSERTEQ(int, m_replies, 303);
+
+	replayer.Close();
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+}
+
+void TestEventRecorder::testTruncatedLog()
+{
+	std::string path = fs::TempPath() + DIR_DELIM "test_eventrecorder_cut.evlog";
+
+	EventManager mgr("TestEventRecorder", false);
+	mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestEventRecorder::onReply), EvtData_LogTest::sk_EventType);
+	m_replies = 0;
+
+	// a log that is still being written (or was never closed) is preallocated past its records
+	{
+		EventRecorder recorder;
+		UASSERT(recorder.Open(path));
+		for (int i = 0; i != 10; i++)
+			recorder.RecordEvent(EvtData_LogTest(EvtData_LogTest::sk_EventType, i, "x"), EVENTRECORD_QUEUED, false);
+		recorder.RecordFrame(IEventManager::kINFINITE);
+		recorder.RecordEvent(EvtData_LogTest(EvtData_LogTest::sk_EventType, 10, "x"), EVENTRECORD_QUEUED, false);
+
+		EventReplayer replayer;
+		UASSERT(replayer.Open(path));
+		UASSERTEQ(uint32_t, replayer.ReplayAll(mgr), 2);
+		UASSERTEQ(int, m_replies, 11);
+	}
+
+	// not an event log
+	MappedFile file;
+	UASSERT(file.openWrite(path, 64));
+	file.close();
+	EventReplayer replayer;
+	UASSERT(!replayer.Open(path));
+
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+}
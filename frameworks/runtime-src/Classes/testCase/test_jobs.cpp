@@ -0,0 +1,497 @@
+#include "unittest/test.h"
+#include "threading/job_system.h"
+#include "threading/job_graph.h"
+#include "components/componentmanager.h"
+#include "settings.h"
+#include "log.h"
+#include "utils/time_utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class TestJobs :public TestBase {
+public:
+	TestJobs() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestJobs"; }
+
+	void runTests();
+
+	void testSubmitWait();
+	void testJobFunction();
+	void testNestedJobs();
+	void testOtherThreads();
+	void testParallelFor();
+	void testGraph();
+	void testSystemAccess();
+	void testParallelSystems();
+	void benchSystems();
+	void benchThroughput();
+};
+
+static TestJobs g_test_instance;
+
+void TestJobs::runTests()
+{
+	TEST(testSubmitWait);
+	TEST(testJobFunction);
+	TEST(testNestedJobs);
+	TEST(testOtherThreads);
+	TEST(testParallelFor);
+	TEST(testGraph);
+	TEST(testSystemAccess);
+	TEST(testParallelSystems);
+
+	if (g_settings->getFlag("unittest_benchmark")) {
+		TEST(benchSystems);
+		TEST(benchThroughput);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestJobs::testSubmitWait()
+{
+	// no workers: wait() runs everything on the calling thread
+	for (unsigned int workers = 0; workers != 4; workers++) {
+		JobSystem jobs(workers);
+		UASSERTEQ(unsigned int, jobs.getNumWorkers(), workers);
+
+		std::atomic<int> sum(0);
+		JobCounter counter;
+		for (int i = 1; i <= 1000; i++)
+			jobs.submit(&counter, [&sum, i]() { sum += i; });
+		jobs.wait(counter);
+		UASSERT(counter.isDone());
+		UASSERTEQ(int, sum.load(), 500500);
+	}
+}
+
+void TestJobs::testJobFunction()
+{
+	// captures are destroyed once the job has run
+	std::shared_ptr<int> value = std::make_shared<int>(0);
+	{
+		JobFunction function;
+		function.assign([value]() { (*value)++; });
+		UASSERTEQ(long, value.use_count(), 2);
+		function();
+		function();
+		UASSERTEQ(int, *value, 2);
+		function.assign([]() {});
+		UASSERTEQ(long, value.use_count(), 1);
+	}
+
+	JobSystem jobs(2);
+	JobCounter counter;
+	for (int i = 0; i != 100; i++)
+		jobs.submit(&counter, [value]() { (*value)++; });
+	jobs.wait(counter);
+	UASSERTEQ(int, *value, 102);
+	UASSERTEQ(long, value.use_count(), 1);
+}
+
+void TestJobs::testNestedJobs()
+{
+	JobSystem jobs(3);
+	std::atomic<int> leaves(0);
+	JobCounter counter;
+
+	// jobs submitting jobs to the counter they run under, waited for from outside
+	for (int i = 0; i != 16; i++) {
+		jobs.submit(&counter, [&]() {
+			for (int j = 0; j != 16; j++)
+				jobs.submit(&counter, [&]() { leaves++; });
+		});
+	}
+	jobs.wait(counter);
+	UASSERTEQ(int, leaves.load(), 256);
+
+	// and waited for from inside a job
+	JobCounter outer;
+	std::atomic<int> inner_done(0);
+	for (int i = 0; i != 8; i++) {
+		jobs.submit(&outer, [&]() {
+			JobCounter inner;
+			std::atomic<int> count(0);
+			for (int j = 0; j != 8; j++)
+				jobs.submit(&inner, [&count]() { count++; });
+			jobs.wait(inner);
+			if (count == 8)
+				inner_done++;
+		});
+	}
+	jobs.wait(outer);
+	UASSERTEQ(int, inner_done.load(), 8);
+}
+
+void TestJobs::testOtherThreads()
+{
+	JobSystem jobs(2);
+	std::atomic<int> sum(0);
+
+	// threads that are neither workers nor the creator submit and wait too
+	std::vector<std::thread> threads;
+	for (int t = 0; t != 4; t++) {
+		threads.push_back(std::thread([&]() {
+			JobCounter counter;
+			for (int i = 0; i != 500; i++)
+				jobs.submit(&counter, [&sum]() { sum++; });
+			jobs.wait(counter);
+		}));
+	}
+	for (auto it = threads.begin(); it != threads.end(); ++it)
+		it->join();
+	UASSERTEQ(int, sum.load(), 2000);
+
+	JobSystem::Stats stats = jobs.getStats();
+	UASSERT(stats.executed == 2000);
+	UASSERT(stats.stolen <= stats.executed);
+}
+
+void TestJobs::testParallelFor()
+{
+	JobSystem jobs(3);
+	std::vector<int> hits(10007, 0);
+	std::atomic<size_t> largest(0);
+
+	jobs.parallelFor(0, hits.size(), 64, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i != end; i++)
+			hits[i]++;
+		size_t size = end - begin, seen = largest.load();
+		while (size > seen && !largest.compare_exchange_weak(seen, size)) {}
+	});
+	for (size_t i = 0; i != hits.size(); i++)
+		UASSERTEQ(int, hits[i], 1);
+	UASSERT(largest.load() <= 64);
+
+	// empty and single element ranges, grain 0
+	int calls = 0;
+	jobs.parallelFor(5, 5, 1, [&](size_t, size_t) { calls++; });
+	UASSERTEQ(int, calls, 0);
+	jobs.parallelFor(5, 6, 0, [&](size_t begin, size_t end) { calls += (int)(end - begin); });
+	UASSERTEQ(int, calls, 1);
+}
+
+void TestJobs::testGraph()
+{
+	JobSystem jobs(2);
+
+	/*
+	      0
+	     / \
+	    1   2
+	     \ / \
+	      3   4
+	*/
+	std::mutex mutex;
+	std::vector<int> order;
+	JobGraph graph;
+	for (int i = 0; i != 5; i++) {
+		graph.addJob([&, i]() {
+			std::lock_guard<std::mutex> lock(mutex);
+			order.push_back(i);
+		});
+	}
+	graph.addDependency(0, 1);
+	graph.addDependency(0, 2);
+	graph.addDependency(1, 3);
+	graph.addDependency(2, 3);
+	graph.addDependency(2, 4);
+	graph.addDependency(2, 4);
+	UASSERT(graph.hasDependency(2, 4));
+	UASSERT(!graph.hasDependency(1, 4));
+
+	for (int run = 0; run != 100; run++) {
+		order.clear();
+		graph.run(run % 2 ? &jobs : nullptr);
+		UASSERTEQ(size_t, order.size(), 5);
+
+		int pos[5];
+		for (int i = 0; i != 5; i++)
+			pos[order[i]] = i;
+		UASSERT(pos[0] < pos[1] && pos[0] < pos[2]);
+		UASSERT(pos[1] < pos[3] && pos[2] < pos[3] && pos[2] < pos[4]);
+	}
+}
+
+struct JobTestA { float value = 0; };
+struct JobTestB { float value = 0; };
+struct JobTestC { float value = 0; };
+
+// adds the source component's value to the target component of the same actor
+template <class Target, class Source>
+class CopyAddSystem : public ComponentSystem
+{
+public:
+	virtual void VUpdate(ComponentManager& components, float deltaMs)
+	{
+		ComponentPool<Target> &targets = components.GetPool<Target>();
+		ComponentPool<Source> &sources = components.GetPool<Source>();
+		for (size_t i = 0; i < targets.Size(); i++) {
+			const Source *pSource = sources.Get(targets.Actors()[i]);
+			if (pSource)
+				targets.Data()[i].value += pSource->value;
+		}
+	}
+
+	virtual void VGetAccess(ComponentAccess& access) const
+	{
+		access.Write<Target>().template Read<Source>();
+	}
+};
+
+template <class Target>
+static void incrementSystem(ComponentPool<Target> &pool, float deltaMs)
+{
+	for (auto it = pool.begin(); it != pool.end(); ++it)
+		it->value += deltaMs;
+}
+
+class ExclusiveSystem : public ComponentSystem
+{
+public:
+	virtual void VUpdate(ComponentManager& components, float deltaMs) { }
+};
+
+void TestJobs::testSystemAccess()
+{
+	ComponentManager components;
+	components.AddBatchUpdate<JobTestA>(&incrementSystem<JobTestA>);		// 0: writes A
+	components.AddBatchUpdate<JobTestB>(&incrementSystem<JobTestB>);		// 1: writes B
+	components.AddSystem(std::unique_ptr<ComponentSystem>(new CopyAddSystem<JobTestC, JobTestA>));	// 2: C += A
+	components.AddSystem(std::unique_ptr<ComponentSystem>(new CopyAddSystem<JobTestB, JobTestC>));	// 3: B += C
+	components.AddSystem(std::unique_ptr<ComponentSystem>(new ExclusiveSystem));	// 4
+	components.AddBatchUpdate<JobTestA>(&incrementSystem<JobTestA>);		// 5: writes A
+
+	UASSERT(!components.SystemsConflict(0, 1));
+	UASSERT(components.SystemsConflict(0, 2));	// A written, then read
+	UASSERT(!components.SystemsConflict(1, 2));
+	UASSERT(components.SystemsConflict(1, 3));	// B written twice
+	UASSERT(components.SystemsConflict(2, 3));	// C written, then read
+	UASSERT(!components.SystemsConflict(0, 3));
+	UASSERT(components.SystemsConflict(0, 4) && components.SystemsConflict(3, 4));
+	UASSERT(components.SystemsConflict(4, 5));
+	UASSERT(components.SystemsConflict(0, 5));	// A written twice
+	UASSERT(components.SystemsConflict(2, 5));	// A read, then written
+
+	// declaring the access created the pools up front
+	UASSERTEQ(size_t, components.GetPool<JobTestC>().Size(), 0);
+}
+
+void TestJobs::testParallelSystems()
+{
+	JobSystem jobs(3);
+
+	ComponentManager serial, parallel;
+	ComponentManager *managers[2] = { &serial, &parallel };
+	for (int m = 0; m != 2; m++) {
+		ComponentManager &components = *managers[m];
+		components.AddBatchUpdate<JobTestA>(&incrementSystem<JobTestA>);
+		components.AddBatchUpdate<JobTestB>(&incrementSystem<JobTestB>);
+		components.AddSystem(std::unique_ptr<ComponentSystem>(new CopyAddSystem<JobTestC, JobTestA>));
+		components.AddSystem(std::unique_ptr<ComponentSystem>(new CopyAddSystem<JobTestB, JobTestC>));
+		components.AddBatchUpdate<JobTestA>(&incrementSystem<JobTestA>);
+		for (ActorId id = 1; id != 1000; id++) {
+			components.AddComponent<JobTestA>(id);
+			if (id % 2)
+				components.AddComponent<JobTestB>(id);
+			if (id % 3)
+				components.AddComponent<JobTestC>(id);
+		}
+	}
+	parallel.SetJobSystem(&jobs);
+
+	for (int frame = 0; frame != 50; frame++) {
+		serial.update(1.0f);
+		parallel.update(1.0f);
+	}
+
+	// the dependencies keep the result identical to the serial order
+	for (ActorId id = 1; id != 1000; id++) {
+		UASSERT(serial.GetComponent<JobTestA>(id)->value == parallel.GetComponent<JobTestA>(id)->value);
+		if (id % 2)
+			UASSERT(serial.GetComponent<JobTestB>(id)->value == parallel.GetComponent<JobTestB>(id)->value);
+		if (id % 3)
+			UASSERT(serial.GetComponent<JobTestC>(id)->value == parallel.GetComponent<JobTestC>(id)->value);
+	}
+}
+
+// independent component types, each with its own system doing some math per component
+template <int N>
+struct BenchBody
+{
+	float x = 0, y = 0, vx = 1, vy = 0.5f, heading = 0;
+};
+
+template <int N>
+static void steerSystem(ComponentPool<BenchBody<N> > &pool, float deltaMs)
+{
+	BenchBody<N> *bodies = pool.Data();
+	for (size_t i = 0, count = pool.Size(); i < count; i++) {
+		BenchBody<N> &b = bodies[i];
+		b.heading += 0.001f * deltaMs;
+		float speed = std::sqrt(b.vx * b.vx + b.vy * b.vy);
+		b.vx = std::cos(b.heading) * speed;
+		b.vy = std::sin(b.heading) * speed;
+		b.x += b.vx * deltaMs;
+		b.y += b.vy * deltaMs;
+	}
+}
+
+template <int N>
+static void addBenchSystem(ComponentManager &components, ActorId actors)
+{
+	components.AddBatchUpdate<BenchBody<N> >(&steerSystem<N>);
+	components.GetPool<BenchBody<N> >().Reserve(actors);
+	for (ActorId id = 0; id != actors; id++)
+		components.AddComponent<BenchBody<N> >(id);
+}
+
+void TestJobs::benchSystems()
+{
+	const int frames = 20;
+	unsigned int cores = (std::max)(std::thread::hardware_concurrency(), 1u);
+	rawstream << "    " << cores << " hardware threads, 8 independent systems" << std::endl;
+
+	for (ActorId actors = 1000; actors <= 50000; actors *= (actors == 10000 ? 5 : 10)) {
+		ComponentManager components;
+		addBenchSystem<0>(components, actors);
+		addBenchSystem<1>(components, actors);
+		addBenchSystem<2>(components, actors);
+		addBenchSystem<3>(components, actors);
+		addBenchSystem<4>(components, actors);
+		addBenchSystem<5>(components, actors);
+		addBenchSystem<6>(components, actors);
+		addBenchSystem<7>(components, actors);
+
+		uint64_t t1 = getTimeUs();
+		for (int f = 0; f != frames; f++)
+			components.update(1.0f);
+		uint64_t serial_us = std::max<uint64_t>((getTimeUs() - t1) / frames, 1);
+		rawstream << "    " << actors << " actors: serial " << serial_us << "us/frame";
+
+		// the calling thread works too, so n workers use n + 1 cores
+		for (unsigned int workers = 1; workers < (std::max)(cores, 4u); workers = workers * 2 + 1) {
+			JobSystem jobs(workers);
+			components.SetJobSystem(&jobs);
+			t1 = getTimeUs();
+			for (int f = 0; f != frames; f++)
+				components.update(1.0f);
+			uint64_t us = std::max<uint64_t>((getTimeUs() - t1) / frames, 1);
+			components.SetJobSystem(nullptr);
+
+			rawstream << ", " << workers + 1 << " threads " << us << "us ("
+				<< (float)serial_us / us << "x)";
+		}
+		rawstream << std::endl;
+	}
+}
+
+// the model of cocos2d-x's AsyncTaskPool: one thread per queue, std::function jobs behind a mutex
+class LockedTaskQueue
+{
+public:
+	LockedTaskQueue() : m_pending(0), m_quit(false), m_thread(&LockedTaskQueue::run, this) { }
+
+	~LockedTaskQueue()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_quit = true;
+		}
+		m_condition.notify_one();
+		m_thread.join();
+	}
+
+	void enqueue(std::function<void()> task)
+	{
+		m_pending++;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_tasks.push(std::move(task));
+		}
+		m_condition.notify_one();
+	}
+
+	void wait()
+	{
+		while (m_pending.load())
+			std::this_thread::yield();
+	}
+
+private:
+	void run()
+	{
+		for (;;) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_condition.wait(lock, [this]() { return m_quit || !m_tasks.empty(); });
+				if (m_tasks.empty())
+					return;
+				task = std::move(m_tasks.front());
+				m_tasks.pop();
+			}
+			task();
+			m_pending--;
+		}
+	}
+
+	std::atomic<int> m_pending;
+	bool m_quit;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::queue<std::function<void()> > m_tasks;
+	std::thread m_thread;
+};
+
+void TestJobs::benchThroughput()
+{
+	const int count = 200000;
+	unsigned int cores = (std::max)(std::thread::hardware_concurrency(), 1u);
+	rawstream << "    " << cores << " hardware threads, " << count << " small jobs" << std::endl;
+
+	// jobs carrying more state than std::function keeps inline
+	std::atomic<uint64_t> sum(0);
+	uint64_t a = 1, b = 2, c = 3;
+	uint64_t t1 = getTimeUs();
+	{
+		LockedTaskQueue queue;
+		for (int i = 0; i != count; i++)
+			queue.enqueue([&sum, a, b, c, i]() { sum += a + b + c + i; });
+		queue.wait();
+	}
+	uint64_t locked_us = std::max<uint64_t>(getTimeUs() - t1, 1);
+	rawstream << "    locked std::function queue: " << locked_us << "us, "
+		<< (uint64_t)count * 1000 / locked_us << " jobs/ms" << std::endl;
+
+	for (unsigned int workers = 0; workers < (std::max)(cores, 4u); workers = workers * 2 + 1) {
+		JobSystem jobs(workers);
+
+		// submitted from the owning thread
+		t1 = getTimeUs();
+		JobCounter counter;
+		for (int i = 0; i != count; i++)
+			jobs.submit(&counter, [&sum, a, b, c, i]() { sum += a + b + c + i; });
+		jobs.wait(counter);
+		uint64_t submit_us = std::max<uint64_t>(getTimeUs() - t1, 1);
+
+		// spawned by parallelFor, split across the workers
+		t1 = getTimeUs();
+		jobs.parallelFor(0, count, 1, [&sum](size_t begin, size_t end) { sum += end - begin; });
+		uint64_t for_us = std::max<uint64_t>(getTimeUs() - t1, 1);
+
+		JobSystem::Stats stats = jobs.getStats();
+		rawstream << "    " << workers << " workers: submit+wait " << submit_us << "us, "
+			<< (uint64_t)count * 1000 / submit_us << " jobs/ms; parallelFor " << for_us << "us, "
+			<< stats.stolen << " of " << stats.executed << " jobs stolen" << std::endl;
+	}
+}
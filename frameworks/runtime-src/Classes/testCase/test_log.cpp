@@ -0,0 +1,351 @@
+#include "unittest/test.h"
+#include "log.h"
+#include "filesys.h"
+#include "settings.h"
+#include "utils/macros.h"
+#include "utils/time_utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TestLog :public TestBase {
+public:
+	TestLog() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestLog"; }
+
+	void runTests();
+
+	void testSync();
+	void testAsyncOrder();
+	void testAsyncDrop();
+	void testAsyncStop();
+	void testStreams();
+	void benchLog();
+};
+
+static TestLog g_test_instance;
+
+void TestLog::runTests()
+{
+	TEST(testSync);
+	TEST(testAsyncOrder);
+	TEST(testAsyncDrop);
+	TEST(testAsyncStop);
+	TEST(testStreams);
+
+	if (g_settings->getFlag("unittest_benchmark")) {
+		TEST(benchLog);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Keeps everything logged to it; the logger serializes the calls
+class CaptureLogOutput : public ILogOutput {
+public:
+	struct Line {
+		LogLevel level;
+		std::string combined;
+		std::string thread_name;
+		std::string text;
+	};
+
+	void logRaw(LogLevel lev, const std::string &line)
+	{
+		Line l = { lev, line, "", line };
+		lines.push_back(l);
+	}
+
+	void log(LogLevel lev, const std::string &combined,
+		const std::string &time, const std::string &thread_name,
+		const std::string &payload_text)
+	{
+		Line l = { lev, combined, thread_name, payload_text };
+		lines.push_back(l);
+	}
+
+	void flush() { flushes++; }
+
+	std::vector<Line> lines;
+	int flushes = 0;
+};
+
+// Keeps an output registered for one scope, so a failed assert does not
+// leave the logger writing to a destroyed output
+class ScopedLogOutput {
+public:
+	ScopedLogOutput(Logger &logger, ILogOutput *output, LogLevel lev) :
+		m_logger(logger), m_output(output)
+	{
+		m_logger.addOutput(m_output, lev);
+	}
+
+	~ScopedLogOutput()
+	{
+		m_logger.flushAsync();
+		m_logger.removeOutput(m_output);
+	}
+
+private:
+	Logger &m_logger;
+	ILogOutput *m_output;
+};
+
+// Logs count numbered lines from each of num_threads threads named T<n>
+void logFromThreads(Logger &logger, int num_threads, int count, LogLevel lev)
+{
+	std::vector<std::thread> threads;
+	for (int t = 0; t != num_threads; t++) {
+		threads.push_back(std::thread([&logger, t, count, lev]() {
+			logger.registerThread("T" + std::to_string(t));
+			for (int i = 0; i != count; i++)
+				logger.log(lev, std::to_string(i));
+			logger.deregisterThread();
+		}));
+	}
+	for (auto it = threads.begin(); it != threads.end(); ++it)
+		it->join();
+}
+
+}
+
+void TestLog::testSync()
+{
+	Logger logger;
+	CaptureLogOutput output;
+	logger.addOutputMaxLevel(&output, LL_INFO);
+	logger.registerThread("Main");
+
+	logger.log(LL_WARNING, "hello");
+	logger.log(LL_VERBOSE, "not shown");
+	logger.logRaw(LL_NONE, "raw line");
+
+	UASSERTEQ(size_t, output.lines.size(), 2);
+	const CaptureLogOutput::Line &line = output.lines[0];
+	UASSERT(line.level == LL_WARNING);
+	UASSERTEQ(std::string, line.thread_name, "Main");
+	UASSERTEQ(std::string, line.text, "hello");
+	UASSERT(line.combined.find(": WARNING[Main]: hello") != std::string::npos);
+	UASSERTEQ(std::string, output.lines[1].combined, "raw line");
+	// every line is flushed when logging synchronously
+	UASSERTEQ(int, output.flushes, 2);
+
+	// renaming a thread shows in the next line
+	logger.registerThread("Renamed");
+	logger.log(LL_ACTION, "again");
+	UASSERTEQ(std::string, output.lines.back().thread_name, "Renamed");
+
+	UASSERT(logger.removeOutput(&output) != 0);
+	logger.log(LL_ERROR, "nobody listens");
+	UASSERTEQ(size_t, output.lines.size(), 3);
+	logger.deregisterThread();
+}
+
+void TestLog::testAsyncOrder()
+{
+	const int num_threads = 8;
+	const int count = 1000;
+
+	Logger logger;
+	CaptureLogOutput output;
+	logger.addOutputMaxLevel(&output, LL_VERBOSE);
+
+	// a small ring, so the threads have to wait for the writer
+	logger.startAsync(16 * 1024, LOG_ASYNC_BLOCK);
+	UASSERT(logger.isAsync());
+	logFromThreads(logger, num_threads, count, LL_INFO);
+	logger.flushAsync();
+
+	// everything arrives, in order per thread
+	UASSERTEQ(size_t, output.lines.size(), (size_t)(num_threads * count));
+	std::vector<int> next(num_threads, 0);
+	for (auto it = output.lines.begin(); it != output.lines.end(); ++it) {
+		UASSERT(it->level == LL_INFO);
+		UASSERT(it->thread_name.size() >= 2 && it->thread_name[0] == 'T');
+		int t = atoi(it->thread_name.c_str() + 1);
+		UASSERT(t >= 0 && t < num_threads);
+		UASSERTEQ(int, atoi(it->text.c_str()), next[t]);
+		next[t]++;
+		UASSERT(it->combined.find("[" + it->thread_name + "]: " + it->text) != std::string::npos);
+	}
+	UASSERTEQ(uint64_t, logger.getAsyncDropped(), 0);
+	// flushed per batch, not per line
+	UASSERT(output.flushes < num_threads * count);
+
+	logger.stopAsync();
+	UASSERT(!logger.isAsync());
+}
+
+void TestLog::testAsyncDrop()
+{
+	const int num_threads = 8;
+	const int count = 2000;
+
+	Logger logger;
+	CaptureLogOutput output;
+	logger.addOutputMaxLevel(&output, LL_VERBOSE);
+
+	logger.startAsync(4096, LOG_ASYNC_DROP);
+	logFromThreads(logger, num_threads, count, LL_VERBOSE);
+	logger.log(LL_WARNING, "after the flood");
+	logger.flushAsync();
+
+	// every record was either written or counted, and the drops reported
+	size_t verbose = 0, reports = 0;
+	bool warning = false;
+	for (auto it = output.lines.begin(); it != output.lines.end(); ++it) {
+		if (it->level == LL_VERBOSE)
+			verbose++;
+		else if (it->text == "after the flood")
+			warning = true;
+		else if (it->thread_name == "LogWriter")
+			reports++;
+	}
+	uint64_t dropped = logger.getAsyncDropped();
+	UASSERTEQ(uint64_t, verbose + dropped, (uint64_t)(num_threads * count));
+	UASSERT(warning);
+	UASSERT(dropped == 0 || reports > 0);
+
+	logger.stopAsync();
+}
+
+void TestLog::testAsyncStop()
+{
+	Logger logger;
+	CaptureLogOutput output;
+	logger.addOutputMaxLevel(&output, LL_VERBOSE);
+
+	logger.startAsync(4096, LOG_ASYNC_BLOCK);
+	logger.log(LL_ACTION, "first");
+	// longer than a quarter of the ring: written directly, after the queue
+	logger.log(LL_ACTION, std::string(2000, 'x'));
+	logger.logRaw(LL_NONE, "raw");
+	logger.stopAsync();
+
+	// stopping writes out what was queued
+	UASSERTEQ(size_t, output.lines.size(), 3);
+	UASSERTEQ(std::string, output.lines[0].text, "first");
+	UASSERTEQ(size_t, output.lines[1].text.size(), 2000);
+	UASSERTEQ(std::string, output.lines[2].combined, "raw");
+
+	// synchronous again
+	logger.log(LL_ACTION, "sync");
+	UASSERTEQ(size_t, output.lines.size(), 4);
+
+	// and can be restarted
+	logger.startAsync(4096, LOG_ASYNC_BLOCK);
+	logger.log(LL_ACTION, "restarted");
+	logger.flushAsync();
+	UASSERTEQ(size_t, output.lines.size(), 5);
+	UASSERTEQ(std::string, output.lines[4].text, "restarted");
+}
+
+void TestLog::testStreams()
+{
+	// end whatever an earlier test left unfinished on this thread
+	infostream << std::endl;
+	g_logger.flushAsync();
+	CaptureLogOutput output;
+	ScopedLogOutput scoped_output(g_logger, &output, LL_INFO);
+
+	// line breaks inside the text and long lines
+	infostream << "first" << "\n" << "second " << 2 << std::endl;
+	infostream << std::string(300, 'x') << std::endl;
+	g_logger.flushAsync();
+	UASSERTEQ(size_t, output.lines.size(), 4);
+	UASSERTEQ(std::string, output.lines[0].text, "first");
+	UASSERTEQ(std::string, output.lines[1].text, "second 2");
+	UASSERTEQ(size_t, output.lines[2].text.size() + output.lines[3].text.size(), 300);
+	output.lines.clear();
+
+	// threads writing a line in pieces do not mix them
+	const int num_threads = 4;
+	const int count = 500;
+	std::vector<std::thread> threads;
+	for (int t = 0; t != num_threads; t++) {
+		threads.push_back(std::thread([t, count]() {
+			for (int i = 0; i != count; i++)
+				infostream << "thread " << t << " line " << i << std::endl;
+		}));
+	}
+	for (auto it = threads.begin(); it != threads.end(); ++it)
+		it->join();
+	g_logger.flushAsync();
+
+	UASSERTEQ(size_t, output.lines.size(), (size_t)(num_threads * count));
+	std::vector<int> next(num_threads, 0);
+	for (auto it = output.lines.begin(); it != output.lines.end(); ++it) {
+		int t = -1, i = -1;
+		UASSERT(sscanf(it->text.c_str(), "thread %d line %d", &t, &i) == 2);
+		UASSERT(t >= 0 && t < num_threads);
+		UASSERTEQ(int, i, next[t]);
+		next[t]++;
+	}
+
+	// compiled out levels do not evaluate their arguments
+	int calls = 0;
+	auto describe = [&calls]() { calls++; return "described"; };
+	g_logger.setLevelSilenced(LL_VERBOSE, true);
+	verbosestream << describe() << std::endl;
+	g_logger.setLevelSilenced(LL_VERBOSE, false);
+	UASSERTEQ(int, calls, LOG_LEVEL_COMPILED(LL_VERBOSE) ? 1 : 0);
+	UASSERT(LOG_LEVEL_COMPILED(LL_ERROR));
+
+	// a log statement is a plain expression under an unbraced if/else
+	bool taken = false;
+	if (calls < 0)
+		verbosestream << describe() << std::endl;
+	else
+		taken = true;
+	UASSERT(taken);
+}
+
+void TestLog::benchLog()
+{
+	const int num_threads = 8;
+	const int count = 20000;
+	std::string path = fs::TempPath() + DIR_DELIM "test_log_bench.txt";
+
+	struct Mode {
+		const char *name;
+		bool async;
+		LogAsyncPolicy policy;
+	};
+	const Mode modes[] = {
+		{ "synchronous", false, LOG_ASYNC_BLOCK },
+		{ "async, block", true, LOG_ASYNC_BLOCK },
+		{ "async, drop", true, LOG_ASYNC_DROP },
+	};
+
+	rawstream << "    " << num_threads << " threads x " << count << " lines to a file, "
+		<< (std::max)(std::thread::hardware_concurrency(), 1u) << " hardware threads" << std::endl;
+	for (size_t m = 0; m != ARRLEN(modes); m++) {
+		fs::DeleteSingleFileOrEmptyDirectory(path);
+		Logger logger;
+		FileLogOutput output;
+		output.setFile(path, 0);
+		logger.addOutputMaxLevel(&output, LL_INFO);
+		if (modes[m].async)
+			logger.startAsync(1024 * 1024, modes[m].policy);
+
+		uint64_t t1 = getTimeUs();
+		logFromThreads(logger, num_threads, count, LL_INFO);
+		uint64_t log_us = std::max<uint64_t>(getTimeUs() - t1, 1);
+		logger.stopAsync();
+		uint64_t total_us = std::max<uint64_t>(getTimeUs() - t1, 1);
+
+		rawstream << "    " << modes[m].name << ": "
+			<< (uint64_t)num_threads * count * 1000000 / log_us << " calls/s, "
+			<< total_us << "us until written, "
+			<< logger.getAsyncDropped() << " dropped" << std::endl;
+		logger.removeOutput(&output);
+	}
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+}
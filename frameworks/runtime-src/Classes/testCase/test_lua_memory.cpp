@@ -0,0 +1,365 @@
+#include "unittest/test.h"
+#include "LUAScripting/LuaMemory.h"
+#include "settings.h"
+#include "log.h"
+#include "utils/time_utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+class TestLuaMemory :public TestBase {
+public:
+	TestLuaMemory() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestLuaMemory"; }
+
+	void runTests();
+
+	void testAllocator();
+	void testAdopt();
+	void testSubsystems();
+	void testGarbageCollector();
+	void testLoadingAndLimit();
+	void benchAllocator();
+	void benchFrameSpikes();
+};
+
+static TestLuaMemory g_test_instance;
+
+void TestLuaMemory::runTests()
+{
+	TEST(testAllocator);
+	TEST(testAdopt);
+	TEST(testSubsystems);
+	TEST(testGarbageCollector);
+	TEST(testLoadingAndLimit);
+
+	if (g_settings->getFlag("unittest_benchmark")) {
+		TEST(benchAllocator);
+		TEST(benchFrameSpikes);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+bool run(lua_State *L, const char *code)
+{
+	return luaL_loadbuffer(L, code, strlen(code), "=test") == 0 && lua_pcall(L, 0, 0, 0) == 0;
+}
+
+uint64_t luaBytes(lua_State *L)
+{
+	return (uint64_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+// small tables, strings and closures, and a few arrays too large for the pools
+const char *s_garbage =
+	"local keep = {}\n"
+	"for i = 1, 2000 do\n"
+	"  local t = { x = i, y = i * 2, name = 'unit' .. i }\n"
+	"  local f = function() return t.x end\n"
+	"  if i % 10 == 0 then keep[#keep + 1] = t end\n"
+	"end\n"
+	"local big = {}\n"
+	"for i = 1, 1000 do big[i] = i end\n"
+	"kept = keep\n";
+
+}
+
+void TestLuaMemory::testAllocator()
+{
+	LuaAllocator allocator;
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(&LuaAllocator::Alloc, &allocator, true);
+	lua_State *L = pState->GetCState();
+	UASSERT(LuaAllocator::Get(L) == &allocator);
+
+	UASSERT(run(L, s_garbage));
+
+	// the allocator counts what Lua counts
+	LuaMemoryStats stats = allocator.GetStats();
+	UASSERTEQ(uint64_t, stats.liveBytes, luaBytes(L));
+	UASSERT(stats.peakBytes >= stats.liveBytes);
+	UASSERT(stats.poolAllocs > 10000);
+	UASSERT(stats.heapAllocs > 0);
+	UASSERT(stats.poolAllocs > stats.heapAllocs * 10);
+	UASSERT(stats.poolBytes > 0 && stats.poolBytes % LuaAllocator::kChunkSize == 0);
+
+	// freed blocks are reused: another round needs no more chunks
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	UASSERTEQ(uint64_t, allocator.GetStats().liveBytes, luaBytes(L));
+	uint64_t poolBytes = allocator.GetStats().poolBytes;
+	UASSERT(run(L, "kept = nil\n"));
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	UASSERT(run(L, s_garbage));
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	UASSERT(allocator.GetStats().poolBytes <= poolBytes);
+
+	// strings growing through the size classes and out of the pools keep their contents
+	UASSERT(run(L,
+		"local s = ''\n"
+		"for i = 1, 400 do s = s .. string.char(65 + i % 26) end\n"
+		"local t = {}\n"
+		"for i = 1, 100 do t[i] = i end\n"
+		"for i = 100, 1, -1 do t[i] = nil end\n"
+		"result = #s .. string.sub(s, 1, 3) .. string.sub(s, -2)\n"));
+	UASSERTEQ(std::string, pState->GetGlobal("result").GetString(), "400BCDJK");
+
+	LuaPlus::LuaState::Destroy(pState);
+	UASSERTEQ(uint64_t, allocator.GetStats().liveBytes, 0);
+}
+
+void TestLuaMemory::testAdopt()
+{
+	// the allocator outlives the state it was installed in
+	LuaAllocator allocator;
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	lua_State *L = pState->GetCState();
+	UASSERT(LuaAllocator::Get(L) == nullptr);
+
+	// blocks from both allocators, freed and resized by the pools
+	UASSERT(run(L, s_garbage));
+	allocator.Adopt(L);
+	UASSERT(LuaAllocator::Get(L) == &allocator);
+	allocator.Adopt(L);
+	UASSERT(run(L, "old = kept\n"));
+	UASSERT(run(L, s_garbage));
+	UASSERT(run(L, "for i = 1, #old do old[i].name = old[i].name .. '_renamed' end\n"));
+	UASSERTEQ(uint64_t, allocator.GetStats().liveBytes, luaBytes(L));
+
+	UASSERT(run(L, "old = nil kept = nil\n"));
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	UASSERTEQ(uint64_t, allocator.GetStats().liveBytes, luaBytes(L));
+	UASSERT(allocator.GetStats().poolAllocs > 0);
+
+	LuaPlus::LuaState::Destroy(pState);
+	UASSERTEQ(uint64_t, allocator.GetStats().liveBytes, 0);
+}
+
+void TestLuaMemory::testSubsystems()
+{
+	static const unsigned int s_ai = LuaAllocator::RegisterSubsystem("test_ai");
+	static const unsigned int s_ui = LuaAllocator::RegisterSubsystem("test_ui");
+	UASSERTEQ(unsigned int, LuaAllocator::RegisterSubsystem("test_ai"), s_ai);
+	UASSERT(s_ai != s_ui && s_ai != LuaAllocator::kScriptSubsystem);
+
+	LuaAllocator allocator;
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(&LuaAllocator::Alloc, &allocator, true);
+	lua_State *L = pState->GetCState();
+	std::vector<LuaSubsystemMemoryStats> before = allocator.GetSubsystemStats();
+
+	{
+		LuaAllocator::Scope ai(L, s_ai);
+		UASSERT(run(L, "ai = {} for i = 1, 500 do ai[i] = { i } end\n"));
+		{
+			LuaAllocator::Scope ui(L, s_ui);
+			UASSERT(run(L, "ui = { 1, 2, 3 }\n"));
+		}
+		UASSERT(run(L, "ai.more = { 1 }\n"));
+	}
+	{
+		LuaAllocator::Scope ai(L, s_ai);
+		UASSERT(run(L, "ai = nil\n"));
+		lua_gc(L, LUA_GCCOLLECT, 0);
+	}
+
+	std::vector<LuaSubsystemMemoryStats> after = allocator.GetSubsystemStats();
+	UASSERT(after.size() > s_ui);
+	UASSERTEQ(std::string, after[s_ai].name, "test_ai");
+	UASSERT(after[s_ai].allocs > 500);
+	UASSERT(after[s_ai].allocBytes > 500 * 16);
+	UASSERT(after[s_ai].freedBytes >= 500 * 16);
+	UASSERT(after[s_ui].allocs > 0 && after[s_ui].allocs < 20);
+	UASSERT(after[s_ui].allocBytes < after[s_ai].allocBytes);
+
+	// outside the scopes
+	uint64_t scriptAllocs = after[LuaAllocator::kScriptSubsystem].allocs;
+	UASSERT(run(L, "x = { 1, 2 }\n"));
+	UASSERT(allocator.GetSubsystemStats()[LuaAllocator::kScriptSubsystem].allocs > scriptAllocs);
+	UASSERTEQ(uint64_t, allocator.GetSubsystemStats()[s_ui].allocs, after[s_ui].allocs);
+
+	// a scope on a state with another allocator does nothing
+	LuaPlus::LuaState *pOther = LuaPlus::LuaState::Create(true);
+	{
+		LuaAllocator::Scope ai(pOther->GetCState(), s_ai);
+		UASSERT(run(pOther->GetCState(), "t = {}\n"));
+	}
+	LuaPlus::LuaState::Destroy(pOther);
+
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestLuaMemory::testGarbageCollector()
+{
+	LuaAllocator allocator;
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(&LuaAllocator::Alloc, &allocator, true);
+	lua_State *L = pState->GetCState();
+	UASSERT(run(L, "function frame() for i = 1, 300 do local t = { i, tostring(i) } end end\n"));
+
+	{
+		LuaGarbageCollector collector(L);
+		collector.SetBudget(300, 2000);
+		collector.Start();
+		UASSERT(collector.IsRunning());
+
+		// no collection in the allocations while it runs
+		uint64_t start = luaBytes(L);
+		for (int i = 0; i < 50; i++)
+			UASSERT(run(L, "frame()\n"));
+		UASSERT(luaBytes(L) > start + 50 * 300 * 32);
+		collector.Update();
+		UASSERT(run(L, "frame()\n"));
+
+		// the frames collect their garbage in their budget
+		size_t maxBytes = 0;
+		for (int i = 0; i < 300; i++) {
+			UASSERT(run(L, "frame()\n"));
+			collector.Update();
+			maxBytes = (std::max)(maxBytes, collector.GetBytes());
+		}
+		const LuaGCStats &stats = collector.GetStats();
+		UASSERTEQ(uint64_t, stats.frames, 301);
+		UASSERT(stats.cycles > 2);
+		UASSERT(stats.steps > stats.cycles);
+		UASSERT(maxBytes < start + 50 * 300 * 200);
+		UASSERT(collector.GetThreshold() > 0);
+		UASSERT(stats.totalNs >= stats.maxFrameNs);
+
+		// a frame spends about its budget, four times in catch-up
+		UASSERT(stats.totalNs / stats.frames < 4 * 300 * 1000 + 1000000);
+
+		collector.Stop();
+		UASSERT(!collector.IsRunning());
+		uint64_t frames = collector.GetStats().frames;
+		collector.Update();
+		UASSERTEQ(uint64_t, collector.GetStats().frames, frames);
+	}
+
+	// Lua's collector is back: the garbage stays bounded without Update()
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	uint64_t start = luaBytes(L);
+	for (int i = 0; i < 300; i++)
+		UASSERT(run(L, "frame()\n"));
+	UASSERT(luaBytes(L) < start * 4 + 300 * 300 * 16);
+
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestLuaMemory::testLoadingAndLimit()
+{
+	LuaAllocator allocator;
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(&LuaAllocator::Alloc, &allocator, true);
+	lua_State *L = pState->GetCState();
+	UASSERT(run(L, "function frame() for i = 1, 300 do local t = { i, tostring(i) } end end\n"));
+
+	{
+		LuaGarbageCollector collector(L);
+		collector.SetBudget(50, 100000);
+		collector.SetPause(400);
+		collector.Start();
+
+		// below the threshold a frame does nothing, on a loading screen it collects at once
+		UASSERT(run(L, "frame()\n"));
+		collector.Update();
+		UASSERTEQ(uint64_t, collector.GetStats().steps, 0);
+		UASSERT(collector.GetBudgetUs() == 50);
+
+		collector.SetLoading(true);
+		UASSERT(collector.IsLoading());
+		UASSERTEQ(unsigned int, collector.GetBudgetUs(), 100000);
+		collector.Update();
+		UASSERTEQ(uint64_t, collector.GetStats().cycles, 1);
+		collector.SetLoading(false);
+
+		// at the limit a frame finishes the collection
+		collector.SetLimit(collector.GetBytes() + 64 * 1024);
+		for (int i = 0; i < 20; i++) {
+			UASSERT(run(L, "frame()\n"));
+			collector.Update();
+		}
+		UASSERT(collector.GetStats().fullCollects > 0);
+		UASSERT(collector.GetBytes() < collector.GetThreshold() + 64 * 1024 * 4);
+	}
+
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestLuaMemory::benchAllocator()
+{
+	const char *code =
+		"for round = 1, 20 do\n"
+		"  local units = {}\n"
+		"  for i = 1, 5000 do units[i] = { x = i, y = i, name = 'u' .. i, hp = { cur = 10, max = 10 } } end\n"
+		"end\n";
+	const int rounds = 5;
+
+	uint64_t defaultNs = UINT64_MAX;
+	uint64_t pooledNs = UINT64_MAX;
+	for (int round = 0; round < rounds; round++) {
+		LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+		uint64_t start = getTimeNs();
+		UASSERT(run(pState->GetCState(), code));
+		defaultNs = (std::min)(defaultNs, getTimeNs() - start);
+		LuaPlus::LuaState::Destroy(pState);
+
+		LuaAllocator allocator;
+		pState = LuaPlus::LuaState::Create(&LuaAllocator::Alloc, &allocator, true);
+		start = getTimeNs();
+		UASSERT(run(pState->GetCState(), code));
+		pooledNs = (std::min)(pooledNs, getTimeNs() - start);
+		LuaPlus::LuaState::Destroy(pState);
+	}
+
+	rawstream << "    Lua allocation-heavy script: " << defaultNs / 1000 << " us with realloc, "
+		<< pooledNs / 1000 << " us with the pools" << std::endl;
+}
+
+// the worst frame of a battle-like load with Lua's collector and with the frame budget
+void TestLuaMemory::benchFrameSpikes()
+{
+	const char *setup =
+		"units = {}\n"
+		"for i = 1, 20000 do units[i] = { x = i, y = i, target = nil, path = { i, i + 1 } } end\n"
+		"function frame()\n"
+		"  for i = 1, 2000 do\n"
+		"    local u = units[math.random(#units)]\n"
+		"    u.path = { u.x, u.y, u.x + 1, u.y + 1 }\n"
+		"    local msg = 'hit ' .. i\n"
+		"  end\n"
+		"end\n";
+	const int frames = 600;
+
+	for (int driven = 0; driven < 2; driven++) {
+		LuaAllocator allocator;
+		LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(&LuaAllocator::Alloc, &allocator, true);
+		lua_State *L = pState->GetCState();
+		UASSERT(run(L, setup));
+		{
+			LuaGarbageCollector collector(L);
+			collector.SetBudget(1000, 8000);
+			if (driven)
+				collector.Start();
+
+			std::vector<uint64_t> times;
+			for (int i = 0; i < frames; i++) {
+				uint64_t start = getTimeNs();
+				UASSERT(run(L, "frame()\n"));
+				collector.Update();
+				times.push_back(getTimeNs() - start);
+			}
+
+			std::sort(times.begin(), times.end());
+			uint64_t total = 0;
+			for (size_t i = 0; i < times.size(); i++)
+				total += times[i];
+			rawstream << "    " << (driven ? "GC budget 1000 us" : "Lua's collector  ") << ": frame average "
+				<< total / frames / 1000 << " us, 99% " << times[frames * 99 / 100] / 1000 << " us, worst "
+				<< times.back() / 1000 << " us, peak " << allocator.GetStats().peakBytes / 1024 << " KB, "
+				<< collector.GetStats().cycles << " driven cycles" << std::endl;
+		}
+		LuaPlus::LuaState::Destroy(pState);
+	}
+}
@@ -0,0 +1,571 @@
+#include "unittest/test.h"
+#include "math2d/math2d.h"
+#include "settings.h"
+#include "log.h"
+#include "utils/time_utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+class TestMath2D :public TestBase {
+public:
+	TestMath2D() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMath2D"; }
+
+	void runTests();
+
+	void testPointBuffer();
+	void testSimdLevels();
+	void testBatchTransforms();
+	void testLengthAndNormalize();
+	void testInPlace();
+	void testPrecisions();
+	void testAffineMultiply();
+	void testFloatTransforms();
+	void benchBatchTransforms();
+	void benchSteering();
+};
+
+static TestMath2D g_test_instance;
+
+void TestMath2D::runTests()
+{
+	TEST(testPointBuffer);
+	TEST(testSimdLevels);
+	TEST(testBatchTransforms);
+	TEST(testLengthAndNormalize);
+	TEST(testInPlace);
+	TEST(testPrecisions);
+	TEST(testAffineMultiply);
+	TEST(testFloatTransforms);
+
+	if (g_settings->getFlag("unittest_benchmark")) {
+		TEST(benchBatchTransforms);
+		TEST(benchSteering);
+	}
+
+	SetBatchSimdLevel(GetBestBatchSimdLevel());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// odd, so the SIMD kernels have a tail
+const size_t s_numPoints = 37;
+
+std::vector<Vector2D> randomPoints(size_t count, unsigned int seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> coord(-100.0, 100.0);
+	std::vector<Vector2D> points(count);
+	for (Vector2D &point : points)
+		point.Set(coord(rng), coord(rng));
+	return points;
+}
+
+bool sameAs(const PointBuffer &buffer, const std::vector<Vector2D> &points)
+{
+	if (buffer.Size() != points.size())
+		return false;
+	for (size_t i = 0; i < points.size(); i++) {
+		if (buffer.X()[i] != points[i].x || buffer.Y()[i] != points[i].y)
+			return false;
+	}
+	return true;
+}
+
+template <typename T>
+std::vector<Vector2<T> > randomPointsOf(size_t count, unsigned int seed)
+{
+	std::vector<Vector2D> points = randomPoints(count, seed);
+	return std::vector<Vector2<T> >(points.begin(), points.end());
+}
+
+std::vector<BatchSimdLevel> supportedLevels()
+{
+	std::vector<BatchSimdLevel> levels;
+	for (int level = BATCH_SIMD_SCALAR; level <= GetBestBatchSimdLevel(); level++)
+		levels.push_back((BatchSimdLevel)level);
+	return levels;
+}
+
+}
+
+void TestMath2D::testPointBuffer()
+{
+	PointBuffer buffer;
+	UASSERT(buffer.Empty());
+
+	for (int i = 0; i < 100; i++)
+		buffer.PushBack(Vector2D(i, -i));
+	UASSERTEQ(size_t, buffer.Size(), 100);
+	UASSERT(buffer.Capacity() >= 100);
+	UASSERT(buffer.Capacity() % (PointBuffer::kAlignment / sizeof(double)) == 0);
+	UASSERT((uintptr_t)buffer.X() % PointBuffer::kAlignment == 0);
+	UASSERT((uintptr_t)buffer.Y() % PointBuffer::kAlignment == 0);
+	UASSERT(buffer.Get(42).x == 42.0 && buffer.Get(42).y == -42.0);
+
+	// resizing keeps the points and zeroes the new ones
+	buffer.Resize(150);
+	UASSERT(buffer.Get(99).x == 99.0);
+	UASSERT(buffer.Get(120).x == 0.0 && buffer.Get(120).y == 0.0);
+
+	std::vector<Vector2D> points = randomPoints(s_numPoints, 1);
+	PointBuffer fromPoints(points);
+	UASSERT(sameAs(fromPoints, points));
+
+	PointBuffer copy(fromPoints);
+	UASSERT(sameAs(copy, points));
+	UASSERT(copy.X() != fromPoints.X());
+
+	PointBuffer moved(std::move(copy));
+	UASSERT(sameAs(moved, points));
+	UASSERT(copy.Empty());
+
+	buffer = moved;
+	std::vector<Vector2D> back;
+	buffer.CopyTo(back);
+	UASSERTEQ(size_t, back.size(), points.size());
+	for (size_t i = 0; i < points.size(); i++)
+		UASSERT(back[i] == points[i]);
+}
+
+void TestMath2D::testSimdLevels()
+{
+	UASSERTEQ(int, SetBatchSimdLevel(BATCH_SIMD_SCALAR), BATCH_SIMD_SCALAR);
+	UASSERTEQ(int, GetBatchSimdLevel(), BATCH_SIMD_SCALAR);
+
+	// a level the CPU lacks is lowered to the best it has
+	UASSERTEQ(int, SetBatchSimdLevel(BATCH_SIMD_AVX), GetBestBatchSimdLevel());
+	UASSERTEQ(int, GetBatchSimdLevel(), GetBestBatchSimdLevel());
+
+	infostream << "TestMath2D: batch transforms run at "
+		<< GetBatchSimdLevelName(GetBatchSimdLevel()) << std::endl;
+}
+
+// every level gives exactly what transformations.h gives point by point
+void TestMath2D::testBatchTransforms()
+{
+	std::vector<Vector2D> points = randomPoints(s_numPoints, 2);
+	PointBuffer in(points);
+	PointBuffer out;
+
+	Vector2D pos(12.5, -3.25);
+	Vector2D heading = Vec2DNormalize(Vector2D(0.6, 0.8));
+	Vector2D side = heading.Perp();
+	Vector2D scale(2.0, 0.5);
+
+	for (BatchSimdLevel level : supportedLevels()) {
+		UASSERTEQ(int, SetBatchSimdLevel(level), level);
+
+		WorldTransformPoints(in, pos, heading, side, scale, out);
+		UASSERT(sameAs(out, worldTransform(points, pos, heading, side, scale)));
+
+		WorldTransformPoints(in, pos, heading, side, out);
+		UASSERT(sameAs(out, worldTransform(points, pos, heading, side)));
+
+		std::vector<Vector2D> expected(points.size());
+		PointsToWorldSpace(in, heading, side, pos, out);
+		for (size_t i = 0; i < points.size(); i++)
+			expected[i] = pointToWorldSpace(points[i], heading, side, pos);
+		UASSERT(sameAs(out, expected));
+
+		VectorsToWorldSpace(in, heading, side, out);
+		for (size_t i = 0; i < points.size(); i++)
+			expected[i] = VectorToWorldSpace(points[i], heading, side);
+		UASSERT(sameAs(out, expected));
+
+		PointsToLocalSpace(in, heading, side, pos, out);
+		for (size_t i = 0; i < points.size(); i++)
+			expected[i] = pointToLocalSpace(points[i], heading, side, pos);
+		UASSERT(sameAs(out, expected));
+
+		VectorsToLocalSpace(in, heading, side, out);
+		for (size_t i = 0; i < points.size(); i++)
+			expected[i] = VectorToLocalSpace(points[i], heading, side);
+		UASSERT(sameAs(out, expected));
+
+		RotatePointsAroundOrigin(in, 0.7, out);
+		for (size_t i = 0; i < points.size(); i++) {
+			expected[i] = points[i];
+			Vec2DRotateAroundOrigin(expected[i], 0.7);
+		}
+		UASSERT(sameAs(out, expected));
+
+		Matrix2D mat;
+		mat.Scale(3.0, -1.0);
+		mat.Rotate(-1.1);
+		mat.Translate(7.0, 8.0);
+		TransformPoints(mat, in, out);
+		expected = points;
+		mat.TransformVector2Ds(expected);
+		UASSERT(sameAs(out, expected));
+
+		// the raw arrays, from an offset that is not aligned
+		std::vector<double> outX(points.size() - 1), outY(points.size() - 1);
+		TransformPoints(mat, in.X() + 1, in.Y() + 1, outX.data(), outY.data(), outX.size());
+		for (size_t i = 0; i < outX.size(); i++)
+			UASSERT(outX[i] == expected[i + 1].x && outY[i] == expected[i + 1].y);
+
+		// nothing to do
+		PointBuffer empty;
+		TransformPoints(mat, empty, out);
+		UASSERT(out.Empty());
+	}
+}
+
+void TestMath2D::testLengthAndNormalize()
+{
+	std::vector<Vector2D> points = randomPoints(s_numPoints, 3);
+	// too short to normalize, left as they are
+	points[4].Zero();
+	points[9].Set(1e-17, 0.0);
+	points[10].Set(0.0, -3.0);
+	PointBuffer in(points);
+	PointBuffer out;
+	std::vector<double> lengths(points.size());
+
+	for (BatchSimdLevel level : supportedLevels()) {
+		UASSERTEQ(int, SetBatchSimdLevel(level), level);
+
+		PointLengths(in, lengths.data());
+		for (size_t i = 0; i < points.size(); i++)
+			UASSERT(lengths[i] == points[i].Length());
+
+		NormalizePoints(in, out);
+		std::vector<Vector2D> expected(points.size());
+		for (size_t i = 0; i < points.size(); i++)
+			expected[i] = Vec2DNormalize(points[i]);
+		UASSERT(sameAs(out, expected));
+		UASSERT(out.Get(4).isZero());
+		UASSERT(out.Get(9).x == 1e-17);
+		UASSERT(out.Get(10).y == -1.0);
+	}
+}
+
+void TestMath2D::testInPlace()
+{
+	std::vector<Vector2D> points = randomPoints(s_numPoints, 4);
+	Vector2D heading(0.0, 1.0);
+	Vector2D side = heading.Perp();
+	Vector2D pos(-5.0, 5.0);
+
+	for (BatchSimdLevel level : supportedLevels()) {
+		UASSERTEQ(int, SetBatchSimdLevel(level), level);
+
+		PointBuffer buffer(points);
+		PointsToWorldSpace(buffer, heading, side, pos, buffer);
+		PointsToLocalSpace(buffer, heading, side, pos, buffer);
+		for (size_t i = 0; i < points.size(); i++)
+			UASSERT(buffer.Get(i).Distance(points[i]) < 1e-9);
+
+		NormalizePoints(buffer, buffer);
+		for (size_t i = 0; i < points.size(); i++)
+			UASSERT(fabs(buffer.Get(i).Length() - 1.0) < 1e-12);
+	}
+}
+
+// the hulls of 10000 units to world space each frame, with worldTransform() per unit
+// and with one batch per unit at every level
+void TestMath2D::benchBatchTransforms()
+{
+	const size_t numUnits = 10000;
+	const int frames = 20;
+	std::vector<Vector2D> hull = randomPoints(8, 5);
+	std::vector<Vector2D> positions = randomPoints(numUnits, 6);
+	std::vector<Vector2D> headings = randomPoints(numUnits, 7);
+	for (Vector2D &heading : headings)
+		heading.Normalize();
+
+	double sink = 0.0;
+	uint64_t perPointNs = UINT64_MAX;
+	for (int frame = 0; frame < frames; frame++) {
+		uint64_t start = getTimeNs();
+		for (size_t unit = 0; unit < numUnits; unit++) {
+			std::vector<Vector2D> world = worldTransform(hull, positions[unit],
+				headings[unit], headings[unit].Perp());
+			sink += world[0].x;
+		}
+		perPointNs = (std::min)(perPointNs, getTimeNs() - start);
+	}
+	rawstream << "    " << numUnits << " hulls of " << hull.size() << " points: worldTransform() "
+		<< perPointNs / 1000 << " us";
+
+	PointBuffer in(hull);
+	PointBuffer out;
+	for (BatchSimdLevel level : supportedLevels()) {
+		SetBatchSimdLevel(level);
+		uint64_t batchNs = UINT64_MAX;
+		for (int frame = 0; frame < frames; frame++) {
+			uint64_t start = getTimeNs();
+			for (size_t unit = 0; unit < numUnits; unit++) {
+				WorldTransformPoints(in, positions[unit], headings[unit], headings[unit].Perp(), out);
+				sink += out.X()[0];
+			}
+			batchNs = (std::min)(batchNs, getTimeNs() - start);
+		}
+		rawstream << ", " << GetBatchSimdLevelName(level) << " " << batchNs / 1000 << " us";
+	}
+	rawstream << std::endl;
+
+	// all the points of all the units in one buffer: lengths and normalizing
+	PointBuffer all(positions);
+	std::vector<double> lengths(numUnits);
+	uint64_t loopNs = UINT64_MAX;
+	for (int frame = 0; frame < frames; frame++) {
+		std::vector<Vector2D> copy = positions;
+		uint64_t start = getTimeNs();
+		for (size_t i = 0; i < numUnits; i++) {
+			lengths[i] = copy[i].Length();
+			copy[i].Normalize();
+		}
+		loopNs = (std::min)(loopNs, getTimeNs() - start);
+		sink += copy[0].x + lengths[0];
+	}
+	rawstream << "    " << numUnits << " lengths and normalizes: Vector2D " << loopNs / 1000 << " us";
+
+	for (BatchSimdLevel level : supportedLevels()) {
+		SetBatchSimdLevel(level);
+		uint64_t batchNs = UINT64_MAX;
+		for (int frame = 0; frame < frames; frame++) {
+			uint64_t start = getTimeNs();
+			PointLengths(all, lengths.data());
+			NormalizePoints(all, out);
+			batchNs = (std::min)(batchNs, getTimeNs() - start);
+			sink += out.X()[0] + lengths[0];
+		}
+		rawstream << ", " << GetBatchSimdLevelName(level) << " " << batchNs / 1000 << " us";
+	}
+	rawstream << std::endl;
+
+	UASSERT(sink == sink);
+}
+
+void TestMath2D::testPrecisions()
+{
+	UASSERT((std::is_same<Vector2D, Vector2<double> >::value));
+	UASSERT((std::is_same<Matrix2D, Matrix2x3<double> >::value));
+	UASSERT(sizeof(Vector2F) == 2 * sizeof(float));
+	UASSERT(sizeof(Matrix2F) == 6 * sizeof(float));
+	UASSERT(sizeof(Matrix2D) == 6 * sizeof(double));
+
+	// constant expressions
+	constexpr Vector2F half(0.5f, 0.25f);
+	constexpr Vector2D wide(half);
+	constexpr Matrix2F identity;
+	constexpr Matrix2F shift(1, 0, 0, 1, 3, 4);
+	static_assert(wide.y == 0.25, "");
+	static_assert(identity._11() == 1.0f && identity._31() == 0.0f && identity._33() == 1.0f, "");
+	static_assert(shift.GetTranslation().x == 3.0f, "");
+
+	// the same math in both precisions
+	Vector2F v(3.0f, 4.0f);
+	UASSERT(v.Length() == 5.0f);
+	v.Normalize();
+	UASSERT(fabs(v.x - 0.6f) < 1e-6f && fabs(v.y - 0.8f) < 1e-6f);
+	Vector2F scaled = 2 * v + v * 0.5f - Vector2F(1.0f, 1.0f) / 2;
+	UASSERT(fabs(scaled.x - (2.5f * 0.6f - 0.5f)) < 1e-6f);
+	UASSERT(Vec2DDistance(Vector2F(0, 0), Vector2F(0, 2)) == 2.0f);
+	UASSERT(Vector2F(1e-30f, 0.0f).isZero());
+
+	Vector2D heading(0.6, 0.8);
+	Vector2D pos(10.0, -5.0);
+	Vector2D point(2.0, 1.0);
+	Vector2D world = pointToWorldSpace(point, heading, heading.Perp(), pos);
+	Vector2F worldF = pointToWorldSpace(Vector2F(point), Vector2F(heading), Vector2F(heading.Perp()), Vector2F(pos));
+	UASSERT(fabs(worldF.x - world.x) < 1e-5 && fabs(worldF.y - world.y) < 1e-5);
+
+	std::vector<Vector2F> whiskers = CreateWhiskers(5, 10.0f, 1.0f, Vector2F(1.0f, 0.0f), Vector2F(0.0f, 0.0f));
+	UASSERTEQ(size_t, whiskers.size(), 5);
+	UASSERT(fabs(whiskers[2].x - 10.0f) < 1e-5f && fabs(whiskers[2].y) < 1e-5f);
+}
+
+// the affine product is the 3x3 product with the last column dropped
+void TestMath2D::testAffineMultiply()
+{
+	Matrix2D lhs(1.5, -0.5, 0.25, 2.0, 3.0, -7.0);
+	Matrix2D rhs(0.8, 0.6, -0.6, 0.8, -1.0, 4.0);
+	double full[3][3];
+	double l[3][3] = { { lhs._11(), lhs._12(), lhs._13() }, { lhs._21(), lhs._22(), lhs._23() },
+		{ lhs._31(), lhs._32(), lhs._33() } };
+	double r[3][3] = { { rhs._11(), rhs._12(), rhs._13() }, { rhs._21(), rhs._22(), rhs._23() },
+		{ rhs._31(), rhs._32(), rhs._33() } };
+	for (int row = 0; row < 3; row++) {
+		for (int col = 0; col < 3; col++)
+			full[row][col] = l[row][0] * r[0][col] + l[row][1] * r[1][col] + l[row][2] * r[2][col];
+	}
+
+	Matrix2D product = lhs * rhs;
+	UASSERT(product._11() == full[0][0] && product._12() == full[0][1]);
+	UASSERT(product._21() == full[1][0] && product._22() == full[1][1]);
+	UASSERT(product._31() == full[2][0] && product._32() == full[2][1]);
+	UASSERT(full[0][2] == 0.0 && full[1][2] == 0.0 && full[2][2] == 1.0);
+
+	// transforming by the product is transforming by one then the other
+	Vector2D point(4.0, -2.0);
+	Vector2D twice = point;
+	lhs.TransformVector2Ds(twice);
+	rhs.TransformVector2Ds(twice);
+	product.TransformVector2Ds(point);
+	UASSERT(point.Distance(twice) < 1e-12);
+
+	// Scale, Rotate and Translate compose the same way
+	Matrix2D built;
+	built.Scale(2.0, 3.0);
+	built.Rotate(0.5);
+	built.Translate(1.0, 2.0);
+	Matrix2D scale(2.0, 0, 0, 3.0, 0, 0);
+	Matrix2D rotate(cos(0.5), sin(0.5), -sin(0.5), cos(0.5), 0, 0);
+	Matrix2D translate(1, 0, 0, 1, 1.0, 2.0);
+	Matrix2D composed = scale * rotate * translate;
+	UASSERT(built._11() == composed._11() && built._22() == composed._22());
+	UASSERT(built._31() == composed._31() && built._32() == composed._32());
+}
+
+// the SIMD Matrix2F::TransformVector2Ds() against the point by point one
+void TestMath2D::testFloatTransforms()
+{
+	std::vector<Vector2F> points = randomPointsOf<float>(s_numPoints, 8);
+	Matrix2F mat;
+	mat.Rotate(0.3f);
+	mat.Scale(1.5f, 0.75f);
+	mat.Translate(-2.0f, 9.0f);
+
+	std::vector<Vector2F> expected = points;
+	for (Vector2F &point : expected) {
+		// the single point version is not vectorized
+		mat.TransformVector2Ds(point);
+	}
+
+	for (BatchSimdLevel level : supportedLevels()) {
+		UASSERTEQ(int, SetBatchSimdLevel(level), level);
+
+		std::vector<Vector2F> transformed = points;
+		mat.TransformVector2Ds(transformed);
+		for (size_t i = 0; i < points.size(); i++)
+			UASSERT(transformed[i].x == expected[i].x && transformed[i].y == expected[i].y);
+
+		std::vector<Vector2F> out(points.size() - 1);
+		TransformPoints(mat, &points[1], &out[0], out.size());
+		for (size_t i = 0; i < out.size(); i++)
+			UASSERT(out[i].x == expected[i + 1].x && out[i].y == expected[i + 1].y);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+template <typename T>
+struct SteeringAgent
+{
+	Vector2<T> pos;
+	Vector2<T> velocity;
+	Vector2<T> heading;
+	Vector2<T> side;
+	Vector2<T> wanderTarget;
+	Vector2<T> target;
+};
+
+// arrive at a target plus wander, as the unit movement does it
+template <typename T>
+void steerAgents(std::vector<SteeringAgent<T> > &agents, T dt)
+{
+	const T maxSpeed = 150;
+	const T maxForce = 400;
+	const T wanderRadius = 12;
+	const T wanderDistance = 20;
+	const T jitter = T(0.3);
+
+	for (SteeringAgent<T> &agent : agents) {
+		Vector2<T> toTarget = agent.target - agent.pos;
+		T dist = toTarget.Length();
+		Vector2<T> force;
+		if (dist > 0) {
+			T speed = (std::min)(dist / T(0.3), maxSpeed);
+			force = toTarget * (speed / dist) - agent.velocity;
+		}
+
+		agent.wanderTarget += Vector2<T>(jitter * agent.heading.y, -jitter * agent.heading.x);
+		agent.wanderTarget.Normalize();
+		agent.wanderTarget *= wanderRadius;
+		Vector2<T> local = agent.wanderTarget + Vector2<T>(wanderDistance, 0);
+		force += pointToWorldSpace(local, agent.heading, agent.side, agent.pos) - agent.pos;
+
+		force.Truncate(maxForce);
+		agent.velocity += force * dt;
+		agent.velocity.Truncate(maxSpeed);
+		agent.pos += agent.velocity * dt;
+
+		if (agent.velocity.LengthSq() > T(1e-8)) {
+			agent.heading = Vec2DNormalize(agent.velocity);
+			agent.side = agent.heading.Perp();
+		}
+	}
+}
+
+template <typename T>
+uint64_t benchSteeringOf(size_t numAgents, int frames, double &sink)
+{
+	std::vector<Vector2<T> > positions = randomPointsOf<T>(numAgents, 9);
+	std::vector<Vector2<T> > targets = randomPointsOf<T>(numAgents, 10);
+	std::vector<SteeringAgent<T> > agents(numAgents);
+	for (size_t i = 0; i < numAgents; i++) {
+		agents[i].pos = positions[i];
+		agents[i].heading = Vector2<T>(1, 0);
+		agents[i].side = agents[i].heading.Perp();
+		agents[i].wanderTarget = Vector2<T>(1, 0);
+		agents[i].target = targets[i];
+	}
+
+	uint64_t bestNs = UINT64_MAX;
+	for (int frame = 0; frame < frames; frame++) {
+		uint64_t start = getTimeNs();
+		steerAgents(agents, T(1) / 60);
+		bestNs = (std::min)(bestNs, getTimeNs() - start);
+	}
+	sink += agents[0].pos.x;
+	return bestNs;
+}
+
+}
+
+// a frame of steering for many agents in doubles and in floats
+void TestMath2D::benchSteering()
+{
+	double sink = 0.0;
+	for (size_t numAgents : { (size_t)10000, (size_t)50000 }) {
+		uint64_t doubleNs = benchSteeringOf<double>(numAgents, 30, sink);
+		uint64_t floatNs = benchSteeringOf<float>(numAgents, 30, sink);
+		rawstream << "    " << numAgents << " agents steering: Vector2D " << doubleNs / 1000
+			<< " us, Vector2F " << floatNs / 1000 << " us" << std::endl;
+	}
+
+	// the vectorized float transform against the double one
+	std::vector<Vector2D> points = randomPoints(100000, 11);
+	std::vector<Vector2F> pointsF(points.begin(), points.end());
+	Matrix2D mat;
+	mat.Rotate(0.3);
+	mat.Translate(5.0, 5.0);
+	Matrix2F matF(mat);
+	uint64_t doubleNs = UINT64_MAX;
+	uint64_t floatNs = UINT64_MAX;
+	for (int round = 0; round < 20; round++) {
+		uint64_t start = getTimeNs();
+		mat.TransformVector2Ds(points);
+		doubleNs = (std::min)(doubleNs, getTimeNs() - start);
+		start = getTimeNs();
+		matF.TransformVector2Ds(pointsF);
+		floatNs = (std::min)(floatNs, getTimeNs() - start);
+	}
+	sink += points[0].x + pointsF[0].x;
+	rawstream << "    " << points.size() << " points transformed: Matrix2D " << doubleNs / 1000
+		<< " us, Matrix2F " << floatNs / 1000 << " us ("
+		<< GetBatchSimdLevelName(GetBatchSimdLevel()) << ")" << std::endl;
+
+	UASSERT(sink == sink);
+}
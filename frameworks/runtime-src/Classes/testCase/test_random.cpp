@@ -1,7 +1,21 @@
 #include "unittest/test.h"
 #include "utils/random_utils.h"
+#include "utils/string_utils.h"
+#include "utils/time_utils.h"
+#include "math2d/batchtransform.h"
+#include "threading/job_system.h"
+#include "settings.h"
+#include "log.h"
 #include "debug.h"
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+
 class TestRandom :public TestBase {
 public:
 	TestRandom() { TestManager::registerTestModule(this); }
@@ -10,11 +24,59 @@ public:
 	void runTests();
 
 	void testAllRandoms();
+	void testFunctionRanges();
+	void testSeeds();
+	void testRanges();
+	void testUniformity();
+	void testFillLevels();
+	void testSplit();
+	void testThreads();
+	void benchRandom();
 };
 
 void TestRandom::runTests()
 {
 	TEST(testAllRandoms);
+	TEST(testFunctionRanges);
+	TEST(testSeeds);
+	TEST(testRanges);
+	TEST(testUniformity);
+	TEST(testFillLevels);
+	TEST(testSplit);
+	TEST(testThreads);
+
+	if (g_settings->getFlag("unittest_benchmark"))
+		TEST(benchRandom);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Pearson's chi-squared of counts expected to be equal
+double chiSquared(const std::vector<int> &counts, int total)
+{
+	double expected = (double)total / counts.size();
+	double sum = 0;
+	for (size_t i = 0; i < counts.size(); i++)
+		sum += (counts[i] - expected) * (counts[i] - expected) / expected;
+	return sum;
+}
+
+// of each number with the next one
+double serialCorrelation(const std::vector<float> &values)
+{
+	double n = (double)values.size() - 1, sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+	for (size_t i = 0; i + 1 < values.size(); i++) {
+		double x = values[i], y = values[i + 1];
+		sx += x; sy += y; sxx += x * x; syy += y * y; sxy += x * y;
+	}
+	return (n * sxy - sx * sy) / std::sqrt((n * sxx - sx * sx) * (n * syy - sy * sy));
+}
+
+// 16 buckets: 37.7 is exceeded by chance once in a thousand runs
+const double kChiSquared15 = 37.7;
+
 }
 
 void TestRandom::testAllRandoms()
@@ -26,4 +88,291 @@ void TestRandom::testAllRandoms()
 
 }
 
-static TestRandom g_test_instance;
\ No newline at end of file
+void TestRandom::testFunctionRanges()
+{
+	int r1 = random_int(0, 10);
+	float f1 = random_float(0, 1);
+	double d1 = random_double(0, 0.88);
+	float f2 = random_float();
+	double c1 = random_clamped();
+
+	UASSERT(r1 >= 0 && r1 <= 10);
+	UASSERT(f1 >= 0 && f1 < 1);
+	UASSERT(d1 >= 0 && d1 < 0.88);
+	UASSERT(f2 >= 0 && f2 < 1);
+	UASSERT(c1 >= -1 && c1 < 1);
+}
+
+void TestRandom::testSeeds()
+{
+	UASSERTEQ(uint64_t, read_seed("12345"), 12345);
+	UASSERTEQ(uint64_t, read_seed("0x10"), 16);
+	UASSERTEQ(uint64_t, read_seed("18446744073709551615"), UINT64_MAX);
+	UASSERT(read_seed("total wars") == read_seed("total wars"));
+	UASSERT(read_seed("total wars") != read_seed("total war"));
+	UASSERT(read_seed("12345x") != 12345);
+
+	RandomGenerator g1(42), g2(42), g3(43), zero(0);
+	for (int i = 0; i < 100; i++) {
+		uint64_t n = g1.next();
+		UASSERT(n == g2.next());
+		UASSERT(n != g3.next());
+	}
+	UASSERT(zero.next() != 0 || zero.next() != 0);
+
+	g1.setSeed(7);
+	g2.setSeed(7);
+	UASSERT(g1 == g2);
+	g2.next();
+	UASSERT(g1 != g2);
+
+	// the functions replay after the same seed
+	set_random_seed(read_seed("replay"));
+	std::vector<int> first;
+	for (int i = 0; i < 50; i++)
+		first.push_back(random_int(0, 1000000));
+	set_random_seed(read_seed("replay"));
+	for (int i = 0; i < 50; i++)
+		UASSERTEQ(int, random_int(0, 1000000), first[i]);
+}
+
+void TestRandom::testRanges()
+{
+	RandomGenerator g(1);
+
+	bool low = false, high = false;
+	for (int i = 0; i < 1000; i++) {
+		int n = g.nextInt(-3, 3);
+		UASSERT(n >= -3 && n <= 3);
+		low |= n == -3;
+		high |= n == 3;
+	}
+	UASSERT(low && high);
+
+	UASSERTEQ(int, g.nextInt(5, 5), 5);
+	UASSERTEQ(int, g.nextInt(5, 2), 5);
+
+	bool negative = false, positive = false;
+	for (int i = 0; i < 100; i++) {
+		int n = g.nextInt(INT_MIN, INT_MAX);
+		negative |= n < 0;
+		positive |= n > 0;
+		UASSERT(g.nextInt(INT_MAX - 1, INT_MAX) >= INT_MAX - 1);
+	}
+	UASSERT(negative && positive);
+
+	for (int i = 0; i < 10000; i++) {
+		float f = g.nextFloat(-2.0f, 3.0f);
+		double d = g.nextDouble(10.0, 10.5);
+		UASSERT(f >= -2.0f && f < 3.0f);
+		UASSERT(d >= 10.0 && d < 10.5);
+	}
+
+	// a range of one float, where a + u * (b - a) would round up to b
+	float a = 1.0f, b = std::nextafter(1.0f, 2.0f);
+	std::vector<float> values(100, -1.0f);
+	g.fillFloats(values.data(), values.size(), a, b);
+	for (size_t i = 0; i < values.size(); i++) {
+		UASSERT(values[i] == a);
+		UASSERT(g.nextFloat(a, b) == a);
+	}
+
+	values.assign(1001, -1.0f);
+	g.fillFloats(values.data(), values.size(), 100.0f, 200.0f);
+	for (size_t i = 0; i < values.size(); i++)
+		UASSERT(values[i] >= 100.0f && values[i] < 200.0f);
+}
+
+void TestRandom::testUniformity()
+{
+	const int total = 160000;
+	RandomGenerator g(read_seed("uniformity"));
+
+	std::vector<int> ints(16, 0), floats(16, 0), bools(2, 0);
+	for (int i = 0; i < total; i++) {
+		ints[g.nextInt(0, 15)]++;
+		floats[(int)(g.nextFloat() * 16)]++;
+		bools[g.nextBool()]++;
+	}
+	UASSERT(chiSquared(ints, total) < kChiSquared15);
+	UASSERT(chiSquared(floats, total) < kChiSquared15);
+	UASSERT(std::abs(bools[0] - bools[1]) < 4 * std::sqrt((double)total));
+
+	for (int level = BATCH_SIMD_SCALAR; level <= BATCH_SIMD_SSE2; level++) {
+		SetBatchSimdLevel((BatchSimdLevel)level);
+
+		std::vector<float> values(total);
+		g.fillFloats(values.data(), values.size(), 0.0f, 1.0f);
+
+		std::vector<int> buckets(16, 0);
+		double mean = 0, variance = 0;
+		for (size_t i = 0; i < values.size(); i++) {
+			buckets[(int)(values[i] * 16)]++;
+			mean += values[i];
+		}
+		mean /= total;
+		for (size_t i = 0; i < values.size(); i++)
+			variance += (values[i] - mean) * (values[i] - mean);
+		variance /= total;
+
+		// standard errors of 0.0007 and 0.0002
+		UASSERT(chiSquared(buckets, total) < kChiSquared15);
+		UASSERT(std::abs(mean - 0.5) < 0.005);
+		UASSERT(std::abs(variance - 1.0 / 12) < 0.002);
+		UASSERT(std::abs(serialCorrelation(values)) < 0.01);
+
+		// also across the lanes, eight apart
+		std::vector<float> lane0;
+		for (size_t i = 0; i < values.size(); i += 8)
+			lane0.push_back(values[i]);
+		UASSERT(std::abs(serialCorrelation(lane0)) < 0.03);
+	}
+	SetBatchSimdLevel(GetBestBatchSimdLevel());
+}
+
+void TestRandom::testFillLevels()
+{
+	// every count, to cover the numbers after the last full batch
+	for (size_t count = 0; count < 40; count++) {
+		RandomGenerator scalar(99), simd(99);
+		std::vector<float> scalarValues(count + 1, -1.0f), simdValues(count + 1, -1.0f);
+
+		SetBatchSimdLevel(BATCH_SIMD_SCALAR);
+		scalar.fillFloats(scalarValues.data(), count, -1.0f, 1.0f);
+		SetBatchSimdLevel(GetBestBatchSimdLevel());
+		simd.fillFloats(simdValues.data(), count, -1.0f, 1.0f);
+
+		UASSERT(scalarValues == simdValues);
+		UASSERT(scalar == simd);
+		UASSERT(scalarValues[count] == -1.0f);
+	}
+}
+
+void TestRandom::testSplit()
+{
+	RandomGenerator g(5), copy(5);
+	RandomGenerator stream = g.split();
+	UASSERT(stream == copy);
+	copy.jump();
+	UASSERT(g == copy);
+
+	// each job of a fixed split draws the same numbers, on any thread
+	const size_t jobs = 64, perJob = 1000;
+	std::vector<RandomGenerator> streams;
+	RandomGenerator root(read_seed("jobs"));
+	for (size_t i = 0; i < jobs; i++)
+		streams.push_back(root.split());
+
+	std::vector<float> serial(jobs * perJob), parallel(jobs * perJob);
+	std::vector<RandomGenerator> serialStreams = streams;
+	for (size_t i = 0; i < jobs; i++)
+		serialStreams[i].fillFloats(&serial[i * perJob], perJob, 0.0f, 1.0f);
+
+	JobSystem jobSystem(3);
+	jobSystem.parallelFor(0, jobs, 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			streams[i].fillFloats(&parallel[i * perJob], perJob, 0.0f, 1.0f);
+	});
+	UASSERT(serial == parallel);
+
+	// and the streams are not the same numbers
+	for (size_t i = 1; i < jobs; i++)
+		UASSERT(serial[i * perJob] != serial[(i - 1) * perJob] || serial[i * perJob + 1] != serial[(i - 1) * perJob + 1]);
+}
+
+void TestRandom::testThreads()
+{
+	set_random_seed(77);
+	uint64_t mainFirst = thread_random().next();
+
+	const int numThreads = 4;
+	std::vector<uint64_t> firsts(numThreads);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < numThreads; i++) {
+		threads.push_back(std::thread([&firsts, i]() {
+			firsts[i] = thread_random().next();
+			for (int j = 0; j < 10000; j++)
+				random_int(0, 100);
+		}));
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	// the threads drew from streams split off after the main thread's
+	RandomGenerator root(77);
+	std::vector<uint64_t> expected;
+	UASSERT(root.split().next() == mainFirst);
+	for (int i = 0; i < numThreads; i++)
+		expected.push_back(root.split().next());
+	for (int i = 0; i < numThreads; i++)
+		UASSERT(std::find(expected.begin(), expected.end(), firsts[i]) != expected.end());
+	for (int i = 1; i < numThreads; i++)
+		UASSERT(std::find(firsts.begin(), firsts.begin() + i, firsts[i]) == firsts.begin() + i);
+
+	// reseeding reaches a thread that drew before
+	std::atomic<int> stage(0);
+	uint64_t before = 0, after = 0;
+	std::thread drawing([&stage, &before, &after]() {
+		before = thread_random().next();
+		stage = 1;
+		while (stage != 2)
+			std::this_thread::yield();
+		after = thread_random().next();
+	});
+	while (stage != 1)
+		std::this_thread::yield();
+	set_random_seed(78);
+	stage = 2;
+	drawing.join();
+
+	// the main thread took the first stream of the new seed
+	root.setSeed(78);
+	root.split();
+	UASSERT(before != 0);
+	UASSERT(after == root.split().next());
+}
+
+void TestRandom::benchRandom()
+{
+	const size_t count = 1 << 22;
+	std::vector<float> values(count);
+	volatile uint64_t sink = 0;
+
+	RandomGenerator g(1);
+	uint64_t start = getTimeUs();
+	uint64_t sum = 0;
+	for (size_t i = 0; i < count; i++)
+		sum += g.next();
+	sink = sum;
+	uint64_t nextUs = getTimeUs() - start;
+
+	start = getTimeUs();
+	for (size_t i = 0; i < count; i++)
+		values[i] = random_float(-1.0f, 1.0f);
+	uint64_t threadUs = getTimeUs() - start;
+
+	// what random_float() did before
+	std::default_random_engine engine(1);
+	std::uniform_real_distribution<float> distribution;
+	start = getTimeUs();
+	for (size_t i = 0; i < count; i++)
+		values[i] = distribution(engine, std::uniform_real_distribution<float>::param_type(-1.0f, 1.0f));
+	uint64_t stdUs = getTimeUs() - start;
+
+	uint64_t fillUs[2];
+	for (int level = BATCH_SIMD_SCALAR; level <= BATCH_SIMD_SSE2; level++) {
+		SetBatchSimdLevel((BatchSimdLevel)level);
+		start = getTimeUs();
+		g.fillFloats(values.data(), count, -1.0f, 1.0f);
+		fillUs[level] = getTimeUs() - start;
+	}
+	SetBatchSimdLevel(GetBestBatchSimdLevel());
+	(void)sink;
+
+	double ns = 1000.0 / count;
+	rawstream << "    " << count << " numbers, ns each: next() " << nextUs * ns << ", random_float() " << threadUs * ns
+		<< " (default_random_engine " << stdUs * ns << "), fillFloats() scalar " << fillUs[0] * ns
+		<< ", SSE2 " << fillUs[1] * ns << std::endl;
+}
+
+static TestRandom g_test_instance;
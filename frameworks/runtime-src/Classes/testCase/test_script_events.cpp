@@ -0,0 +1,550 @@
+#include "unittest/test.h"
+#include "LUAScripting/ScriptEvent.h"
+#include "LUAScripting/ScriptEventBatch.h"
+#include "LUAScripting/ScriptModule.h"
+#include "eventmanager/EventManagerImpl.h"
+#include "settings.h"
+#include "log.h"
+#include "utils/slot_map.h"
+#include "utils/time_utils.h"
+
+#include <string>
+#include <vector>
+
+static const EventType TEST_EVENT_HIT(0x6b1e0001);
+static const EventType TEST_EVENT_DIED(0x6b1e0002);
+static const EventType TEST_EVENT_UNKNOWN(0x6b1e0003);
+
+// the event as QueueEvent() sends it: one ScriptEvent with its data table per event
+class EvtData_TestScriptHit : public ScriptEvent
+{
+public:
+	virtual const EventType& VGetEventType(void) const { return TEST_EVENT_HIT; }
+	virtual IEventDataPtr VCopy(void) const { return IEventDataPtr(new EvtData_TestScriptHit); }
+	virtual const char* GetName(void) const { return "EvtData_TestScriptHit"; }
+};
+
+class TestScriptEvents :public TestBase {
+public:
+	TestScriptEvents() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestScriptEvents"; }
+
+	void runTests();
+
+	void testBatch();
+	void testInvalidEvents();
+	void testFireDuringFlush();
+	void testRingGrowth();
+	void testSlotMap();
+	void testListenerHandles();
+	void testModules();
+	void benchScriptEvents();
+	void benchListenerChurn();
+
+	void onHit(const ScriptEventBatch &events);
+	void onHitRemove(const ScriptEventBatch &events);
+	void onLegacyHit(IEventDataPtr pEvent);
+
+	std::vector<long long> m_actors;
+	std::vector<double> m_damage;
+	std::vector<bool> m_critical;
+	int m_calls;
+	ScriptEventBatcher *m_batcher;
+	LuaPlus::LuaObject m_callback;
+};
+
+static TestScriptEvents g_test_instance;
+
+void TestScriptEvents::runTests()
+{
+	TEST(testBatch);
+	TEST(testInvalidEvents);
+	TEST(testFireDuringFlush);
+	TEST(testRingGrowth);
+	TEST(testSlotMap);
+	TEST(testListenerHandles);
+	TEST(testModules);
+
+	if (g_settings->getFlag("unittest_benchmark")) {
+		TEST(benchScriptEvents);
+		TEST(benchListenerChurn);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+EventManager *s_bench_mgr = nullptr;
+
+// what QueueEvent() does: a heap event per call holding a reference to the data table
+int benchQueueEvent(LuaPlus::LuaState *pState)
+{
+	std::shared_ptr<ScriptEvent> pEvent(new EvtData_TestScriptHit);
+	pEvent->SetEventData(LuaPlus::LuaObject(pState, 2));
+	s_bench_mgr->VQueueEvent(pEvent);
+	return 0;
+}
+
+void registerTestTypes(ScriptEventBatcher &batcher, LuaPlus::LuaState *pState)
+{
+	batcher.RegisterEventType(TEST_EVENT_HIT, "TestHit", {
+		{ "actor", SCRIPT_FIELD_INTEGER },
+		{ "damage", SCRIPT_FIELD_NUMBER },
+		{ "critical", SCRIPT_FIELD_BOOL } });
+	batcher.RegisterEventType(TEST_EVENT_DIED, "TestDied", { { "actor", SCRIPT_FIELD_INTEGER } });
+	batcher.RegisterScriptFunctions(pState->GetGlobals());
+
+	LuaPlus::LuaObject types = pState->GetGlobals().CreateTable("EventType");
+	types.SetNumber("TestHit", (double)TEST_EVENT_HIT);
+	types.SetNumber("TestDied", (double)TEST_EVENT_DIED);
+	types.SetNumber("TestUnknown", (double)TEST_EVENT_UNKNOWN);
+}
+
+}
+
+void TestScriptEvents::onHit(const ScriptEventBatch &events)
+{
+	m_calls++;
+	int damage = events.FindField("damage");
+	for (unsigned int i = 0; i < events.GetNumEvents(); i++) {
+		m_actors.push_back(events.GetInteger(i, 0));
+		m_damage.push_back(events.GetNumber(i, damage));
+		m_critical.push_back(events.GetBool(i, 2));
+	}
+}
+
+void TestScriptEvents::onHitRemove(const ScriptEventBatch &events)
+{
+	m_calls++;
+	m_batcher->RemoveListener(fastdelegate::MakeDelegate(this, &TestScriptEvents::onHitRemove), TEST_EVENT_HIT);
+}
+
+void TestScriptEvents::onLegacyHit(IEventDataPtr pEvent)
+{
+	std::shared_ptr<ScriptEvent> pScriptEvent = std::static_pointer_cast<ScriptEvent>(pEvent);
+	LuaPlus::LuaFunction<int> callback = m_callback;
+	callback(pScriptEvent->GetEventData());
+}
+
+void TestScriptEvents::testBatch()
+{
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	{
+		ScriptEventBatcher batcher(pState);
+		registerTestTypes(batcher, pState);
+		UASSERT(batcher.IsEventTypeRegistered(TEST_EVENT_HIT));
+		UASSERT(!batcher.IsEventTypeRegistered(TEST_EVENT_UNKNOWN));
+
+		m_calls = 0;
+		m_actors.clear();
+		m_damage.clear();
+		m_critical.clear();
+		UASSERT(batcher.AddListener(fastdelegate::MakeDelegate(this, &TestScriptEvents::onHit), TEST_EVENT_HIT));
+		UASSERT(!batcher.AddListener(fastdelegate::MakeDelegate(this, &TestScriptEvents::onHit), TEST_EVENT_HIT));
+
+		UASSERT(pState->DoString(
+			"calls, hits, died = 0, {}, {}\n"
+			"hitListener = RegisterBatchListener(EventType.TestHit, function(batch)\n"
+			"  calls = calls + 1\n"
+			"  for i = 1, batch.count do\n"
+			"    hits[#hits + 1] = batch.actor[i] .. ':' .. batch.damage[i] .. ':' .. tostring(batch.critical[i])\n"
+			"  end\n"
+			"end)\n"
+			"RegisterBatchListener(EventType.TestDied, function(batch)\n"
+			"  calls = calls + 1\n"
+			"  for i = 1, batch.count do died[#died + 1] = batch.actor[i] end\n"
+			"end)\n"
+			"for i = 1, 5 do\n"
+			"  assert(FireEvent(EventType.TestHit, i, i * 1.5, i % 2 == 0))\n"
+			"  if i % 2 == 1 then assert(FireEvent(EventType.TestDied, 100 + i)) end\n"
+			"end\n") == 0);
+		UASSERTEQ(size_t, batcher.GetNumPendingEvents(), 8);
+		UASSERT(pState->GetGlobal("hitListener").GetNumber() > 0);
+
+		// one call per listener and type, each type in the order it was fired
+		UASSERTEQ(unsigned int, batcher.Flush(), 8);
+		UASSERTEQ(size_t, batcher.GetNumPendingEvents(), 0);
+		UASSERTEQ(int, m_calls, 1);
+		UASSERTEQ(size_t, m_actors.size(), 5);
+		for (int i = 0; i < 5; i++) {
+			UASSERTEQ(long long, m_actors[i], i + 1);
+			UASSERTEQ(double, m_damage[i], (i + 1) * 1.5);
+			UASSERT(m_critical[i] == ((i + 1) % 2 == 0));
+		}
+		UASSERTEQ(int, pState->GetGlobal("calls").GetInteger(), 2);
+		UASSERTEQ(std::string, pState->GetGlobal("hits").GetByIndex(2).GetString(), "2:3:true");
+		UASSERTEQ(int, pState->GetGlobal("died").GetTableCount(), 3);
+		UASSERTEQ(int, pState->GetGlobal("died").GetByIndex(3).GetInteger(), 105);
+
+		// nothing fired, nothing called
+		UASSERTEQ(unsigned int, batcher.Flush(), 0);
+		UASSERTEQ(int, pState->GetGlobal("calls").GetInteger(), 2);
+
+		// the arrays are as long as the batch, even after a larger one
+		UASSERT(pState->DoString(
+			"RemoveBatchListener(hitListener)\n"
+			"RegisterBatchListener(EventType.TestHit, function(batch) lengths = #batch.actor .. ',' .. #batch.damage end)\n"
+			"FireEvent(EventType.TestHit, 7, 0.25, false)\n") == 0);
+		UASSERTEQ(unsigned int, batcher.Flush(), 1);
+		UASSERTEQ(std::string, pState->GetGlobal("lengths").GetString(), "1,1");
+		UASSERTEQ(int, pState->GetGlobal("calls").GetInteger(), 2);
+		UASSERTEQ(long long, m_actors.back(), 7);
+
+		UASSERT(batcher.RemoveListener(fastdelegate::MakeDelegate(this, &TestScriptEvents::onHit), TEST_EVENT_HIT));
+		UASSERT(!batcher.RemoveListener(fastdelegate::MakeDelegate(this, &TestScriptEvents::onHit), TEST_EVENT_HIT));
+	}
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestScriptEvents::testInvalidEvents()
+{
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	{
+		ScriptEventBatcher batcher(pState);
+		registerTestTypes(batcher, pState);
+		UASSERT(!batcher.RegisterEventType(TEST_EVENT_HIT, "TestHit", {}));
+
+		// rejected events leave nothing in the ring
+		UASSERT(pState->DoString(
+			"results = {\n"
+			"  FireEvent(EventType.TestUnknown, 1),\n"
+			"  FireEvent(nil),\n"
+			"  FireEvent(EventType.TestHit, 1, 2),\n"
+			"  FireEvent(EventType.TestHit, 1, 2, true, 4),\n"
+			"  FireEvent(EventType.TestHit, 1, 2, 3),\n"
+			"  FireEvent(EventType.TestHit, 'x', 2, true),\n"
+			"  FireEvent(EventType.TestDied, 1),\n"
+			"}\n"
+			"badListener = RegisterBatchListener(EventType.TestUnknown, function() end)\n"
+			"noFunction = RegisterBatchListener(EventType.TestDied, 5)\n"
+			"RegisterBatchListener(EventType.TestDied, function(batch) error('listener error') end)\n"
+			"RegisterBatchListener(EventType.TestDied, function(batch) after = batch.count end)\n") == 0);
+		LuaPlus::LuaObject results = pState->GetGlobal("results");
+		for (int i = 1; i <= 6; i++)
+			UASSERT(!results.GetByIndex(i).GetBoolean());
+		UASSERT(results.GetByIndex(7).GetBoolean());
+		UASSERTEQ(double, pState->GetGlobal("badListener").GetNumber(), 0);
+		UASSERTEQ(double, pState->GetGlobal("noFunction").GetNumber(), 0);
+		UASSERTEQ(size_t, batcher.GetNumPendingEvents(), 1);
+
+		// a failing listener does not keep the others from their batch
+		UASSERTEQ(unsigned int, batcher.Flush(), 1);
+		UASSERTEQ(int, pState->GetGlobal("after").GetInteger(), 1);
+		UASSERTEQ(int, lua_gettop(pState->GetCState()), 0);
+
+		ScriptEventValue values[1];
+		values[0].integer = 1;
+		UASSERT(!batcher.Fire(TEST_EVENT_HIT, values, 1));
+		UASSERT(batcher.Fire(TEST_EVENT_DIED, values, 1));
+		UASSERT(!batcher.Fire(TEST_EVENT_UNKNOWN, values, 1));
+	}
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestScriptEvents::testFireDuringFlush()
+{
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	{
+		ScriptEventBatcher batcher(pState);
+		registerTestTypes(batcher, pState);
+		m_batcher = &batcher;
+		m_calls = 0;
+		batcher.AddListener(fastdelegate::MakeDelegate(this, &TestScriptEvents::onHitRemove), TEST_EVENT_HIT);
+
+		// events fired by listeners wait for the next flush, listeners removed
+		// during the flush are not called again
+		UASSERT(pState->DoString(
+			"chain, seen = 0, 0\n"
+			"local handle\n"
+			"handle = RegisterBatchListener(EventType.TestHit, function(batch)\n"
+			"  seen = seen + batch.count\n"
+			"  if chain < 3 then chain = chain + 1; FireEvent(EventType.TestHit, chain, 0, false) end\n"
+			"end)\n"
+			"once = RegisterBatchListener(EventType.TestHit, function(batch)\n"
+			"  onceCalls = (onceCalls or 0) + 1\n"
+			"  RemoveBatchListener(once)\n"
+			"end)\n"
+			"FireEvent(EventType.TestHit, 0, 0, false)\n") == 0);
+
+		UASSERTEQ(unsigned int, batcher.Flush(), 1);
+		UASSERTEQ(size_t, batcher.GetNumPendingEvents(), 1);
+		UASSERTEQ(unsigned int, batcher.Flush(), 1);
+		UASSERTEQ(unsigned int, batcher.Flush(), 1);
+		UASSERTEQ(unsigned int, batcher.Flush(), 1);
+		UASSERTEQ(unsigned int, batcher.Flush(), 0);
+		UASSERTEQ(int, pState->GetGlobal("seen").GetInteger(), 4);
+		UASSERTEQ(int, pState->GetGlobal("onceCalls").GetInteger(), 1);
+		UASSERTEQ(int, m_calls, 1);
+	}
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestScriptEvents::testRingGrowth()
+{
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	{
+		// four events fit in the smallest ring
+		ScriptEventBatcher batcher(pState, 1);
+		registerTestTypes(batcher, pState);
+		m_calls = 0;
+		m_actors.clear();
+		m_damage.clear();
+		m_critical.clear();
+		batcher.AddListener(fastdelegate::MakeDelegate(this, &TestScriptEvents::onHit), TEST_EVENT_HIT);
+
+		// wrap around a few times before growing
+		for (int frame = 0; frame < 10; frame++) {
+			UASSERT(pState->DoString("for i = 1, 3 do FireEvent(EventType.TestHit, i, i, true) end") == 0);
+			UASSERTEQ(unsigned int, batcher.Flush(), 3);
+		}
+		UASSERTEQ(size_t, m_actors.size(), 30);
+
+		m_actors.clear();
+		m_damage.clear();
+		UASSERT(pState->DoString(
+			"for i = 1, 1000 do\n"
+			"  FireEvent(EventType.TestHit, i, -i, false)\n"
+			"  FireEvent(EventType.TestDied, i)\n"
+			"end") == 0);
+		UASSERTEQ(unsigned int, batcher.Flush(), 2000);
+		UASSERTEQ(int, m_calls, 11);
+		UASSERTEQ(size_t, m_actors.size(), 1000);
+		for (int i = 0; i < 1000; i++) {
+			UASSERTEQ(long long, m_actors[i], i + 1);
+			UASSERTEQ(double, m_damage[i], -(i + 1));
+		}
+	}
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestScriptEvents::testSlotMap()
+{
+	SlotMap<std::string> slots;
+	SlotMap<std::string>::Handle first = slots.Insert("first");
+	SlotMap<std::string>::Handle second = slots.Insert("second");
+	UASSERT(first != 0 && second != 0 && first != second);
+	UASSERTEQ(size_t, slots.Size(), 2);
+	UASSERTEQ(std::string, *slots.Get(first), "first");
+	UASSERT(!slots.Get(0));
+
+	// a stale handle resolves to nothing, even once its slot is reused
+	UASSERT(slots.Remove(first));
+	UASSERT(!slots.Remove(first));
+	UASSERT(!slots.Get(first));
+	SlotMap<std::string>::Handle third = slots.Insert("third");
+	UASSERTEQ(uint32_t, SlotMap<std::string>::HandleIndex(third), SlotMap<std::string>::HandleIndex(first));
+	UASSERT(third != first);
+	UASSERT(!slots.Get(first));
+	UASSERTEQ(std::string, *slots.Get(third), "third");
+
+	// freed slots are reused oldest first
+	std::vector<SlotMap<std::string>::Handle> handles;
+	for (int i = 0; i < 4; i++)
+		handles.push_back(slots.Insert(std::to_string(i)));
+	slots.Remove(handles[2]);
+	slots.Remove(handles[0]);
+	UASSERTEQ(uint32_t, SlotMap<std::string>::HandleIndex(slots.Insert("x")),
+		SlotMap<std::string>::HandleIndex(handles[2]));
+
+	int count = 0;
+	slots.ForEach([&count](SlotMap<std::string>::Handle handle, std::string &value) { count++; });
+	UASSERTEQ(int, count, (int)slots.Size());
+
+	slots.Clear();
+	UASSERT(slots.Empty());
+	UASSERT(!slots.Get(third));
+	UASSERT(slots.Insert("after") != third);
+}
+
+void TestScriptEvents::testListenerHandles()
+{
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	{
+		ScriptEventBatcher batcher(pState);
+		registerTestTypes(batcher, pState);
+
+		// stale and made-up handles remove nothing
+		UASSERT(pState->DoString(
+			"calls = 0\n"
+			"handles = {}\n"
+			"for i = 1, 100 do\n"
+			"  handles[i] = RegisterBatchListener(EventType.TestDied, function(batch) calls = calls + 1 end)\n"
+			"end\n"
+			"for i = 1, 100, 2 do assert(RemoveBatchListener(handles[i])) end\n"
+			"removedTwice = RemoveBatchListener(handles[1])\n"
+			"madeUp = RemoveBatchListener(123456789)\n"
+			"reused = RegisterBatchListener(EventType.TestDied, function(batch) calls = calls + 100 end)\n"
+			"staleAfterReuse = RemoveBatchListener(handles[1])\n"
+			"FireEvent(EventType.TestDied, 1)\n") == 0);
+		UASSERT(!pState->GetGlobal("removedTwice").GetBoolean());
+		UASSERT(!pState->GetGlobal("madeUp").GetBoolean());
+		UASSERT(!pState->GetGlobal("staleAfterReuse").GetBoolean());
+		UASSERTEQ(size_t, batcher.GetNumScriptListeners(), 51);
+
+		batcher.Flush();
+		UASSERTEQ(int, pState->GetGlobal("calls").GetInteger(), 150);
+
+		// listeners keep their order through removals
+		UASSERT(pState->DoString(
+			"order = ''\n"
+			"local h = {}\n"
+			"for i = 1, 6 do\n"
+			"  h[i] = RegisterBatchListener(EventType.TestHit, function(batch) order = order .. i end)\n"
+			"end\n"
+			"RemoveBatchListener(h[2]); RemoveBatchListener(h[3]); RemoveBatchListener(h[5])\n"
+			"FireEvent(EventType.TestHit, 1, 1, true)\n") == 0);
+		batcher.Flush();
+		UASSERTEQ(std::string, pState->GetGlobal("order").GetString(), "146");
+	}
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestScriptEvents::testModules()
+{
+	UASSERT(ScriptModule::IsModule("src.app.units.Archer", "app.units.Archer"));
+	UASSERT(ScriptModule::IsModule("app.units.Archer", "app.units.Archer"));
+	UASSERT(ScriptModule::IsModule("src.app.units.init", "app.units"));
+	UASSERT(!ScriptModule::IsModule("src.app.units.HorseArcher", "units.Archer"));
+	UASSERT(!ScriptModule::IsModule("src.app.units.Archer", "app.units"));
+	UASSERT(!ScriptModule::IsModule("", "app.units.Archer"));
+	UASSERT(!ScriptModule::IsModule("src.app.units.Archer", ""));
+
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	{
+		ScriptEventBatcher batcher(pState);
+		registerTestTypes(batcher, pState);
+		lua_State *L = pState->GetCState();
+
+		// loaded the way the cocos loader and luaL_loadfile name their chunks
+		const char *code =
+			"local function onDied(batch) calls = (calls or 0) + 1 end\n"
+			"for i = 1, 10 do RegisterBatchListener(EventType.TestDied, onDied) end\n"
+			"RegisterBatchListener(EventType.TestHit, function(batch) end)\n"
+			"return onDied\n";
+		UASSERT(luaL_loadbuffer(L, code, strlen(code), "src/app/units/Archer.lua") == 0);
+		UASSERT(lua_pcall(L, 0, 1, 0) == 0);
+		LuaPlus::LuaObject onDied(L, -1);
+		lua_pop(L, 1);
+		UASSERTEQ(std::string, ScriptModule::GetFunctionModule(onDied), "src.app.units.Archer");
+
+		UASSERT(luaL_loadbuffer(L, code, strlen(code), "@.\\src\\app\\units\\Knight.luac") == 0);
+		UASSERT(lua_pcall(L, 0, 0, 0) == 0);
+		UASSERT(pState->DoString("RegisterBatchListener(EventType.TestDied, function(batch) end)") == 0);
+		UASSERT(pState->DoString("anonymous = function() end") == 0);
+		UASSERTEQ(std::string, ScriptModule::GetFunctionModule(pState->GetGlobal("anonymous")), "");
+		UASSERTEQ(size_t, batcher.GetNumScriptListeners(), 23);
+		UASSERTEQ(int, lua_gettop(L), 0);
+
+		UASSERTEQ(unsigned int, batcher.RemoveModuleListeners("app.units.Archer"), 11);
+		UASSERTEQ(unsigned int, batcher.RemoveModuleListeners("app.units.Archer"), 0);
+		UASSERTEQ(size_t, batcher.GetNumScriptListeners(), 12);
+
+		// the other module still listens
+		UASSERT(pState->DoString("FireEvent(EventType.TestDied, 1)") == 0);
+		batcher.Flush();
+		UASSERTEQ(int, pState->GetGlobal("calls").GetInteger(), 10);
+
+		UASSERTEQ(unsigned int, batcher.RemoveModuleListeners("units.Knight"), 11);
+		UASSERTEQ(size_t, batcher.GetNumScriptListeners(), 1);
+	}
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestScriptEvents::benchScriptEvents()
+{
+	const int count = 100000;
+	const int frames = 10;
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	{
+		ScriptEventBatcher batcher(pState);
+		registerTestTypes(batcher, pState);
+		EventManager mgr("TestScriptEvents", false);
+
+		// the per-event path: a ScriptEvent holding a data table, a Lua call per event
+		s_bench_mgr = &mgr;
+		pState->GetGlobals().Register("QueueEvent", &benchQueueEvent);
+		UASSERT(pState->DoString(
+			"total = 0\n"
+			"function onHit(data) total = total + data.damage end\n"
+			"function onHitBatch(batch)\n"
+			"  local damage = batch.damage\n"
+			"  for i = 1, batch.count do total = total + damage[i] end\n"
+			"end\n"
+			"RegisterBatchListener(EventType.TestHit, onHitBatch)\n"
+			"function fireLegacy(n)\n"
+			"  for i = 1, n do QueueEvent(EventType.TestHit, { actor = i, damage = 1, critical = false }) end\n"
+			"end\n"
+			"function fireBatched(n)\n"
+			"  for i = 1, n do FireEvent(EventType.TestHit, i, 1, false) end\n"
+			"end\n") == 0);
+		m_callback = pState->GetGlobal("onHit");
+		mgr.VAddListener(fastdelegate::MakeDelegate(this, &TestScriptEvents::onLegacyHit), TEST_EVENT_HIT);
+
+		LuaPlus::LuaObject fireLegacyObject = pState->GetGlobal("fireLegacy");
+		LuaPlus::LuaObject fireBatchedObject = pState->GetGlobal("fireBatched");
+		LuaPlus::LuaFunction<int> fireLegacy = fireLegacyObject;
+		LuaPlus::LuaFunction<int> fireBatched = fireBatchedObject;
+
+		uint64_t t1 = getTimeNs();
+		for (int frame = 0; frame < frames; frame++) {
+			fireLegacy(count);
+			mgr.VUpdate();
+		}
+		uint64_t legacy_ns = getTimeNs() - t1;
+		UASSERTEQ(double, pState->GetGlobal("total").GetNumber(), (double)count * frames);
+
+		pState->GetGlobals().SetNumber("total", 0);
+		t1 = getTimeNs();
+		for (int frame = 0; frame < frames; frame++) {
+			fireBatched(count);
+			batcher.Flush();
+		}
+		uint64_t batched_ns = getTimeNs() - t1;
+		UASSERTEQ(double, pState->GetGlobal("total").GetNumber(), (double)count * frames);
+
+		rawstream << "    " << count << " events per frame from Lua to a Lua listener:" << std::endl;
+		rawstream << "    QueueEvent: " << legacy_ns / frames / 1000 << " us/frame, "
+			<< legacy_ns / frames / count << " ns/event" << std::endl;
+		rawstream << "    FireEvent:  " << batched_ns / frames / 1000 << " us/frame, "
+			<< batched_ns / frames / count << " ns/event ("
+			<< (double)legacy_ns / batched_ns << "x faster)" << std::endl;
+		m_callback.Reset();
+	}
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestScriptEvents::benchListenerChurn()
+{
+	const int count = 100000;
+	const int live = 1000;
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	{
+		ScriptEventBatcher batcher(pState);
+		registerTestTypes(batcher, pState);
+
+		// short-lived listeners over a steady set of live ones
+		UASSERT(pState->DoString(
+			"function onDied(batch) end\n"
+			"function churn(live, count)\n"
+			"  local handles = {}\n"
+			"  for i = 1, live do handles[i] = RegisterBatchListener(EventType.TestDied, onDied) end\n"
+			"  for i = 1, count do\n"
+			"    local slot = i % live + 1\n"
+			"    RemoveBatchListener(handles[slot])\n"
+			"    handles[slot] = RegisterBatchListener(EventType.TestDied, onDied)\n"
+			"  end\n"
+			"end\n") == 0);
+		LuaPlus::LuaObject churnObject = pState->GetGlobal("churn");
+		LuaPlus::LuaFunction<int> churn = churnObject;
+
+		uint64_t t1 = getTimeNs();
+		churn(live, count);
+		uint64_t churn_ns = getTimeNs() - t1;
+		UASSERTEQ(size_t, batcher.GetNumScriptListeners(), (size_t)live);
+
+		rawstream << "    " << count << " listener removals and adds with " << live << " live: "
+			<< churn_ns / count << " ns per pair" << std::endl;
+	}
+	LuaPlus::LuaState::Destroy(pState);
+}
@@ -0,0 +1,322 @@
+#include "unittest/test.h"
+#include "LUAScripting/ScriptProfiler.h"
+#include "settings.h"
+#include "log.h"
+#include "utils/time_utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+class TestScriptProfiler :public TestBase {
+public:
+	TestScriptProfiler() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestScriptProfiler"; }
+
+	void runTests();
+
+	void testSampling();
+	void testFoldedStacks();
+	void testExports();
+	void testScriptFunctions();
+	void benchProfilerOverhead();
+};
+
+static TestScriptProfiler g_test_instance;
+
+void TestScriptProfiler::runTests()
+{
+	TEST(testSampling);
+	TEST(testFoldedStacks);
+	TEST(testExports);
+	TEST(testScriptFunctions);
+
+	if (g_settings->getFlag("unittest_benchmark")) {
+		TEST(benchProfilerOverhead);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// hot() does most of the work, on line 4
+const char *s_workload =
+	"function hot(n)\n"
+	"  local sum = 0\n"
+	"  for i = 1, n do\n"
+	"    sum = sum + math.sin(i) * i\n"
+	"  end\n"
+	"  return sum\n"
+	"end\n"
+	"function cold(n)\n"
+	"  local sum = 0\n"
+	"  for i = 1, n do sum = sum + i end\n"
+	"  return sum\n"
+	"end\n"
+	"function outer(n)\n"
+	"  return hot(n) + cold(n / 20)\n"
+	"end\n"
+	"function recurse(depth, n)\n"
+	"  local sum = depth == 0 and hot(n) or recurse(depth - 1, n)\n"
+	"  return sum\n"
+	"end\n"
+	"function tail(n)\n"
+	"  return hot(n)\n"
+	"end\n";
+
+bool loadWorkload(LuaPlus::LuaState *pState)
+{
+	lua_State *L = pState->GetCState();
+	return luaL_loadbuffer(L, s_workload, strlen(s_workload), "@profile_test.lua") == 0 && lua_pcall(L, 0, 0, 0) == 0;
+}
+
+bool run(LuaPlus::LuaState *pState, const char *code)
+{
+	lua_State *L = pState->GetCState();
+	return luaL_loadbuffer(L, code, strlen(code), "@profile_run.lua") == 0 && lua_pcall(L, 0, 0, 0) == 0;
+}
+
+const ScriptProfiler::FunctionStats *findFunction(const std::vector<ScriptProfiler::FunctionStats> &stats,
+	const std::string &prefix)
+{
+	for (size_t i = 0; i < stats.size(); i++) {
+		if (stats[i].name.compare(0, prefix.size(), prefix) == 0)
+			return &stats[i];
+	}
+	return nullptr;
+}
+
+void spin(uint64_t ns)
+{
+	uint64_t end = getTimeNs() + ns;
+	while (getTimeNs() < end)
+		;
+}
+
+// an export spending 200 us of its own around an optional Lua callback
+int slowExport(lua_State *L)
+{
+	SCRIPT_PROFILE_EXPORT("TestSlowExport");
+	spin(100000);
+	if (lua_isfunction(L, 1)) {
+		lua_pushvalue(L, 1);
+		lua_call(L, 0, 0);
+	}
+	spin(100000);
+	return 0;
+}
+
+}
+
+void TestScriptProfiler::testSampling()
+{
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	{
+		ScriptProfiler profiler(pState);
+		UASSERT(loadWorkload(pState));
+
+		UASSERT(profiler.Start(100));
+		UASSERT(profiler.IsRunning());
+		UASSERT(ScriptProfiler::GetActive() == &profiler);
+
+		// a second profiler cannot take the hook
+		ScriptProfiler other(pState);
+		UASSERT(!other.Start(100));
+
+		UASSERT(run(pState, "for i = 1, 20 do outer(5000) end\nrecurse(10, 20000)\ntail(20000)\n"));
+		profiler.Stop();
+		UASSERT(!profiler.IsRunning());
+		UASSERT(ScriptProfiler::GetActive() == nullptr);
+		UASSERT(profiler.GetNumSamples() > 100);
+
+		std::vector<ScriptProfiler::FunctionStats> stats = profiler.GetFunctionStats();
+		const ScriptProfiler::FunctionStats *pHot = findFunction(stats, "hot@profile_test.lua:1");
+		const ScriptProfiler::FunctionStats *pCold = findFunction(stats, "cold@profile_test.lua:8");
+		const ScriptProfiler::FunctionStats *pOuter = findFunction(stats, "outer@profile_test.lua:13");
+		const ScriptProfiler::FunctionStats *pRecurse = findFunction(stats, "recurse@profile_test.lua:16");
+		UASSERT(pHot && pOuter && pRecurse);
+
+		// hot() has the most self time; the callers have little of their own
+		UASSERT(stats[0].name == pHot->name);
+		UASSERT(!pCold || pCold->selfNs < pHot->selfNs);
+		UASSERT(pOuter->totalNs >= pOuter->selfNs);
+		UASSERT(pOuter->totalNs > pOuter->selfNs * 4);
+		UASSERT(pHot->totalNs == pHot->selfNs);
+
+		// recursion counts once per sample
+		UASSERT(pRecurse->totalNs <= profiler.GetLuaNs());
+		UASSERT(pRecurse->totalNs > pRecurse->selfNs * 4);
+
+		// a tail call leaves a frame without its caller
+		const ScriptProfiler::FunctionStats *pTail = findFunction(stats, "[tail]");
+		UASSERT(pTail && pTail->totalNs > 0 && pTail->selfNs == 0);
+
+		// the loop body is the hottest line
+		std::vector<ScriptProfiler::LineStats> lines = profiler.GetLineStats();
+		UASSERT(!lines.empty());
+		UASSERTEQ(std::string, profiler.GetFunctionName(lines[0].function), pHot->name);
+		UASSERT(lines[0].line >= 3 && lines[0].line <= 5);
+
+		// nothing sampled while stopped
+		uint64_t samples = profiler.GetNumSamples();
+		UASSERT(run(pState, "outer(50000)\n"));
+		UASSERTEQ(uint64_t, profiler.GetNumSamples(), samples);
+
+		profiler.Reset();
+		UASSERTEQ(uint64_t, profiler.GetNumSamples(), 0);
+		UASSERT(profiler.GetFunctionStats().empty());
+	}
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestScriptProfiler::testFoldedStacks()
+{
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	{
+		ScriptProfiler profiler(pState);
+		UASSERT(loadWorkload(pState));
+		UASSERT(profiler.Start(100));
+		UASSERT(run(pState, "for i = 1, 20 do outer(5000) end\n"));
+		profiler.Stop();
+
+		const std::string path = "test_script_profiler.folded";
+		UASSERT(profiler.WriteFoldedStacks(path));
+
+		// "outer;...;inner microseconds", the sum of all lines is the Lua time less the stacks under a microsecond
+		std::ifstream is(path.c_str());
+		std::string line;
+		bool foundHot = false;
+		uint64_t totalUs = 0;
+		int numLines = 0;
+		while (std::getline(is, line)) {
+			numLines++;
+			size_t space = line.rfind(' ');
+			UASSERT(space != std::string::npos && space > 0);
+			UASSERT(line.find(' ') == space);
+			totalUs += std::stoull(line.substr(space + 1));
+			if (line.compare(0, space, "main@profile_run.lua;outer@profile_test.lua:13;hot@profile_test.lua:1") == 0)
+				foundHot = true;
+		}
+		is.close();
+		std::remove(path.c_str());
+
+		UASSERT(numLines > 0);
+		UASSERT(foundHot);
+		UASSERT(totalUs <= profiler.GetLuaNs() / 1000);
+		UASSERT(totalUs >= profiler.GetLuaNs() / 1000 * 9 / 10);
+	}
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestScriptProfiler::testExports()
+{
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	{
+		ScriptProfiler profiler(pState);
+		UASSERT(loadWorkload(pState));
+		lua_register(pState->GetCState(), "SlowExport", &slowExport);
+
+		// not measured without a running profiler
+		UASSERT(run(pState, "SlowExport()\n"));
+		UASSERT(profiler.GetExportStats().empty());
+
+		UASSERT(profiler.Start(100));
+		uint64_t start = getTimeNs();
+		UASSERT(run(pState,
+			"for i = 1, 5 do SlowExport() end\n"
+			"for i = 1, 5 do SlowExport(function() hot(20000) end) end\n"));
+		uint64_t elapsed = getTimeNs() - start;
+		profiler.Stop();
+
+		std::vector<ScriptProfiler::ExportStats> exports = profiler.GetExportStats();
+		UASSERTEQ(size_t, exports.size(), 1);
+		UASSERTEQ(std::string, exports[0].name, "TestSlowExport");
+		UASSERTEQ(uint64_t, exports[0].calls, 10);
+
+		// 5 x 200 us of its own, and at least the 100 us after the callback of the others: the time before the callback
+		// may go to the first sample in it
+		UASSERT(exports[0].selfNs >= 1500000);
+		UASSERT(exports[0].selfNs < elapsed);
+		UASSERTEQ(uint64_t, profiler.GetExportNs(), exports[0].selfNs);
+
+		// and not in the Lua time, which has the callback
+		UASSERT(profiler.GetLuaNs() + profiler.GetExportNs() <= elapsed);
+		std::vector<ScriptProfiler::FunctionStats> stats = profiler.GetFunctionStats();
+		const ScriptProfiler::FunctionStats *pHot = findFunction(stats, "hot@profile_test.lua:1");
+		UASSERT(pHot && pHot->selfNs > 0);
+	}
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestScriptProfiler::testScriptFunctions()
+{
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	{
+		ScriptProfiler profiler(pState);
+		profiler.RegisterScriptFunctions(pState->GetGlobals());
+		UASSERT(loadWorkload(pState));
+
+		const std::string path = "test_script_profiler_lua.folded";
+		UASSERT(run(pState,
+			"assert(StartProfiler(100))\n"
+			"for i = 1, 10 do outer(5000) end\n"
+			"assert(StopProfiler('test_script_profiler_lua.folded'))\n"
+			"stats = GetProfilerStats()\n"
+			"top = stats.functions[1].name\n"));
+		UASSERT(!profiler.IsRunning());
+		UASSERT(profiler.GetNumSamples() > 0);
+
+		LuaPlus::LuaObject stats = pState->GetGlobal("stats");
+		UASSERTEQ(double, stats.GetByName("samples").GetNumber(), (double)profiler.GetNumSamples());
+		UASSERT(stats.GetByName("luaUs").GetNumber() > 0);
+		UASSERTEQ(std::string, pState->GetGlobal("top").GetString(), "hot@profile_test.lua:1");
+
+		std::ifstream is(path.c_str());
+		UASSERT(is.good());
+		is.close();
+		std::remove(path.c_str());
+
+		// starting again forgets the last run
+		UASSERT(run(pState, "StartProfiler()\nStopProfiler()\n"));
+		UASSERT(profiler.GetNumSamples() < 10);
+	}
+	LuaPlus::LuaState::Destroy(pState);
+}
+
+void TestScriptProfiler::benchProfilerOverhead()
+{
+	const char *code = "for i = 1, 200 do outer(5000) end\n";
+	const int rounds = 9;
+	LuaPlus::LuaState *pState = LuaPlus::LuaState::Create(true);
+	{
+		ScriptProfiler profiler(pState);
+		UASSERT(loadWorkload(pState));
+		UASSERT(run(pState, code));
+
+		// the best of a few rounds each, alternated
+		uint64_t plainNs = UINT64_MAX;
+		uint64_t profiledNs = UINT64_MAX;
+		for (int round = 0; round < rounds; round++) {
+			uint64_t start = getTimeNs();
+			UASSERT(run(pState, code));
+			plainNs = (std::min)(plainNs, getTimeNs() - start);
+
+			UASSERT(profiler.Start());
+			start = getTimeNs();
+			UASSERT(run(pState, code));
+			profiledNs = (std::min)(profiledNs, getTimeNs() - start);
+			profiler.Stop();
+		}
+
+		rawstream << "    Lua profiler, a sample every " << (int)ScriptProfiler::kDefaultInterval << " instructions: "
+			<< plainNs / 1000 << " us without, " << profiledNs / 1000 << " us with, overhead "
+			<< (double)((int64_t)profiledNs - (int64_t)plainNs) * 100.0 / plainNs << "%, "
+			<< profiler.GetNumSamples() << " samples" << std::endl;
+	}
+	LuaPlus::LuaState::Destroy(pState);
+}
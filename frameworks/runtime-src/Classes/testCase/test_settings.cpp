@@ -1,6 +1,17 @@
 #include "unittest/test.h"
 #include "settings.h"
+#include "settings_reload.h"
 #include "debug.h"
+#include "filesys.h"
+#include "utils/time_utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <vector>
 
 class TestSettings:public TestBase {
 public:
@@ -12,6 +23,13 @@ public:
     void testAllSettings();
     void testDefaults();
     void testFlagDesc();
+    void testHandles();
+    void testHandlesThreaded();
+    void benchHandles();
+    void testReload();
+    void benchReload();
+    void testBufferParser();
+    void benchParser();
     
     static const char *config_text_before;
     static const std::string config_text_after;
@@ -24,6 +42,16 @@ void TestSettings::runTests()
 	TEST(testAllSettings);
 // 	TEST(testDefaults);
 // 	TEST(testFlagDesc);
+	TEST(testHandles);
+	TEST(testHandlesThreaded);
+	TEST(testReload);
+	TEST(testBufferParser);
+
+	if (g_settings->getFlag("unittest_benchmark")) {
+		TEST(benchHandles);
+		TEST(benchReload);
+		TEST(benchParser);
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -251,3 +279,344 @@ void TestSettings::testFlagDesc()
 
 	delete &s;
 }
+
+void TestSettings::testHandles()
+{
+	Settings s;
+	s.set("speed", "2.5");
+	s.set("count", "70000");
+	s.set("enabled", "true");
+
+	SettingHandle<float> speed(&s, "speed", 1.0f);
+	SettingHandle<uint16_t> count(&s, "count");
+	SettingHandle<bool> enabled(&s, "enabled");
+	SettingHandle<int32_t> missing(&s, "missing", -1);
+
+	UASSERT(speed.exists());
+	UASSERTEQ(float, speed.get(), 2.5f);
+	UASSERTEQ(uint16_t, count.get(), 65535);
+	UASSERT(enabled.get());
+	UASSERT(!missing.exists());
+	UASSERTEQ(int32_t, missing.get(), -1);
+
+	// changes reach the handles
+	s.setFloat("speed", 4.0f);
+	UASSERTEQ(float, speed.get(), 4.0f);
+	s.set("missing", "-12");
+	UASSERT(missing.exists());
+	UASSERTEQ(int32_t, missing, -12);
+	s.set("missing", "many");
+	UASSERT(!missing.exists());
+	UASSERTEQ(int32_t, missing.get(), -1);
+	s.remove("speed");
+	UASSERT(!speed.exists());
+	UASSERTEQ(float, speed.get(), 1.0f);
+
+	// files do not call back
+	std::istringstream is("speed = 8\n");
+	s.parseConfigLines(is);
+	UASSERTEQ(float, speed.get(), 1.0f);
+	speed.refresh();
+	UASSERTEQ(float, speed.get(), 8.0f);
+
+	// a handle on a layer follows the layers below it
+	Settings *def = Settings::getLayer(SL_DEFAULTS);
+	bool own_defaults = !def;
+	if (own_defaults)
+		def = Settings::createLayer(SL_DEFAULTS);
+	{
+		def->set("test_handle_default", "3");
+		SettingHandle<int32_t> layered(g_settings, "test_handle_default");
+		UASSERTEQ(int32_t, layered.get(), 3);
+		def->set("test_handle_default", "4");
+		UASSERTEQ(int32_t, layered.get(), 4);
+		g_settings->set("test_handle_default", "5");
+		UASSERTEQ(int32_t, layered.get(), 5);
+		// the global value still hides the default
+		def->set("test_handle_default", "6");
+		UASSERTEQ(int32_t, layered.get(), 5);
+		g_settings->remove("test_handle_default");
+		UASSERTEQ(int32_t, layered.get(), 6);
+		def->remove("test_handle_default");
+	}
+	if (own_defaults)
+		delete def;
+}
+
+void TestSettings::testHandlesThreaded()
+{
+	const int num_threads = 4;
+	const int count = 2000;
+	Settings s;
+	s.setS32("frame", 0);
+	SettingHandle<int32_t> frame(&s, "frame");
+
+	// readers never see a value go back
+	std::atomic<bool> done(false);
+	std::atomic<int> backwards(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t != num_threads; t++) {
+		threads.push_back(std::thread([&frame, &done, &backwards]() {
+			int32_t last = 0;
+			while (!done.load()) {
+				int32_t v = frame.get();
+				if (v < last)
+					backwards++;
+				last = v;
+			}
+		}));
+	}
+	for (int i = 1; i <= count; i++)
+		s.setS32("frame", i);
+	done = true;
+	for (auto it = threads.begin(); it != threads.end(); ++it)
+		it->join();
+
+	UASSERTEQ(int, backwards.load(), 0);
+	UASSERTEQ(int32_t, frame.get(), count);
+}
+
+void TestSettings::benchHandles()
+{
+	const int num_threads = 4;
+	const int count = 1000000;
+	g_settings->setFloat("test_handle_bench", 1.5f);
+	SettingHandle<float> handle(g_settings, "test_handle_bench");
+
+	for (int mode = 0; mode != 2; mode++) {
+		std::vector<std::thread> threads;
+		uint64_t t1 = getTimeNs();
+		for (int t = 0; t != num_threads; t++) {
+			threads.push_back(std::thread([mode, count, &handle]() {
+				float sum = 0.0f;
+				for (int i = 0; i != count; i++)
+					sum += mode == 0 ? g_settings->getFloat("test_handle_bench") : handle.get();
+				volatile float sink = sum;
+				(void)sink;
+			}));
+		}
+		for (auto it = threads.begin(); it != threads.end(); ++it)
+			it->join();
+		uint64_t ns = getTimeNs() - t1;
+		rawstream << "    " << (mode == 0 ? "getFloat():    " : "SettingHandle: ")
+			<< (double)ns / ((uint64_t)num_threads * count) << " ns/read, "
+			<< num_threads << " threads" << std::endl;
+	}
+	g_settings->remove("test_handle_bench");
+}
+
+namespace {
+
+void writeSettingsFile(const std::string &path, const std::string &text)
+{
+	std::ofstream os(path.c_str(), std::ios::binary | std::ios::trunc);
+	os << text;
+}
+
+// Applies reloads until one changed something, false after timeout_ms
+size_t waitForReload(SettingsReloader &reloader, int timeout_ms)
+{
+	for (int waited = 0; waited < timeout_ms; waited += 5) {
+		if (size_t count = reloader.update())
+			return count;
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	return 0;
+}
+
+void countCallback(const std::string &name, void *data)
+{
+	(*(std::map<std::string, int> *)data)[name]++;
+}
+
+}
+
+void TestSettings::testReload()
+{
+	std::string path = fs::TempPath() + DIR_DELIM "test_settings_reload.txt";
+
+	for (int polling = 0; polling != 2; polling++) {
+		writeSettingsFile(path, "a = 1\nb = 2\nc = 3\ngrp = {\n\tx = 1\n}\n");
+		Settings s;
+		UASSERT(s.readConfigFile(path.c_str()));
+		s.set("b", "20");			// set at runtime, overrides the file
+		s.set("runtime", "yes");	// never in the file
+
+		std::map<std::string, int> calls;
+		const char *names[] = { "a", "b", "c", "d", "grp", "runtime" };
+		for (const char *name : names)
+			s.registerChangedCallback(name, countCallback, &calls);
+		SettingHandle<int32_t> value_a(&s, "a");
+
+		SettingsReloader reloader(&s, path);
+		UASSERT(reloader.start(10, polling != 0));
+		UASSERTEQ(size_t, reloader.update(), 0);
+
+		// changed, added and unchanged keys, a changed group
+		writeSettingsFile(path, "a = 5\nb = 2\nc = 3\nd = 4\ngrp = {\n\tx = 2\n}\n");
+		UASSERTEQ(size_t, waitForReload(reloader, 5000), 3);
+		UASSERTEQ(int32_t, value_a.get(), 5);
+		UASSERTEQ(std::string, s.get("b"), "20");
+		UASSERTEQ(std::string, s.get("d"), "4");
+		UASSERTEQ(std::string, s.getGroup("grp")->get("x"), "2");
+		UASSERTEQ(int, calls["a"], 1);
+		UASSERTEQ(int, calls["b"], 0);
+		UASSERTEQ(int, calls["c"], 0);
+		UASSERTEQ(int, calls["d"], 1);
+		UASSERTEQ(int, calls["grp"], 1);
+
+		// the file changes the overridden key, c is removed
+		writeSettingsFile(path, "a = 5\nb = 7\nd = 4\ngrp = {\n\tx = 2\n}\n");
+		UASSERTEQ(size_t, waitForReload(reloader, 5000), 2);
+		UASSERTEQ(std::string, s.get("b"), "7");
+		UASSERT(!s.exists("c"));
+		UASSERTEQ(int, calls["c"], 1);
+		UASSERTEQ(std::string, s.get("runtime"), "yes");
+		UASSERTEQ(int, calls["runtime"], 0);
+
+		// a broken file changes nothing
+		writeSettingsFile(path, "a = 6\ngrp = {\n\tx = 3\n");
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		UASSERTEQ(size_t, reloader.update(), 0);
+		UASSERTEQ(int32_t, value_a.get(), 5);
+
+		reloader.stop();
+		UASSERT(!reloader.isRunning());
+	}
+
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+}
+
+void TestSettings::benchReload()
+{
+	const int num_keys = 5000;
+	std::string path = fs::TempPath() + DIR_DELIM "test_settings_reload_bench.txt";
+
+	auto generate = [num_keys](int changed, int value) {
+		std::ostringstream os;
+		for (int i = 0; i != num_keys; i++)
+			os << "unit_" << i << "_speed = " << (i < changed ? value : i) << "\n";
+		return os.str();
+	};
+
+	writeSettingsFile(path, generate(0, 0));
+	Settings s;
+	s.readConfigFile(path.c_str());
+	SettingsReloader reloader(&s, path);
+	reloader.start(10);
+
+	const int changes[] = { 10, num_keys };
+	for (int c = 0; c != 2; c++) {
+		writeSettingsFile(path, generate(changes[c], -1 - c));
+		uint32_t reloads = reloader.getReloadCount();
+		uint64_t t1 = getTimeUs();
+		while (reloader.getReloadCount() == reloads && getTimeUs() - t1 < 5000000)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		uint64_t t2 = getTimeUs();
+		size_t count = reloader.update();
+		uint64_t t3 = getTimeUs();
+		UASSERTEQ(size_t, count, (size_t)changes[c]);
+		rawstream << "    " << num_keys << " keys, " << count << " changed: read after "
+			<< (t2 - t1) / 1000 << "ms, update() on the main thread " << (t3 - t2) << "us" << std::endl;
+	}
+
+	reloader.stop();
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+}
+
+void TestSettings::testBufferParser()
+{
+	// the same settings as read from a stream
+	Settings lines("[dummy_eof_end_tag]");
+	std::istringstream is(config_text_before);
+	UASSERT(lines.parseConfigLines(is));
+
+	Settings buffer("[dummy_eof_end_tag]");
+	std::string text = config_text_before;
+	UASSERT(buffer.parseConfigBuffer(text.data(), text.size()));
+	compare_settings("(lines)", &lines, &buffer);
+	compare_settings("(buffer)", &buffer, &lines);
+	UASSERTEQ(std::string, buffer.getGroup("asdf")->get("ccc"), "testy\n   testa   ");
+	UASSERTEQ(std::string, buffer.get("blarg"), "some multiline text\n     with leading whitespace!");
+
+	// Windows line breaks read like a file in text mode
+	std::string crlf;
+	for (char c : text) {
+		if (c == '\n')
+			crlf.push_back('\r');
+		crlf.push_back(c);
+	}
+	Settings windows("[dummy_eof_end_tag]");
+	UASSERT(windows.parseConfigBuffer(crlf.data(), crlf.size()));
+	compare_settings("(crlf)", &windows, &lines);
+	compare_settings("(lines)", &lines, &windows);
+
+	// end of text without a line break, missing end tags
+	Settings last;
+	std::string no_break = "a = 1\nmulti = \"\"\"\nx\ny";
+	UASSERT(last.parseConfigBuffer(no_break.data(), no_break.size()));
+	UASSERTEQ(std::string, last.get("a"), "1");
+	UASSERTEQ(std::string, last.get("multi"), "x\ny");
+	Settings open_group;
+	std::string unterminated = "a = 1\ngrp = {\n\tb = 2\n";
+	UASSERT(!open_group.parseConfigBuffer(unterminated.data(), unterminated.size()));
+	UASSERT(!open_group.exists("grp"));
+	Settings empty;
+	UASSERT(empty.parseConfigBuffer(nullptr, 0));
+	UASSERT(empty.getNames().empty());
+
+	// from a file
+	std::string path = fs::TempPath() + DIR_DELIM "test_settings_parser.txt";
+	writeSettingsFile(path, "x = 1\ngrp = {\n\ty = 2\n}\n");
+	Settings file;
+	UASSERT(file.readConfigFile(path.c_str()));
+	UASSERTEQ(std::string, file.getGroup("grp")->get("y"), "2");
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+	UASSERT(!file.readConfigFile(path.c_str()));
+}
+
+void TestSettings::benchParser()
+{
+	// a generated balance file: grouped unit definitions and flat tables
+	std::string path = fs::TempPath() + DIR_DELIM "test_settings_parser_bench.txt";
+	std::ostringstream os;
+	int units = 0;
+	while (os.tellp() < 10 * 1024 * 1024) {
+		os << "# unit " << units << "\n"
+			<< "unit_" << units << " = {\n"
+			<< "\tname = Unit " << units << "\n"
+			<< "\thp = " << 100 + units % 900 << "\n"
+			<< "\tspeed = " << 1.0f + (units % 50) * 0.05f << "\n"
+			<< "\tcost = (" << units % 7 << ", " << units % 11 << ", " << units % 13 << ")\n"
+			<< "\tdescription = \"\"\"\n"
+			<< "A generated unit\n"
+			<< "\tof the " << units % 5 << "th kind\n"
+			<< "\"\"\"\n"
+			<< "}\n";
+		for (int k = 0; k != 8; k++)
+			os << "balance_" << units << "_" << k << " = " << (units * 31 + k) % 1000 << "\n";
+		units++;
+	}
+	writeSettingsFile(path, os.str());
+	double mb = (double)os.str().size() / (1024 * 1024);
+
+	uint64_t t1 = getTimeUs();
+	Settings lines;
+	std::ifstream is(path.c_str());
+	UASSERT(lines.parseConfigLines(is));
+	uint64_t t2 = getTimeUs();
+	Settings mapped;
+	UASSERT(mapped.readConfigFile(path.c_str()));
+	uint64_t t3 = getTimeUs();
+
+	UASSERTEQ(size_t, mapped.getNames().size(), lines.getNames().size());
+	UASSERTEQ(std::string, mapped.getGroup("unit_7")->get("description"), "A generated unit\n\tof the 2th kind");
+
+	rawstream << "    " << mb << " MB, " << units << " groups, " << mapped.getNames().size() << " entries" << std::endl;
+	rawstream << "    parseConfigLines: " << (t2 - t1) / 1000 << "ms, "
+		<< mb * 1000000 / std::max<uint64_t>(t2 - t1, 1) << " MB/s" << std::endl;
+	rawstream << "    readConfigFile:   " << (t3 - t2) / 1000 << "ms, "
+		<< mb * 1000000 / std::max<uint64_t>(t3 - t2, 1) << " MB/s" << std::endl;
+
+	fs::DeleteSingleFileOrEmptyDirectory(path);
+}
@@ -0,0 +1,385 @@
+#include "unittest/test.h"
+#include "components/steeringsystem.h"
+#include "math2d/batchtransform.h"
+#include "threading/job_system.h"
+#include "settings.h"
+#include "log.h"
+#include "utils/time_utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+class TestSteering :public TestBase {
+public:
+	TestSteering() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestSteering"; }
+
+	void runTests();
+
+	void testBehaviorNames();
+	void testSeekFleeArrive();
+	void testPursuitAndWander();
+	void testFlocking();
+	void testWallAvoidance();
+	void testLanesAndThreads();
+	void benchSteering();
+};
+
+static TestSteering g_test_instance;
+
+void TestSteering::runTests()
+{
+	TEST(testBehaviorNames);
+	TEST(testSeekFleeArrive);
+	TEST(testPursuitAndWander);
+	TEST(testFlocking);
+	TEST(testWallAvoidance);
+	TEST(testLanesAndThreads);
+
+	if (g_settings->getFlag("unittest_benchmark")) {
+		TEST(benchSteering);
+	}
+
+	SetBatchSimdLevel(GetBestBatchSimdLevel());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// a world with one steering system, updated 100ms at a time
+struct World
+{
+	ComponentManager components;
+	SteeringSystem *system;
+
+	explicit World(const SteeringSettings &settings = SteeringSettings())
+	{
+		system = new SteeringSystem(settings);
+		components.AddSystem(std::unique_ptr<ComponentSystem>(system));
+	}
+
+	SteeringComponent &add(ActorId id, const Vector2D &position, uint32_t behaviors)
+	{
+		components.AddComponent<TransformComponent>(id, position, 0.0);
+		SteeringComponent &steering = components.AddComponent<SteeringComponent>(id);
+		steering.behaviors = behaviors;
+		steering.maxForce = 10000;
+		return steering;
+	}
+
+	SteeringComponent &steering(ActorId id) { return *components.GetComponent<SteeringComponent>(id); }
+	TransformComponent &transform(ActorId id) { return *components.GetComponent<TransformComponent>(id); }
+
+	void update(int frames = 1)
+	{
+		for (int f = 0; f < frames; f++)
+			components.update(100.0f);
+	}
+};
+
+bool near(double value, double expected, double tolerance = 0.0001)
+{
+	return fabs(value - expected) <= tolerance;
+}
+
+// agents with every behaviour, some without a transform
+void addCrowd(World &world, size_t count, uint32_t seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> coord(0.0, 1000.0);
+	std::uniform_real_distribution<double> speed(-50.0, 50.0);
+	std::uniform_int_distribution<uint32_t> behaviors(0, (STEER_WALL_AVOIDANCE << 1) - 1);
+
+	for (ActorId id = 1; id <= count; id++) {
+		if (id % 97 == 0) {
+			world.components.AddComponent<SteeringComponent>(id);
+			continue;
+		}
+		SteeringComponent &steering = world.add(id, Vector2D(coord(rng), coord(rng)), behaviors(rng));
+		steering.maxForce = 200;
+		steering.velocity = Vector2D(speed(rng), speed(rng));
+		steering.heading = Vec2DNormalize(steering.velocity);
+		steering.target = Vector2D(coord(rng), coord(rng));
+		steering.evader = 1 + rng() % (ActorId)count;
+		steering.mass = 1.0f + (float)(id % 3);
+	}
+}
+
+bool sameVector(const Vector2D &v1, const Vector2D &v2, double tolerance)
+{
+	return tolerance ? Vec2DDistance(v1, v2) <= tolerance : (v1.x == v2.x && v1.y == v2.y);
+}
+
+// the same bits without a tolerance
+bool sameComponents(World &world1, World &world2, double tolerance = 0)
+{
+	ComponentPool<SteeringComponent> &pool1 = world1.components.GetPool<SteeringComponent>();
+	ComponentPool<SteeringComponent> &pool2 = world2.components.GetPool<SteeringComponent>();
+	if (pool1.Size() != pool2.Size())
+		return false;
+
+	for (size_t i = 0; i < pool1.Size(); i++) {
+		ActorId id = pool1.Actors()[i];
+		const SteeringComponent &s1 = pool1.Data()[i];
+		const SteeringComponent *s2 = pool2.Get(id);
+		if (!s2 || !sameVector(s1.velocity, s2->velocity, tolerance) || !sameVector(s1.heading, s2->heading, tolerance)
+				|| !sameVector(s1.wanderTarget, s2->wanderTarget, tolerance))
+			return false;
+
+		TransformComponent *t1 = world1.components.GetComponent<TransformComponent>(id);
+		TransformComponent *t2 = world2.components.GetComponent<TransformComponent>(id);
+		if (t1 && (!sameVector(t1->position, t2->position, tolerance) || fabs(t1->yaw - t2->yaw) > tolerance))
+			return false;
+	}
+	return true;
+}
+
+}
+
+void TestSteering::testBehaviorNames()
+{
+	UASSERTEQ(uint32_t, SteeringComponent::GetBehaviorFromName("seek"), STEER_SEEK);
+	UASSERTEQ(uint32_t, SteeringComponent::GetBehaviorFromName("wall_avoidance"), STEER_WALL_AVOIDANCE);
+	UASSERTEQ(uint32_t, SteeringComponent::GetBehaviorFromName("flocking"), STEER_FLOCKING);
+	UASSERTEQ(uint32_t, SteeringComponent::GetBehaviorFromName("hide"), 0);
+}
+
+void TestSteering::testSeekFleeArrive()
+{
+	World world;
+
+	// seek: full speed towards the target, 0.1s of a force of maxSpeed
+	world.add(1, Vector2D(0, 0), STEER_SEEK).target = Vector2D(500, 0);
+
+	// flee: away from targets within the panic distance only
+	world.add(2, Vector2D(100, 100), STEER_FLEE).target = Vector2D(100, 150);
+	world.add(3, Vector2D(100, 300), STEER_FLEE).target = Vector2D(100, 500);
+
+	// arrive: slows down to reach the target in arriveTime
+	world.add(4, Vector2D(200, 0), STEER_ARRIVE).target = Vector2D(203, 0);
+	world.add(5, Vector2D(300, 0), STEER_ARRIVE).target = Vector2D(300, 0);
+
+	// no behaviour: coasts
+	world.add(6, Vector2D(400, 0), 0).velocity = Vector2D(0, 10);
+
+	world.update();
+
+	UASSERT(near(world.steering(1).velocity.x, 10) && world.steering(1).velocity.y == 0);
+	UASSERT(near(world.transform(1).position.x, 1));
+	UASSERT(world.steering(1).heading == Vector2D(1, 0) && world.transform(1).yaw == 0);
+
+	UASSERT(world.steering(2).velocity.x == 0 && near(world.steering(2).velocity.y, -10));
+	UASSERT(near(world.transform(2).yaw, -Math<double>::HALF_PI));
+	UASSERT(world.steering(3).velocity.isZero());
+	UASSERT(world.transform(3).position == Vector2D(100, 300));
+
+	UASSERT(near(world.steering(4).velocity.x, 0.5));
+	UASSERT(world.steering(5).velocity.isZero());
+	UASSERT(world.steering(5).heading == Vector2D(1, 0));
+
+	UASSERT(world.steering(6).velocity == Vector2D(0, 10));
+	UASSERT(near(world.transform(6).position.y, 1));
+
+	// velocity and force stay within their limits
+	world.steering(1).maxForce = 20;
+	world.update(60);
+	UASSERT(world.steering(1).velocity.Length() <= 100.0001);
+	UASSERT(world.steering(1).velocity.Length() > 95);
+
+	World limited;
+	limited.add(1, Vector2D(0, 0), STEER_SEEK).target = Vector2D(500, 0);
+	limited.steering(1).maxForce = 20;
+	limited.steering(1).mass = 2;
+	limited.update();
+	UASSERT(near(limited.steering(1).velocity.x, 1));
+}
+
+void TestSteering::testPursuitAndWander()
+{
+	World world;
+
+	// the evader moves up: the pursuer aims ahead of it
+	world.add(1, Vector2D(100, 0), 0).velocity = Vector2D(0, 50);
+	world.add(2, Vector2D(0, 0), STEER_PURSUIT).evader = 1;
+
+	// an evader coming head on is aimed at directly
+	world.add(3, Vector2D(100, 500), 0).velocity = Vector2D(-50, 0);
+	world.steering(3).heading = Vector2D(-1, 0);
+	world.add(4, Vector2D(0, 500), STEER_PURSUIT).evader = 3;
+
+	// pursuing no one does nothing
+	world.add(5, Vector2D(0, 800), STEER_PURSUIT).evader = 1000;
+
+	world.update();
+	UASSERT(world.steering(2).velocity.x > 0 && world.steering(2).velocity.y > 0);
+	UASSERT(near(world.steering(4).velocity.x, 10) && world.steering(4).velocity.y == 0);
+	UASSERT(world.steering(5).velocity.isZero());
+
+	// wander jitters the target on its circle, by the agent's seed
+	World wander1, wander2;
+	for (ActorId id = 1; id <= 8; id++) {
+		wander1.add(id, Vector2D(id * 10.0, 0), STEER_WANDER);
+		wander2.add(id, Vector2D(id * 10.0, 0), STEER_WANDER);
+	}
+	wander1.update(10);
+	wander2.update(10);
+	UASSERT(sameComponents(wander1, wander2));
+
+	int different = 0;
+	for (ActorId id = 1; id <= 8; id++) {
+		const SteeringComponent &agent = wander1.steering(id);
+		UASSERT(near(agent.wanderTarget.Length(), 1.2));
+		UASSERT(!agent.velocity.isZero());
+		different += agent.wanderTarget != wander1.steering(1).wanderTarget;
+	}
+	UASSERTEQ(int, different, 7);
+}
+
+void TestSteering::testFlocking()
+{
+	World world;
+
+	// separation pushes apart, cohesion pulls together, within the view distance only
+	world.add(1, Vector2D(100, 100), STEER_SEPARATION);
+	world.add(2, Vector2D(110, 100), STEER_SEPARATION);
+	world.add(3, Vector2D(300, 100), STEER_COHESION);
+	world.add(4, Vector2D(340, 100), STEER_COHESION);
+	world.add(5, Vector2D(600, 100), STEER_FLOCKING);
+
+	// alignment turns towards the neighbours' heading
+	world.add(6, Vector2D(100, 500), STEER_ALIGNMENT);
+	world.add(7, Vector2D(120, 500), 0).heading = Vector2D(0, 1);
+	world.add(8, Vector2D(100, 520), 0).heading = Vector2D(0, 1);
+
+	world.update();
+
+	UASSERT(near(world.steering(1).velocity.x, -0.01) && world.steering(1).velocity.y == 0);
+	UASSERT(near(world.steering(2).velocity.x, 0.01));
+	UASSERT(near(world.steering(3).velocity.x, 0.2));
+	UASSERT(near(world.steering(4).velocity.x, -0.2));
+	UASSERT(world.steering(5).velocity.isZero());
+	UASSERT(near(world.steering(6).velocity.x, -0.1) && near(world.steering(6).velocity.y, 0.1));
+
+	// agents coming and going keep their neighbours right
+	world.components.RemoveActor(1);
+	world.add(9, Vector2D(600, 110), 0);
+	world.update();
+	UASSERT(near(world.steering(2).velocity.x, 0.01));
+	UASSERT(world.steering(5).velocity.y > 0);
+	UASSERTEQ(size_t, world.system->GetNumAgents(), 8);
+}
+
+void TestSteering::testWallAvoidance()
+{
+	World world;
+	world.system->AddWall(Vector2D(100, 0), Vector2D(100, 1000));
+	UASSERT(world.system->GetWalls()[0].normal == Vector2D(-1, 0));
+
+	// the front feeler is 40 long, 10 of it past the wall
+	world.add(1, Vector2D(70, 500), STEER_WALL_AVOIDANCE);
+
+	// the side feelers are 20 long at 45 degrees: the right one ends ~5.9 past the wall
+	world.add(2, Vector2D(90, 200), STEER_WALL_AVOIDANCE).heading = Vector2D(0, 1);
+
+	// too far, or facing away
+	world.add(3, Vector2D(50, 800), STEER_WALL_AVOIDANCE);
+	world.add(4, Vector2D(90, 900), STEER_WALL_AVOIDANCE).heading = Vector2D(-1, 0);
+
+	world.update();
+
+	// weight 10, 0.1s
+	UASSERT(near(world.steering(1).velocity.x, -10));
+	UASSERT(near(world.steering(2).velocity.x, -(20 - 10 / 0.70710678), 0.001));
+	UASSERT(world.steering(3).velocity.isZero());
+	UASSERT(world.steering(4).velocity.isZero());
+
+	world.system->ClearWalls();
+	world.update();
+	UASSERT(near(world.steering(1).velocity.x, -10));
+}
+
+// the SIMD levels only sum the neighbours in another order, the threads not even that
+void TestSteering::testLanesAndThreads()
+{
+	SteeringSettings settings;
+	World scalar(settings), simd(settings), threaded(settings);
+	addCrowd(scalar, 3000, 11);
+	addCrowd(simd, 3000, 11);
+	addCrowd(threaded, 3000, 11);
+	scalar.system->AddWall(Vector2D(0, 500), Vector2D(1000, 500));
+	simd.system->AddWall(Vector2D(0, 500), Vector2D(1000, 500));
+	threaded.system->AddWall(Vector2D(0, 500), Vector2D(1000, 500));
+
+	JobSystem jobs(3);
+	threaded.components.SetJobSystem(&jobs);
+
+	for (int f = 0; f < 5; f++) {
+		SetBatchSimdLevel(BATCH_SIMD_SCALAR);
+		scalar.update();
+		SetBatchSimdLevel(GetBestBatchSimdLevel());
+		simd.update();
+		threaded.update();
+	}
+
+	UASSERT(sameComponents(scalar, simd, 0.001));
+	UASSERT(sameComponents(simd, threaded));
+	UASSERTEQ(size_t, scalar.system->GetNumAgents(), 3000 - 3000 / 97);
+}
+
+void TestSteering::benchSteering()
+{
+	const int frames = 20;
+
+	for (size_t numAgents = 10000; numAgents <= 50000; numAgents *= 5) {
+		// 10000 agents per 1000x1000, about 12 within the view distance of each
+		double size = 1000.0 * sqrt(numAgents / 10000.0);
+		SteeringSettings settings;
+		settings.viewDistance = 20;
+		settings.worldMax = Vector2D(size, size);
+		World world(settings);
+		world.system->AddWall(Vector2D(0, 0), Vector2D(size, 0));
+		world.system->AddWall(Vector2D(size, 0), Vector2D(size, size));
+		world.system->AddWall(Vector2D(size, size), Vector2D(0, size));
+		world.system->AddWall(Vector2D(0, size), Vector2D(0, 0));
+
+		std::mt19937 rng(3);
+		std::uniform_real_distribution<double> coord(0.0, size);
+		for (ActorId id = 1; id <= numAgents; id++) {
+			SteeringComponent &steering = world.add(id, Vector2D(coord(rng), coord(rng)),
+				STEER_WANDER | STEER_FLOCKING | STEER_WALL_AVOIDANCE);
+			steering.maxForce = 200;
+		}
+		world.update();
+
+		uint64_t times[3];
+		for (int run = 0; run < 2; run++) {
+			SetBatchSimdLevel(run == 0 ? BATCH_SIMD_SCALAR : GetBestBatchSimdLevel());
+			uint64_t start = getTimeUs();
+			world.update(frames);
+			times[run] = (getTimeUs() - start) / frames;
+		}
+
+		JobSystem jobs(3);
+		world.components.SetJobSystem(&jobs);
+		uint64_t start = getTimeUs();
+		world.update(frames);
+		times[2] = (getTimeUs() - start) / frames;
+
+		// the behaviours alone, without neighbours to find
+		world.components.SetJobSystem(nullptr);
+		ComponentPool<SteeringComponent> &pool = world.components.GetPool<SteeringComponent>();
+		for (size_t i = 0; i < pool.Size(); i++)
+			pool.Data()[i].behaviors = STEER_WANDER | STEER_WALL_AVOIDANCE | STEER_SEEK | STEER_ARRIVE;
+		start = getTimeUs();
+		world.update(frames);
+		uint64_t soloUs = (getTimeUs() - start) / frames;
+
+		rawstream << "    " << numAgents << " agents flocking: scalar " << times[0] << " us/frame, "
+			<< "SIMD " << times[1] << " us/frame, 4 threads "
+			<< times[2] << " us/frame; without neighbours " << soloUs << " us/frame" << std::endl;
+	}
+}